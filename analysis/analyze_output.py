@@ -1,65 +1,41 @@
 import os
+import sys
 
-import numpy as np
-import pandas as pd
 import matplotlib.pyplot as plt
 
+from trajectory import open_trajectory, physical
 
-df = pd.DataFrame(columns=np.arange(9))
 
 '''
-Parsing could possibly done in a better way
+Reads the binary trajectory, given as the first argument or
+trajectory.bin next to the built executables
 '''
-try:
-
-    split_string = " seconds] DATA: "
-    columns = {}
-    i = 0
-
-    file_handle = open(os.path.join(os.path.dirname(__file__), "../_build/bin/debug_output.txt"), "r")
-    file_lines = file_handle.readlines()
-
-    for line in file_lines:
-
-        if split_string in line:
-            
-            _, line = line.split(split_string)
-            line = line.replace('\n', '').split(',')
+path = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), "../_build/bin/trajectory.bin")
 
-            if i == 0:
-                i += 1
-                df.columns = columns = line
-            else:
-                df = pd.concat([df, pd.DataFrame([line], columns=columns, dtype=float)], ignore_index=True)
-
-    file_handle.close()
-
-except (FileNotFoundError, PermissionError):
-    print("Failed to open debug_output.txt")
+try:
+    header, frames = open_trajectory(path)
+except (FileNotFoundError, PermissionError, ValueError) as error:
+    print(f"Failed to open {path}: {error}")
     exit()
 
 
 '''
-Correct dataframe population check
+Correct frame population check
 '''
-print(df.head())
+print(f"{len(frames)} frames of {header['particle_count']} particles, dt = {header['sample_period']}")
 
 
 '''
 Plot trace of particle motion
 '''
-unique_ids = []
+fig, axis = plt.subplots(1, 2)
 
-for id in df.particle_id:
-    if id not in unique_ids:
-        unique_ids.append(id)
+momenta = physical(header, frames, "momenta")
 
-fig, axis = plt.subplots(1, 2)
+for n in range(header["particle_count"]):
+    axis[0].plot(frames["pos"][:, 0, n], frames["pos"][:, 1, n])
+    axis[1].plot(momenta[:, 0, n], momenta[:, 1, n])
 
-for id in unique_ids:
-    axis[0].plot(df.loc[df.particle_id == id].x_pos, df.loc[df.particle_id == id].y_pos)
-    axis[1].plot(df.loc[df.particle_id == id].x_momenta, df.loc[df.particle_id == id].y_momenta)
-    
 
 axis[0].title.set_text("Position")
 axis[1].title.set_text("Momenta")
@@ -0,0 +1,100 @@
+import os
+import struct
+
+import numpy as np
+
+
+'''
+Reader for the binary trajectory files written by mechanics/src/trajectory.c,
+see mechanics/inc/trajectory.h for the layout
+'''
+MAGIC = b"PSIMTRJ\0"
+VERSION = 2
+HEADER_FORMAT = "<8sIIQdIIQdd"
+
+# Arrays are stored in reduced units, these header entries convert them back
+UNIT_OF = {
+    "mass": "unit_mass",
+    "charge": "unit_charge",
+    "momenta": "unit_mass",
+    "angular_momenta": "unit_mass",
+    "force": "unit_mass",
+}
+
+# (mask bit, name, dtype, components) in the order the arrays appear in a frame
+FIELDS = [
+    (1 << 0, "id", "<u8", 1),
+    (1 << 1, "mass", "<f8", 1),
+    (1 << 2, "charge", "<f8", 1),
+    (1 << 3, "radius", "<f8", 1),
+    (1 << 4, "pos", "<f8", 3),
+    (1 << 5, "momenta", "<f8", 3),
+    (1 << 6, "orientation", "<f8", 3),
+    (1 << 7, "angular_momenta", "<f8", 3),
+    (1 << 8, "force", "<f8", 3),
+]
+
+
+def read_header(path):
+
+    with open(path, "rb") as file_handle:
+        magic, version, header_size, particle_count, sample_period, field_mask, _, frame_size, unit_mass, unit_charge = \
+            struct.unpack(HEADER_FORMAT, file_handle.read(struct.calcsize(HEADER_FORMAT)))
+
+    if magic != MAGIC:
+        raise ValueError(f"{path} is not a trajectory file")
+    if version != VERSION:
+        raise ValueError(f"{path} is version {version}, only version {VERSION} is supported")
+
+    return {
+        "header_size": header_size,
+        "particle_count": particle_count,
+        "sample_period": sample_period,
+        "field_mask": field_mask,
+        "frame_size": frame_size,
+        "unit_mass": unit_mass,
+        "unit_charge": unit_charge,
+    }
+
+
+def frame_dtype(particle_count, field_mask):
+
+    fields = [("time", "<f8"), ("step", "<u8")]
+
+    for bit, name, dtype, components in FIELDS:
+        if field_mask & bit:
+            shape = (particle_count,) if components == 1 else (components, particle_count)
+            fields.append((name, dtype, shape))
+
+    return np.dtype(fields)
+
+
+def open_trajectory(path):
+    '''
+    Maps every complete frame without reading the file, frames["pos"] has
+    shape (frames, 3, particles), frames["mass"] (frames, particles).
+    A frame cut short by a crash is left out.
+    '''
+    header = read_header(path)
+    dtype = frame_dtype(header["particle_count"], header["field_mask"])
+
+    if dtype.itemsize != header["frame_size"]:
+        raise ValueError(f"{path} has frames of {header['frame_size']} bytes, expected {dtype.itemsize}")
+
+    frame_count = (os.path.getsize(path) - header["header_size"]) // dtype.itemsize
+
+    if frame_count == 0:
+        return header, np.empty(0, dtype=dtype)
+
+    return header, np.memmap(path, dtype=dtype, mode="r", offset=header["header_size"], shape=(frame_count,))
+
+
+def physical(header, frames, name):
+    '''
+    A copy of frames[name] in grams, coulombs and the units derived from
+    them, fields without a unit come back as they are
+    '''
+    if name not in UNIT_OF:
+        return frames[name]
+
+    return frames[name] * header[UNIT_OF[name]]
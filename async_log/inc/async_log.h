@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+
+#define DEFAULT_ASYNC_LOG_CAPACITY  4096
+#define ASYNC_LOG_MESSAGE_SIZE      512     // longer messages are cut short
+#define ASYNC_LOG_MAX_VALUES        16
+
+
+/* What a writer does when the queue is full */
+typedef enum
+{
+    ASYNC_LOG_BLOCK,    // wait for the writer thread to make room, nothing is lost
+    ASYNC_LOG_DROP,     // discard the message and count it, never waits
+
+} async_log_policy_t;
+
+/**
+ * Moves log__write() off the threads doing the work.  Messages go
+ * into a bounded queue of preallocated records that any number of
+ * threads may write to, a single background thread takes them out in
+ * order and writes them to the underlying log in batches.  Dropped
+ * messages are reported in the log once there is room again.
+ *
+ * Nothing else may write to the underlying log while the writer
+ * thread is running, except right after async_log__flush().
+ */
+typedef struct async_log async_log_t;
+
+
+/**
+ * @param log Log the messages end up in, still owned by the caller
+ * @param capacity Records in the queue, rounded up to a power of two
+ * @return NULL if the queue could not be allocated or the thread started
+ */
+async_log_t *async_log__new(log_t *log, const size_t capacity, const async_log_policy_t policy);
+
+/* Writes out everything still queued, then stops the writer thread */
+void async_log__delete(async_log_t *async_log);
+
+/**
+ * Formats the message on the calling thread and queues it.
+ *
+ * @return 0 if queued, 1 if dropped
+ */
+int async_log__write(async_log_t *async_log, const log_level_t level, const char *format, ...);
+int async_log__vwrite(async_log_t *async_log, const log_level_t level, const char *format, va_list args);
+
+/**
+ * Queues up to ASYNC_LOG_MAX_VALUES doubles and leaves the formatting
+ * to the writer thread, the cheap way to log numbers from a hot loop.
+ * format must take exactly count doubles and outlive the call, a
+ * string literal.
+ *
+ * @return 0 if queued, 1 if dropped
+ */
+int async_log__write_values(async_log_t *async_log, const log_level_t level, const char *format,
+                            const double *values, const size_t count);
+
+/**
+ * async_log__write_values() with a prefix the calling thread formats
+ * and the writer puts in front of the numbers, for fields a double
+ * cannot hold exactly, such as 64 bit ids.
+ *
+ * @return 0 if queued, 1 if dropped
+ */
+int async_log__write_prefixed_values(async_log_t *async_log, const log_level_t level, const char *prefix,
+                                     const char *format, const double *values, const size_t count);
+
+/* Waits until every message queued before the call has been written */
+void async_log__flush(async_log_t *async_log);
+
+/* Messages discarded under ASYNC_LOG_DROP so far */
+unsigned long long int async_log__dropped(const async_log_t *async_log);
@@ -0,0 +1,346 @@
+#include "async_log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+#define CACHE_LINE_SIZE     64
+#define WRITER_TIMEOUT_NS   10000000    // writer looks at the queue at least this often
+#define LINE_SIZE           (4 * ASYNC_LOG_MESSAGE_SIZE)
+
+
+/**
+ * One queue slot.  sequence tells producers and the writer whose turn
+ * it is: equal to the slot's position when free, one past it once a
+ * message has been stored.
+ */
+typedef struct
+{
+    _Atomic size_t sequence;
+    log_level_t level;
+    const char *format;     // NULL when text already holds the message, else text is its prefix
+    size_t value_count;
+    double values[ASYNC_LOG_MAX_VALUES];
+    char text[ASYNC_LOG_MESSAGE_SIZE];
+
+} record_t;
+
+struct async_log
+{
+    log_t *log;
+    async_log_policy_t policy;
+    record_t *records;
+    size_t mask;
+
+    /* Written by producers and the writer respectively, kept on separate lines */
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t enqueue_position;
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t dequeue_position;
+    _Atomic unsigned long long int dropped;
+    _Atomic int writer_sleeping;
+
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t written;
+    int stop;
+};
+
+
+/* Private function declarations */
+static void *writer_main(void *arg);
+static size_t write_batch(async_log_t *async_log, unsigned long long int *reported_drops);
+static int queue_empty(async_log_t *async_log);
+static record_t *claim_record(async_log_t *async_log);
+static void publish_record(async_log_t *async_log, record_t *record);
+static void wake_writer(async_log_t *async_log);
+
+/* Public function definitions */
+async_log_t *async_log__new(log_t *log, const size_t capacity, const async_log_policy_t policy)
+{
+    async_log_t *async_log = calloc(1, sizeof(async_log_t));
+    size_t slots = 2;
+
+    if (!async_log)
+        return NULL;
+
+    while (slots < capacity)
+        slots *= 2;
+
+    if (!(async_log->records = calloc(slots, sizeof(record_t)))) {
+        free(async_log);
+        return NULL;
+    }
+
+    async_log->log = log;
+    async_log->policy = policy;
+    async_log->mask = slots - 1;
+
+    for (size_t n = 0; n < slots; ++n)
+        atomic_init(&async_log->records[n].sequence, n);
+
+    atomic_init(&async_log->enqueue_position, 0);
+    atomic_init(&async_log->dequeue_position, 0);
+    atomic_init(&async_log->dropped, 0);
+    atomic_init(&async_log->writer_sleeping, 0);
+
+    pthread_mutex_init(&async_log->lock, NULL);
+    pthread_cond_init(&async_log->wake, NULL);
+    pthread_cond_init(&async_log->written, NULL);
+
+    if (pthread_create(&async_log->writer, NULL, writer_main, async_log)) {
+        pthread_mutex_destroy(&async_log->lock);
+        pthread_cond_destroy(&async_log->wake);
+        pthread_cond_destroy(&async_log->written);
+        free(async_log->records);
+        free(async_log);
+        return NULL;
+    }
+
+    return async_log;
+}
+
+void async_log__delete(async_log_t *async_log)
+{
+    if (!async_log) return;
+
+    pthread_mutex_lock(&async_log->lock);
+    async_log->stop = 1;
+    pthread_cond_signal(&async_log->wake);
+    pthread_mutex_unlock(&async_log->lock);
+
+    pthread_join(async_log->writer, NULL);
+
+    pthread_mutex_destroy(&async_log->lock);
+    pthread_cond_destroy(&async_log->wake);
+    pthread_cond_destroy(&async_log->written);
+    free(async_log->records);
+    free(async_log);
+}
+
+int async_log__write(async_log_t *async_log, const log_level_t level, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    const int dropped = async_log__vwrite(async_log, level, format, args);
+    va_end(args);
+
+    return dropped;
+}
+
+int async_log__vwrite(async_log_t *async_log, const log_level_t level, const char *format, va_list args)
+{
+    record_t *record = claim_record(async_log);
+
+    if (!record)
+        return 1;
+
+    record->level = level;
+    record->format = NULL;
+    vsnprintf(record->text, sizeof(record->text), format, args);
+    publish_record(async_log, record);
+
+    return 0;
+}
+
+int async_log__write_values(async_log_t *async_log, const log_level_t level, const char *format,
+                            const double *values, const size_t count)
+{
+    return async_log__write_prefixed_values(async_log, level, "", format, values, count);
+}
+
+int async_log__write_prefixed_values(async_log_t *async_log, const log_level_t level, const char *prefix,
+                                     const char *format, const double *values, const size_t count)
+{
+    record_t *record = claim_record(async_log);
+
+    if (!record)
+        return 1;
+
+    record->level = level;
+    record->format = format;
+    snprintf(record->text, sizeof(record->text), "%s", prefix);
+    record->value_count = count < ASYNC_LOG_MAX_VALUES ? count : ASYNC_LOG_MAX_VALUES;
+    memcpy(record->values, values, record->value_count * sizeof(double));
+    publish_record(async_log, record);
+
+    return 0;
+}
+
+void async_log__flush(async_log_t *async_log)
+{
+    const size_t target = atomic_load(&async_log->enqueue_position);
+
+    pthread_mutex_lock(&async_log->lock);
+    pthread_cond_signal(&async_log->wake);
+
+    while (atomic_load(&async_log->dequeue_position) < target)
+        pthread_cond_wait(&async_log->written, &async_log->lock);
+
+    pthread_mutex_unlock(&async_log->lock);
+}
+
+unsigned long long int async_log__dropped(const async_log_t *async_log)
+{
+    return atomic_load(&async_log->dropped);
+}
+
+/* Private function definitions */
+static void *writer_main(void *arg)
+{
+    async_log_t *async_log = arg;
+    unsigned long long int reported_drops = 0;
+
+    for (;;) {
+
+        if (write_batch(async_log, &reported_drops)) {
+            pthread_mutex_lock(&async_log->lock);
+            pthread_cond_broadcast(&async_log->written);
+            pthread_mutex_unlock(&async_log->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&async_log->lock);
+
+        if (async_log->stop && queue_empty(async_log)) {
+            pthread_mutex_unlock(&async_log->lock);
+            break;
+        }
+
+        /* Producers only signal while this is set, the timeout covers a wake up that slips past */
+        atomic_store(&async_log->writer_sleeping, 1);
+
+        if (!async_log->stop && queue_empty(async_log)) {
+            struct timespec deadline;
+
+            timespec_get(&deadline, TIME_UTC);
+            deadline.tv_nsec += WRITER_TIMEOUT_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&async_log->wake, &async_log->lock, &deadline);
+        }
+
+        atomic_store(&async_log->writer_sleeping, 0);
+        pthread_mutex_unlock(&async_log->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Writes every message published so far, in queue order.
+ *
+ * @return Number of messages written
+ */
+static size_t write_batch(async_log_t *async_log, unsigned long long int *reported_drops)
+{
+    size_t position = atomic_load_explicit(&async_log->dequeue_position, memory_order_relaxed);
+    size_t count = 0;
+    char line[LINE_SIZE];
+
+    for (;;) {
+
+        record_t *record = &async_log->records[position & async_log->mask];
+
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) != position + 1)
+            break;
+
+        if (record->format) {
+            const double *v = record->values;
+            snprintf(line, sizeof(line), record->format,
+                     v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+            log__write(async_log->log, record->level, "%s%s", record->text, line);
+        }
+        else {
+            log__write(async_log->log, record->level, "%s", record->text);
+        }
+
+        /* Hand the slot back for the lap after this one */
+        atomic_store_explicit(&record->sequence, position + async_log->mask + 1, memory_order_release);
+        atomic_store_explicit(&async_log->dequeue_position, ++position, memory_order_release);
+        ++count;
+    }
+
+    const unsigned long long int dropped = atomic_load_explicit(&async_log->dropped, memory_order_relaxed);
+
+    if (dropped != *reported_drops) {
+        log__write(async_log->log, LOG_WARNING, "%llu log messages dropped, the queue was full.", dropped - *reported_drops);
+        *reported_drops = dropped;
+    }
+
+    return count;
+}
+
+static int queue_empty(async_log_t *async_log)
+{
+    const size_t position = atomic_load(&async_log->dequeue_position);
+
+    return atomic_load(&async_log->records[position & async_log->mask].sequence) != position + 1;
+}
+
+/**
+ * Vyukov's bounded queue, producer side.  A producer owns the slot at
+ * enqueue_position once it moves the position past it.
+ *
+ * @return NULL if the message was dropped
+ */
+static record_t *claim_record(async_log_t *async_log)
+{
+    size_t position = atomic_load_explicit(&async_log->enqueue_position, memory_order_relaxed);
+
+    for (;;) {
+
+        record_t *record = &async_log->records[position & async_log->mask];
+        const size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        const intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+
+        if (lag == 0) {
+            if (atomic_compare_exchange_weak_explicit(&async_log->enqueue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                return record;
+        }
+        else if (lag < 0) {
+
+            /* Full, the writer has not freed this slot from the previous lap */
+            if (async_log->policy == ASYNC_LOG_DROP) {
+                atomic_fetch_add_explicit(&async_log->dropped, 1, memory_order_relaxed);
+                return NULL;
+            }
+
+            wake_writer(async_log);
+            sched_yield();
+            position = atomic_load_explicit(&async_log->enqueue_position, memory_order_relaxed);
+        }
+        else {
+            position = atomic_load_explicit(&async_log->enqueue_position, memory_order_relaxed);
+        }
+    }
+}
+
+static void publish_record(async_log_t *async_log, record_t *record)
+{
+    const size_t position = atomic_load_explicit(&record->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+
+    /* Pairs with the writer setting writer_sleeping before it looks at the queue */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&async_log->writer_sleeping, memory_order_relaxed))
+        wake_writer(async_log);
+}
+
+static void wake_writer(async_log_t *async_log)
+{
+    pthread_mutex_lock(&async_log->lock);
+    pthread_cond_signal(&async_log->wake);
+    pthread_mutex_unlock(&async_log->lock);
+}
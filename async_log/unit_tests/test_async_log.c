@@ -0,0 +1,195 @@
+#include "async_log.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+
+#define TEST_FILEPATH       "test_async_log.txt"
+#define WRITER_COUNT        4
+#define MESSAGE_COUNT       5000
+
+
+static log_t *log_under_test;
+static async_log_t *async_log;
+
+
+static char *read_log(void)
+{
+    FILE *file = fopen(TEST_FILEPATH, "rb");
+    char *contents;
+    long size;
+
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents = calloc((size_t)size + 1, 1);
+    TEST_ASSERT_EQUAL(size, fread(contents, 1, (size_t)size, file));
+    fclose(file);
+
+    return contents;
+}
+
+static size_t count_occurrences(const char *text, const char *pattern)
+{
+    size_t count = 0;
+
+    while ((text = strstr(text, pattern))) {
+        ++count;
+        text += strlen(pattern);
+    }
+
+    return count;
+}
+
+/* Stops the writer and closes the log so the file is complete */
+static char *finish(void)
+{
+    async_log__delete(async_log);
+    async_log = NULL;
+    log__close(log_under_test);
+    log__delete(log_under_test);
+    log_under_test = NULL;
+
+    return read_log();
+}
+
+static void *writer(void *arg)
+{
+    const unsigned int index = *(const unsigned int *)arg;
+
+    for (unsigned int n = 0; n < MESSAGE_COUNT; ++n)
+        async_log__write(async_log, LOG_INFO, "writer %u message %u", index, n);
+
+    return NULL;
+}
+
+
+void setUp(void)
+{
+    log_under_test = log__open(TEST_FILEPATH, "w");
+    TEST_ASSERT_NOT_NULL(log_under_test);
+}
+
+void tearDown(void)
+{
+    async_log__delete(async_log);
+    async_log = NULL;
+
+    if (log_under_test) {
+        log__close(log_under_test);
+        log__delete(log_under_test);
+        log_under_test = NULL;
+    }
+
+    remove(TEST_FILEPATH);
+}
+
+void test_messages_arrive_in_order(void)
+{
+    char pattern[64];
+
+    async_log = async_log__new(log_under_test, 8, ASYNC_LOG_BLOCK);
+    TEST_ASSERT_NOT_NULL(async_log);
+
+    for (unsigned int n = 0; n < 100; ++n)
+        TEST_ASSERT_EQUAL(0, async_log__write(async_log, LOG_STATUS, "message %u.", n));
+
+    char *contents = finish();
+    const char *cursor = contents;
+
+    for (unsigned int n = 0; n < 100; ++n) {
+        snprintf(pattern, sizeof(pattern), "message %u.", n);
+        TEST_ASSERT_NOT_NULL(cursor = strstr(cursor, pattern));
+    }
+
+    free(contents);
+}
+
+void test_blocking_writers_lose_nothing(void)
+{
+    pthread_t threads[WRITER_COUNT];
+    unsigned int indices[WRITER_COUNT];
+
+    async_log = async_log__new(log_under_test, 16, ASYNC_LOG_BLOCK);
+    TEST_ASSERT_NOT_NULL(async_log);
+
+    for (unsigned int t = 0; t < WRITER_COUNT; ++t) {
+        indices[t] = t;
+        pthread_create(&threads[t], NULL, writer, &indices[t]);
+    }
+
+    for (unsigned int t = 0; t < WRITER_COUNT; ++t)
+        pthread_join(threads[t], NULL);
+
+    TEST_ASSERT_EQUAL(0, async_log__dropped(async_log));
+
+    char *contents = finish();
+
+    TEST_ASSERT_EQUAL(WRITER_COUNT * MESSAGE_COUNT, count_occurrences(contents, "writer "));
+    TEST_ASSERT_EQUAL(0, count_occurrences(contents, "dropped"));
+
+    free(contents);
+}
+
+void test_dropped_messages_are_counted(void)
+{
+    async_log = async_log__new(log_under_test, 2, ASYNC_LOG_DROP);
+    TEST_ASSERT_NOT_NULL(async_log);
+
+    unsigned int queued = 0;
+
+    for (unsigned int n = 0; n < MESSAGE_COUNT; ++n)
+        queued += !async_log__write(async_log, LOG_INFO, "writer 0 message %u", n);
+
+    const unsigned long long int dropped = async_log__dropped(async_log);
+
+    TEST_ASSERT_EQUAL(MESSAGE_COUNT, queued + dropped);
+
+    char *contents = finish();
+
+    TEST_ASSERT_EQUAL(queued, count_occurrences(contents, "writer 0"));
+    TEST_ASSERT_TRUE(!dropped || count_occurrences(contents, "log messages dropped"));
+
+    free(contents);
+}
+
+void test_values_are_formatted_by_the_writer(void)
+{
+    const double values[] = {42, 1.5, -0.25};
+
+    async_log = async_log__new(log_under_test, DEFAULT_ASYNC_LOG_CAPACITY, ASYNC_LOG_BLOCK);
+    TEST_ASSERT_NOT_NULL(async_log);
+
+    async_log__write_values(async_log, LOG_DATA, "%.0f,%E,%f", values, 3);
+    async_log__flush(async_log);
+
+    char *contents = finish();
+
+    TEST_ASSERT_NOT_NULL(strstr(contents, "42,1.500000E+00,-0.250000"));
+
+    free(contents);
+}
+
+void test_prefix_is_written_before_the_values(void)
+{
+    const double values[] = {1.5, -0.25};
+    char prefix[32];
+
+    async_log = async_log__new(log_under_test, DEFAULT_ASYNC_LOG_CAPACITY, ASYNC_LOG_BLOCK);
+    TEST_ASSERT_NOT_NULL(async_log);
+
+    /* Above 2^53, where a double would round the id */
+    snprintf(prefix, sizeof(prefix), "%llu,", 18446744073709551557ULL);
+    async_log__write_prefixed_values(async_log, LOG_DATA, prefix, "%E,%f", values, 2);
+    async_log__flush(async_log);
+
+    char *contents = finish();
+
+    TEST_ASSERT_NOT_NULL(strstr(contents, "18446744073709551557,1.500000E+00,-0.250000"));
+
+    free(contents);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle.h"
+#include "particle_system.h"
+
+
+#define DEFAULT_MAX_COUNT           1000000
+#define DEFAULT_MIN_TIME            0.5     // seconds of samples per benchmark and particle count
+#define WARMUP_TIME                 0.1     // seconds run and thrown away before sampling
+#define MIN_SAMPLE_TIME             1E-3    // iterations are batched until a sample takes this long
+#define MIN_SAMPLES                 5
+#define MAX_SAMPLES                 1000
+
+#define BENCH_SEED                  12345
+#define BENCH_SAMPLE_PERIOD         1E-15
+#define BENCH_DENSITY               1E21    // particles per cubic metre, the box grows with the count
+#define BENCH_CUTOFF                3E-7    // some hundred neighbours at BENCH_DENSITY
+
+
+/* Command line settings of a benchmark run */
+typedef struct
+{
+    size_t max_count;           // no benchmark runs with more particles than this
+    double min_time;
+    unsigned int thread_count;  // for time_evolution_soa, 0 for one per online processor
+    const char *filter;         // only benchmarks whose name contains this, NULL for all
+    const char *output_filepath;    // NULL for stdout
+
+} bench_options_t;
+
+/* Particles of one benchmark case in both layouts */
+typedef struct
+{
+    particle_system_t *system;
+    particle_pool_t *pool;      // holds what particles points to
+    particle_t **particles;
+    vector3d_t *directions;     // position differences of consecutive particles
+    size_t count;
+
+} bench_state_t;
+
+/**
+ * One timed operation.  run() does iterations repetitions of it, the
+ * number it returns only exists so the work cannot be optimised away.
+ * pairs() gives the pair interactions one repetition evaluates, 0 when
+ * that is not a meaningful measure.
+ */
+typedef struct
+{
+    const char *name;
+    size_t max_count;
+    double (*run)(bench_state_t *state, const size_t iterations);
+    double (*pairs)(const size_t count);
+
+} benchmark_t;
+
+/* Timings of a benchmark at one particle count, all per repetition */
+typedef struct
+{
+    size_t iterations;          // repetitions per sample
+    size_t sample_count;
+    double median;
+    double p99;
+    double min;
+    double mean;
+
+} bench_result_t;
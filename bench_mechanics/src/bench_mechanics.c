@@ -0,0 +1,475 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_mechanics.h"
+#include "particle.h"
+#include "particle_system.h"
+#include "mechanics.h"
+#include "pair_kernel.h"
+#include "scenario.h"
+#include "log.h"
+
+
+static int parse_options(const int argc, char **argv, bench_options_t *options);
+static void print_usage(const char *program);
+
+static int state_new(bench_state_t *state, const size_t count);
+static void state_delete(bench_state_t *state);
+static bench_result_t measure(const benchmark_t *benchmark, bench_state_t *state, const double min_time);
+static double timed_run(const benchmark_t *benchmark, bench_state_t *state, const size_t iterations);
+static int compare_doubles(const void *a, const void *b);
+static void write_result(FILE *file, const benchmark_t *benchmark, const size_t count, const bench_result_t *result,
+                         const int first);
+static double wall_seconds(void);
+
+static double run_resultant_force(bench_state_t *state, const size_t iterations);
+static double run_componentize_force(bench_state_t *state, const size_t iterations);
+static double run_detect_collision(bench_state_t *state, const size_t iterations);
+static double run_time_evolution(bench_state_t *state, const size_t iterations);
+static double run_direct_step(bench_state_t *state, const size_t iterations);
+static double run_barnes_hut_step(bench_state_t *state, const size_t iterations);
+static double run_neighbour_list_step(bench_state_t *state, const size_t iterations);
+static double run_pair_kernel(bench_state_t *state, const size_t iterations);
+static double run_pair_kernel_float(bench_state_t *state, const size_t iterations);
+static double ordered_pairs(const size_t count);
+static double unordered_pairs(const size_t count);
+static double single_pairs(const size_t count);
+
+
+/* Global variables */
+log_t *log_handle;
+
+/* Results of the timed code end up here so the compiler has to compute them */
+static volatile double sink;
+
+static const size_t counts[] = {3, 10, 100, 1000, 10000, 100000, 1000000};
+
+static const benchmark_t benchmarks[] = {
+    {"resultant_force_from_fields", 10000, run_resultant_force, ordered_pairs},
+    {"componentize_force_3d", 1000000, run_componentize_force, single_pairs},
+    {"detect_collision", 10000, run_detect_collision, unordered_pairs},
+    {"time_evolution", 3000, run_time_evolution, ordered_pairs},
+    {"time_evolution_soa_direct", 10000, run_direct_step, ordered_pairs},
+    {"time_evolution_soa_barnes_hut", 1000000, run_barnes_hut_step, NULL},
+    {"time_evolution_soa_neighbour_list", 1000000, run_neighbour_list_step, NULL},
+    {"pair_kernel", 10000, run_pair_kernel, ordered_pairs},
+    {"pair_kernel_float", 10000, run_pair_kernel_float, ordered_pairs},
+};
+
+
+/* Entry point */
+int main(int argc, char **argv)
+{
+    bench_options_t options = {
+        .max_count = DEFAULT_MAX_COUNT,
+        .min_time = DEFAULT_MIN_TIME,
+    };
+    FILE *output = stdout;
+    int first = 1;
+
+    if (parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (options.output_filepath && !(output = fopen(options.output_filepath, "w"))) {
+        fprintf(stderr, "Could not open %s\n", options.output_filepath);
+        return 1;
+    }
+
+    set_thread_count(options.thread_count);
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"benchmark\": \"bench_mechanics\",\n");
+    #ifdef __VERSION__
+    fprintf(output, "  \"compiler\": \"%s\",\n", __VERSION__);
+    #else
+    fprintf(output, "  \"compiler\": \"unknown\",\n");
+    #endif
+    #ifdef __OPTIMIZE__
+    fprintf(output, "  \"optimized\": true,\n");
+    #else
+    fprintf(output, "  \"optimized\": false,\n");
+    #endif
+    fprintf(output, "  \"threads\": %u,\n", get_thread_count());
+    fprintf(output, "  \"sample_period\": %g,\n", BENCH_SAMPLE_PERIOD);
+    fprintf(output, "  \"results\": [\n");
+
+    for (size_t b = 0; b < sizeof(benchmarks)/sizeof(benchmarks[0]); ++b) {
+
+        const benchmark_t *benchmark = &benchmarks[b];
+
+        if (options.filter && !strstr(benchmark->name, options.filter))
+            continue;
+
+        for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); ++c) {
+
+            bench_state_t state;
+
+            if (counts[c] > benchmark->max_count || counts[c] > options.max_count)
+                break;
+
+            if (state_new(&state, counts[c])) {
+                fprintf(stderr, "Out of memory for %zu particles\n", counts[c]);
+                break;
+            }
+
+            const bench_result_t result = measure(benchmark, &state, options.min_time);
+
+            fprintf(stderr, "%-32s N = %-8zu median %12.1f ns  p99 %12.1f ns\n",
+                    benchmark->name, counts[c], result.median * 1E9, result.p99 * 1E9);
+            write_result(output, benchmark, counts[c], &result, first);
+            first = 0;
+
+            state_delete(&state);
+            free_mechanics_workspace();
+        }
+    }
+
+    fprintf(output, "\n  ]\n}\n");
+
+    if (output != stdout)
+        fclose(output);
+
+    return 0;
+}
+
+
+/* Local function definitions */
+
+/* @return 0 on success, 1 on an unknown option or a bad value */
+static int parse_options(const int argc, char **argv, bench_options_t *options)
+{
+    for (int i = 1; i < argc; ++i) {
+
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;   // left NULL by options that do not take a number
+
+        if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+            return 1;
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return 1;
+        }
+
+        if (!strcmp(option, "-n") || !strcmp(option, "--max-count"))
+            options->max_count = strtoull(value, &end, 10);
+        else if (!strcmp(option, "-t") || !strcmp(option, "--min-time"))
+            options->min_time = strtod(value, &end);
+        else if (!strcmp(option, "-j") || !strcmp(option, "--threads"))
+            options->thread_count = (unsigned int)strtoul(value, &end, 10);
+        else if (!strcmp(option, "-f") || !strcmp(option, "--filter"))
+            options->filter = value;
+        else if (!strcmp(option, "-o") || !strcmp(option, "--output"))
+            options->output_filepath = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+
+        if (end && (end == value || *end != '\0')) {
+            fprintf(stderr, "Bad value %s for %s\n", value, option);
+            return 1;
+        }
+
+        ++i;
+    }
+
+    if (options->min_time < 0) {
+        fprintf(stderr, "The minimum time must be positive\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("\n");
+    printf("Times the mechanics library for particle counts from 3 up to %d and writes the\n", DEFAULT_MAX_COUNT);
+    printf("median, 99th percentile, minimum and mean of every case as JSON.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help                  print this message\n");
+    printf("  -n, --max-count <count>     largest particle count to run, default %d\n", DEFAULT_MAX_COUNT);
+    printf("  -t, --min-time <seconds>    sampling time per case, default %g\n", DEFAULT_MIN_TIME);
+    printf("  -j, --threads <count>       worker threads of time_evolution_soa, 0 for one per processor\n");
+    printf("  -f, --filter <text>         only benchmarks whose name contains text\n");
+    printf("  -o, --output <file>         JSON results, default stdout\n");
+}
+
+/* Random ions at a fixed density, far enough apart that collisions are rare */
+static int state_new(bench_state_t *state, const size_t count)
+{
+    scenario_t *scenario = scenario__new();
+    const scenario_group_t ions = {
+        .generator = SCENARIO_RANDOM_IONS,
+        .count = count,
+        .charge_states = 1,
+        .mass = PROTON_MASS,
+        .charge = PROTON_CHARGE,
+        .radius = 1E-15,
+        .size = cbrt((double)count / BENCH_DENSITY),
+    };
+
+    *state = (bench_state_t){.count = count};
+
+    if (!scenario || scenario__add_group(scenario, &ions)) {
+        scenario__delete(scenario);
+        return 1;
+    }
+
+    scenario->seed = BENCH_SEED;
+    state->system = scenario__build(scenario, 0);
+    state->pool = particle_pool__new(count);
+    state->particles = malloc(count * sizeof(particle_t *));
+    state->directions = malloc(count * sizeof(vector3d_t));
+    particle_handle_t *handles = malloc(count * sizeof(particle_handle_t));
+
+    scenario__delete(scenario);
+
+    /* The particles are never released, the handles are only needed to find them once */
+    if (!state->system || !state->pool || !state->particles || !state->directions || !handles ||
+        particle__new_n(state->pool, NULL, count, handles)) {
+        free(handles);
+        state_delete(state);
+        return 1;
+    }
+
+    for (size_t n = 0; n < count; ++n) {
+        const particle_t reduced = particle_system__get(state->system, n);
+
+        state->particles[n] = particle_pool__get(state->pool, handles[n]);
+        *state->particles[n] = units__to_physical(&reduced);
+    }
+
+    free(handles);
+
+    for (size_t n = 0; n < count; ++n)
+        state->directions[n] = vector3d__sub(state->particles[n]->pos, state->particles[(n + 1) % count]->pos);
+
+    return 0;
+}
+
+static void state_delete(bench_state_t *state)
+{
+    particle_pool__delete(state->pool);
+    free(state->particles);
+    free(state->directions);
+    particle_system__delete(state->system);
+}
+
+static bench_result_t measure(const benchmark_t *benchmark, bench_state_t *state, const double min_time)
+{
+    bench_result_t result = {.iterations = 1};
+    double samples[MAX_SAMPLES];
+    double total = 0;
+
+    /* Batch up iterations until a sample is long enough to time, this warms up too */
+    while (timed_run(benchmark, state, result.iterations) < MIN_SAMPLE_TIME)
+        result.iterations *= 2;
+
+    for (const double warmup_end = wall_seconds() + WARMUP_TIME; wall_seconds() < warmup_end; )
+        timed_run(benchmark, state, result.iterations);
+
+    while (result.sample_count < MIN_SAMPLES || (total < min_time && result.sample_count < MAX_SAMPLES)) {
+
+        const double elapsed = timed_run(benchmark, state, result.iterations);
+
+        samples[result.sample_count++] = elapsed / (double)result.iterations;
+        total += elapsed;
+    }
+
+    qsort(samples, result.sample_count, sizeof(double), compare_doubles);
+
+    /* Nearest rank percentiles */
+    result.median = samples[(result.sample_count + 1) / 2 - 1];
+    result.p99 = samples[(size_t)ceil(0.99 * (double)result.sample_count) - 1];
+    result.min = samples[0];
+    result.mean = total / (double)(result.sample_count * result.iterations);
+
+    return result;
+}
+
+/* @return Wall clock seconds the iterations took */
+static double timed_run(const benchmark_t *benchmark, bench_state_t *state, const size_t iterations)
+{
+    const double start = wall_seconds();
+
+    sink = benchmark->run(state, iterations);
+
+    return wall_seconds() - start;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void write_result(FILE *file, const benchmark_t *benchmark, const size_t count, const bench_result_t *result,
+                         const int first)
+{
+    const double pairs = benchmark->pairs ? benchmark->pairs(count) : 0;
+
+    fprintf(file, "%s    {\"name\": \"%s\", \"n\": %zu, \"iterations\": %zu, \"samples\": %zu, "
+                  "\"median_ns\": %.6g, \"p99_ns\": %.6g, \"min_ns\": %.6g, \"mean_ns\": %.6g, "
+                  "\"ns_per_particle\": %.6g, ",
+            first ? "" : ",\n", benchmark->name, count, result->iterations, result->sample_count,
+            result->median * 1E9, result->p99 * 1E9, result->min * 1E9, result->mean * 1E9,
+            result->median * 1E9 / (double)count);
+
+    if (pairs > 0)
+        fprintf(file, "\"pairs\": %.0f, \"ns_per_pair\": %.6g}", pairs, result->median * 1E9 / pairs);
+    else
+        fprintf(file, "\"pairs\": null, \"ns_per_pair\": null}");
+}
+
+/* Wall clock rather than clock(), which adds up the time of every thread */
+static double wall_seconds(void)
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return now.tv_sec + now.tv_nsec * 1E-9;
+}
+
+/* Forces on every particle, as time_evolution() computes them */
+static double run_resultant_force(bench_state_t *state, const size_t iterations)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < iterations; ++i)
+        for (size_t n = 0; n < state->count; ++n)
+            sum += resultant_force_from_fields(state->particles, state->count, n).i;
+
+    return sum;
+}
+
+static double run_componentize_force(bench_state_t *state, const size_t iterations)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < iterations; ++i)
+        for (size_t n = 0; n < state->count; ++n)
+            sum += componentize_force_3d(1E-9, state->directions[n]).k;
+
+    return sum;
+}
+
+/* Every pair once */
+static double run_detect_collision(bench_state_t *state, const size_t iterations)
+{
+    size_t collisions = 0;
+
+    for (size_t i = 0; i < iterations; ++i)
+        for (size_t this = 0; this < state->count; ++this)
+            for (size_t that = this + 1; that < state->count; ++that)
+                collisions += (size_t)detect_collision(state->particles[this], state->particles[that]);
+
+    return (double)collisions;
+}
+
+static double run_time_evolution(bench_state_t *state, const size_t iterations)
+{
+    for (size_t i = 0; i < iterations; ++i)
+        time_evolution(state->particles, state->count, BENCH_SAMPLE_PERIOD);
+
+    return state->particles[0]->pos.i;
+}
+
+static double run_direct_step(bench_state_t *state, const size_t iterations)
+{
+    set_force_solver(FORCE_SOLVER_DIRECT);
+
+    for (size_t i = 0; i < iterations; ++i)
+        time_evolution_soa(state->system, BENCH_SAMPLE_PERIOD);
+
+    return state->system->pos.i[0];
+}
+
+static double run_barnes_hut_step(bench_state_t *state, const size_t iterations)
+{
+    set_force_solver(FORCE_SOLVER_BARNES_HUT);
+
+    for (size_t i = 0; i < iterations; ++i)
+        time_evolution_soa(state->system, BENCH_SAMPLE_PERIOD);
+
+    return state->system->pos.i[0];
+}
+
+static double run_neighbour_list_step(bench_state_t *state, const size_t iterations)
+{
+    set_force_solver(FORCE_SOLVER_NEIGHBOUR_LIST);
+    set_cutoff(BENCH_CUTOFF, 0.1 * BENCH_CUTOFF);
+
+    for (size_t i = 0; i < iterations; ++i)
+        time_evolution_soa(state->system, BENCH_SAMPLE_PERIOD);
+
+    return state->system->pos.i[0];
+}
+
+/* Every force of the direct sum with the widest kernel, on the calling thread */
+static double run_pair_kernel(bench_state_t *state, const size_t iterations)
+{
+    const particle_system_t *system = state->system;
+    const pair_kernel_t kernel = pair_kernel();
+    double sum = 0;
+
+    for (size_t i = 0; i < iterations; ++i)
+        for (size_t n = 0; n < system->count; ++n) {
+            const vector3d_t pos = {system->pos.i[n], system->pos.j[n], system->pos.k[n]};
+            sum += kernel(pos, system->charge[n], system->mass[n], system, 0, system->count, (vector3d_t){0}).i;
+        }
+
+    return sum;
+}
+
+/* The same in single precision, refreshing the float copy once per repetition as a step does */
+static double run_pair_kernel_float(bench_state_t *state, const size_t iterations)
+{
+    const particle_system_t *system = state->system;
+    const pair_kernel_float_t kernel = pair_kernel_float();
+    pair_sources_t sources = {0};
+    double sum = 0;
+
+    for (size_t i = 0; i < iterations; ++i) {
+
+        if (pair_sources__fill(&sources, system))
+            break;
+
+        for (size_t n = 0; n < system->count; ++n) {
+            const vector3d_t pos = {system->pos.i[n], system->pos.j[n], system->pos.k[n]};
+            sum += kernel(pos, system->charge[n], &sources, 0, sources.count, (vector3d_t){0}).i;
+        }
+    }
+
+    pair_sources__free(&sources);
+
+    return sum;
+}
+
+static double ordered_pairs(const size_t count)
+{
+    return (double)count * (double)(count - 1);
+}
+
+static double unordered_pairs(const size_t count)
+{
+    return 0.5 * (double)count * (double)(count - 1);
+}
+
+/* componentize_force_3d() is the per-pair part of the force, one call is one pair */
+static double single_pairs(const size_t count)
+{
+    return (double)count;
+}
@@ -36,13 +36,15 @@ macro(run_tests_macro)
                                             ${TEST_RUNNER}
                                DEPENDS ${TEST_SRC} VERBATIM)
 
-            add_executable(test_runner ${TEST_SRC} ${TEST_RUNNER})
-            target_link_libraries(test_runner PRIVATE unity ${PROJECT_NAME})
-            target_include_directories(test_runner PRIVATE ${UNITY_DIR}/src)
+            set(TEST_TARGET test_${FILENAME}_runner)
+
+            add_executable(${TEST_TARGET} ${TEST_SRC} ${TEST_RUNNER})
+            target_link_libraries(${TEST_TARGET} PRIVATE unity ${PROJECT_NAME})
+            target_include_directories(${TEST_TARGET} PRIVATE ${UNITY_DIR}/src)
             
-            add_custom_command(TARGET test_runner POST_BUILD
+            add_custom_command(TARGET ${TEST_TARGET} POST_BUILD
                                WORKING_DIRECTORY  ${TEST_DIR}
-                               COMMAND $<TARGET_FILE:test_runner>
+                               COMMAND $<TARGET_FILE:${TEST_TARGET}>
                                VERBATIM USES_TERMINAL)
         else()
             message(STATUS "No unit test for ${FILENAME} exists.")
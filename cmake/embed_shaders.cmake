@@ -0,0 +1,35 @@
+# Writes every .glsl file of SHADER_DIR into OUTPUT as a null terminated
+# char array, named after the file with dots made underscores:
+# vs.vert.glsl becomes vs_vert_glsl.  Run with cmake -P.
+
+file(GLOB SHADERS ${SHADER_DIR}/*.glsl)
+list(SORT SHADERS)
+
+set(SOURCE "/* Generated from ${SHADER_DIR} by embed_shaders.cmake, do not edit */\n")
+
+foreach(SHADER ${SHADERS})
+
+    get_filename_component(FILENAME ${SHADER} NAME)
+    string(MAKE_C_IDENTIFIER ${FILENAME} SYMBOL)
+
+    file(READ ${SHADER} HEX HEX)
+    string(LENGTH "${HEX}" HEX_LENGTH)
+    string(APPEND SOURCE "\nconst char ${SYMBOL}[] = {\n")
+
+    # 16 bytes a line
+    foreach(OFFSET RANGE 0 ${HEX_LENGTH} 32)
+        string(SUBSTRING "${HEX}" ${OFFSET} 32 LINE)
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " LINE "${LINE}")
+        if (LINE)
+            string(APPEND SOURCE "    ${LINE}\n")
+        endif()
+    endforeach()
+
+    string(APPEND SOURCE "    0x00\n};\n")
+
+endforeach()
+
+# Only touched when the shaders changed, so nothing rebuilds otherwise
+file(WRITE ${OUTPUT}.tmp "${SOURCE}")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
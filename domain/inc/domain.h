@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "particle_system.h"
+
+
+#define DOMAIN_HISTOGRAM_BINS   4096    // resolution of the cut positions when rebalancing
+#define DOMAIN_MAX_IMBALANCE    1.1     // largest count on a rank over the mean before the cuts move
+
+
+/**
+ * Spatial domain decomposition over MPI.  The x axis is cut into one
+ * slab per rank, in rank order, and each rank steps the particles it
+ * owns with time_evolution_soa().  Every particle closer than the
+ * cutoff plus the skin to a face of its slab is a ghost on the rank
+ * across that face, so each owned particle sees every partner of the
+ * neighbour list solver.  The ghosts are chosen the way the neighbour
+ * lists are built: once, then kept until some particle has moved half
+ * the skin.  In between the same ghosts are sent again before every
+ * step and land on the same indices, so the lists are not rebuilt.
+ * Only when they are chosen again do particles that left their slab
+ * go to the rank that now holds it, until then a rank may own
+ * particles up to half the skin outside its slab.  When one rank
+ * ends up with more than DOMAIN_MAX_IMBALANCE times the mean count,
+ * the cuts move to even the counts out again.
+ *
+ * Needs FORCE_SOLVER_NEIGHBOUR_LIST with a cutoff, no slab is made
+ * narrower than the cutoff plus the skin.  The integrator must
+ * evaluate forces once per step, RK4 and block timesteps would need
+ * fresh ghosts for every stage.  Every function taking a domain is
+ * collective.
+ */
+typedef struct domain domain_t;
+
+
+/**
+ * Takes over system, which on each rank may hold any share of the
+ * particles, none included.  The cuts are placed so every rank gets
+ * about as many particles, and every particle is sent to its rank.
+ *
+ * @return NULL on every rank if any rank failed, system is freed then
+ */
+domain_t *domain__new(MPI_Comm comm, particle_system_t *system);
+void domain__delete(domain_t *domain);
+
+/**
+ * One step of sample_period with the ghost exchange before it.  When
+ * the ghosts are chosen again migration, and rebalancing if due, come
+ * first.
+ *
+ * @return 0 on success, 1 on every rank if the settings do not allow
+ *         decomposition or a rank ran out of memory
+ */
+int domain__step(domain_t *domain, const double sample_period);
+
+/**
+ * Moves the cuts so every rank holds about the same number of
+ * particles and sends each particle to its new rank.
+ *
+ * @return 0 on success, 1 on every rank if a rank ran out of memory
+ */
+int domain__rebalance(domain_t *domain);
+
+/* Particles this rank owns, without ghosts, valid until the next call on the domain */
+const particle_system_t *domain__particles(const domain_t *domain);
+
+/* Slab of this rank, lower <= x < upper, infinite at the ends of open space, see domain_t for what it holds */
+void domain__bounds(const domain_t *domain, double *lower, double *upper);
+
+/* Particles over every rank and the largest count on a rank over the mean, as of the last migration */
+size_t domain__global_count(const domain_t *domain);
+double domain__imbalance(const domain_t *domain);
+unsigned long long int domain__rebalance_count(const domain_t *domain);
+
+/**
+ * Copies every particle to root, in order of id.
+ *
+ * @return the particles on root, NULL elsewhere and on every rank if a rank ran out of memory
+ */
+particle_system_t *domain__gather(const domain_t *domain, const int root);
@@ -0,0 +1,712 @@
+#include "domain.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "mechanics.h"
+#include "periodic.h"
+
+
+/* What travels between ranks for one particle, forces included so they stay current */
+typedef struct
+{
+    particle_t particle;
+    vector3d_t force;
+
+} domain_particle_t;
+
+/* A particle queued for another rank */
+typedef struct
+{
+    size_t index;
+    int rank;
+
+} transfer_t;
+
+struct domain
+{
+    MPI_Comm comm;
+    int rank;
+    int size;
+    MPI_Datatype particle_type;
+
+    /* Owned particles first, followed by the ghosts while a step runs */
+    particle_system_t *system;
+    size_t owned;
+
+    /* Slab r is cuts[r] <= x < cuts[r + 1], the same on every rank */
+    double *cuts;
+    double halo;
+    double skin;
+    vector3d_t periodic_box;
+
+    /*
+     * Ghosts chosen at the last rebuild, sent to the same ranks in the
+     * same order every step so they land on the same indices there and
+     * the neighbour lists stay valid.  reference holds where the owned
+     * particles were then, x, y and z arrays of owned_reference each.
+     */
+    transfer_t *ghosts;
+    size_t ghost_count;
+    size_t ghost_capacity;
+    double *reference;
+    size_t reference_capacity;
+    size_t owned_reference;
+    double ghost_halo;
+    int ghosts_current;     // cleared whenever particles change ranks
+
+    /* Scratch kept between steps */
+    transfer_t *transfers;
+    size_t transfer_count;
+    size_t transfer_capacity;
+    domain_particle_t *send;
+    size_t send_capacity;
+    domain_particle_t *receive;
+    size_t receive_capacity;
+    int *send_counts;
+    int *send_offsets;
+    int *receive_counts;
+    int *receive_offsets;
+    unsigned long long int *histogram;
+
+    size_t global_count;
+    double imbalance;
+    unsigned long long int rebalance_count;
+};
+
+
+/* Private function declarations */
+static int check_settings(domain_t *domain);
+static int agree(const domain_t *domain, const int failed);
+static int owner(const domain_t *domain, const double x);
+static int queue(domain_t *domain, const size_t index, const int rank);
+static int exchange(domain_t *domain);
+static int ghosts_stale(const domain_t *domain);
+static int select_ghosts(domain_t *domain);
+static int send_ghosts(domain_t *domain);
+static int migrate(domain_t *domain);
+static void place_cuts(domain_t *domain);
+static domain_particle_t pack(const particle_system_t *system, const size_t n);
+static void unpack(particle_system_t *system, const size_t n, const domain_particle_t *p);
+static int grow(void **array, size_t *capacity, const size_t count, const size_t element_size);
+static int compare_transfers(const void *a, const void *b);
+static int compare_ids(const void *a, const void *b);
+
+/* Public function definitions */
+domain_t *domain__new(MPI_Comm comm, particle_system_t *system)
+{
+    int size;
+    domain_t *domain = calloc(1, sizeof(domain_t));
+
+    MPI_Comm_size(comm, &size);
+
+    if (domain) {
+        domain->particle_type = MPI_DATATYPE_NULL;
+        domain->cuts = malloc(((size_t)size + 1) * sizeof(double));
+        domain->send_counts = malloc((size_t)size * sizeof(int));
+        domain->send_offsets = malloc((size_t)size * sizeof(int));
+        domain->receive_counts = malloc((size_t)size * sizeof(int));
+        domain->receive_offsets = malloc((size_t)size * sizeof(int));
+        domain->histogram = malloc(DOMAIN_HISTOGRAM_BINS * sizeof(unsigned long long int));
+    }
+
+    const int failed = !system || !domain || !domain->cuts || !domain->send_counts || !domain->send_offsets ||
+                       !domain->receive_counts || !domain->receive_offsets || !domain->histogram;
+    int any_failed = failed;
+
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR, comm);
+
+    if (any_failed) {
+        if (domain) {
+            domain->system = system;
+            domain__delete(domain);
+        }
+        else {
+            particle_system__delete(system);
+        }
+        return NULL;
+    }
+
+    domain->comm = comm;
+    domain->size = size;
+    domain->system = system;
+    domain->owned = system->count;
+    domain->periodic_box = get_periodic_box();
+    MPI_Comm_rank(comm, &domain->rank);
+    MPI_Type_contiguous((int)sizeof(domain_particle_t), MPI_BYTE, &domain->particle_type);
+    MPI_Type_commit(&domain->particle_type);
+
+    /* Ranks that start empty take the clock of the others */
+    MPI_Allreduce(MPI_IN_PLACE, &system->time, 1, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &system->step_count, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+
+    if (agree(domain, check_settings(domain)) || domain__rebalance(domain)) {
+        domain__delete(domain);
+        return NULL;
+    }
+
+    domain->rebalance_count = 0;
+
+    return domain;
+}
+
+void domain__delete(domain_t *domain)
+{
+    if (!domain) return;
+
+    if (domain->particle_type != MPI_DATATYPE_NULL)
+        MPI_Type_free(&domain->particle_type);
+
+    particle_system__delete(domain->system);
+    free(domain->cuts);
+    free(domain->transfers);
+    free(domain->ghosts);
+    free(domain->reference);
+    free(domain->send);
+    free(domain->receive);
+    free(domain->send_counts);
+    free(domain->send_offsets);
+    free(domain->receive_counts);
+    free(domain->receive_offsets);
+    free(domain->histogram);
+    free(domain);
+}
+
+int domain__step(domain_t *domain, const double sample_period)
+{
+    particle_system_t *system = domain->system;
+
+    if (agree(domain, check_settings(domain)))
+        return 1;
+
+    /* Owners and ghosts are only chosen again once some particle may have come within the cutoff of one the ghosts miss */
+    if (agree(domain, ghosts_stale(domain))) {
+
+        if (migrate(domain) || (domain->imbalance > DOMAIN_MAX_IMBALANCE && domain__rebalance(domain)) ||
+            select_ghosts(domain))
+            return 1;
+    }
+
+    if (send_ghosts(domain))
+        return 1;
+
+    /*
+     * Velocity Verlet drifts with the forces of the previous step, so the
+     * ghosts must carry their owners' forces, which the owners may not
+     * have yet on the first step.
+     */
+    if (get_integrator() == INTEGRATOR_VELOCITY_VERLET) {
+
+        int current = system->forces_current;
+
+        MPI_Allreduce(MPI_IN_PLACE, &current, 1, MPI_INT, MPI_LAND, domain->comm);
+
+        if (!current) {
+
+            if (agree(domain, compute_forces(system)))
+                return 1;
+
+            system->count = domain->owned;
+
+            if (send_ghosts(domain))
+                return 1;
+        }
+    }
+
+    time_evolution_soa(system, sample_period);
+
+    /* Ghosts were only there to be felt, their owners stepped them properly */
+    system->count = domain->owned;
+
+    return 0;
+}
+
+int domain__rebalance(domain_t *domain)
+{
+    place_cuts(domain);
+    domain->rebalance_count++;
+
+    return migrate(domain);
+}
+
+const particle_system_t *domain__particles(const domain_t *domain)
+{
+    return domain->system;
+}
+
+void domain__bounds(const domain_t *domain, double *lower, double *upper)
+{
+    *lower = domain->cuts[domain->rank];
+    *upper = domain->cuts[domain->rank + 1];
+}
+
+size_t domain__global_count(const domain_t *domain)
+{
+    return domain->global_count;
+}
+
+double domain__imbalance(const domain_t *domain)
+{
+    return domain->imbalance;
+}
+
+unsigned long long int domain__rebalance_count(const domain_t *domain)
+{
+    return domain->rebalance_count;
+}
+
+particle_system_t *domain__gather(const domain_t *domain, const int root)
+{
+    const particle_system_t *system = domain->system;
+    const int is_root = domain->rank == root;
+    const int count = (int)domain->owned;
+    domain_particle_t *local = malloc((domain->owned ? domain->owned : 1) * sizeof(domain_particle_t));
+    domain_particle_t *all = NULL;
+    int *counts = NULL;
+    int *offsets = NULL;
+    particle_system_t *gathered = NULL;
+
+    if (is_root) {
+        all = malloc((domain->global_count ? domain->global_count : 1) * sizeof(domain_particle_t));
+        counts = malloc((size_t)domain->size * sizeof(int));
+        offsets = malloc((size_t)domain->size * sizeof(int));
+        gathered = particle_system__new(domain->global_count);
+    }
+
+    if (agree(domain, !local || (is_root && (!all || !counts || !offsets || !gathered)))) {
+        free(local);
+        free(all);
+        free(counts);
+        free(offsets);
+        particle_system__delete(gathered);
+        return NULL;
+    }
+
+    for (size_t n = 0; n < domain->owned; ++n)
+        local[n] = pack(system, n);
+
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, root, domain->comm);
+
+    if (is_root)
+        for (int r = 0; r < domain->size; ++r)
+            offsets[r] = r ? offsets[r - 1] + counts[r - 1] : 0;
+
+    MPI_Gatherv(local, count, domain->particle_type, all, counts, offsets, domain->particle_type, root, domain->comm);
+
+    if (is_root) {
+
+        qsort(all, domain->global_count, sizeof(domain_particle_t), compare_ids);
+
+        for (size_t n = 0; n < domain->global_count; ++n) {
+            gathered->count++;
+            unpack(gathered, n, &all[n]);
+        }
+
+        gathered->time = system->time;
+        gathered->step_count = system->step_count;
+        gathered->forces_current = system->forces_current;
+    }
+
+    free(local);
+    free(all);
+    free(counts);
+    free(offsets);
+
+    return gathered;
+}
+
+/* Private function definitions */
+/* @return 0 if the mechanics settings allow decomposition, 1 otherwise */
+static int check_settings(domain_t *domain)
+{
+    const mechanics_settings_t settings = get_mechanics_settings();
+    const double box[3] = {settings.periodic_box.i, settings.periodic_box.j, settings.periodic_box.k};
+
+    if (settings.solver != FORCE_SOLVER_NEIGHBOUR_LIST || !(settings.cutoff > 0) ||
+        settings.integrator == INTEGRATOR_RK4 || settings.integrator == INTEGRATOR_BLOCK_TIMESTEP ||
+        settings.periodic_box.i != domain->periodic_box.i)
+        return 1;
+
+    /* Neighbour lists must fit the box, and in x every slab must fit a halo */
+    for (int d = 0; d < 3; ++d)
+        if (box[d] > 0 && 2 * (settings.cutoff + settings.skin) >= box[d])
+            return 1;
+
+    if (box[0] > 0 && domain->size * (settings.cutoff + settings.skin) > box[0])
+        return 1;
+
+    domain->halo = settings.cutoff + settings.skin;
+    domain->skin = settings.skin;
+
+    return 0;
+}
+
+/* Collective, @return 1 on every rank if failed is set on any */
+static int agree(const domain_t *domain, const int failed)
+{
+    int any_failed = failed;
+
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR, domain->comm);
+
+    return any_failed;
+}
+
+/* Rank whose slab holds x */
+static int owner(const domain_t *domain, const double x)
+{
+    int lower = 0, upper = domain->size - 1;
+
+    while (lower < upper) {
+
+        const int middle = (lower + upper + 1) / 2;
+
+        if (x >= domain->cuts[middle])
+            lower = middle;
+        else
+            upper = middle - 1;
+    }
+
+    return lower;
+}
+
+static int queue(domain_t *domain, const size_t index, const int rank)
+{
+    if (grow((void **)&domain->transfers, &domain->transfer_capacity, domain->transfer_count + 1, sizeof(transfer_t)))
+        return 1;
+
+    domain->transfers[domain->transfer_count++] = (transfer_t){.index = index, .rank = rank};
+
+    return 0;
+}
+
+/**
+ * Sends every queued particle to its rank and appends the ones that
+ * arrive to the system, in rank order.  The queue is emptied.
+ *
+ * @return 0 on success, 1 on every rank if a rank ran out of memory
+ */
+static int exchange(domain_t *domain)
+{
+    particle_system_t *system = domain->system;
+    const int forces_current = system->forces_current;
+    size_t received = 0;
+
+    if (domain->transfer_count)
+        qsort(domain->transfers, domain->transfer_count, sizeof(transfer_t), compare_transfers);
+
+    const int failed = grow((void **)&domain->send, &domain->send_capacity, domain->transfer_count, sizeof(domain_particle_t));
+
+    if (agree(domain, failed)) {
+        domain->transfer_count = 0;
+        return 1;
+    }
+
+    memset(domain->send_counts, 0, (size_t)domain->size * sizeof(int));
+
+    for (size_t t = 0; t < domain->transfer_count; ++t) {
+        domain->send[t] = pack(system, domain->transfers[t].index);
+        domain->send_counts[domain->transfers[t].rank]++;
+    }
+
+    domain->transfer_count = 0;
+
+    MPI_Alltoall(domain->send_counts, 1, MPI_INT, domain->receive_counts, 1, MPI_INT, domain->comm);
+
+    for (int r = 0; r < domain->size; ++r) {
+        domain->send_offsets[r] = r ? domain->send_offsets[r - 1] + domain->send_counts[r - 1] : 0;
+        domain->receive_offsets[r] = r ? domain->receive_offsets[r - 1] + domain->receive_counts[r - 1] : 0;
+        received += (size_t)domain->receive_counts[r];
+    }
+
+    if (agree(domain, grow((void **)&domain->receive, &domain->receive_capacity, received, sizeof(domain_particle_t)) ||
+                      particle_system__reserve(system, system->count + received)))
+        return 1;
+
+    MPI_Alltoallv(domain->send, domain->send_counts, domain->send_offsets, domain->particle_type,
+                  domain->receive, domain->receive_counts, domain->receive_offsets, domain->particle_type, domain->comm);
+
+    for (size_t n = 0; n < received; ++n) {
+        system->count++;
+        unpack(system, system->count - 1, &domain->receive[n]);
+    }
+
+    system->forces_current = forces_current;
+
+    return 0;
+}
+
+/**
+ * Every pair the neighbour lists need has its ghosts until a particle
+ * moves half the skin from where it was when they were chosen, the
+ * same bound the lists themselves are rebuilt on.
+ *
+ * @return 1 if the ghosts must be chosen again, 0 otherwise
+ */
+static int ghosts_stale(const domain_t *domain)
+{
+    const particle_system_t *system = domain->system;
+    const double *reference = domain->reference;
+    const size_t stride = domain->owned_reference;
+    const double limit = domain->skin * domain->skin / 4;
+
+    if (!domain->ghosts_current || domain->ghost_halo != domain->halo)
+        return 1;
+
+    for (size_t n = 0; n < domain->owned; ++n) {
+
+        const double dx = periodic__wrap(system->pos.i[n] - reference[n], domain->periodic_box.i);
+        const double dy = periodic__wrap(system->pos.j[n] - reference[stride + n], domain->periodic_box.j);
+        const double dz = periodic__wrap(system->pos.k[n] - reference[2 * stride + n], domain->periodic_box.k);
+
+        if (dx*dx + dy*dy + dz*dz > limit)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Picks the particles within a halo of a slab face as ghosts for the rank across it */
+static int select_ghosts(domain_t *domain)
+{
+    const particle_system_t *system = domain->system;
+    const int periodic = domain->periodic_box.i > 0;
+    const int lower_rank = domain->rank > 0 ? domain->rank - 1 : periodic ? domain->size - 1 : -1;
+    const int upper_rank = domain->rank < domain->size - 1 ? domain->rank + 1 : periodic ? 0 : -1;
+    const double lower = domain->cuts[domain->rank];
+    const double upper = domain->cuts[domain->rank + 1];
+    const size_t owned = domain->owned;
+    int failed = 0;
+
+    /* A single rank is its own neighbour, the periodic images are the mechanics' business */
+    for (size_t n = 0; n < owned && domain->size > 1 && !failed; ++n) {
+
+        const int near_lower = lower_rank >= 0 && system->pos.i[n] - lower < domain->halo;
+        const int near_upper = upper_rank >= 0 && upper - system->pos.i[n] < domain->halo;
+
+        if (near_lower)
+            failed |= queue(domain, n, lower_rank);
+
+        /* With two periodic ranks both faces are shared with the same one */
+        if (near_upper && !(near_lower && upper_rank == lower_rank))
+            failed |= queue(domain, n, upper_rank);
+    }
+
+    failed |= grow((void **)&domain->ghosts, &domain->ghost_capacity, domain->transfer_count, sizeof(transfer_t)) ||
+              grow((void **)&domain->reference, &domain->reference_capacity, 3 * owned, sizeof(double));
+
+    if (agree(domain, failed)) {
+        domain->transfer_count = 0;
+        return 1;
+    }
+
+    memcpy(domain->ghosts, domain->transfers, domain->transfer_count * sizeof(transfer_t));
+    domain->ghost_count = domain->transfer_count;
+    domain->transfer_count = 0;
+
+    memcpy(domain->reference, system->pos.i, owned * sizeof(double));
+    memcpy(domain->reference + owned, system->pos.j, owned * sizeof(double));
+    memcpy(domain->reference + 2 * owned, system->pos.k, owned * sizeof(double));
+    domain->owned_reference = owned;
+    domain->ghost_halo = domain->halo;
+    domain->ghosts_current = 1;
+
+    return 0;
+}
+
+/* Appends the current state of the chosen ghosts on the ranks that take them, every rank in the same order as last time */
+static int send_ghosts(domain_t *domain)
+{
+    const int failed = grow((void **)&domain->transfers, &domain->transfer_capacity, domain->ghost_count, sizeof(transfer_t));
+
+    if (agree(domain, failed))
+        return 1;
+
+    memcpy(domain->transfers, domain->ghosts, domain->ghost_count * sizeof(transfer_t));
+    domain->transfer_count = domain->ghost_count;
+
+    return exchange(domain);
+}
+
+/* Sends away the particles outside this rank's slab, then refreshes the counts */
+static int migrate(domain_t *domain)
+{
+    particle_system_t *system = domain->system;
+    const int forces_current = system->forces_current;
+    unsigned long long int counts[2];
+    size_t kept = 0;
+    int failed = 0;
+
+    for (size_t n = 0; n < system->count && !failed; ++n) {
+
+        const int rank = owner(domain, system->pos.i[n]);
+
+        if (rank != domain->rank)
+            failed |= queue(domain, n, rank);
+    }
+
+    if (agree(domain, failed)) {
+        domain->transfer_count = 0;
+        return 1;
+    }
+
+    if (exchange(domain))
+        return 1;
+
+    /* What left is still in place, arrivals were appended behind it */
+    for (size_t n = 0; n < system->count; ++n) {
+
+        if (owner(domain, system->pos.i[n]) != domain->rank) continue;
+
+        if (kept != n) {
+            const domain_particle_t p = pack(system, n);
+            unpack(system, kept, &p);
+        }
+
+        ++kept;
+    }
+
+    system->count = domain->owned = kept;
+    system->forces_current = forces_current;
+    domain->ghosts_current = 0;
+
+    counts[0] = counts[1] = kept;
+    MPI_Allreduce(MPI_IN_PLACE, &counts[0], 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, domain->comm);
+    MPI_Allreduce(MPI_IN_PLACE, &counts[1], 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, domain->comm);
+
+    domain->global_count = counts[0];
+    domain->imbalance = counts[0] ? (double)counts[1] * domain->size / (double)counts[0] : 1;
+
+    return 0;
+}
+
+/**
+ * Cuts at the quantiles of a histogram of x summed over every rank,
+ * then pushed apart until no slab is narrower than the halo.
+ */
+static void place_cuts(domain_t *domain)
+{
+    const particle_system_t *system = domain->system;
+    const int periodic = domain->periodic_box.i > 0;
+    const double min_width = domain->size * domain->halo;
+    double lower, upper;
+
+    if (periodic) {
+        lower = -domain->periodic_box.i / 2;
+        upper = domain->periodic_box.i / 2;
+    }
+    else {
+        double extent[2] = {-INFINITY, -INFINITY};     // -min and max, so one reduction finds both
+
+        for (size_t n = 0; n < domain->owned; ++n) {
+            extent[0] = fmax(extent[0], -system->pos.i[n]);
+            extent[1] = fmax(extent[1], system->pos.i[n]);
+        }
+
+        MPI_Allreduce(MPI_IN_PLACE, extent, 2, MPI_DOUBLE, MPI_MAX, domain->comm);
+
+        lower = isfinite(extent[0]) ? -extent[0] : 0;
+        upper = isfinite(extent[1]) ? extent[1] : 0;
+
+        if (upper - lower < min_width) {
+            const double centre = (lower + upper) / 2;
+            lower = centre - min_width / 2;
+            upper = centre + min_width / 2;
+        }
+    }
+
+    const double bin_width = (upper - lower) / DOMAIN_HISTOGRAM_BINS;
+    unsigned long long int total = 0, cumulative = 0;
+    size_t bin = 0;
+
+    memset(domain->histogram, 0, DOMAIN_HISTOGRAM_BINS * sizeof(unsigned long long int));
+
+    for (size_t n = 0; n < domain->owned; ++n) {
+        const double b = floor((system->pos.i[n] - lower) / bin_width);
+        domain->histogram[b < 0 ? 0 : b >= DOMAIN_HISTOGRAM_BINS ? DOMAIN_HISTOGRAM_BINS - 1 : (size_t)b]++;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, domain->histogram, DOMAIN_HISTOGRAM_BINS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, domain->comm);
+
+    for (size_t b = 0; b < DOMAIN_HISTOGRAM_BINS; ++b)
+        total += domain->histogram[b];
+
+    domain->cuts[0] = periodic ? lower : -INFINITY;
+    domain->cuts[domain->size] = periodic ? upper : INFINITY;
+
+    for (int r = 1; r < domain->size; ++r) {
+
+        const double target = (double)total * r / domain->size;
+
+        while (bin < DOMAIN_HISTOGRAM_BINS - 1 && (double)(cumulative + domain->histogram[bin]) < target)
+            cumulative += domain->histogram[bin++];
+
+        const double fraction = domain->histogram[bin] ? (target - (double)cumulative) / (double)domain->histogram[bin] : 0;
+
+        domain->cuts[r] = total ? lower + ((double)bin + fmin(fmax(fraction, 0), 1)) * bin_width
+                                : lower + (upper - lower) * r / domain->size;
+    }
+
+    /* Upwards then downwards, the box holds size halos so both limits can be met */
+    for (int r = 1; r < domain->size; ++r) {
+        const double limit = r > 1 || periodic ? domain->cuts[r - 1] + domain->halo : -INFINITY;
+        domain->cuts[r] = fmax(domain->cuts[r], limit);
+    }
+
+    for (int r = domain->size - 1; r > 0; --r) {
+        const double limit = r < domain->size - 1 || periodic ? domain->cuts[r + 1] - domain->halo : INFINITY;
+        domain->cuts[r] = fmin(domain->cuts[r], limit);
+    }
+}
+
+static domain_particle_t pack(const particle_system_t *system, const size_t n)
+{
+    return (domain_particle_t){
+        .particle = particle_system__get(system, n),
+        .force = {system->force.i[n], system->force.j[n], system->force.k[n]}
+    };
+}
+
+static void unpack(particle_system_t *system, const size_t n, const domain_particle_t *p)
+{
+    particle_system__set(system, n, &p->particle);
+
+    system->force.i[n] = p->force.i;
+    system->force.j[n] = p->force.j;
+    system->force.k[n] = p->force.k;
+}
+
+/* @return 0 once array holds at least count elements, 1 on allocation failure */
+static int grow(void **array, size_t *capacity, const size_t count, const size_t element_size)
+{
+    if (count <= *capacity && *array)
+        return 0;
+
+    const size_t new_capacity = count > 2 * *capacity ? count : 2 * *capacity;
+    void *grown = realloc(*array, (new_capacity ? new_capacity : 1) * element_size);
+
+    if (!grown)
+        return 1;
+
+    *array = grown;
+    *capacity = new_capacity;
+
+    return 0;
+}
+
+/* By rank, then by index so the order on the wire is the order in the system */
+static int compare_transfers(const void *a, const void *b)
+{
+    const transfer_t *x = a, *y = b;
+
+    if (x->rank != y->rank)
+        return x->rank < y->rank ? -1 : 1;
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    const domain_particle_t *x = a, *y = b;
+
+    return (x->particle.id > y->particle.id) - (x->particle.id < y->particle.id);
+}
@@ -0,0 +1,234 @@
+#include "domain.h"
+
+#include <math.h>
+
+#include "mechanics.h"
+#include "log.h"
+
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define CLOUD_SIZE      400
+#define CUTOFF          0.12
+#define SKIN            0.02
+#define STEP_COUNT      20
+#define SAMPLE_PERIOD   1E-4
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static int rank;
+static int size;
+
+
+/* The same cloud on every rank, drifting fast enough in x to cross slabs within a few steps */
+static particle_system_t *new_cloud(const double drift)
+{
+    particle_system_t *cloud = particle_system__new(CLOUD_SIZE);
+    unsigned long long int state = 13;
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+        const particle_t p = {
+            .id = n,
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .momenta = {drift + 100 * (next_random(&state) - 0.5), 0, 0},
+            .mass = 1,
+            .charge = n % 2 ? 1 : -1
+        };
+        particle_system__add(cloud, &p);
+    }
+
+    return cloud;
+}
+
+/* Rank 0 starts with every particle, the domain has to spread them */
+static domain_t *new_domain(const double drift)
+{
+    particle_system_t *cloud = new_cloud(drift);
+
+    if (rank != 0)
+        cloud->count = 0;
+
+    return domain__new(MPI_COMM_WORLD, cloud);
+}
+
+/* Largest position difference from a single process run of the same steps, the same on every rank */
+static double deviation_from_single_process(void)
+{
+    particle_system_t *reference = new_cloud(0);
+    domain_t *domain = new_domain(0);
+    double deviation = 0;
+
+    TEST_ASSERT_NOT_NULL(domain);
+
+    for (int step = 0; step < STEP_COUNT; ++step) {
+        time_evolution_soa(reference, SAMPLE_PERIOD);
+        TEST_ASSERT_EQUAL(0, domain__step(domain, SAMPLE_PERIOD));
+    }
+
+    particle_system_t *gathered = domain__gather(domain, 0);
+
+    if (rank == 0) {
+
+        TEST_ASSERT_NOT_NULL(gathered);
+        TEST_ASSERT_EQUAL(CLOUD_SIZE, gathered->count);
+        TEST_ASSERT_EQUAL(STEP_COUNT, gathered->step_count);
+
+        for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+            TEST_ASSERT_EQUAL(n, gathered->id[n]);
+            deviation = fmax(deviation, fabs(gathered->pos.i[n] - reference->pos.i[n]));
+            deviation = fmax(deviation, fabs(gathered->pos.j[n] - reference->pos.j[n]));
+            deviation = fmax(deviation, fabs(gathered->momenta.i[n] - reference->momenta.i[n]) * SAMPLE_PERIOD);
+        }
+    }
+
+    MPI_Bcast(&deviation, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    particle_system__delete(gathered);
+    particle_system__delete(reference);
+    domain__delete(domain);
+
+    return deviation;
+}
+
+
+void suiteSetUp(void)
+{
+    MPI_Init(NULL, NULL);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+}
+
+int suiteTearDown(int num_failures)
+{
+    MPI_Finalize();
+
+    return num_failures;
+}
+
+void setUp(void)
+{
+    set_thread_count(1);
+    set_force_solver(FORCE_SOLVER_NEIGHBOUR_LIST);
+    set_cutoff(CUTOFF, SKIN);
+    set_integrator(INTEGRATOR_SYMPLECTIC_EULER);
+    set_periodic_box((vector3d_t){0});
+}
+
+void tearDown(void)
+{
+    set_force_solver(FORCE_SOLVER_DIRECT);
+    set_cutoff(0, 0);
+    set_integrator(INTEGRATOR_SYMPLECTIC_EULER);
+    set_periodic_box((vector3d_t){0});
+    free_mechanics_workspace();
+}
+
+void test_particles_are_spread_over_the_slabs(void)
+{
+    domain_t *domain = new_domain(0);
+    double lower, upper;
+    int outside = 0;
+
+    TEST_ASSERT_NOT_NULL(domain);
+    TEST_ASSERT_EQUAL(CLOUD_SIZE, domain__global_count(domain));
+    TEST_ASSERT_TRUE(domain__imbalance(domain) <= DOMAIN_MAX_IMBALANCE);
+
+    const particle_system_t *particles = domain__particles(domain);
+
+    domain__bounds(domain, &lower, &upper);
+
+    for (size_t n = 0; n < particles->count; ++n)
+        outside += particles->pos.i[n] < lower || particles->pos.i[n] >= upper;
+
+    MPI_Allreduce(MPI_IN_PLACE, &outside, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    TEST_ASSERT_EQUAL(0, outside);
+
+    /* No slab is narrower than a halo */
+    TEST_ASSERT_TRUE(upper - lower >= (CUTOFF + SKIN) * (1 - 1E-12));
+
+    domain__delete(domain);
+}
+
+void test_open_space_matches_a_single_process(void)
+{
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9, 0, deviation_from_single_process());
+}
+
+void test_periodic_box_matches_a_single_process(void)
+{
+    set_periodic_box((vector3d_t){1, 1, 1});
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9, 0, deviation_from_single_process());
+}
+
+/* The ghosts carry their owners' forces, so the first half kick is the same as in one process */
+void test_velocity_verlet_matches_a_single_process(void)
+{
+    set_integrator(INTEGRATOR_VELOCITY_VERLET);
+    set_periodic_box((vector3d_t){1, 1, 1});
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9, 0, deviation_from_single_process());
+}
+
+/* The whole cloud drifts towards the last slab in open space until the cuts follow it */
+void test_drift_triggers_rebalancing(void)
+{
+    domain_t *domain = new_domain(1000);
+
+    TEST_ASSERT_NOT_NULL(domain);
+
+    for (int step = 0; step < 10 * STEP_COUNT; ++step) {
+        TEST_ASSERT_EQUAL(0, domain__step(domain, SAMPLE_PERIOD));
+        TEST_ASSERT_TRUE(domain__imbalance(domain) <= DOMAIN_MAX_IMBALANCE);
+    }
+
+    TEST_ASSERT_EQUAL(CLOUD_SIZE, domain__global_count(domain));
+
+    if (size > 1)
+        TEST_ASSERT_TRUE(domain__rebalance_count(domain) > 0);
+
+    domain__delete(domain);
+}
+
+/* The ghosts stay the same between rebuilds, so the lists are rebuilt about as often as particles move half the skin */
+void test_neighbour_lists_outlive_steps(void)
+{
+    domain_t *domain = new_domain(0);
+
+    TEST_ASSERT_NOT_NULL(domain);
+
+    const unsigned long long int builds = get_neighbour_list_builds();
+
+    /* No particle is faster than 50, a tenth of the usual timestep takes it 5E-4 a step and half the skin in 20 */
+    for (int step = 0; step < 2 * STEP_COUNT; ++step)
+        TEST_ASSERT_EQUAL(0, domain__step(domain, SAMPLE_PERIOD / 10));
+
+    unsigned long long int rebuilds = get_neighbour_list_builds() - builds;
+
+    MPI_Allreduce(MPI_IN_PLACE, &rebuilds, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    TEST_ASSERT_TRUE(rebuilds >= 1);
+    TEST_ASSERT_TRUE(rebuilds <= 4);
+    TEST_ASSERT_EQUAL(CLOUD_SIZE, domain__global_count(domain));
+
+    domain__delete(domain);
+}
+
+void test_unsupported_settings_are_refused(void)
+{
+    set_integrator(INTEGRATOR_RK4);
+    TEST_ASSERT_NULL(new_domain(0));
+
+    set_integrator(INTEGRATOR_SYMPLECTIC_EULER);
+    set_cutoff(0, 0);
+    TEST_ASSERT_NULL(new_domain(0));
+
+    /* Four slabs no narrower than a halo do not fit */
+    set_cutoff(CUTOFF, SKIN);
+    set_periodic_box((vector3d_t){3.5 * (CUTOFF + SKIN), 1, 1});
+    if (size >= 4)
+        TEST_ASSERT_NULL(new_domain(0));
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <glad/glad.h>
+
+
+#define FRAME_CAPTURE_RING_SIZE     3   // frames in flight before the oldest is mapped
+
+
+/**
+ * Renders into an offscreen framebuffer and streams its frames as raw
+ * RGB, 8 bits a channel, top row first, with nothing between frames.
+ * That is what ffmpeg takes as -f rawvideo -pix_fmt rgb24.
+ *
+ * Each frame is read into the next pixel buffer object of a ring.  The
+ * copy is queued on the GPU and only the oldest buffer is mapped, by
+ * which time the GPU has long finished it, so reading back does not
+ * wait for the frame just drawn.
+ */
+struct frame_capture
+{
+    GLuint FBO;
+    GLuint color_RBO;
+    GLuint depth_RBO;
+    GLuint PBOs[FRAME_CAPTURE_RING_SIZE];
+    GLsizei width;
+    GLsizei height;
+    unsigned int next;          // buffer the next frame is read into
+    unsigned int pending;       // frames read back but not written yet
+    unsigned long long int frames_written;
+    FILE *output;
+};
+
+
+/**
+ * Creates the framebuffer and leaves it bound, everything drawn from
+ * then on goes to it.
+ *
+ * @return 0 on success, 1 if the framebuffer is incomplete
+ */
+int frame_capture_init(struct frame_capture *capture, const GLsizei width, const GLsizei height, FILE *output);
+
+/**
+ * Queues the frame just drawn and writes out the oldest queued one once
+ * the ring is full.
+ *
+ * @return 0 on success, 1 if writing to the output failed
+ */
+int frame_capture_read(struct frame_capture *capture);
+
+/* @return 0 on success, 1 if writing one of the queued frames failed */
+int frame_capture_finish(struct frame_capture *capture);
+
+/* Binds the default framebuffer again, the output is left open */
+void frame_capture_delete(struct frame_capture *capture);
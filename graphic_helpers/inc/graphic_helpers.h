@@ -7,15 +7,16 @@
 
 #include "linmath.h"
 
+#include "async_log.h"
 #include "vector.h"
 
 
 #define PI                  3.14159265358979323846264338327950
 
-#define VERTEX_SHADER_FILEPATH      "shaders/vs.vert.glsl"
-#define FRAGMENT_SHADER_FILEPATH    "shaders/fs.frag.glsl"
-
 #define DEBUG_OUTPUT_FILEPATH       "debug_output.txt"
+#define SHADER_CACHE_DIRECTORY      "shader_cache"      // linked programs, one file per program, driver and source
+
+#define ICOSPHERE_MAX_SUBDIVISIONS  4   // 2562 vertices, indices must fit a GLushort
 
 
 typedef struct
@@ -26,27 +27,61 @@ typedef struct
 
 } color_t;
 
-struct vertex
+/* Per-particle attributes, angles already divided by the view scalar */
+struct instance
 {
-    vector3d_t pos;
+    GLfloat pos[3];
+    GLfloat angle[3];
     color_t color;
 };
 
 struct shader_variables
 {
     GLint vpos_location;
-    GLint vcol_location;
-    GLint mvp_location;
+    GLint ipos_location;
+    GLint iangle_location;
+    GLint icol_location;
+    GLint projection_location;
+    GLint radius_location;
 };
 
+/**
+ * The view scalar only sets how fast particles appear to spin: scaling
+ * the old per-particle MVP by it scaled w as well, so it never changed
+ * their size.
+ */
 struct draw_variables
 {
     float ratio;
-    int num_segments;
     double view_scalar;
+};
+
+/* Unit sphere made of triangles, the positions double as normals */
+struct icosphere
+{
+    GLfloat (*vertices)[3];
+    GLushort (*triangles)[3];
+    int vertex_count;
+    int triangle_count;
+};
+
+/**
+ * One mesh shared by every particle of a species.  The mesh vertices
+ * sit in a static buffer, the instances are streamed into a second one
+ * each frame and the whole species is drawn in one call.  Meshes are in
+ * units of radius.
+ */
+struct instanced_mesh
+{
+    GLuint program;
     struct shader_variables shader_vars;
-    vector3d_t pos;
-    vector3d_t angle;
+    GLuint VAO;
+    GLuint mesh_VBO;
+    GLuint index_VBO;       // 0 for meshes drawn without indices
+    GLuint instance_VBO;
+    GLenum mode;
+    GLsizei element_count;  // indices, or vertices without them
+    double radius;
 };
 
 
@@ -54,11 +89,37 @@ struct draw_variables
 extern const color_t p_color;
 extern const color_t e_color;
 
-
-int shader_compile_and_link(GLuint *program);
-
-void vertex_buffer_init(GLuint *VBO, const struct vertex *vertices, const int v_size);
-void vertex_buffer_draw(const GLuint VBO, const struct draw_variables draw_vars);
-
-void create_circle_vertex_array(struct vertex *v, const vector2d_t center, const double r, const int num_segments, const color_t color);
-void create_sphere_vertex_array(struct vertex *v, const vector3d_t center, const double r, const int num_y_segments, const int num_z_segments, const color_t color);
+/* Corners of the square an impostor is ray cast in, drawn as a triangle strip */
+extern const GLfloat impostor_quad[4][3];
+
+/* Sources of shaders/ compiled in at build time, named after their files by cmake/embed_shaders.cmake */
+extern const char vs_vert_glsl[];
+extern const char fs_frag_glsl[];
+extern const char impostor_vert_glsl[];
+extern const char impostor_frag_glsl[];
+
+
+/**
+ * Loads the program from SHADER_CACHE_DIRECTORY if it was linked before
+ * by the same driver from the same sources.  Otherwise compiles both
+ * shaders, links them and caches the binary, when the driver can hand
+ * it out.  The info log of a failed step goes to async_log under name, the
+ * caller's writer thread owns the debug log.
+ *
+ * @return 0 on success, 1 if a step failed
+ */
+int shader_compile_and_link(async_log_t *async_log, GLuint *program, const char *name, const char *vs_source, const char *fs_source);
+
+void instanced_mesh_init(struct instanced_mesh *mesh, const GLuint program, const GLfloat (*positions)[3], const int vertex_count,
+                         const GLushort *indices, const int index_count, const GLenum mode, const double radius);
+void instanced_mesh_draw(const struct instanced_mesh *mesh, const struct instance *instances, const GLsizei instance_count, const struct draw_variables draw_vars);
+void instanced_mesh_delete(struct instanced_mesh *mesh);
+
+/**
+ * Subdivides an icosahedron, every level splits each triangle into
+ * four: 12, 42, 162, 642 then 2562 vertices.
+ *
+ * @return 0 on success, 1 without memory or past ICOSPHERE_MAX_SUBDIVISIONS
+ */
+int create_icosphere(struct icosphere *sphere, const unsigned int subdivisions);
+void free_icosphere(struct icosphere *sphere);
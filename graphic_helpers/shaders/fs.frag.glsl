@@ -1,6 +1,14 @@
 #version 110
+// Stripes of latitude show the spin, the light comes from in front, up and to the left
 varying vec3 color;
+varying vec3 normal;
+varying vec3 objectNormal;
+const float STRIPES = 64.0;
+const vec3 LIGHT = vec3(-0.3, 0.4, -0.866);
 void main()
 {
-    gl_FragColor = vec4(color, 1.0);
+    vec3 n = normalize(normal);
+    float band = mod(floor(acos(clamp(normalize(objectNormal).z, -1.0, 1.0)) * STRIPES / 3.14159265), 2.0);
+    float light = 0.35 + 0.65 * max(dot(n, LIGHT), 0.0);
+    gl_FragColor = vec4(color * mix(1.0, 0.6, band) * light, 1.0);
 }
@@ -0,0 +1,24 @@
+#version 110
+// Shaded like the icosphere in fs.frag.glsl, but with the exact sphere per pixel
+varying vec3 color;
+varying vec2 corner;
+varying vec3 axisZ;
+varying float centerDepth;
+varying float depthPerRadius;
+const float STRIPES = 64.0;
+const vec3 LIGHT = vec3(-0.3, 0.4, -0.866);
+void main()
+{
+    float r2 = dot(corner, corner);
+    if (r2 > 1.0)
+        discard;
+
+    // The viewer looks down +z, the visible half of the sphere faces -z
+    vec3 n = vec3(corner, -sqrt(1.0 - r2));
+    float z = dot(axisZ, n) / length(axisZ);
+
+    float band = mod(floor(acos(clamp(z, -1.0, 1.0)) * STRIPES / 3.14159265), 2.0);
+    float light = 0.35 + 0.65 * max(dot(n, LIGHT), 0.0);
+    gl_FragColor = vec4(color * mix(1.0, 0.6, band) * light, 1.0);
+    gl_FragDepth = centerDepth + depthPerRadius * n.z;
+}
@@ -0,0 +1,36 @@
+// Sphere impostor: a square facing the viewer, ray cast in impostor.frag.glsl.
+// vPos is a corner of the square.  The stripes only need the particle's own z axis,
+// which is the last column of the rotation.
+
+// #version 110
+uniform mat4 P;
+uniform float radius;
+attribute vec3 vPos;
+attribute vec3 iPos;
+attribute vec3 iAngle;
+attribute vec3 iCol;
+varying vec3 color;
+varying vec2 corner;
+varying vec3 axisZ;
+varying float centerDepth;
+varying float depthPerRadius;
+void main()
+{
+    vec3 s = sin(iAngle);
+    vec3 c = cos(iAngle);
+    mat3 rx = mat3(1.0, 0.0, 0.0,   0.0, c.x, s.x,   0.0, -s.x, c.x);
+    mat3 ry = mat3(c.y, 0.0, s.y,   0.0, 1.0, 0.0,   -s.y, 0.0, c.y);
+    mat3 rz = mat3(c.z, s.z, 0.0,   -s.z, c.z, 0.0,  0.0, 0.0, 1.0);
+    mat3 r = rx * ry * rz;
+
+    axisZ = r[2];
+
+    // Orthographic, so depth is linear in view z and w stays 1
+    vec4 center = P * vec4(iPos, 1.0);
+    centerDepth = 0.5 * center.z + 0.5;
+    depthPerRadius = 0.5 * P[2][2] * radius;
+
+    corner = vPos.xy;
+    gl_Position = center + P * vec4(radius * vPos.xy, 0.0, 0.0);
+    color = iCol;
+}
@@ -5,14 +5,30 @@
 
 // Source: https://stackoverflow.com/questions/17537879/in-webgl-what-are-the-differences-between-an-attribute-a-uniform-and-a-varying
 
+// Icosphere mesh.  The i attributes are per instance, one particle each, vPos is a
+// vertex of the unit sphere and so also its normal.  The rotation is X * Y * Z as
+// linmath builds it.
+
 // #version 110
-uniform mat4 MVP;
-attribute vec3 vCol;
+uniform mat4 P;
+uniform float radius;
 attribute vec3 vPos;
+attribute vec3 iPos;
+attribute vec3 iAngle;
+attribute vec3 iCol;
 varying vec3 color;
+varying vec3 normal;
+varying vec3 objectNormal;
 void main()
 {
-    gl_Position = MVP * vec4(vPos, 1.0);
-    color = vCol;
-}
+    vec3 s = sin(iAngle);
+    vec3 c = cos(iAngle);
+    mat3 rx = mat3(1.0, 0.0, 0.0,   0.0, c.x, s.x,   0.0, -s.x, c.x);
+    mat3 ry = mat3(c.y, 0.0, s.y,   0.0, 1.0, 0.0,   -s.y, 0.0, c.y);
+    mat3 rz = mat3(c.z, s.z, 0.0,   -s.z, c.z, 0.0,  0.0, 0.0, 1.0);
 
+    normal = rx * ry * rz * vPos;
+    objectNormal = vPos;
+    gl_Position = P * vec4(iPos + radius * normal, 1.0);
+    color = iCol;
+}
@@ -0,0 +1,111 @@
+#include "frame_capture.h"
+
+
+/* Private function declarations */
+static int write_oldest(struct frame_capture *capture);
+
+
+/* Public function definitions */
+int frame_capture_init(struct frame_capture *capture, const GLsizei width, const GLsizei height, FILE *output)
+{
+    const GLsizeiptr frame_size = (GLsizeiptr)width * height * 3;
+
+    capture->width = width;
+    capture->height = height;
+    capture->next = 0;
+    capture->pending = 0;
+    capture->frames_written = 0;
+    capture->output = output;
+
+    glGenRenderbuffers(1, &capture->color_RBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, capture->color_RBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &capture->depth_RBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, capture->depth_RBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &capture->FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, capture->FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, capture->color_RBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture->depth_RBO);
+
+    /* Allocated once, the driver may keep them where the GPU writes fastest */
+    glGenBuffers(FRAME_CAPTURE_RING_SIZE, capture->PBOs);
+    for (unsigned int b = 0; b < FRAME_CAPTURE_RING_SIZE; ++b) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->PBOs[b]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    /* Rows of 3 byte pixels are not padded to 4 bytes */
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE;
+}
+
+int frame_capture_read(struct frame_capture *capture)
+{
+    if (capture->pending == FRAME_CAPTURE_RING_SIZE && write_oldest(capture))
+        return 1;
+
+    /* With a pack buffer bound the last argument is an offset into it and the call returns at once */
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->PBOs[capture->next]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, capture->width, capture->height, GL_RGB, GL_UNSIGNED_BYTE, (void*) 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    capture->next = (capture->next + 1) % FRAME_CAPTURE_RING_SIZE;
+    ++capture->pending;
+
+    return 0;
+}
+
+int frame_capture_finish(struct frame_capture *capture)
+{
+    while (capture->pending)
+        if (write_oldest(capture))
+            return 1;
+
+    return fflush(capture->output) != 0;
+}
+
+void frame_capture_delete(struct frame_capture *capture)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &capture->FBO);
+    glDeleteRenderbuffers(1, &capture->color_RBO);
+    glDeleteRenderbuffers(1, &capture->depth_RBO);
+    glDeleteBuffers(FRAME_CAPTURE_RING_SIZE, capture->PBOs);
+}
+
+
+/* Private function definitions */
+
+/* GL rows go bottom up, they are written top down */
+static int write_oldest(struct frame_capture *capture)
+{
+    const unsigned int oldest = (capture->next + FRAME_CAPTURE_RING_SIZE - capture->pending) % FRAME_CAPTURE_RING_SIZE;
+    const size_t row_size = (size_t)capture->width * 3;
+    const GLsizeiptr frame_size = (GLsizeiptr)row_size * capture->height;
+    int rc = 0;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->PBOs[oldest]);
+    const unsigned char *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_size, GL_MAP_READ_BIT);
+
+    if (!pixels) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return 1;
+    }
+
+    for (GLsizei row = capture->height - 1; row >= 0 && !rc; --row)
+        rc = fwrite(pixels + (size_t)row * row_size, 1, row_size, capture->output) != row_size;
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    --capture->pending;
+    capture->frames_written += !rc;
+
+    return rc;
+}
@@ -1,160 +1,487 @@
 #include "graphic_helpers.h"
 
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include "particle.h"
-#include "log.h"
+#include "async_log.h"
 
 
-/* Global variables */
-extern log_t *log_handle;
+#define INFO_LOG_SIZE       1024
+
+#define CACHE_MAGIC         "PSIMPRG1"
+#define CACHE_FILEPATH_SIZE 256
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+
+/* Start of a program cache file, the binary follows */
+struct cache_header
+{
+    char magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
 
+
+/* Global variables */
 const color_t p_color = (color_t){.r = 1.0f, .g = 0.0f, .b = 0.0f};
 const color_t e_color = (color_t){.r = 0.0f, .g = 0.0f, .b = 1.0f};;
 
+const GLfloat impostor_quad[4][3] = {{-1, -1, 0}, {1, -1, 0}, {-1, 1, 0}, {1, 1, 0}};
+
+
+/* Private function declarations */
+static int link_program(async_log_t *async_log, GLuint *program, const char *name, const char *vs_source, const char *fs_source,
+                        const int retrievable);
+static GLuint compile_shader(async_log_t *async_log, const GLenum type, const char *name, const char *source);
+static void log_info(async_log_t *async_log, const char *heading, const char *info);
+static int binary_cache_usable(void);
+static uint64_t hash_string(uint64_t hash, const char *text);
+static uint64_t program_key(const char *vs_source, const char *fs_source);
+static int load_cached_program(async_log_t *async_log, GLuint *program, const char *filepath, const uint64_t key);
+static int store_program(const GLuint program, const char *filepath, const uint64_t key);
+static GLushort midpoint(struct icosphere *sphere, GLushort (*edges)[3], int *edge_count, const GLushort a, const GLushort b);
+
 
 /* Public function definitions */
-int shader_compile_and_link(GLuint *program)
+int shader_compile_and_link(async_log_t *async_log, GLuint *program, const char *name, const char *vs_source, const char *fs_source)
 {
-    FILE *vs_fp = fopen(VERTEX_SHADER_FILEPATH, "r");
-    FILE *fs_fp = fopen(FRAGMENT_SHADER_FILEPATH, "r");
-    char *vs_text;
-    char *fs_text;
-    size_t rc;
+    const int cacheable = binary_cache_usable();
+    const uint64_t key = program_key(vs_source, fs_source);
+    char filepath[CACHE_FILEPATH_SIZE];
 
-    GLuint vertex_shader, fragment_shader;
+    snprintf(filepath, sizeof(filepath), "%s/%s-%016llx.bin", SHADER_CACHE_DIRECTORY, name, (unsigned long long)key);
 
+    if (cacheable && !load_cached_program(async_log, program, filepath, key))
+        return 0;
 
-    if (!vs_fp || !fs_fp) {
+    if (link_program(async_log, program, name, vs_source, fs_source, cacheable))
         return 1;
+
+    if (cacheable && store_program(*program, filepath, key))
+        async_log__write(async_log, LOG_WARNING, "SHADER CACHE: could not write %s", filepath);
+
+    return 0;
+}
+
+/* The attribute layout is recorded in the vertex array object once, drawing only binds it */
+void instanced_mesh_init(struct instanced_mesh *mesh, const GLuint program, const GLfloat (*positions)[3], const int vertex_count,
+                         const GLushort *indices, const int index_count, const GLenum mode, const double radius)
+{
+    struct shader_variables *shader_vars = &mesh->shader_vars;
+
+    mesh->program = program;
+    mesh->mode = mode;
+    mesh->element_count = indices ? index_count : vertex_count;
+    mesh->radius = radius;
+    mesh->index_VBO = 0;
+
+    shader_vars->vpos_location = glGetAttribLocation(program, "vPos");
+    shader_vars->ipos_location = glGetAttribLocation(program, "iPos");
+    shader_vars->iangle_location = glGetAttribLocation(program, "iAngle");
+    shader_vars->icol_location = glGetAttribLocation(program, "iCol");
+    shader_vars->projection_location = glGetUniformLocation(program, "P");
+    shader_vars->radius_location = glGetUniformLocation(program, "radius");
+
+    glGenVertexArrays(1, &mesh->VAO);
+    glBindVertexArray(mesh->VAO);
+
+    glGenBuffers(1, &mesh->mesh_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->mesh_VBO);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertex_count * (GLsizeiptr)sizeof(positions[0]), positions, GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray((GLuint)shader_vars->vpos_location);
+    glVertexAttribPointer((GLuint)shader_vars->vpos_location, 3, GL_FLOAT, GL_FALSE, sizeof(positions[0]), (void*) 0);
+
+    /* The element buffer binding is part of the vertex array object */
+    if (indices) {
+        glGenBuffers(1, &mesh->index_VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_VBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)index_count * (GLsizeiptr)sizeof(GLushort), indices, GL_STATIC_DRAW);
     }
 
-    const size_t vs_size = get_file_size(vs_fp);
-    const size_t fs_size = get_file_size(fs_fp);
+    /* Filled in by instanced_mesh_draw(), the attributes advance once per instance */
+    glGenBuffers(1, &mesh->instance_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_VBO);
+
+    glEnableVertexAttribArray((GLuint)shader_vars->ipos_location);
+    glVertexAttribPointer((GLuint)shader_vars->ipos_location, 3, GL_FLOAT, GL_FALSE, sizeof(struct instance), (void*) offsetof(struct instance, pos));
+    glVertexAttribDivisor((GLuint)shader_vars->ipos_location, 1);
+    glEnableVertexAttribArray((GLuint)shader_vars->iangle_location);
+    glVertexAttribPointer((GLuint)shader_vars->iangle_location, 3, GL_FLOAT, GL_FALSE, sizeof(struct instance), (void*) offsetof(struct instance, angle));
+    glVertexAttribDivisor((GLuint)shader_vars->iangle_location, 1);
+    glEnableVertexAttribArray((GLuint)shader_vars->icol_location);
+    glVertexAttribPointer((GLuint)shader_vars->icol_location, 3, GL_FLOAT, GL_FALSE, sizeof(struct instance), (void*) offsetof(struct instance, color));
+    glVertexAttribDivisor((GLuint)shader_vars->icol_location, 1);
+
+    glBindVertexArray(0);
+}
+
+void instanced_mesh_draw(const struct instanced_mesh *mesh, const struct instance *instances, const GLsizei instance_count, const struct draw_variables draw_vars)
+{
+    const GLsizeiptr size = (GLsizeiptr)instance_count * (GLsizeiptr)sizeof(struct instance);
+    mat4x4 p;
 
-    vs_text = malloc(sizeof(char)*vs_size);
-    fs_text = malloc(sizeof(char)*fs_size);
+    if (instance_count <= 0)
+        return;
 
-    if (!vs_text || !fs_text) {
+    mat4x4_ortho(p, -draw_vars.ratio, draw_vars.ratio, -1.f, 1.f, 1.f, -1.f);
+
+    /* Orphaning the old storage lets the driver keep drawing from it rather than stall on the upload */
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_VBO);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances);
+
+    glUseProgram(mesh->program);
+    glBindVertexArray(mesh->VAO);
+    glUniformMatrix4fv(mesh->shader_vars.projection_location, 1, GL_FALSE, (const GLfloat*)p);
+    glUniform1f(mesh->shader_vars.radius_location, (GLfloat)mesh->radius);
+
+    if (mesh->index_VBO)
+        glDrawElementsInstanced(mesh->mode, mesh->element_count, GL_UNSIGNED_SHORT, (void*) 0, instance_count);
+    else
+        glDrawArraysInstanced(mesh->mode, 0, mesh->element_count, instance_count);
+
+    glBindVertexArray(0);
+}
+
+void instanced_mesh_delete(struct instanced_mesh *mesh)
+{
+    glDeleteBuffers(1, &mesh->mesh_VBO);
+    if (mesh->index_VBO)
+        glDeleteBuffers(1, &mesh->index_VBO);
+    glDeleteBuffers(1, &mesh->instance_VBO);
+    glDeleteVertexArrays(1, &mesh->VAO);
+}
+
+int create_icosphere(struct icosphere *sphere, const unsigned int subdivisions)
+{
+    /* Corners of three orthogonal golden rectangles */
+    const GLfloat t = 1.618033988749895f;
+    const GLfloat corners[12][3] = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1},
+    };
+    const GLushort faces[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1},
+    };
+
+    sphere->vertices = NULL;
+    sphere->triangles = NULL;
+
+    if (subdivisions > ICOSPHERE_MAX_SUBDIVISIONS)
         return 1;
-    }
 
-    rc = fread(vs_text, sizeof(char), vs_size, vs_fp);
-    if (rc != vs_size) {
-        log__write(log_handle, LOG_WARNING, "VERTEX SHADER READ: read %i bytes\n\n%s\n", rc, vs_text);
+    const int final_triangle_count = 20 << (2 * subdivisions);
+    const int final_vertex_count = final_triangle_count / 2 + 2;
+    GLushort (*edges)[3] = malloc((size_t)final_triangle_count * 3 / 2 * sizeof(edges[0]));
+
+    sphere->vertices = malloc((size_t)final_vertex_count * sizeof(sphere->vertices[0]));
+    sphere->triangles = malloc((size_t)final_triangle_count * sizeof(sphere->triangles[0]));
+
+    if (!edges || !sphere->vertices || !sphere->triangles) {
+        free(edges);
+        free_icosphere(sphere);
         return 1;
     }
-    rc = fread(fs_text, sizeof(char), fs_size, fs_fp);
-    if (rc != fs_size) {
-        log__write(log_handle, LOG_WARNING, "FRAGMENT SHADER READ: read %i bytes\n\n%s\n", rc, fs_text);
+
+    sphere->vertex_count = 12;
+    sphere->triangle_count = 20;
+
+    for (int v = 0; v < 12; ++v) {
+        const GLfloat length = sqrtf(corners[v][0] * corners[v][0] + corners[v][1] * corners[v][1] + corners[v][2] * corners[v][2]);
+        for (int axis = 0; axis < 3; ++axis)
+            sphere->vertices[v][axis] = corners[v][axis] / length;
+    }
+
+    for (int f = 0; f < 20; ++f)
+        for (int corner = 0; corner < 3; ++corner)
+            sphere->triangles[f][corner] = faces[f][corner];
+
+    for (unsigned int level = 0; level < subdivisions; ++level) {
+
+        const int old_count = sphere->triangle_count;
+        int edge_count = 0;
+
+        /* In place from the back, triangle f becomes 4f to 4f + 3 after every lower one has been read */
+        for (int f = old_count - 1; f >= 0; --f) {
+
+            const GLushort a = sphere->triangles[f][0];
+            const GLushort b = sphere->triangles[f][1];
+            const GLushort c = sphere->triangles[f][2];
+            const GLushort ab = midpoint(sphere, edges, &edge_count, a, b);
+            const GLushort bc = midpoint(sphere, edges, &edge_count, b, c);
+            const GLushort ca = midpoint(sphere, edges, &edge_count, c, a);
+
+            GLushort (*out)[3] = sphere->triangles + 4 * f;
+
+            out[0][0] = a;  out[0][1] = ab; out[0][2] = ca;
+            out[1][0] = b;  out[1][1] = bc; out[1][2] = ab;
+            out[2][0] = c;  out[2][1] = ca; out[2][2] = bc;
+            out[3][0] = ab; out[3][1] = bc; out[3][2] = ca;
+        }
+
+        sphere->triangle_count = 4 * old_count;
+    }
+
+    free(edges);
+
+    return 0;
+}
+
+void free_icosphere(struct icosphere *sphere)
+{
+    free(sphere->vertices);
+    free(sphere->triangles);
+    sphere->vertices = NULL;
+    sphere->triangles = NULL;
+}
+
+
+/* Private function definitions */
+
+static int link_program(async_log_t *async_log, GLuint *program, const char *name, const char *vs_source, const char *fs_source,
+                        const int retrievable)
+{
+    const GLuint vertex_shader = compile_shader(async_log, GL_VERTEX_SHADER, name, vs_source);
+    const GLuint fragment_shader = compile_shader(async_log, GL_FRAGMENT_SHADER, name, fs_source);
+    GLint linked = GL_FALSE;
+
+
+    if (!vertex_shader || !fragment_shader) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
         return 1;
     }
 
-    fclose(vs_fp);
-    fclose(fs_fp);
-
-    vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, (const GLchar * const*)&vs_text, NULL);
-    glCompileShader(vertex_shader);
- 
-    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, (const GLchar * const*)&fs_text, NULL);
-    glCompileShader(fragment_shader);
- 
     *program = glCreateProgram();
     glAttachShader(*program, vertex_shader);
     glAttachShader(*program, fragment_shader);
+
+    /* Some drivers only keep the binary around when asked to before linking */
+    if (retrievable)
+        glProgramParameteri(*program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
     glLinkProgram(*program);
 
-    free(vs_text);
-    free(fs_text);
+    /* The program keeps what it needs */
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    glGetProgramiv(*program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char info[INFO_LOG_SIZE];
+        char heading[128];
+
+        glGetProgramInfoLog(*program, INFO_LOG_SIZE, NULL, info);
+        snprintf(heading, sizeof(heading), "LINKING %s:", name);
+        log_info(async_log, heading, info);
+        glDeleteProgram(*program);
+        *program = 0;
+        return 1;
+    }
 
     return 0;
 }
 
-void vertex_buffer_init(GLuint *VBO, const struct vertex *vertices, const int v_size)
+/* @return the shader, 0 on failure */
+static GLuint compile_shader(async_log_t *async_log, const GLenum type, const char *name, const char *source)
 {
-    glGenBuffers(1, VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, *VBO);
-    glBufferData(GL_ARRAY_BUFFER, v_size, vertices, GL_STATIC_DRAW);
+    GLint compiled = GL_FALSE;
+    const GLuint shader = glCreateShader(type);
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char info[INFO_LOG_SIZE];
+        char heading[128];
+
+        glGetShaderInfoLog(shader, INFO_LOG_SIZE, NULL, info);
+        snprintf(heading, sizeof(heading), "COMPILING %s %s SHADER:", name, type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT");
+        log_info(async_log, heading, info);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
 }
 
-void vertex_buffer_draw(const GLuint VBO, const struct draw_variables draw_vars)
+/* One message per line of the info log, a whole log may not fit in one */
+static void log_info(async_log_t *async_log, const char *heading, const char *info)
 {
-    mat4x4 m, p, mvp;
+    async_log__write(async_log, LOG_ERROR, "%s", heading);
 
-    mat4x4_translate(m, draw_vars.pos.i, draw_vars.pos.j, draw_vars.pos.k);
-    /* Angles need to be "unscaled" */
-    mat4x4_rotate_X(m, m, draw_vars.angle.i/draw_vars.view_scalar);
-    mat4x4_rotate_Y(m, m, draw_vars.angle.j/draw_vars.view_scalar);
-    mat4x4_rotate_Z(m, m, draw_vars.angle.k/draw_vars.view_scalar);
-    mat4x4_scale(m, m, draw_vars.view_scalar);
-    mat4x4_ortho(p, -draw_vars.ratio, draw_vars.ratio, -1.f, 1.f, 1.f, -1.f);
-    mat4x4_mul(mvp, p, m);
+    while (*info) {
+        const size_t length = strcspn(info, "\n");
+
+        if (length)
+            async_log__write(async_log, LOG_ERROR, "%.*s", (int)length, info);
+
+        info += length + (info[length] == '\n');
+    }
+}
 
+/* Contexts older than 4.1 without ARB_get_program_binary leave the count at 0 */
+static int binary_cache_usable(void)
+{
+    GLint format_count = 0;
+
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    glGetError();
+
+    return format_count > 0;
+}
+
+/* FNV-1a, the terminating null included so "ab" "c" and "a" "bc" differ */
+static uint64_t hash_string(uint64_t hash, const char *text)
+{
+    if (!text)
+        text = "";
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    /**
-     * These attributes need to be reassociated with the currently bound vertex buffer object for the shader
-     * to properly set the variables.
-     */
-    glEnableVertexAttribArray((GLuint)draw_vars.shader_vars.vpos_location);
-    glVertexAttribPointer((GLuint)draw_vars.shader_vars.vpos_location, 3, GL_DOUBLE, GL_FALSE, sizeof(struct vertex), (void*) 0);
-    glEnableVertexAttribArray((GLuint)draw_vars.shader_vars.vcol_location);
-    glVertexAttribPointer((GLuint)draw_vars.shader_vars.vcol_location, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*) (sizeof(double) * 3));
+    do {
+        hash = (hash ^ (unsigned char)*text) * FNV_PRIME;
+    } while (*text++);
 
-    glUniformMatrix4fv(draw_vars.shader_vars.mvp_location, 1, GL_FALSE, (const GLfloat*)mvp);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, draw_vars.num_segments);
+    return hash;
 }
 
-void create_circle_vertex_array(struct vertex *v, const vector2d_t center, const double r, const int num_segments, const color_t color)
+/* A binary is only valid for the driver that made it, a driver update changes the version string */
+static uint64_t program_key(const char *vs_source, const char *fs_source)
 {
-    for(int a = 0; a < num_segments; ++a) {
-        const double theta = 2.0f * PI * a / num_segments;
+    uint64_t key = FNV_OFFSET_BASIS;
 
-        const double x = r * cos(theta);
-        const double y = r * sin(theta);
+    key = hash_string(key, (const char*)glGetString(GL_VENDOR));
+    key = hash_string(key, (const char*)glGetString(GL_RENDERER));
+    key = hash_string(key, (const char*)glGetString(GL_VERSION));
+    key = hash_string(key, vs_source);
+    key = hash_string(key, fs_source);
 
-        v[a].pos.i = x + center.i;
-        v[a].pos.j = y + center.j;
-        v[a].color = color;
+    return key;
+}
+
+/* @return 0 if the program was loaded, 1 if there is no usable cache file */
+static int load_cached_program(async_log_t *async_log, GLuint *program, const char *filepath, const uint64_t key)
+{
+    FILE *fp = fopen(filepath, "rb");
+    struct cache_header header;
+    void *binary = NULL;
+    GLint linked = GL_FALSE;
+
+    if (!fp)
+        return 1;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) ||
+        header.key != key || !(binary = malloc(header.length)) || fread(binary, 1, header.length, fp) != header.length) {
+        free(binary);
+        fclose(fp);
+        return 1;
     }
+
+    fclose(fp);
+
+    *program = glCreateProgram();
+    glProgramBinary(*program, header.format, binary, (GLsizei)header.length);
+    free(binary);
+
+    /* A driver may still turn down its own binary, then it is built from source again */
+    glGetProgramiv(*program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        async_log__write(async_log, LOG_WARNING, "SHADER CACHE: %s was rejected by the driver", filepath);
+        glDeleteProgram(*program);
+        *program = 0;
+        return 1;
+    }
+
+    return 0;
 }
 
-void create_sphere_vertex_array(struct vertex *v, const vector3d_t center, const double r, const int num_y_segments, const int num_z_segments, const color_t color)
+/* @return 0 on success, 1 if the driver gave no binary or the file could not be written */
+static int store_program(const GLuint program, const char *filepath, const uint64_t key)
 {
-    v[0].pos.i = 0 + center.i;
-    v[0].pos.j = 0 + center.j;
-    v[0].pos.k = r + center.k;
-    v[0].color = color;
+    struct cache_header header = {.key = key};
+    GLint length = 0;
+    GLenum format;
+    void *binary;
+    FILE *fp;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !(binary = malloc((size_t)length)))
+        return 1;
 
-    for (int a = 0; a < num_z_segments; ++a) {
+    glGetProgramBinary(program, length, &length, &format, binary);
 
-        const double phi = PI * (a+1) / num_z_segments;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.format = format;
+    header.length = (uint32_t)length;
 
-        for(int b = 0; b < num_y_segments; ++b) {
+    /* Failing because it already exists is fine */
+    #ifdef _WIN32
+    _mkdir(SHADER_CACHE_DIRECTORY);
+    #else
+    mkdir(SHADER_CACHE_DIRECTORY, 0777);
+    #endif
 
-            const int index = (num_z_segments * a) + b + 1;
+    if (!(fp = fopen(filepath, "wb"))) {
+        free(binary);
+        return 1;
+    }
 
-            const double theta = 2.0 * PI * b / num_y_segments;
+    int failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+    failed |= fwrite(binary, 1, header.length, fp) != header.length;
+    failed |= fclose(fp) != 0;
+    free(binary);
 
-            const double x = r * cos(theta) * sin(phi);
-            const double y = r * sin(theta) * sin(phi);
-            const double z = r * cos(phi);
-            
-            v[index].pos.i = x + center.i;
-            v[index].pos.j = y + center.j;
-            v[index].pos.k = z + center.k;
-            if (!(a % 2))
-                v[index].color = (color_t){1,1,1};
-            else
-                v[index].color = color;
-        }
+    /* Half a file would only be turned down on every start */
+    if (failed)
+        remove(filepath);
+
+    return failed;
+}
+
+/* Shared edges get one midpoint, pushed out onto the unit sphere */
+static GLushort midpoint(struct icosphere *sphere, GLushort (*edges)[3], int *edge_count, const GLushort a, const GLushort b)
+{
+    const GLushort low = a < b ? a : b;
+    const GLushort high = a < b ? b : a;
+
+    for (int e = 0; e < *edge_count; ++e)
+        if (edges[e][0] == low && edges[e][1] == high)
+            return edges[e][2];
+
+    const GLushort m = (GLushort)sphere->vertex_count++;
+    GLfloat length = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        sphere->vertices[m][axis] = (sphere->vertices[a][axis] + sphere->vertices[b][axis]) / 2;
+        length += sphere->vertices[m][axis] * sphere->vertices[m][axis];
     }
 
-    v[num_z_segments*num_y_segments+1].pos.i = 0 + center.i;
-    v[num_z_segments*num_y_segments+1].pos.j = 0 + center.j;
-    v[num_z_segments*num_y_segments+1].pos.k = -r + center.k;
-    v[num_z_segments*num_y_segments+1].color = color;
+    length = sqrtf(length);
+    for (int axis = 0; axis < 3; ++axis)
+        sphere->vertices[m][axis] /= length;
+
+    edges[*edge_count][0] = low;
+    edges[*edge_count][1] = high;
+    edges[*edge_count][2] = m;
+    ++*edge_count;
 
+    return m;
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "async_log.h"
+
+
+/* Comment out to compile every timer away, the macros below then expand to nothing */
+#define __USE_INSTRUMENTATION
+
+#define INSTRUMENTATION_SUB_BUCKET_BITS     7   // exact below 2^7 ns, then 2^6 linear buckets per power of two, under 1.6% error
+#define INSTRUMENTATION_MAX_MAGNITUDE       40  // longer durations, about 18 minutes, go in the last bucket
+#define INSTRUMENTATION_BUCKET_COUNT        ((1 << INSTRUMENTATION_SUB_BUCKET_BITS) + \
+                                             (INSTRUMENTATION_MAX_MAGNITUDE - INSTRUMENTATION_SUB_BUCKET_BITS) * \
+                                             (1 << (INSTRUMENTATION_SUB_BUCKET_BITS - 1)))
+
+
+/* Phases of a step and of a rendered frame */
+typedef enum
+{
+    TIMER_STEP,             // a whole time_evolution() or time_evolution_soa() call
+    TIMER_FORCES,
+    TIMER_INTEGRATION,
+    TIMER_COLLISIONS,
+    TIMER_LOGGING,          // per-particle text lines
+    TIMER_TRAJECTORY,       // trajectory__write_frame()
+    TIMER_RENDER_DRAW,
+    TIMER_RENDER_SWAP,      // includes waiting for vsync
+    TIMER_RENDER_EVENTS,
+    TIMER_RENDER_READBACK,  // queuing a captured frame and writing out the oldest one
+    TIMER_FRAME,            // a whole pass of the render loop
+
+    TIMER_COUNT
+
+} timer_id_t;
+
+/* Distribution of the durations recorded for one timer, in nanoseconds */
+typedef struct
+{
+    unsigned long long int count;
+    double total;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+
+} instrumentation_summary_t;
+
+typedef struct
+{
+    timer_id_t timer;
+    uint64_t start;
+
+} instrumentation_scope_t;
+
+
+/**
+ * Durations are kept in log-linear histograms, one set per thread so
+ * recording never contends: exact below 2^7 ns, then 64 buckets per
+ * power of two.  A thread's histograms are allocated the first time it
+ * records and are only ever written by it.  Reports and exports add up
+ * every thread's histograms.
+ */
+
+/* Monotonic clock in nanoseconds */
+uint64_t instrumentation__now(void);
+void instrumentation__record(const timer_id_t timer, const uint64_t nanoseconds);
+
+const char *instrumentation__timer_name(const timer_id_t timer);
+instrumentation_summary_t instrumentation__summary(const timer_id_t timer);
+
+/**
+ * Logs one LOG_STATUS line per timer with what was recorded since the
+ * previous report, timers without new samples are left out.
+ */
+void instrumentation__report(async_log_t *log);
+
+/**
+ * Writes the summary and the non-empty buckets of every timer since
+ * the start as JSON.
+ *
+ * @return 0 on success, 1 if the file could not be written
+ */
+int instrumentation__export(const char *filepath);
+
+/* Clears every histogram, only while no other thread is recording */
+void instrumentation__reset(void);
+
+static inline instrumentation_scope_t instrumentation__scope_begin(const timer_id_t timer)
+{
+    return (instrumentation_scope_t){timer, instrumentation__now()};
+}
+
+static inline void instrumentation__scope_end(const instrumentation_scope_t *scope)
+{
+    instrumentation__record(scope->timer, instrumentation__now() - scope->start);
+}
+
+
+#define INSTRUMENTATION_CONCAT_(a, b)   a##b
+#define INSTRUMENTATION_CONCAT(a, b)    INSTRUMENTATION_CONCAT_(a, b)
+
+/**
+ * Times the rest of the enclosing block, however it is left.  Relies
+ * on the cleanup attribute of GCC and Clang.
+ */
+#ifdef __USE_INSTRUMENTATION
+#define INSTRUMENT_SCOPE(timer)                                                 \
+    __attribute__((cleanup(instrumentation__scope_end)))                        \
+    const instrumentation_scope_t INSTRUMENTATION_CONCAT(instrumentation_scope_, __LINE__) = \
+        instrumentation__scope_begin(timer)
+#else
+#define INSTRUMENT_SCOPE(timer)     ((void)0)
+#endif
@@ -0,0 +1,336 @@
+#include "instrumentation.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+#define SUB_BUCKET_COUNT        (1 << INSTRUMENTATION_SUB_BUCKET_BITS)
+#define HALF_SUB_BUCKET_COUNT   (SUB_BUCKET_COUNT / 2)
+#define MAX_TRACKABLE           ((1ULL << INSTRUMENTATION_MAX_MAGNITUDE) - 1)
+
+
+/**
+ * One thread's histograms.  Only the owner writes, with relaxed loads
+ * and stores rather than read-modify-write instructions, so recording
+ * costs plain adds and readers on other threads still see whole values.
+ */
+typedef struct thread_histograms
+{
+    _Atomic uint64_t counts[TIMER_COUNT][INSTRUMENTATION_BUCKET_COUNT];
+    _Atomic uint64_t total[TIMER_COUNT];
+    _Atomic uint64_t max[TIMER_COUNT];
+    struct thread_histograms *next;
+
+} thread_histograms_t;
+
+/* Every thread's histograms added up */
+typedef struct
+{
+    uint64_t counts[TIMER_COUNT][INSTRUMENTATION_BUCKET_COUNT];
+    uint64_t total[TIMER_COUNT];
+    uint64_t max[TIMER_COUNT];
+
+} histograms_t;
+
+static const char *const timer_names[TIMER_COUNT] = {
+    "step",
+    "forces",
+    "integration",
+    "collisions",
+    "logging",
+    "trajectory",
+    "render_draw",
+    "render_swap",
+    "render_events",
+    "render_readback",
+    "frame",
+};
+
+static _Thread_local thread_histograms_t *local_histograms;
+static _Atomic(thread_histograms_t *) all_histograms;
+
+/* Totals at the last report, so reports cover the time in between */
+static histograms_t *reported;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Private function declarations */
+static thread_histograms_t *register_thread(void);
+static void add_relaxed(_Atomic uint64_t *counter, const uint64_t value);
+static size_t bucket_index(uint64_t nanoseconds);
+static uint64_t bucket_lower(const size_t index);
+static uint64_t bucket_width(const size_t index);
+static void merge(histograms_t *merged);
+static instrumentation_summary_t summarize(const uint64_t *counts, const uint64_t total, const uint64_t max);
+static double percentile(const uint64_t *counts, const unsigned long long int count, const double fraction);
+static void subtract(histograms_t *now, const histograms_t *before, const timer_id_t timer);
+
+/* Public function definitions */
+uint64_t instrumentation__now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void instrumentation__record(const timer_id_t timer, const uint64_t nanoseconds)
+{
+    thread_histograms_t *histograms = local_histograms ? local_histograms : register_thread();
+
+    if (!histograms)
+        return;
+
+    add_relaxed(&histograms->counts[timer][bucket_index(nanoseconds)], 1);
+    add_relaxed(&histograms->total[timer], nanoseconds);
+
+    if (nanoseconds > atomic_load_explicit(&histograms->max[timer], memory_order_relaxed))
+        atomic_store_explicit(&histograms->max[timer], nanoseconds, memory_order_relaxed);
+}
+
+const char *instrumentation__timer_name(const timer_id_t timer)
+{
+    return timer < TIMER_COUNT ? timer_names[timer] : "unknown";
+}
+
+instrumentation_summary_t instrumentation__summary(const timer_id_t timer)
+{
+    histograms_t *merged = malloc(sizeof(histograms_t));
+    instrumentation_summary_t summary = {0};
+
+    if (!merged)
+        return summary;
+
+    merge(merged);
+    summary = summarize(merged->counts[timer], merged->total[timer], merged->max[timer]);
+    free(merged);
+
+    return summary;
+}
+
+void instrumentation__report(async_log_t *log)
+{
+    histograms_t *merged = malloc(sizeof(histograms_t));
+
+    pthread_mutex_lock(&report_lock);
+
+    if (!reported)
+        reported = calloc(1, sizeof(histograms_t));
+
+    if (merged && reported) {
+
+        merge(merged);
+
+        for (timer_id_t timer = 0; timer < TIMER_COUNT; ++timer) {
+
+            /* Only totals are kept per report, so the interval max is the max so far */
+            subtract(merged, reported, timer);
+            const instrumentation_summary_t s = summarize(merged->counts[timer], merged->total[timer], merged->max[timer]);
+
+            if (!s.count)
+                continue;
+
+            async_log__write(log, LOG_STATUS, "%-13s %8llu samples, mean %.3f us, p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us",
+                             timer_names[timer], s.count, s.mean / 1E3, s.p50 / 1E3, s.p99 / 1E3, s.p999 / 1E3, s.max / 1E3);
+        }
+
+        merge(reported);
+    }
+
+    pthread_mutex_unlock(&report_lock);
+    free(merged);
+}
+
+int instrumentation__export(const char *filepath)
+{
+    histograms_t *merged = malloc(sizeof(histograms_t));
+    FILE *file = merged ? fopen(filepath, "w") : NULL;
+
+    if (!file) {
+        free(merged);
+        return 1;
+    }
+
+    merge(merged);
+
+    fprintf(file, "{\n  \"unit\": \"ns\",\n  \"timers\": [");
+
+    for (timer_id_t timer = 0; timer < TIMER_COUNT; ++timer) {
+
+        const instrumentation_summary_t s = summarize(merged->counts[timer], merged->total[timer], merged->max[timer]);
+        int first = 1;
+
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"count\": %llu, \"total\": %.0f, \"mean\": %.1f, "
+                      "\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f,\n     \"buckets\": [",
+                timer ? "," : "", timer_names[timer], s.count, s.total, s.mean, s.p50, s.p90, s.p99, s.p999, s.max);
+
+        /* [lowest value, count] of every bucket something landed in */
+        for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b) {
+            if (merged->counts[timer][b]) {
+                fprintf(file, "%s[%llu, %llu]", first ? "" : ", ",
+                        (unsigned long long int)bucket_lower(b), (unsigned long long int)merged->counts[timer][b]);
+                first = 0;
+            }
+        }
+
+        fprintf(file, "]}");
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+
+    const int failed = ferror(file) != 0;
+
+    free(merged);
+
+    return fclose(file) != 0 || failed;
+}
+
+void instrumentation__reset(void)
+{
+    pthread_mutex_lock(&report_lock);
+
+    for (thread_histograms_t *h = atomic_load(&all_histograms); h; h = h->next) {
+        for (timer_id_t timer = 0; timer < TIMER_COUNT; ++timer) {
+            for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b)
+                atomic_store_explicit(&h->counts[timer][b], 0, memory_order_relaxed);
+            atomic_store_explicit(&h->total[timer], 0, memory_order_relaxed);
+            atomic_store_explicit(&h->max[timer], 0, memory_order_relaxed);
+        }
+    }
+
+    free(reported);
+    reported = NULL;
+
+    pthread_mutex_unlock(&report_lock);
+}
+
+/* Private function definitions */
+
+/* Histograms stay allocated after their thread ends, its samples still count */
+static thread_histograms_t *register_thread(void)
+{
+    thread_histograms_t *histograms = calloc(1, sizeof(thread_histograms_t));
+
+    if (!histograms)
+        return NULL;
+
+    histograms->next = atomic_load_explicit(&all_histograms, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&all_histograms, &histograms->next, histograms,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+
+    local_histograms = histograms;
+
+    return histograms;
+}
+
+static void add_relaxed(_Atomic uint64_t *counter, const uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/* Exact below SUB_BUCKET_COUNT, then HALF_SUB_BUCKET_COUNT buckets per power of two */
+static size_t bucket_index(uint64_t nanoseconds)
+{
+    if (nanoseconds < SUB_BUCKET_COUNT)
+        return (size_t)nanoseconds;
+
+    if (nanoseconds > MAX_TRACKABLE)
+        nanoseconds = MAX_TRACKABLE;
+
+    const unsigned int magnitude = 63 - (unsigned int)__builtin_clzll(nanoseconds);
+    const unsigned int shift = magnitude - (INSTRUMENTATION_SUB_BUCKET_BITS - 1);
+
+    return SUB_BUCKET_COUNT + (shift - 1) * HALF_SUB_BUCKET_COUNT + (size_t)(nanoseconds >> shift) - HALF_SUB_BUCKET_COUNT;
+}
+
+static uint64_t bucket_lower(const size_t index)
+{
+    if (index < SUB_BUCKET_COUNT)
+        return index;
+
+    const size_t shift = (index - SUB_BUCKET_COUNT) / HALF_SUB_BUCKET_COUNT + 1;
+
+    return (uint64_t)(HALF_SUB_BUCKET_COUNT + (index - SUB_BUCKET_COUNT) % HALF_SUB_BUCKET_COUNT) << shift;
+}
+
+static uint64_t bucket_width(const size_t index)
+{
+    return index < SUB_BUCKET_COUNT ? 1 : 1ULL << ((index - SUB_BUCKET_COUNT) / HALF_SUB_BUCKET_COUNT + 1);
+}
+
+static void merge(histograms_t *merged)
+{
+    memset(merged, 0, sizeof(histograms_t));
+
+    for (thread_histograms_t *h = atomic_load_explicit(&all_histograms, memory_order_acquire); h; h = h->next) {
+        for (timer_id_t timer = 0; timer < TIMER_COUNT; ++timer) {
+
+            for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b)
+                merged->counts[timer][b] += atomic_load_explicit(&h->counts[timer][b], memory_order_relaxed);
+
+            merged->total[timer] += atomic_load_explicit(&h->total[timer], memory_order_relaxed);
+
+            const uint64_t max = atomic_load_explicit(&h->max[timer], memory_order_relaxed);
+            if (max > merged->max[timer])
+                merged->max[timer] = max;
+        }
+    }
+}
+
+static instrumentation_summary_t summarize(const uint64_t *counts, const uint64_t total, const uint64_t max)
+{
+    instrumentation_summary_t summary = {.total = (double)total, .max = (double)max};
+
+    for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b)
+        summary.count += counts[b];
+
+    if (!summary.count)
+        return summary;
+
+    summary.mean = summary.total / (double)summary.count;
+    summary.p50 = percentile(counts, summary.count, 0.5);
+    summary.p90 = percentile(counts, summary.count, 0.9);
+    summary.p99 = percentile(counts, summary.count, 0.99);
+    summary.p999 = percentile(counts, summary.count, 0.999);
+
+    /* A bucket's midpoint can lie past the largest value in it */
+    if (summary.p999 > summary.max && summary.max > 0) {
+        summary.p50 = summary.p50 < summary.max ? summary.p50 : summary.max;
+        summary.p90 = summary.p90 < summary.max ? summary.p90 : summary.max;
+        summary.p99 = summary.p99 < summary.max ? summary.p99 : summary.max;
+        summary.p999 = summary.max;
+    }
+
+    return summary;
+}
+
+/* Midpoint of the bucket holding the sample of nearest rank fraction * count */
+static double percentile(const uint64_t *counts, const unsigned long long int count, const double fraction)
+{
+    unsigned long long int rank = (unsigned long long int)(fraction * (double)count + 0.5);
+    unsigned long long int seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+
+    for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b) {
+        seen += counts[b];
+        if (seen >= rank)
+            return (double)bucket_lower(b) + (double)(bucket_width(b) - 1) / 2;
+    }
+
+    return 0;
+}
+
+static void subtract(histograms_t *now, const histograms_t *before, const timer_id_t timer)
+{
+    for (size_t b = 0; b < INSTRUMENTATION_BUCKET_COUNT; ++b)
+        now->counts[timer][b] -= before->counts[timer][b];
+
+    now->total[timer] -= before->total[timer];
+}
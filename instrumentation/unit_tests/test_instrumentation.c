@@ -0,0 +1,147 @@
+#include "instrumentation.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+
+#define TEST_FILEPATH       "test_instrumentation.json"
+#define THREAD_COUNT        4
+#define SAMPLES_PER_THREAD  10000
+
+
+static void *recorder(void *arg)
+{
+    const uint64_t offset = *(const uint64_t *)arg;
+
+    for (uint64_t n = 1; n <= SAMPLES_PER_THREAD; ++n)
+        instrumentation__record(TIMER_COLLISIONS, n * 1000 + offset);
+
+    return NULL;
+}
+
+static void timed_scope(void)
+{
+    INSTRUMENT_SCOPE(TIMER_LOGGING);
+
+    const uint64_t start = instrumentation__now();
+    while (instrumentation__now() - start < 200000)
+        ;
+}
+
+
+void setUp(void)
+{
+    instrumentation__reset();
+}
+
+void tearDown(void)
+{
+    remove(TEST_FILEPATH);
+}
+
+void test_small_durations_are_exact(void)
+{
+    for (uint64_t n = 0; n < 100; ++n)
+        instrumentation__record(TIMER_FORCES, n);
+
+    const instrumentation_summary_t summary = instrumentation__summary(TIMER_FORCES);
+
+    TEST_ASSERT_EQUAL(100, summary.count);
+    TEST_ASSERT_EQUAL_DOUBLE(4950, summary.total);
+    TEST_ASSERT_EQUAL_DOUBLE(49, summary.p50);
+    TEST_ASSERT_EQUAL_DOUBLE(98, summary.p99);
+    TEST_ASSERT_EQUAL_DOUBLE(99, summary.max);
+}
+
+void test_percentiles_within_bucket_error(void)
+{
+    /* 1 us to 10 ms, evenly spread */
+    for (uint64_t n = 1; n <= 10000; ++n)
+        instrumentation__record(TIMER_STEP, n * 1000);
+
+    const instrumentation_summary_t summary = instrumentation__summary(TIMER_STEP);
+
+    TEST_ASSERT_EQUAL(10000, summary.count);
+    TEST_ASSERT_DOUBLE_WITHIN(5E6 * 0.016, 5E6, summary.p50);
+    TEST_ASSERT_DOUBLE_WITHIN(9E6 * 0.016, 9E6, summary.p90);
+    TEST_ASSERT_DOUBLE_WITHIN(9.9E6 * 0.016, 9.9E6, summary.p99);
+    TEST_ASSERT_DOUBLE_WITHIN(1, 5000500, summary.mean);
+    TEST_ASSERT_EQUAL_DOUBLE(1E7, summary.max);
+    TEST_ASSERT_TRUE(summary.p999 <= summary.max);
+}
+
+void test_huge_durations_are_clamped(void)
+{
+    instrumentation__record(TIMER_FRAME, UINT64_MAX / 2);
+
+    const instrumentation_summary_t summary = instrumentation__summary(TIMER_FRAME);
+
+    TEST_ASSERT_EQUAL(1, summary.count);
+    TEST_ASSERT_TRUE(summary.p50 > 1E12);
+}
+
+void test_threads_are_merged(void)
+{
+    pthread_t threads[THREAD_COUNT];
+    uint64_t offsets[THREAD_COUNT];
+
+    for (size_t t = 0; t < THREAD_COUNT; ++t) {
+        offsets[t] = t;
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[t], NULL, recorder, &offsets[t]));
+    }
+
+    for (size_t t = 0; t < THREAD_COUNT; ++t)
+        pthread_join(threads[t], NULL);
+
+    const instrumentation_summary_t summary = instrumentation__summary(TIMER_COLLISIONS);
+
+    TEST_ASSERT_EQUAL(THREAD_COUNT * SAMPLES_PER_THREAD, summary.count);
+    TEST_ASSERT_EQUAL_DOUBLE(1E7 + THREAD_COUNT - 1, summary.max);
+    TEST_ASSERT_DOUBLE_WITHIN(5E6 * 0.016, 5E6, summary.p50);
+}
+
+void test_scope_records_on_exit(void)
+{
+    timed_scope();
+    timed_scope();
+
+    const instrumentation_summary_t summary = instrumentation__summary(TIMER_LOGGING);
+
+#ifdef __USE_INSTRUMENTATION
+    TEST_ASSERT_EQUAL(2, summary.count);
+    TEST_ASSERT_TRUE(summary.total >= 400000);
+#else
+    TEST_ASSERT_EQUAL(0, summary.count);
+#endif
+}
+
+void test_export(void)
+{
+    instrumentation__record(TIMER_RENDER_DRAW, 42);
+    instrumentation__record(TIMER_RENDER_DRAW, 1000000);
+
+    TEST_ASSERT_EQUAL(0, instrumentation__export(TEST_FILEPATH));
+
+    FILE *file = fopen(TEST_FILEPATH, "r");
+    char contents[65536] = {0};
+
+    TEST_ASSERT_NOT_NULL(file);
+    fread(contents, 1, sizeof(contents) - 1, file);
+    fclose(file);
+
+    TEST_ASSERT_NOT_NULL(strstr(contents, "\"name\": \"render_draw\", \"count\": 2,"));
+    TEST_ASSERT_NOT_NULL(strstr(contents, "[42, 1], [999424, 1]"));
+    TEST_ASSERT_NOT_NULL(strstr(contents, "\"name\": \"frame\", \"count\": 0,"));
+
+    TEST_ASSERT_EQUAL(1, instrumentation__export("no_such_directory/timings.json"));
+}
+
+void test_timer_names(void)
+{
+    TEST_ASSERT_EQUAL_STRING("step", instrumentation__timer_name(TIMER_STEP));
+    TEST_ASSERT_EQUAL_STRING("frame", instrumentation__timer_name(TIMER_FRAME));
+    TEST_ASSERT_EQUAL_STRING("unknown", instrumentation__timer_name(TIMER_COUNT));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+#define BARNES_HUT_LEAF_CAPACITY    8
+#define BARNES_HUT_MAX_DEPTH        32
+
+
+/**
+ * Octree over the particle positions.  Every node stores the total
+ * positive charge, negative charge and mass beneath it, each at its
+ * own centre.  Positive and negative charges are kept apart so a
+ * neutral cluster does not collapse into a monopole of zero charge
+ * at an undefined centre.
+ */
+typedef struct barnes_hut barnes_hut_t;
+
+
+barnes_hut_t *barnes_hut__new(void);
+void barnes_hut__delete(barnes_hut_t *tree);
+
+/**
+ * Rebuilds the tree from the current particle positions.  Must be
+ * called whenever positions change before querying forces.
+ *
+ * @return 0 on success, 1 on allocation failure
+ */
+int barnes_hut__build(barnes_hut_t *tree, const particle_system_t *system);
+
+/**
+ * Resultant force on particle "this" from every other particle.
+ * A node is treated as a point source when its width divided by
+ * the distance to it is below the opening angle theta, so theta = 0
+ * degenerates into the direct sum.
+ *
+ * In a periodic box every node is taken at the image of its centre
+ * nearest to "this", and every particle in an opened leaf at its own
+ * nearest image, the minimum image convention of the direct sum.
+ *
+ * @param theta Opening angle, typically 0.3 to 1.0
+ * @param periodic_box Side lengths of a periodic box centred on the origin, zero for open axes
+ */
+vector3d_t barnes_hut__force(const barnes_hut_t *tree, const particle_system_t *system, const size_t this, const double theta,
+                             const vector3d_t periodic_box);
+
+size_t barnes_hut__node_count(const barnes_hut_t *tree);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+#define DEFAULT_BLOCK_MAX_LEVEL     10
+#define DEFAULT_BLOCK_ACCURACY      0.025
+#define MAX_BLOCK_LEVEL             30
+
+
+/**
+ * Hierarchical power-of-two timesteps.  A step of length T is split
+ * into 2^max_level substeps and a particle on level l steps every
+ * 2^(max_level - l) substeps, a period of T / 2^l.  Each particle step
+ * is a kick-drift-kick leapfrog step: half kick at its start, drift
+ * with everyone else every substep, forces and the closing half kick
+ * at its end.  Particles between the ends of their steps are only
+ * drifted, which predicts their positions for the active ones.
+ *
+ * Levels come from the time over which the force changes,
+ * |F| / |dF/dt|, estimated from the forces at the start and end of the
+ * particle's last step.  A particle may always move to a finer level
+ * and may move to a coarser one when the substep lines up with it.
+ */
+typedef struct
+{
+    size_t capacity;
+    unsigned int max_level;
+    unsigned char *level;
+    vector3d_array_t start_force;   // force at the start of each particle's current step
+
+    /* Particles whose steps start, or end, on the current substep */
+    size_t *starting;
+    size_t starting_count;
+    size_t *ending;
+    size_t ending_count;
+
+} block_timestep_t;
+
+
+/* @return 0 on success, 1 on allocation failure */
+int block_timestep__reserve(block_timestep_t *block, const size_t capacity);
+void block_timestep__free(block_timestep_t *block);
+
+/**
+ * Levels for the first step, from how long the current force takes
+ * to change the momentum by a fraction accuracy, |p| / |F|.
+ * system->force must hold the current forces.
+ */
+void block_timestep__initial_levels(block_timestep_t *block, const particle_system_t *system,
+                                    const double max_period, const double accuracy);
+
+/**
+ * Fills the starting and ending lists for the stretch of substeps
+ * from substep, in [0, 2^max_level), to the next end of a step on the
+ * finest occupied level.  Substeps in between have nothing to do.
+ *
+ * @return Number of substeps in the stretch
+ */
+unsigned long long int block_timestep__select(block_timestep_t *block, const size_t count, const unsigned long long int substep);
+
+/* Opening half kick of the starting particles */
+void block_timestep__begin_steps(block_timestep_t *block, particle_system_t *system, const double max_period);
+
+/**
+ * Closing half kick of the ending particles, whose forces must have
+ * just been evaluated, and their levels for the steps starting at
+ * end_substep.
+ */
+void block_timestep__end_steps(block_timestep_t *block, particle_system_t *system, const unsigned long long int end_substep,
+                               const double max_period, const double accuracy);
+
+double block_timestep__period(const block_timestep_t *block, const size_t n, const double max_period);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "particle_system.h"
+
+
+#define CHECKPOINT_MAGIC        "PSIMCKP"   // 8 bytes with the terminating zero
+#define CHECKPOINT_VERSION      3
+#define CHECKPOINT_ANY_COUNT    SIZE_MAX    // checkpoint__read() takes whatever particle count was saved
+
+
+/**
+ * Checkpoints hold every particle array, the time and step count, the
+ * sample period, the mechanics_settings_t in force and, for block
+ * timesteps, each particle's level.  Forces are saved too, so a
+ * restored run takes exactly the steps the original would have.
+ *
+ * The file is a fixed header followed by the raw arrays in host byte
+ * order and the reduced units of units.h, with a checksum over the
+ * arrays.  It is meant for restarting on the same kind of machine, not
+ * for exchange, see trajectory.h for that.
+ */
+
+/**
+ * Writes the checkpoint to filepath.tmp, syncs it and renames it over
+ * filepath, so filepath always holds either the old checkpoint or the
+ * new one, never a partial one.
+ *
+ * @return 0 on success, 1 if the checkpoint could not be written
+ */
+int checkpoint__write(const char *filepath, const particle_system_t *system, const double sample_period);
+
+/**
+ * Maps the checkpoint into memory, checks it and rebuilds the particle
+ * system from it.  The mechanics settings and block timestep levels
+ * are restored as a side effect, but only once the checkpoint has been
+ * accepted, a refused one leaves the running simulation as it was.
+ *
+ * @param particle_count Particles the caller can take, CHECKPOINT_ANY_COUNT for any number
+ * @param sample_period Set to the sample period of the saved run
+ * @return NULL if the file is missing, damaged, from another version or of another size
+ */
+particle_system_t *checkpoint__read(const char *filepath, const size_t particle_count, double *sample_period);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+/**
+ * Time integration schemes for time_evolution_soa().  The explicit
+ * and symplectic Euler steps and the Boris pusher use one force
+ * evaluation per step, velocity Verlet one once the forces of the
+ * previous step can be reused, RK4 four.  Block timesteps evaluate
+ * forces per particle as often as its own step needs.
+ */
+typedef enum
+{
+    INTEGRATOR_EXPLICIT_EULER,      // positions move with the momenta from before the kick
+    INTEGRATOR_SYMPLECTIC_EULER,    // kick then drift, what time_evolution() does
+    INTEGRATOR_VELOCITY_VERLET,     // half kick, drift, half kick, equivalent to leapfrog
+    INTEGRATOR_RK4,                 // classic fourth order Runge-Kutta, not symplectic
+    INTEGRATOR_BORIS,               // leapfrog with an exact rotation about a uniform magnetic field
+    INTEGRATOR_BLOCK_TIMESTEP,      // leapfrog with a power-of-two step per particle, see block_timestep.h
+
+} integrator_t;
+
+/* Start of step state and slope sums kept across the four RK4 stages */
+typedef struct
+{
+    size_t capacity;
+    vector3d_array_t pos0;
+    vector3d_array_t momenta0;
+    vector3d_array_t pos_slope;
+    vector3d_array_t momenta_slope;
+
+} rk4_workspace_t;
+
+
+/**
+ * Range kernels, each only touches particles [begin, end) so the
+ * caller can split a step over threads.
+ */
+
+/* momenta += force * dt */
+void integrator__kick(particle_system_t *system, const size_t begin, const size_t end, const double dt);
+
+/**
+ * pos += momenta / mass * dt, then wraps into the periodic box on axes
+ * with a positive length.
+ */
+void integrator__drift(particle_system_t *system, const size_t begin, const size_t end, const double dt,
+                       const vector3d_t periodic_box);
+
+/* orientation += angular_momenta / moment of inertia * dt */
+void integrator__spin(particle_system_t *system, const size_t begin, const size_t end, const double dt);
+
+/**
+ * Rotates the momenta about a uniform magnetic field by the angle
+ * q |B| dt / m, the middle of a Boris step.  The magnitude of each
+ * momentum is preserved exactly.
+ */
+void integrator__boris_rotate(particle_system_t *system, const size_t begin, const size_t end, const double dt,
+                              const vector3d_t magnetic_field);
+
+/* @return 0 on success, 1 if the workspace could not be allocated */
+int integrator__rk4_reserve(rk4_workspace_t *workspace, const size_t capacity);
+void integrator__rk4_free(rk4_workspace_t *workspace);
+
+/**
+ * One RK4 stage, stage 0 to 3, with system->force holding the forces
+ * at the current positions.  Stage 0 saves the start of step state.
+ * Stages 0 to 2 move the particles to the next stage point, stage 3
+ * to the end of the step.
+ */
+void integrator__rk4_stage(rk4_workspace_t *workspace, particle_system_t *system, const size_t begin, const size_t end,
+                           const double dt, const unsigned int stage, const vector3d_t periodic_box);
+
+const char *integrator_name(const integrator_t integrator);
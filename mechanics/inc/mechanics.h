@@ -2,10 +2,66 @@
 
 #include <stdlib.h>
 
+#include "async_log.h"
+#include "block_timestep.h"
+#include "integrator.h"
 #include "particle.h"
+#include "particle_mesh.h"
+#include "particle_system.h"
+#include "units.h"
 #include "vector.h"
 
 
+// #define __USE_GRAVITY
+
+/* Direct sum in single precision, see pair_kernel_float_t */
+// #define __USE_FLOAT_FORCES
+
+#if defined(__USE_FLOAT_FORCES) && defined(__USE_GRAVITY)
+#error "The gravity term is some 1E-36 of the Coulomb one in reduced units and underflows a float"
+#endif
+
+#define DEFAULT_OPENING_ANGLE       0.5
+
+
+typedef enum
+{
+    FORCE_SOLVER_DIRECT,        // All-pairs sum, O(N^2)
+    FORCE_SOLVER_BARNES_HUT,    // Octree with opening angle, O(N log N), nearest images in a periodic box
+    FORCE_SOLVER_PARTICLE_MESH, // FFT Poisson solve on a grid, needs a periodic box
+    FORCE_SOLVER_NEIGHBOUR_LIST,// Verlet lists within a cutoff, O(N neighbours), needs set_cutoff()
+
+} force_solver_t;
+
+/**
+ * Every setting that changes how a run evolves, what a checkpoint
+ * has to carry besides the particles themselves.
+ */
+typedef struct
+{
+    force_solver_t solver;
+    double opening_angle;
+    size_t mesh_size;
+    mesh_assignment_t mesh_assignment;
+    vector3d_t periodic_box;
+    integrator_t integrator;
+    vector3d_t magnetic_field;
+    unsigned int block_max_level;
+    double block_accuracy;
+    double cutoff;
+    double skin;
+
+} mechanics_settings_t;
+
+/* Deviation of a force solver from the direct sum, relative to the force magnitude */
+typedef struct
+{
+    double rms_relative;    // sqrt(sum |F - F_direct|^2 / sum |F_direct|^2)
+    double max_relative;    // largest |F - F_direct| / |F_direct| of a single particle
+
+} force_error_t;
+
+
 double gravitational_force(const double m1, const double m2, double r);
 double electric_force(const double q1, const double q2, double r);
 
@@ -27,3 +83,160 @@ vector3d_t componentize_force_3d(const double F, const vector3d_t direction_vect
  */
 void time_evolution(particle_t **particles, const size_t particle_count, const double sample_period);
 int detect_collision(const particle_t *this, const particle_t *that);
+
+/* Force on particles[this] from every other particle, the inner loop of time_evolution() */
+vector3d_t resultant_force_from_fields(particle_t **particles, const size_t particle_count, const size_t this);
+
+/**
+ * Same physics as time_evolution() on the structure-of-arrays store,
+ * split into phases.  Every force is evaluated from the positions at
+ * the start of the step, then all particles are integrated, then each
+ * colliding pair is resolved once.  system->time and
+ * system->step_count are advanced.
+ */
+void time_evolution_soa(particle_system_t *system, const double sample_period);
+
+/**
+ * Force backend used by time_evolution_soa().  Switching solvers
+ * mid-run is allowed, the next step picks up the new one.
+ */
+void set_force_solver(const force_solver_t solver);
+force_solver_t get_force_solver(void);
+void set_opening_angle(const double theta);
+void set_mesh(const size_t grid_size, const mesh_assignment_t assignment);
+
+/**
+ * Interaction range of FORCE_SOLVER_NEIGHBOUR_LIST.  Pairs further
+ * apart than radius do not interact and the force is shifted to reach
+ * zero there, see neighbour_list__force().  The lists cover radius +
+ * skin and are rebuilt once a particle has moved half the skin.  Until
+ * a positive radius is set the solver falls back to the direct sum.
+ */
+void set_cutoff(const double radius, const double skin);
+
+/* Times the neighbour lists were rebuilt since free_mechanics_workspace() last released them */
+unsigned long long int get_neighbour_list_builds(void);
+
+/* Releases the trees, grids, scratch lists and threads kept between steps */
+void free_mechanics_workspace(void);
+
+/**
+ * Threads time_evolution_soa() spreads the force, integration and
+ * collision search phases over, 0 for one per online processor, which
+ * is the default.  Each particle is always handled by a single thread,
+ * so the result does not depend on the thread count.
+ */
+void set_thread_count(const unsigned int count);
+unsigned int get_thread_count(void);
+
+/**
+ * Fixed-order sums for bitwise reproducible runs, off by default.  The
+ * direct sum then adds up the sources one at a time with the scalar
+ * pair kernel, rather than in the lanes of the widest kernel the CPU
+ * has, so the forces no longer depend on the machine either.  The
+ * other solvers and the energy sums always add up in a fixed order.
+ * See particle_system__checksum() to compare runs step by step.
+ */
+void set_deterministic(const int enabled);
+int get_deterministic(void);
+
+/**
+ * Integration scheme of time_evolution_soa(), symplectic Euler by
+ * default.  Can be switched between steps.
+ */
+void set_integrator(const integrator_t scheme);
+integrator_t get_integrator(void);
+
+/**
+ * Depth and accuracy of INTEGRATOR_BLOCK_TIMESTEP.  The sample_period
+ * given to time_evolution_soa() is the longest step, the shortest is
+ * sample_period / 2^max_level.  Smaller accuracy values put particles
+ * on finer levels.
+ */
+void set_block_timestep(const unsigned int max_level, const double accuracy);
+
+/* Particle force evaluations made by block timesteps so far */
+unsigned long long int get_block_force_evaluations(void);
+
+/**
+ * Block timestep level of every particle of system, NULL when the
+ * next block step would choose fresh levels for it.
+ */
+const unsigned char *get_block_levels(const particle_system_t *system);
+
+/**
+ * Makes the next block step of system carry on with these levels
+ * rather than choose new ones.  system->force must hold the forces
+ * the levels were chosen with and forces_current be set.
+ *
+ * @return 0 on success, 1 on allocation failure
+ */
+int set_block_levels(const particle_system_t *system, const unsigned char *levels);
+
+mechanics_settings_t get_mechanics_settings(void);
+void set_mechanics_settings(const mechanics_settings_t *settings);
+
+/* Uniform magnetic field in tesla, felt only by the Boris pusher */
+void set_magnetic_field(const vector3d_t B);
+vector3d_t get_magnetic_field(void);
+
+/**
+ * Per-particle LOG_DATA text lines from time_evolution() and
+ * time_evolution_soa(), off by default.  Enabling it writes the CSV
+ * column names first.  trajectory.h is the fast way to record a run.
+ */
+void set_text_logging(const int enabled);
+int get_text_logging(void);
+
+/**
+ * Sends everything mechanics logs through an asynchronous log instead
+ * of writing to log_handle on the simulation thread.  NULL goes back
+ * to writing directly.  Unset it before deleting the async log.
+ */
+void set_async_log(async_log_t *log);
+
+/**
+ * Translational kinetic energy and pairwise Coulomb (and gravitational)
+ * potential energy, nearest image in a periodic box.  The potential is
+ * an O(N^2) sum whatever the force solver, so check it every few
+ * hundred steps rather than every step.  With the neighbour list solver
+ * the potential is the shifted-force one within the cutoff, the energy
+ * that solver conserves.  Converted to physical units.
+ */
+double kinetic_energy(const particle_system_t *system);
+double potential_energy(const particle_system_t *system);
+double total_energy(const particle_system_t *system);
+
+/**
+ * (E - E_reference) / |E_reference|, where E_reference is the
+ * total_energy() taken at the start of the run.  The largest timestep
+ * that keeps this bounded is the one to use for a scenario.
+ */
+double energy_drift(const particle_system_t *system, const double reference_energy);
+
+/**
+ * Makes space periodic with a box of the given side lengths centred
+ * on the origin.  Positions are wrapped back into [-L/2, L/2) after
+ * every position update, and the direct sum and collision test in
+ * time_evolution_soa() use the nearest periodic image.  A zero vector
+ * turns periodic boundaries off, which is the default.
+ */
+void set_periodic_box(const vector3d_t length);
+vector3d_t get_periodic_box(void);
+
+/**
+ * Fills system->force with the resultant force on every particle
+ * using the selected solver.
+ * 
+ * @return 0 on success, 1 if the solver could not allocate its working memory
+ */
+int compute_forces(particle_system_t *system);
+
+/**
+ * Runs the selected solver and the direct sum in double precision on
+ * the same positions and reports how far apart they are.  With
+ * __USE_FLOAT_FORCES the direct solver itself shows the error of the
+ * single precision kernels.  system->force is left holding the
+ * selected solver's result.
+ */
+force_error_t force_solver_error(particle_system_t *system);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+/**
+ * Verlet neighbour lists.  Every particle lists the others that were
+ * within cutoff + skin when the lists were built, found through a
+ * spatial hash with cells that wide.  Until some particle has moved
+ * more than half the skin no pair can have come from beyond
+ * cutoff + skin to within the cutoff, so one O(N) search serves many
+ * steps.  Each particle has a full list of its own, so the forces on
+ * different particles can be summed on different threads.
+ */
+typedef struct neighbour_list neighbour_list_t;
+
+
+neighbour_list_t *neighbour_list__new(void);
+void neighbour_list__delete(neighbour_list_t *list);
+
+/**
+ * @return 1 if the lists do not hold for the current positions: never
+ *         built, built for other particles or another order of them,
+ *         cutoff, skin or box, or a particle has moved more than half
+ *         the skin since, 0 otherwise
+ */
+int neighbour_list__stale(const neighbour_list_t *list, const particle_system_t *system, const double cutoff, const double skin,
+                          const vector3d_t periodic_box);
+
+/**
+ * Rebuilds the lists around the current positions.  In a periodic box
+ * cutoff + skin must be less than half of every periodic side, so each
+ * pair has a single nearest image.  Each list is in ascending index
+ * order, so forces do not depend on when the lists were built.
+ *
+ * @return 0 on success, 1 on allocation failure or a range too long for the box
+ */
+int neighbour_list__build(neighbour_list_t *list, const particle_system_t *system, const double cutoff, const double skin,
+                          const vector3d_t periodic_box);
+
+/**
+ * Shifted-force Coulomb, and gravity with __USE_GRAVITY, on particle
+ * "this" from its neighbours closer than the cutoff rc:
+ *
+ *     F = c (1/r^2 - 1/rc^2) d / |d|,    c = k q_this q_that - G m_this m_that
+ *
+ * Both the force and its potential reach zero at the cutoff, so pairs
+ * crossing it do not kick the energy.
+ */
+vector3d_t neighbour_list__force(const neighbour_list_t *list, const particle_system_t *system, const size_t this);
+
+/**
+ * Potential of the shifted force for a pair with coefficient c as
+ * above, zero from the cutoff on:
+ *
+ *     V = c (1/r - 1/rc + (r - rc) / rc^2)
+ */
+double neighbour_list__potential(const double coefficient, const double r, const double cutoff);
+
+/* Entries over every list, twice the number of pairs within cutoff + skin */
+size_t neighbour_list__entry_count(const neighbour_list_t *list);
+unsigned long long int neighbour_list__build_count(const neighbour_list_t *list);
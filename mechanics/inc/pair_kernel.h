@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+typedef enum
+{
+    PAIR_KERNEL_SCALAR,
+    PAIR_KERNEL_SSE2,
+    PAIR_KERNEL_AVX2,
+    PAIR_KERNEL_AVX512,
+
+} pair_kernel_isa_t;
+
+/**
+ * Resultant force on a particle at this_pos from the particles
+ * [begin, end) of the system, worked out straight from each
+ * displacement vector d = this - that:
+ *
+ *     F = (k q_this q_that - G m_this m_that) d / |d|^3
+ *
+ * in the reduced units of units.h, where k is one.  The gravity term
+ * is only present when __USE_GRAVITY is defined.
+ * Sources at exactly this_pos, including the particle itself, are
+ * skipped.  Axes with a positive periodic_box length use the nearest
+ * periodic image.
+ */
+typedef vector3d_t (*pair_kernel_t)(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                    const particle_system_t *system, const size_t begin, const size_t end,
+                                    const vector3d_t periodic_box);
+
+/**
+ * Single precision copy of the positions and charges the pair loop
+ * reads, one array per component.  A source takes half the bytes and
+ * a vector twice the lanes of the double kernels.
+ */
+typedef struct
+{
+    size_t count;
+    size_t capacity;
+    float *x;
+    float *y;
+    float *z;
+    float *charge;
+
+} pair_sources_t;
+
+/**
+ * pair_kernel_t on a single precision copy of the sources.  The
+ * displacements and each lane's running sum are floats, the lanes are
+ * added up in double.  Coulomb only, which is why __USE_FLOAT_FORCES
+ * rules out __USE_GRAVITY.
+ */
+typedef vector3d_t (*pair_kernel_float_t)(const vector3d_t this_pos, const double this_charge,
+                                          const pair_sources_t *sources, const size_t begin, const size_t end,
+                                          const vector3d_t periodic_box);
+
+
+/**
+ * Widest kernel the CPU supports, chosen from the cpuid feature bits
+ * read at program startup.
+ */
+pair_kernel_t pair_kernel(void);
+pair_kernel_isa_t pair_kernel_isa(void);
+
+/**
+ * Kernel for a specific instruction set, NULL if this CPU or build
+ * cannot run it.  PAIR_KERNEL_SCALAR is always available and is the
+ * reference the vector kernels are checked against.
+ */
+pair_kernel_t pair_kernel_for(const pair_kernel_isa_t isa);
+const char *pair_kernel_name(const pair_kernel_isa_t isa);
+
+/* Single precision counterparts of pair_kernel() and pair_kernel_for() */
+pair_kernel_float_t pair_kernel_float(void);
+pair_kernel_float_t pair_kernel_float_for(const pair_kernel_isa_t isa);
+
+/**
+ * Copies the positions and charges of system into sources, growing
+ * its arrays when needed.  Done once per force evaluation, O(N) next
+ * to the O(N^2) loop that reads it.
+ *
+ * @return 0 on success, 1 on allocation failure
+ */
+int pair_sources__fill(pair_sources_t *sources, const particle_system_t *system);
+void pair_sources__free(pair_sources_t *sources);
+
+/**
+ * componentize_force_3d() without the trigonometry, F scaled onto the
+ * unit vector of direction_vector.
+ */
+vector3d_t project_force_3d(const double F, const vector3d_t direction_vector);
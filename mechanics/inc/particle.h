@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "vector.h"
 
 
@@ -15,6 +18,11 @@
 #define ELECTRON_RADIUS         10E-15     // Meters
 #define FAKE_NUCLEUS_RADIUS     0.1
 
+#define PARTICLE_POOL_ALIGNMENT     64      // slabs start on a cache line, a particle_t is two of them
+#define PARTICLE_SLAB_SIZE          4096    // particles per slab
+
+#define PARTICLE_HANDLE_NONE        UINT64_MAX
+
 
 typedef struct
 {
@@ -35,3 +43,55 @@ particle_t *particle__new(const unsigned long long int id,
                           const vector3d_t initial_orientation, const vector3d_t initial_angular_momentum,
                           const double mass, const double charge, const double radius);
 void particle__delete(particle_t *p);
+
+/**
+ * Names a pooled particle for as long as it lives.  The low half picks
+ * an entry of the pool's handle table and the high half is that entry's
+ * generation, so a handle kept after its particle was released is
+ * recognised as stale rather than reaching whichever particle took the
+ * entry next.
+ */
+typedef uint64_t particle_handle_t;
+
+/**
+ * Particles in cache line aligned slabs of PARTICLE_SLAB_SIZE, taken and
+ * given back in batches.  Released slots go on a free list and are
+ * taken again first.  Slabs never move, so a pointer from
+ * particle_pool__get() holds until the particle is released or the pool
+ * compacted, a handle holds until the particle is released.
+ */
+typedef struct particle_pool particle_pool_t;
+
+
+particle_pool_t *particle_pool__new(const size_t capacity);
+void particle_pool__delete(particle_pool_t *pool);
+
+/**
+ * Takes count slots, all or none of them.
+ *
+ * @param initial  count particles to copy in, NULL to zero them
+ * @param handles  filled with one handle per particle
+ * @return 0 on success, 1 without memory or past 2^32 - 1 particles
+ */
+int particle__new_n(particle_pool_t *pool, const particle_t *initial, const size_t count, particle_handle_t *handles);
+
+/**
+ * Gives the slots back to the free list.  Stale handles are skipped.
+ *
+ * @return the number of particles released
+ */
+size_t particle__release_n(particle_pool_t *pool, const particle_handle_t *handles, const size_t count);
+
+/* @return NULL for a stale handle */
+particle_t *particle_pool__get(const particle_pool_t *pool, const particle_handle_t handle);
+size_t particle_pool__count(const particle_pool_t *pool);
+
+/**
+ * Moves the particles at the end into the released slots before them,
+ * so the live ones fill the first slots without gaps, and frees the
+ * slabs left empty.  Handles are kept, pointers are not.
+ */
+void particle_pool__compact(particle_pool_t *pool);
+
+/* Particle in slot n, 0 <= n < particle_pool__count(), of a compacted pool */
+particle_t *particle_pool__at(const particle_pool_t *pool, const size_t n);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+#define DEFAULT_MESH_SIZE   32
+
+
+/* How a particle is spread onto, and read back from, the grid */
+typedef enum
+{
+    MESH_ASSIGNMENT_CIC,    // Cloud-in-cell, 2 points per dimension
+    MESH_ASSIGNMENT_TSC,    // Triangular-shaped cloud, 3 points per dimension
+
+} mesh_assignment_t;
+
+/**
+ * Periodic particle-mesh solver.  Charge is deposited onto a cubic
+ * grid of grid_size^3 points spanning the periodic box, Poisson's
+ * equation is solved with an FFT, the field is taken from the potential
+ * with a centred difference and interpolated back with the same
+ * assignment scheme.  The box is centred on the origin,
+ * positions are expected in [-L/2, L/2).
+ *
+ * The uniform (k = 0) component is dropped, which is the same as a
+ * neutralising background charge.
+ */
+typedef struct particle_mesh particle_mesh_t;
+
+
+/**
+ * @param grid_size Grid points per dimension, must be a power of two
+ * @param box_length Side lengths of the periodic box
+ * @return NULL if grid_size is not a power of two or allocation fails
+ */
+particle_mesh_t *particle_mesh__new(const size_t grid_size, const vector3d_t box_length, const mesh_assignment_t assignment);
+void particle_mesh__delete(particle_mesh_t *mesh);
+
+size_t particle_mesh__grid_size(const particle_mesh_t *mesh);
+vector3d_t particle_mesh__box_length(const particle_mesh_t *mesh);
+mesh_assignment_t particle_mesh__assignment(const particle_mesh_t *mesh);
+
+/**
+ * Overwrites system->force with the long-range force on every particle.
+ */
+void particle_mesh__forces(particle_mesh_t *mesh, particle_system_t *system);
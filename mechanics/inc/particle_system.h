@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "particle.h"
+#include "vector.h"
+
+
+/* Every array is aligned to a cache line so a vector load never straddles two lines */
+#define PARTICLE_SYSTEM_ALIGNMENT   64
+
+
+/**
+ * One contiguous array per rectangular component, so a loop over
+ * a single component streams through memory.
+ */
+typedef struct
+{
+    double *i;
+    double *j;
+    double *k;
+
+} vector3d_array_t;
+
+/**
+ * Structure-of-arrays particle store.  Element n of every array
+ * belongs to the same particle, everything is in the reduced units of
+ * units.h.  The hot fields (pos, momenta, mass, charge, radius) are
+ * kept apart from the fields the force loop never reads.
+ */
+typedef struct
+{
+    size_t count;
+    size_t capacity;
+
+    vector3d_array_t pos;
+    vector3d_array_t momenta;
+    double *mass;
+    double *charge;
+    double *radius;
+
+    /* Cold data */
+    unsigned long long int *id;
+    vector3d_array_t orientation;
+    vector3d_array_t angular_momenta;
+
+    /* Scratch space for the resultant force on each particle */
+    vector3d_array_t force;
+
+    /* Simulated time and steps taken so far */
+    double time;
+    unsigned long long int step_count;
+
+    /* Set while force holds the forces at the current positions, clear it after moving particles by hand */
+    int forces_current;
+
+} particle_system_t;
+
+
+particle_system_t *particle_system__new(const size_t capacity);
+/* Converts the particles from physical units, as time_evolution() steps them */
+particle_system_t *particle_system__from_particles(particle_t **particles, const size_t particle_count);
+void particle_system__delete(particle_system_t *system);
+
+/* @return 0 on success, 1 on allocation failure or a capacity over particle_system__max_capacity() */
+int particle_system__reserve(particle_system_t *system, const size_t capacity);
+/* Largest capacity whose arrays, all together, still have a size that fits in a size_t */
+size_t particle_system__max_capacity(void);
+int particle_system__add(particle_system_t *system, const particle_t *p);
+
+/**
+ * Per-particle view of the store for code written against particle_t.
+ * The view is a copy, changes are written back with particle_system__set().
+ * Neither converts units, see units__to_physical() for that.
+ */
+particle_t particle_system__get(const particle_system_t *system, const size_t index);
+void particle_system__set(particle_system_t *system, const size_t index, const particle_t *p);
+
+/**
+ * 64 bit FNV-1a hash of the bit patterns of the state: count, time,
+ * step count and every array but the force scratch, in index order.
+ * Equal checksums step after step show two runs stayed bitwise equal,
+ * the first differing one shows where they parted.
+ */
+uint64_t particle_system__checksum(const particle_system_t *system);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <math.h>
+
+#include "vector.h"
+
+
+/**
+ * Maps a coordinate, or a difference of coordinates, into
+ * [-L/2, L/2).  A non-positive length means that axis is not periodic.
+ * Shared by the integrators, which wrap positions, and the solvers,
+ * which take nearest images, so both agree on where the box ends.
+ */
+static inline double periodic__wrap(const double x, const double length)
+{
+    if (length <= 0) return x;
+
+    return x - length * floor(x / length + 0.5);
+}
+
+/* Nearest image of a displacement, periodic__wrap() on each axis of the box */
+static inline vector3d_t periodic__minimum_image(const vector3d_t d, const vector3d_t box)
+{
+    return (vector3d_t){periodic__wrap(d.i, box.i), periodic__wrap(d.j, box.j), periodic__wrap(d.k, box.k)};
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle.h"
+#include "particle_system.h"
+#include "vector.h"
+
+
+#define SCENARIO_TILE_SIZE          4096    // particles generated per tile of work
+
+
+/* How a group of particles is laid out */
+typedef enum
+{
+    SCENARIO_PARTICLE,          // one particle given in full
+    SCENARIO_UNIFORM_BOX,       // count particles spread evenly over a cube of side size
+    SCENARIO_PLUMMER_SPHERE,    // count particles in a Plummer model of scale radius size
+    SCENARIO_LATTICE_PLASMA,    // cells^3 ions on a cubic lattice of spacing size, an electron in every cell centre
+    SCENARIO_RANDOM_IONS,       // count ions of random sign and charge state spread over a cube of side size
+
+} scenario_generator_t;
+
+/**
+ * Generated particles all get mass, charge and radius, with these
+ * exceptions: random ions carry charge times a state drawn from
+ * 1..charge_states with a random sign, and lattice electrons carry
+ * -charge, electron_mass and radius / 8.
+ *
+ * speed is the spread of each velocity component, Gaussian except in
+ * the Plummer sphere, where it is the velocity scale sqrt(G M / size)
+ * of the distribution function.  Lattice electrons get the spread that
+ * puts them at the temperature of the ions.
+ */
+typedef struct
+{
+    scenario_generator_t generator;
+    size_t count;
+    size_t cells;
+    unsigned int charge_states;
+    double mass;
+    double electron_mass;
+    double charge;
+    double radius;
+    double size;
+    double speed;
+    vector3d_t center;
+    particle_t particle;        // SCENARIO_PARTICLE only, the id is assigned on building
+
+} scenario_group_t;
+
+/**
+ * Initial conditions for a run.  Particles are built group by group
+ * in order and numbered from 0.
+ */
+typedef struct
+{
+    unsigned long long int seed;
+    double sample_period;       // 0 when the scenario leaves it to the program
+    double box_length;          // periodic box side, 0 for open space
+
+    size_t group_count;
+    size_t group_capacity;
+    scenario_group_t *groups;
+
+} scenario_t;
+
+
+scenario_t *scenario__new(void);
+void scenario__delete(scenario_t *scenario);
+
+/**
+ * Scenario files are plain text, one directive per line, # starts a
+ * comment:
+ *
+ *     seed 42
+ *     dt 8E-3
+ *     box 1E-6
+ *     particle mass=9.11E-28 charge=-1.602E-19 radius=0.0125 pos=0.3,0.5,0 momentum=0,0,0
+ *     uniform_box count=1000000 mass=1.6727E-24 charge=0 radius=1E-15 size=1E-6 speed=100
+ *     plummer_sphere count=100000 mass=1E3 radius=1 size=1E-3 speed=0.1 center=0,0,0
+ *     lattice_plasma cells=64 mass=1.6727E-24 charge=1.602E-19 radius=1E-15 size=1E-9
+ *     random_ions count=50000 mass=6.6954E-24 charge=1.602E-19 charge_states=2 radius=1E-15 size=1E-6
+ *
+ * particle also takes orientation= and angular_momentum=, generators
+ * take center=, lattice_plasma takes electron_mass=.
+ *
+ * @param error_line Set to the first bad line, or 0 if memory ran out
+ * @return NULL on a bad line
+ */
+scenario_t *scenario__parse(const char *text, size_t *error_line);
+
+/* @param error_line Set as for scenario__parse(), 0 also if the file could not be read */
+scenario_t *scenario__load(const char *filepath, size_t *error_line);
+
+/* @return 0 on success, 1 on allocation failure */
+int scenario__add_group(scenario_t *scenario, const scenario_group_t *group);
+
+size_t scenario__group_size(const scenario_group_t *group);
+/* Saturates at SIZE_MAX */
+size_t scenario__particle_count(const scenario_t *scenario);
+
+/**
+ * Generates every particle straight into a new particle system, in
+ * tiles spread over thread_count threads.  Each particle draws from
+ * its own counter based random stream keyed by the seed, its group
+ * and its index, so the result does not depend on the thread count.
+ * Groups are given in physical units and converted on the way in.
+ *
+ * @param thread_count Threads including the caller, 0 for one per online processor
+ * @return NULL on allocation failure or more particles than a particle system holds
+ */
+particle_system_t *scenario__build(const scenario_t *scenario, const unsigned int thread_count);
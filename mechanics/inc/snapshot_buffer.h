@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "particle_system.h"
+
+
+/* What a viewer needs of the particles at one step, never changed once published */
+typedef struct
+{
+    size_t count;
+    double time;
+    unsigned long long int step_count;
+    uint64_t published;         // monotonic clock in nanoseconds when it was published
+
+    vector3d_array_t pos;
+    vector3d_array_t orientation;
+    double *charge;
+
+} snapshot_t;
+
+/**
+ * Hands snapshots from one writer thread to one reader thread without
+ * either ever waiting for the other.  There are four slots: the writer
+ * fills one, one holds the newest published snapshot, and the reader
+ * keeps the two it last took, so it can interpolate between them.  The
+ * slot in the middle is swapped with a single atomic exchange.  A flag
+ * next to its index tells the reader whether it is newer than its own.
+ */
+typedef struct snapshot_buffer snapshot_buffer_t;
+
+
+/**
+ * Every slot starts out as a copy of system, so the reader has a
+ * snapshot before the first publish.
+ *
+ * @return NULL without memory
+ */
+snapshot_buffer_t *snapshot_buffer__new(const particle_system_t *system);
+void snapshot_buffer__delete(snapshot_buffer_t *buffer);
+
+/**
+ * Writer side.  Copies system into the free slot and makes it the
+ * newest snapshot, replacing one the reader has not taken yet.
+ *
+ * @return 0 on success, 1 if the particle count differs from the buffer's
+ */
+int snapshot_buffer__publish(snapshot_buffer_t *buffer, const particle_system_t *system);
+
+/**
+ * Reader side.  Takes the newest snapshot if one was published since
+ * the last call, otherwise returns the same one again.  Both snapshots
+ * stay valid until the next call.
+ *
+ * @param previous Set to the snapshot taken before the returned one,
+ *                 the same one until a second snapshot is published
+ */
+const snapshot_t *snapshot_buffer__acquire(snapshot_buffer_t *buffer, const snapshot_t **previous);
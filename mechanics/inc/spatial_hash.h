@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "vector.h"
+
+
+typedef struct
+{
+    size_t this;
+    size_t that;
+
+} particle_pair_t;
+
+/* Growable list of pairs, reused between steps to avoid reallocating */
+typedef struct
+{
+    particle_pair_t *pairs;
+    size_t count;
+    size_t capacity;
+
+} pair_list_t;
+
+/**
+ * Uniform grid over space with the occupied cells hashed into a table
+ * sized from the particle count, so memory does not depend on how far
+ * apart the particles are.  Particles closer than the cell size are
+ * always in the same or neighbouring cells.
+ */
+typedef struct spatial_hash spatial_hash_t;
+
+
+spatial_hash_t *spatial_hash__new(void);
+void spatial_hash__delete(spatial_hash_t *hash);
+
+/**
+ * Bins every particle of the system.  Must be called again whenever
+ * positions change.
+ *
+ * @param cell_size Smallest distance that can separate particles in non-neighbouring cells
+ * @param periodic_box Side lengths of a periodic box centred on the origin, zero for open axes
+ * @return 0 on success, 1 on allocation failure
+ */
+int spatial_hash__build(spatial_hash_t *hash, const particle_system_t *system, const double cell_size, const vector3d_t periodic_box);
+
+/**
+ * Appends every pair in the same or neighbouring cells whose lower
+ * index lies in [begin, end).  Each unordered pair appears once with
+ * this < that.
+ *
+ * @return 0 on success, 1 on allocation failure
+ */
+int spatial_hash__pairs(const spatial_hash_t *hash, const size_t begin, const size_t end, pair_list_t *list);
+
+int pair_list__append(pair_list_t *list, const size_t this, const size_t that);
+void pair_list__free(pair_list_t *list);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdlib.h>
+
+
+/**
+ * Fixed set of worker threads that run parallel loops.  The index range
+ * of a loop is cut into tiles, each thread starts on its own share of
+ * the tiles, and threads that run out steal half of what is left from
+ * another thread.  The calling thread works as thread 0.
+ */
+typedef struct thread_pool thread_pool_t;
+
+/**
+ * Runs the loop body over [begin, end), one tile at a time.  worker is
+ * the index of the calling thread, below thread_pool__thread_count(),
+ * for indexing per thread scratch space.
+ */
+typedef void (*thread_pool_task_t)(void *context, const size_t begin, const size_t end, const unsigned int worker);
+
+
+/**
+ * @param thread_count Threads including the caller, 0 for one per online processor
+ * @return NULL if a thread could not be started
+ */
+thread_pool_t *thread_pool__new(const unsigned int thread_count);
+void thread_pool__delete(thread_pool_t *pool);
+
+unsigned int thread_pool__thread_count(const thread_pool_t *pool);
+
+/**
+ * Calls task on every tile of [0, count) and returns once all of them
+ * are done, so consecutive calls act as phase barriers.  Every tile
+ * but the last is exactly tile_size long, so begin / tile_size numbers
+ * the tiles for per tile scratch space.  A NULL pool runs the whole
+ * range on the caller.  Not reentrant, a task must not start another
+ * loop on the same pool.
+ */
+void thread_pool__parallel_for(thread_pool_t *pool, const size_t count, const size_t tile_size,
+                               thread_pool_task_t task, void *context);
+
+/* Processors online, at least 1 */
+unsigned int thread_pool__processor_count(void);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "particle_system.h"
+#include "units.h"
+
+
+#define TRAJECTORY_MAGIC            "PSIMTRJ"   // 8 bytes with the terminating zero
+#define TRAJECTORY_VERSION          2
+#define TRAJECTORY_HEADER_SIZE      64
+#define TRAJECTORY_BUFFER_SIZE      (1 << 20)
+
+
+/* Particle arrays a frame can hold, stored in this order */
+typedef enum
+{
+    TRAJECTORY_ID               = 1 << 0,   // unsigned 64 bit integers
+    TRAJECTORY_MASS             = 1 << 1,
+    TRAJECTORY_CHARGE           = 1 << 2,
+    TRAJECTORY_RADIUS           = 1 << 3,
+    TRAJECTORY_POSITION         = 1 << 4,   // vectors are stored as the i array, then j, then k
+    TRAJECTORY_MOMENTA          = 1 << 5,
+    TRAJECTORY_ORIENTATION      = 1 << 6,
+    TRAJECTORY_ANGULAR_MOMENTA  = 1 << 7,
+    TRAJECTORY_FORCE            = 1 << 8,
+
+} trajectory_field_t;
+
+/* What the text log used to hold */
+#define TRAJECTORY_DEFAULT_FIELDS   (TRAJECTORY_ID | TRAJECTORY_MASS | TRAJECTORY_CHARGE | TRAJECTORY_POSITION | \
+                                     TRAJECTORY_MOMENTA | TRAJECTORY_ORIENTATION | TRAJECTORY_ANGULAR_MOMENTA)
+
+/**
+ * Binary trajectory file, everything little-endian.  The header is
+ * TRAJECTORY_HEADER_SIZE bytes:
+ *
+ *     offset  0   char[8]   TRAJECTORY_MAGIC
+ *             8   uint32    version
+ *            12   uint32    header size
+ *            16   uint64    particle count
+ *            24   float64   sample period
+ *            32   uint32    field mask, trajectory_field_t bits
+ *            36   uint32    zero
+ *            40   uint64    frame size in bytes
+ *            48   float64   UNIT_MASS
+ *            56   float64   UNIT_CHARGE
+ *
+ * followed by fixed size frames: float64 time, uint64 step count, then
+ * one array of particle count elements per scalar field in the mask
+ * and three per vector field, every element 8 bytes.  Frames are
+ * collected in a TRAJECTORY_BUFFER_SIZE buffer, larger ones are
+ * written straight from the particle arrays.
+ *
+ * The arrays are stored in the reduced units of units.h so they can be
+ * written without a copy.  Charge is a multiple of the unit charge,
+ * mass, momenta, angular momenta and force are multiples of the unit
+ * mass, everything else is already in metres, seconds and radians.
+ */
+typedef struct trajectory trajectory_t;
+
+
+/* @return NULL if the file could not be created or the header written */
+trajectory_t *trajectory__open(const char *filepath, const size_t particle_count, const double sample_period,
+                               const unsigned int field_mask);
+
+/**
+ * Carries on writing a trajectory after a restart.  The file must
+ * have been opened with the same particle count, sample period and
+ * fields, anything after its first frame_count frames is cut off.
+ *
+ * @return NULL if the file is missing, does not match or is shorter
+ */
+trajectory_t *trajectory__append(const char *filepath, const size_t particle_count, const double sample_period,
+                                 const unsigned int field_mask, const unsigned long long int frame_count);
+
+/**
+ * Closes the file after writing out any buffered frames.
+ *
+ * @return 0 if every frame made it to the file, 1 otherwise
+ */
+int trajectory__close(trajectory_t *trajectory);
+
+/* @return 0 on success, 1 on a write error or if the particle count changed */
+int trajectory__write_frame(trajectory_t *trajectory, const particle_system_t *system);
+int trajectory__flush(trajectory_t *trajectory);
+
+size_t trajectory__frame_size(const trajectory_t *trajectory);
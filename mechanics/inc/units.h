@@ -0,0 +1,36 @@
+#pragma once
+
+#include "particle.h"
+
+
+#define UNIVERSAL_GRAVITY_CONST     6.6743E-17 // (N*m^2)/(g^2)
+#define COULOMB_CONST               8.9875E9  // (N*m^2)/(C^2)
+
+/**
+ * Reduced units the particle system is stored and stepped in.  Charge
+ * is counted in proton charges and mass in UNIT_MASS, chosen so the
+ * Coulomb constant is exactly one.  Length and time keep metres and
+ * seconds, so positions, velocities, orientations and timesteps are
+ * the same numbers inside and out, and the quantities below all come
+ * out as multiples of UNIT_MASS.  An electron weighs about 3.95 and a
+ * proton about 7252, which keeps every term of the force loop well
+ * inside single precision.
+ */
+#define UNIT_CHARGE                 PROTON_CHARGE
+#define UNIT_MASS                   (COULOMB_CONST * UNIT_CHARGE * UNIT_CHARGE)    // grams, about 2.31E-28
+#define UNIT_MOMENTUM               UNIT_MASS
+#define UNIT_ANGULAR_MOMENTUM       UNIT_MASS
+#define UNIT_FORCE                  UNIT_MASS
+#define UNIT_ENERGY                 UNIT_MASS
+#define UNIT_MAGNETIC_FIELD         (UNIT_MASS / UNIT_CHARGE)    // tesla
+
+#define REDUCED_COULOMB_CONST       1.0
+#define REDUCED_GRAVITY_CONST       (UNIVERSAL_GRAVITY_CONST * UNIT_MASS * UNIT_MASS / UNIT_FORCE)
+
+
+/**
+ * Conversions at the edge of the library, particle_t values handed in
+ * and out are always physical.
+ */
+particle_t units__to_reduced(const particle_t *p);
+particle_t units__to_physical(const particle_t *p);
@@ -0,0 +1,371 @@
+#include "barnes_hut.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "mechanics.h"
+#include "periodic.h"
+
+
+#define OCTANT_COUNT    8
+#define NO_CHILD        0   // The root is never a child so index 0 marks an empty octant
+
+
+typedef struct
+{
+    vector3d_t center;
+    double half_size;
+    size_t begin;
+    size_t end;
+    size_t child[OCTANT_COUNT];
+    int is_leaf;
+
+    double positive_charge;
+    double negative_charge;
+    double mass;
+    vector3d_t positive_charge_center;
+    vector3d_t negative_charge_center;
+    vector3d_t mass_center;
+
+} octree_node_t;
+
+struct barnes_hut
+{
+    octree_node_t *nodes;
+    size_t node_count;
+    size_t node_capacity;
+
+    /* Particle indices ordered so each node owns a contiguous range */
+    size_t *index;
+    size_t *scratch;
+    size_t index_capacity;
+};
+
+
+/* Private function declarations */
+static size_t new_node(barnes_hut_t *tree, const vector3d_t center, const double half_size, const size_t begin, const size_t end);
+static int build_node(barnes_hut_t *tree, const particle_system_t *system, const size_t node, const unsigned int depth);
+static void leaf_moments(octree_node_t *node, const particle_system_t *system, const size_t *index);
+static void branch_moments(octree_node_t *node, const octree_node_t *nodes);
+static int contains(const octree_node_t *node, const vector3d_t pos);
+static vector3d_t point_source_force(const vector3d_t this_pos, const double this_charge, const double this_mass, const octree_node_t *node);
+static vector3d_t image_shift(const vector3d_t pos, const vector3d_t this_pos, const vector3d_t periodic_box);
+static octree_node_t shifted(const octree_node_t *node, const vector3d_t shift);
+
+/* Public function definitions */
+barnes_hut_t *barnes_hut__new(void)
+{
+    return calloc(1, sizeof(barnes_hut_t));
+}
+
+void barnes_hut__delete(barnes_hut_t *tree)
+{
+    if (!tree) return;
+
+    free(tree->nodes);
+    free(tree->index);
+    free(tree->scratch);
+    free(tree);
+}
+
+int barnes_hut__build(barnes_hut_t *tree, const particle_system_t *system)
+{
+    vector3d_t min = {0}, max = {0};
+
+    tree->node_count = 0;
+
+    if (system->count > tree->index_capacity) {
+
+        size_t *index = realloc(tree->index, system->count * sizeof(size_t));
+        size_t *scratch = index ? realloc(tree->scratch, system->count * sizeof(size_t)) : NULL;
+
+        if (index) tree->index = index;
+        if (scratch) tree->scratch = scratch;
+        if (!index || !scratch)
+            return 1;
+
+        tree->index_capacity = system->count;
+    }
+
+    for (size_t n = 0; n < system->count; ++n)
+        tree->index[n] = n;
+
+    if (system->count) {
+        min = max = (vector3d_t){system->pos.i[0], system->pos.j[0], system->pos.k[0]};
+    }
+    for (size_t n = 1; n < system->count; ++n) {
+        min.i = fmin(min.i, system->pos.i[n]);   max.i = fmax(max.i, system->pos.i[n]);
+        min.j = fmin(min.j, system->pos.j[n]);   max.j = fmax(max.j, system->pos.j[n]);
+        min.k = fmin(min.k, system->pos.k[n]);   max.k = fmax(max.k, system->pos.k[n]);
+    }
+
+    const vector3d_t center = vector3d__scale(vector3d__add(min, max), 0.5);
+    const double half_size = 0.5 * fmax(fmax(max.i - min.i, max.j - min.j), max.k - min.k);
+
+    /* Pad the root slightly so particles on the boundary are inside it */
+    new_node(tree, center, half_size > 0 ? half_size * (1 + 1E-9) : 1, 0, system->count);
+    if (!tree->node_count)
+        return 1;
+
+    return build_node(tree, system, 0, 0);
+}
+
+vector3d_t barnes_hut__force(const barnes_hut_t *tree, const particle_system_t *system, const size_t this, const double theta,
+                             const vector3d_t periodic_box)
+{
+    const vector3d_t this_pos = {system->pos.i[this], system->pos.j[this], system->pos.k[this]};
+    const double this_charge = system->charge[this];
+    const double this_mass = system->mass[this];
+
+    size_t stack[BARNES_HUT_MAX_DEPTH * (OCTANT_COUNT - 1) + 1];
+    size_t stack_size = 0;
+    vector3d_t F_resultant = {0};
+
+    if (!tree->node_count)
+        return F_resultant;
+
+    stack[stack_size++] = 0;
+
+    while (stack_size) {
+
+        const octree_node_t *node = &tree->nodes[stack[--stack_size]];
+
+        if (node->is_leaf) {
+
+            for (size_t n = node->begin; n < node->end; ++n) {
+
+                const size_t that = tree->index[n];
+
+                if (that == this) continue;
+
+                const vector3d_t that_pos = {system->pos.i[that], system->pos.j[that], system->pos.k[that]};
+                const vector3d_t image = vector3d__add(that_pos, image_shift(that_pos, this_pos, periodic_box));
+                const octree_node_t point = {
+                    .positive_charge = system->charge[that],
+                    .positive_charge_center = image,
+                    .mass = system->mass[that],
+                    .mass_center = image
+                };
+
+                F_resultant = vector3d__add(F_resultant, point_source_force(this_pos, this_charge, this_mass, &point));
+            }
+            continue;
+        }
+
+        /* The whole node moves to the image of its centre nearest to this particle */
+        const octree_node_t image = shifted(node, image_shift(node->center, this_pos, periodic_box));
+        const double distance = vector3d__distance(this_pos, image.center);
+
+        if (!contains(&image, this_pos) && 2 * node->half_size < theta * distance) {
+            F_resultant = vector3d__add(F_resultant, point_source_force(this_pos, this_charge, this_mass, &image));
+            continue;
+        }
+
+        for (int octant = 0; octant < OCTANT_COUNT; ++octant)
+            if (node->child[octant] != NO_CHILD)
+                stack[stack_size++] = node->child[octant];
+    }
+
+    return F_resultant;
+}
+
+size_t barnes_hut__node_count(const barnes_hut_t *tree)
+{
+    return tree->node_count;
+}
+
+/* Private function definitions */
+static size_t new_node(barnes_hut_t *tree, const vector3d_t center, const double half_size, const size_t begin, const size_t end)
+{
+    if (tree->node_count == tree->node_capacity) {
+
+        const size_t capacity = tree->node_capacity ? 2 * tree->node_capacity : 64;
+        octree_node_t *nodes = realloc(tree->nodes, capacity * sizeof(octree_node_t));
+
+        if (!nodes)
+            return NO_CHILD;
+
+        tree->nodes = nodes;
+        tree->node_capacity = capacity;
+    }
+
+    octree_node_t *node = &tree->nodes[tree->node_count];
+
+    memset(node, 0, sizeof(octree_node_t));
+    node->center = center;
+    node->half_size = half_size;
+    node->begin = begin;
+    node->end = end;
+
+    return tree->node_count++;
+}
+
+static int build_node(barnes_hut_t *tree, const particle_system_t *system, const size_t node, const unsigned int depth)
+{
+    const size_t begin = tree->nodes[node].begin;
+    const size_t end = tree->nodes[node].end;
+    const vector3d_t center = tree->nodes[node].center;
+    const double child_half_size = 0.5 * tree->nodes[node].half_size;
+
+    size_t octant_count[OCTANT_COUNT] = {0};
+    size_t octant_begin[OCTANT_COUNT];
+
+    if (end - begin <= BARNES_HUT_LEAF_CAPACITY || depth >= BARNES_HUT_MAX_DEPTH) {
+        tree->nodes[node].is_leaf = 1;
+        leaf_moments(&tree->nodes[node], system, tree->index);
+        return 0;
+    }
+
+    /* Counting sort of the node's particles into octants */
+    for (size_t n = begin; n < end; ++n) {
+        const size_t p = tree->index[n];
+        const int octant = (system->pos.i[p] >= center.i) | (system->pos.j[p] >= center.j) << 1 | (system->pos.k[p] >= center.k) << 2;
+        octant_count[octant]++;
+    }
+
+    octant_begin[0] = begin;
+    for (int octant = 1; octant < OCTANT_COUNT; ++octant)
+        octant_begin[octant] = octant_begin[octant-1] + octant_count[octant-1];
+
+    size_t fill[OCTANT_COUNT];
+    memcpy(fill, octant_begin, sizeof(fill));
+
+    for (size_t n = begin; n < end; ++n) {
+        const size_t p = tree->index[n];
+        const int octant = (system->pos.i[p] >= center.i) | (system->pos.j[p] >= center.j) << 1 | (system->pos.k[p] >= center.k) << 2;
+        tree->scratch[fill[octant]++] = p;
+    }
+    memcpy(&tree->index[begin], &tree->scratch[begin], (end - begin) * sizeof(size_t));
+
+    for (int octant = 0; octant < OCTANT_COUNT; ++octant) {
+
+        if (!octant_count[octant]) continue;
+
+        const vector3d_t child_center = {
+            .i = center.i + (octant & 1 ? child_half_size : -child_half_size),
+            .j = center.j + (octant & 2 ? child_half_size : -child_half_size),
+            .k = center.k + (octant & 4 ? child_half_size : -child_half_size)
+        };
+        const size_t child = new_node(tree, child_center, child_half_size, octant_begin[octant], octant_begin[octant] + octant_count[octant]);
+
+        if (child == NO_CHILD || build_node(tree, system, child, depth + 1))
+            return 1;
+
+        /* new_node() may have moved the node array */
+        tree->nodes[node].child[octant] = child;
+    }
+
+    branch_moments(&tree->nodes[node], tree->nodes);
+
+    return 0;
+}
+
+static void leaf_moments(octree_node_t *node, const particle_system_t *system, const size_t *index)
+{
+    for (size_t n = node->begin; n < node->end; ++n) {
+
+        const size_t p = index[n];
+        const vector3d_t pos = {system->pos.i[p], system->pos.j[p], system->pos.k[p]};
+        const double q = system->charge[p];
+
+        if (q > 0) {
+            node->positive_charge += q;
+            node->positive_charge_center = vector3d__add(node->positive_charge_center, vector3d__scale(pos, q));
+        }
+        else if (q < 0) {
+            node->negative_charge += q;
+            node->negative_charge_center = vector3d__add(node->negative_charge_center, vector3d__scale(pos, q));
+        }
+
+        node->mass += system->mass[p];
+        node->mass_center = vector3d__add(node->mass_center, vector3d__scale(pos, system->mass[p]));
+    }
+
+    if (node->positive_charge) node->positive_charge_center = vector3d__scale(node->positive_charge_center, 1 / node->positive_charge);
+    if (node->negative_charge) node->negative_charge_center = vector3d__scale(node->negative_charge_center, 1 / node->negative_charge);
+    if (node->mass) node->mass_center = vector3d__scale(node->mass_center, 1 / node->mass);
+}
+
+static void branch_moments(octree_node_t *node, const octree_node_t *nodes)
+{
+    for (int octant = 0; octant < OCTANT_COUNT; ++octant) {
+
+        if (node->child[octant] == NO_CHILD) continue;
+
+        const octree_node_t *child = &nodes[node->child[octant]];
+
+        node->positive_charge += child->positive_charge;
+        node->negative_charge += child->negative_charge;
+        node->mass += child->mass;
+        node->positive_charge_center = vector3d__add(node->positive_charge_center, vector3d__scale(child->positive_charge_center, child->positive_charge));
+        node->negative_charge_center = vector3d__add(node->negative_charge_center, vector3d__scale(child->negative_charge_center, child->negative_charge));
+        node->mass_center = vector3d__add(node->mass_center, vector3d__scale(child->mass_center, child->mass));
+    }
+
+    if (node->positive_charge) node->positive_charge_center = vector3d__scale(node->positive_charge_center, 1 / node->positive_charge);
+    if (node->negative_charge) node->negative_charge_center = vector3d__scale(node->negative_charge_center, 1 / node->negative_charge);
+    if (node->mass) node->mass_center = vector3d__scale(node->mass_center, 1 / node->mass);
+}
+
+static int contains(const octree_node_t *node, const vector3d_t pos)
+{
+    return fabs(pos.i - node->center.i) <= node->half_size &&
+           fabs(pos.j - node->center.j) <= node->half_size &&
+           fabs(pos.k - node->center.k) <= node->half_size;
+}
+
+/**
+ * Same sign conventions as resultant_force_from_fields(), like charges
+ * push "this" away from the source and mass pulls it towards the source.
+ */
+static vector3d_t point_source_force(const vector3d_t this_pos, const double this_charge, const double this_mass, const octree_node_t *node)
+{
+    vector3d_t F = {0};
+
+    if (node->positive_charge) {
+        const vector3d_t r = vector3d__sub(this_pos, node->positive_charge_center);
+        const double r_mag = vector3d__mag(r);
+        if (r_mag > 0)
+            F = vector3d__add(F, vector3d__scale(r, REDUCED_COULOMB_CONST * this_charge * node->positive_charge / (r_mag * r_mag * r_mag)));
+    }
+
+    if (node->negative_charge) {
+        const vector3d_t r = vector3d__sub(this_pos, node->negative_charge_center);
+        const double r_mag = vector3d__mag(r);
+        if (r_mag > 0)
+            F = vector3d__add(F, vector3d__scale(r, REDUCED_COULOMB_CONST * this_charge * node->negative_charge / (r_mag * r_mag * r_mag)));
+    }
+
+    #ifdef __USE_GRAVITY
+    if (node->mass) {
+        const vector3d_t r = vector3d__sub(node->mass_center, this_pos);
+        const double r_mag = vector3d__mag(r);
+        if (r_mag > 0)
+            F = vector3d__add(F, vector3d__scale(r, REDUCED_GRAVITY_CONST * this_mass * node->mass / (r_mag * r_mag * r_mag)));
+    }
+    #else
+    (void)this_mass;
+    #endif
+
+    return F;
+}
+
+/* What moves pos to its image nearest to this_pos, zero on open axes */
+static vector3d_t image_shift(const vector3d_t pos, const vector3d_t this_pos, const vector3d_t periodic_box)
+{
+    const vector3d_t d = vector3d__sub(pos, this_pos);
+
+    return vector3d__sub(periodic__minimum_image(d, periodic_box), d);
+}
+
+static octree_node_t shifted(const octree_node_t *node, const vector3d_t shift)
+{
+    octree_node_t image = *node;
+
+    image.center = vector3d__add(node->center, shift);
+    image.positive_charge_center = vector3d__add(node->positive_charge_center, shift);
+    image.negative_charge_center = vector3d__add(node->negative_charge_center, shift);
+    image.mass_center = vector3d__add(node->mass_center, shift);
+
+    return image;
+}
@@ -0,0 +1,163 @@
+#include "block_timestep.h"
+
+#include <math.h>
+
+
+/* Private function declarations */
+static unsigned int level_for_period(const double period, const double max_period, const unsigned int max_level);
+static unsigned long long int stride(const block_timestep_t *block, const unsigned int level);
+
+/* Public function definitions */
+int block_timestep__reserve(block_timestep_t *block, const size_t capacity)
+{
+    if (capacity <= block->capacity)
+        return 0;
+
+    const unsigned int max_level = block->max_level;
+    unsigned char *level = malloc(capacity * sizeof(unsigned char));
+    double *force = malloc(3 * capacity * sizeof(double));
+    size_t *starting = malloc(capacity * sizeof(size_t));
+    size_t *ending = malloc(capacity * sizeof(size_t));
+
+    if (!level || !force || !starting || !ending) {
+        free(level);
+        free(force);
+        free(starting);
+        free(ending);
+        return 1;
+    }
+
+    block_timestep__free(block);
+
+    block->capacity = capacity;
+    block->max_level = max_level;
+    block->level = level;
+    block->start_force = (vector3d_array_t){force, force + capacity, force + 2 * capacity};
+    block->starting = starting;
+    block->ending = ending;
+
+    return 0;
+}
+
+void block_timestep__free(block_timestep_t *block)
+{
+    const unsigned int max_level = block->max_level;
+
+    free(block->level);
+    free(block->start_force.i);
+    free(block->starting);
+    free(block->ending);
+
+    *block = (block_timestep_t){.max_level = max_level};
+}
+
+void block_timestep__initial_levels(block_timestep_t *block, const particle_system_t *system,
+                                    const double max_period, const double accuracy)
+{
+    for (size_t n = 0; n < system->count; ++n) {
+
+        const double p = sqrt(system->momenta.i[n] * system->momenta.i[n] +
+                              system->momenta.j[n] * system->momenta.j[n] +
+                              system->momenta.k[n] * system->momenta.k[n]);
+        const double F = sqrt(system->force.i[n] * system->force.i[n] +
+                              system->force.j[n] * system->force.j[n] +
+                              system->force.k[n] * system->force.k[n]);
+
+        block->level[n] = (unsigned char)level_for_period(F > 0 ? accuracy * p / F : INFINITY, max_period, block->max_level);
+    }
+}
+
+unsigned long long int block_timestep__select(block_timestep_t *block, const size_t count, const unsigned long long int substep)
+{
+    unsigned int finest = 0;
+
+    for (size_t n = 0; n < count; ++n)
+        if (block->level[n] > finest)
+            finest = block->level[n];
+
+    /* Nobody starts or ends a step before the finest level does */
+    const unsigned long long int substeps = stride(block, finest);
+
+    block->starting_count = 0;
+    block->ending_count = 0;
+
+    for (size_t n = 0; n < count; ++n) {
+
+        const unsigned long long int particle_stride = stride(block, block->level[n]);
+
+        if (substep % particle_stride == 0)
+            block->starting[block->starting_count++] = n;
+        if ((substep + substeps) % particle_stride == 0)
+            block->ending[block->ending_count++] = n;
+    }
+
+    return substeps;
+}
+
+void block_timestep__begin_steps(block_timestep_t *block, particle_system_t *system, const double max_period)
+{
+    for (size_t a = 0; a < block->starting_count; ++a) {
+
+        const size_t n = block->starting[a];
+        const double half_period = block_timestep__period(block, n, max_period) / 2;
+
+        block->start_force.i[n] = system->force.i[n];
+        block->start_force.j[n] = system->force.j[n];
+        block->start_force.k[n] = system->force.k[n];
+
+        system->momenta.i[n] += system->force.i[n] * half_period;
+        system->momenta.j[n] += system->force.j[n] * half_period;
+        system->momenta.k[n] += system->force.k[n] * half_period;
+    }
+}
+
+void block_timestep__end_steps(block_timestep_t *block, particle_system_t *system, const unsigned long long int end_substep,
+                               const double max_period, const double accuracy)
+{
+    for (size_t a = 0; a < block->ending_count; ++a) {
+
+        const size_t n = block->ending[a];
+        const unsigned int level = block->level[n];
+        const double period = block_timestep__period(block, n, max_period);
+        const vector3d_t F = {system->force.i[n], system->force.j[n], system->force.k[n]};
+        const vector3d_t dF = {F.i - block->start_force.i[n], F.j - block->start_force.j[n], F.k - block->start_force.k[n]};
+        const double F_magnitude = sqrt(F.i * F.i + F.j * F.j + F.k * F.k);
+        const double dF_magnitude = sqrt(dF.i * dF.i + dF.j * dF.j + dF.k * dF.k);
+
+        system->momenta.i[n] += F.i * period / 2;
+        system->momenta.j[n] += F.j * period / 2;
+        system->momenta.k[n] += F.k * period / 2;
+
+        /* |F| / |dF/dt| with dF/dt taken across the step just finished */
+        const unsigned int wanted = level_for_period(dF_magnitude > 0 ? accuracy * period * F_magnitude / dF_magnitude : INFINITY,
+                                                     max_period, block->max_level);
+
+        /* Finer right away, coarser one level at a time and only where the coarser step would begin */
+        if (wanted > level)
+            block->level[n] = (unsigned char)wanted;
+        else if (wanted < level && end_substep % stride(block, level - 1) == 0)
+            block->level[n] = (unsigned char)(level - 1);
+    }
+}
+
+double block_timestep__period(const block_timestep_t *block, const size_t n, const double max_period)
+{
+    return ldexp(max_period, -(int)block->level[n]);
+}
+
+/* Private function definitions */
+static unsigned int level_for_period(const double period, const double max_period, const unsigned int max_level)
+{
+    if (!(period < max_period))
+        return 0;
+
+    const double level = ceil(log2(max_period / period));
+
+    return level < max_level ? (unsigned int)level : max_level;
+}
+
+/* Substeps in one step on this level */
+static unsigned long long int stride(const block_timestep_t *block, const unsigned int level)
+{
+    return 1ULL << (block->max_level - level);
+}
@@ -0,0 +1,368 @@
+#include "checkpoint.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mechanics.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#define DOUBLE_ARRAY_COUNT  18
+#define BYTE_ORDER_MARK     0x0102030405060708ULL
+#define CHECKSUM_SEED       0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME      0x100000001b3ULL
+#define TEMPORARY_SUFFIX    ".tmp"
+
+
+/* Everything but the particle arrays, written as is */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t byte_order;        // BYTE_ORDER_MARK as written by the saving host
+    uint64_t particle_count;
+    uint64_t step_count;
+    double sample_period;
+    double time;
+    uint32_t forces_current;
+    uint32_t has_block_levels;
+
+    /* mechanics_settings_t */
+    uint32_t solver;
+    uint32_t mesh_assignment;
+    uint64_t mesh_size;
+    double opening_angle;
+    double periodic_box[3];
+    uint32_t integrator;
+    uint32_t block_max_level;
+    double magnetic_field[3];
+    double block_accuracy;
+    double cutoff;
+    double skin;
+
+    uint64_t payload_size;
+    uint64_t checksum;          // over the payload, see checksum_update()
+
+} checkpoint_header_t;
+
+_Static_assert(sizeof(checkpoint_header_t) == 184, "checkpoint header must not contain padding");
+
+
+/* Private function declarations */
+static void double_arrays(const particle_system_t *system, double **arrays);
+static size_t levels_size(const size_t particle_count);
+static size_t payload_size(const size_t particle_count, const int has_block_levels);
+static uint64_t checksum_update(uint64_t hash, const void *data, const size_t size);
+static int write_file(const char *filepath, const checkpoint_header_t *header, const particle_system_t *system,
+                      const unsigned char *levels);
+static int replace_file(const char *source, const char *destination);
+static particle_system_t *restore(const unsigned char *data, const size_t size, const size_t particle_count,
+                                  double *sample_period);
+static const unsigned char *map_file(const char *filepath, size_t *size);
+static void unmap_file(const unsigned char *data, const size_t size);
+
+/* Public function definitions */
+int checkpoint__write(const char *filepath, const particle_system_t *system, const double sample_period)
+{
+    const mechanics_settings_t settings = get_mechanics_settings();
+    const unsigned char *levels = settings.integrator == INTEGRATOR_BLOCK_TIMESTEP ? get_block_levels(system) : NULL;
+    char *temporary = malloc(strlen(filepath) + sizeof(TEMPORARY_SUFFIX));
+    double *arrays[DOUBLE_ARRAY_COUNT];
+    uint64_t checksum = CHECKSUM_SEED;
+
+    if (!temporary)
+        return 1;
+
+    double_arrays(system, arrays);
+
+    for (size_t a = 0; a < DOUBLE_ARRAY_COUNT; ++a)
+        checksum = checksum_update(checksum, arrays[a], system->count * sizeof(double));
+    checksum = checksum_update(checksum, system->id, system->count * sizeof(unsigned long long int));
+    if (levels)
+        checksum = checksum_update(checksum, levels, system->count);
+
+    const checkpoint_header_t header = {
+        .magic = CHECKPOINT_MAGIC,
+        .version = CHECKPOINT_VERSION,
+        .header_size = sizeof(checkpoint_header_t),
+        .byte_order = BYTE_ORDER_MARK,
+        .particle_count = system->count,
+        .step_count = system->step_count,
+        .sample_period = sample_period,
+        .time = system->time,
+        .forces_current = (uint32_t)system->forces_current,
+        .has_block_levels = levels != NULL,
+        .solver = settings.solver,
+        .mesh_assignment = settings.mesh_assignment,
+        .mesh_size = settings.mesh_size,
+        .opening_angle = settings.opening_angle,
+        .periodic_box = {settings.periodic_box.i, settings.periodic_box.j, settings.periodic_box.k},
+        .integrator = settings.integrator,
+        .block_max_level = settings.block_max_level,
+        .magnetic_field = {settings.magnetic_field.i, settings.magnetic_field.j, settings.magnetic_field.k},
+        .block_accuracy = settings.block_accuracy,
+        .cutoff = settings.cutoff,
+        .skin = settings.skin,
+        .payload_size = payload_size(system->count, levels != NULL),
+        .checksum = checksum,
+    };
+
+    strcpy(temporary, filepath);
+    strcat(temporary, TEMPORARY_SUFFIX);
+
+    const int failed = write_file(temporary, &header, system, levels) || replace_file(temporary, filepath);
+
+    if (failed)
+        remove(temporary);
+
+    free(temporary);
+
+    return failed;
+}
+
+particle_system_t *checkpoint__read(const char *filepath, const size_t particle_count, double *sample_period)
+{
+    size_t size;
+    const unsigned char *data = map_file(filepath, &size);
+
+    if (!data)
+        return NULL;
+
+    particle_system_t *system = restore(data, size, particle_count, sample_period);
+
+    unmap_file(data, size);
+
+    return system;
+}
+
+/* Private function definitions */
+static void double_arrays(const particle_system_t *system, double **arrays)
+{
+    double *const all[DOUBLE_ARRAY_COUNT] = {
+        system->pos.i, system->pos.j, system->pos.k,
+        system->momenta.i, system->momenta.j, system->momenta.k,
+        system->mass, system->charge, system->radius,
+        system->orientation.i, system->orientation.j, system->orientation.k,
+        system->angular_momenta.i, system->angular_momenta.j, system->angular_momenta.k,
+        system->force.i, system->force.j, system->force.k,
+    };
+
+    memcpy(arrays, all, sizeof(all));
+}
+
+/* One byte per particle, padded so the payload stays a whole number of words */
+static size_t levels_size(const size_t particle_count)
+{
+    return (particle_count + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+static size_t payload_size(const size_t particle_count, const int has_block_levels)
+{
+    return particle_count * (DOUBLE_ARRAY_COUNT * sizeof(double) + sizeof(uint64_t)) +
+           (has_block_levels ? levels_size(particle_count) : 0);
+}
+
+/**
+ * FNV-1a taken a 64 bit word at a time, the last word zero padded.
+ * Pieces hashed one after another give the same result as hashing
+ * them joined up, as long as only the last one has a partial word.
+ */
+static uint64_t checksum_update(uint64_t hash, const void *data, const size_t size)
+{
+    const unsigned char *bytes = data;
+    const size_t whole_words = size / sizeof(uint64_t);
+    uint64_t word;
+
+    for (size_t w = 0; w < whole_words; ++w) {
+        memcpy(&word, bytes + w * sizeof(uint64_t), sizeof(uint64_t));
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+    }
+
+    if (size % sizeof(uint64_t)) {
+        word = 0;
+        memcpy(&word, bytes + whole_words * sizeof(uint64_t), size % sizeof(uint64_t));
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+    }
+
+    return hash;
+}
+
+static int write_file(const char *filepath, const checkpoint_header_t *header, const particle_system_t *system,
+                      const unsigned char *levels)
+{
+    static const unsigned char padding[sizeof(uint64_t)];
+    FILE *file = fopen(filepath, "wb");
+    double *arrays[DOUBLE_ARRAY_COUNT];
+    const size_t count = system->count;
+    int failed;
+
+    if (!file)
+        return 1;
+
+    double_arrays(system, arrays);
+
+    failed = fwrite(header, sizeof(checkpoint_header_t), 1, file) != 1;
+
+    for (size_t a = 0; a < DOUBLE_ARRAY_COUNT; ++a)
+        failed |= fwrite(arrays[a], sizeof(double), count, file) != count;
+    failed |= fwrite(system->id, sizeof(unsigned long long int), count, file) != count;
+
+    if (levels) {
+        failed |= fwrite(levels, 1, count, file) != count;
+        failed |= fwrite(padding, 1, levels_size(count) - count, file) != levels_size(count) - count;
+    }
+
+    /* On the disk before the rename makes it the checkpoint */
+    failed |= fflush(file) != 0;
+    #ifdef _WIN32
+    failed |= _commit(_fileno(file)) != 0;
+    #else
+    failed |= fsync(fileno(file)) != 0;
+    #endif
+    failed |= fclose(file) != 0;
+
+    return failed;
+}
+
+static int replace_file(const char *source, const char *destination)
+{
+    #ifdef _WIN32
+    return !MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    #else
+    return rename(source, destination) != 0;
+    #endif
+}
+
+static particle_system_t *restore(const unsigned char *data, const size_t size, const size_t particle_count,
+                                  double *sample_period)
+{
+    checkpoint_header_t header;
+    particle_system_t *system;
+    double *arrays[DOUBLE_ARRAY_COUNT];
+
+    if (size < sizeof(checkpoint_header_t))
+        return NULL;
+
+    memcpy(&header, data, sizeof(checkpoint_header_t));
+
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) || header.version != CHECKPOINT_VERSION ||
+        header.header_size != sizeof(checkpoint_header_t) || header.byte_order != BYTE_ORDER_MARK)
+        return NULL;
+
+    if (particle_count != CHECKPOINT_ANY_COUNT && header.particle_count != particle_count)
+        return NULL;
+
+    const size_t count = header.particle_count;
+    const unsigned char *payload = data + sizeof(checkpoint_header_t);
+
+    if (header.payload_size != payload_size(count, header.has_block_levels != 0) ||
+        size - sizeof(checkpoint_header_t) < header.payload_size ||
+        checksum_update(CHECKSUM_SEED, payload, header.payload_size) != header.checksum)
+        return NULL;
+
+    if (!(system = particle_system__new(count ? count : 1)))
+        return NULL;
+
+    double_arrays(system, arrays);
+
+    for (size_t a = 0; a < DOUBLE_ARRAY_COUNT; ++a)
+        memcpy(arrays[a], payload + a * count * sizeof(double), count * sizeof(double));
+    memcpy(system->id, payload + DOUBLE_ARRAY_COUNT * count * sizeof(double), count * sizeof(unsigned long long int));
+
+    system->count = count;
+    system->time = header.time;
+    system->step_count = header.step_count;
+    system->forces_current = (int)header.forces_current;
+    *sample_period = header.sample_period;
+
+    const mechanics_settings_t settings = {
+        .solver = (force_solver_t)header.solver,
+        .opening_angle = header.opening_angle,
+        .mesh_size = header.mesh_size,
+        .mesh_assignment = (mesh_assignment_t)header.mesh_assignment,
+        .periodic_box = {header.periodic_box[0], header.periodic_box[1], header.periodic_box[2]},
+        .integrator = (integrator_t)header.integrator,
+        .magnetic_field = {header.magnetic_field[0], header.magnetic_field[1], header.magnetic_field[2]},
+        .block_max_level = header.block_max_level,
+        .block_accuracy = header.block_accuracy,
+        .cutoff = header.cutoff,
+        .skin = header.skin,
+    };
+
+    const mechanics_settings_t previous = get_mechanics_settings();
+
+    set_mechanics_settings(&settings);
+
+    if (header.has_block_levels &&
+        set_block_levels(system, payload + count * (DOUBLE_ARRAY_COUNT * sizeof(double) + sizeof(uint64_t)))) {
+        set_mechanics_settings(&previous);
+        particle_system__delete(system);
+        return NULL;
+    }
+
+    return system;
+}
+
+/* Read-only view of a whole file, mapped where there is mmap, read into memory elsewhere */
+static const unsigned char *map_file(const char *filepath, size_t *size)
+{
+    #ifdef _WIN32
+    FILE *file = fopen(filepath, "rb");
+    unsigned char *data = NULL;
+    long length;
+
+    if (!file)
+        return NULL;
+
+    if (!fseek(file, 0, SEEK_END) && (length = ftell(file)) > 0 && !fseek(file, 0, SEEK_SET) &&
+        (data = malloc((size_t)length)) && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+
+    return data;
+    #else
+    const int fd = open(filepath, O_RDONLY);
+    struct stat status;
+    void *data = MAP_FAILED;
+
+    if (fd < 0)
+        return NULL;
+
+    if (!fstat(fd, &status) && status.st_size > 0)
+        data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping outlives the descriptor */
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)status.st_size;
+
+    return data;
+    #endif
+}
+
+static void unmap_file(const unsigned char *data, const size_t size)
+{
+    #ifdef _WIN32
+    free((void *)(uintptr_t)data);
+    #else
+    munmap((void *)(uintptr_t)data, size);
+    #endif
+}
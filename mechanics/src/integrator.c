@@ -0,0 +1,186 @@
+#include "integrator.h"
+
+#include <math.h>
+
+#include "periodic.h"
+
+
+#define RK4_ARRAY_COUNT     12
+
+
+/* Private function declarations */
+static void wrap_range(particle_system_t *system, const size_t begin, const size_t end, const vector3d_t periodic_box);
+
+/* Public function definitions */
+void integrator__kick(particle_system_t *system, const size_t begin, const size_t end, const double dt)
+{
+    for (size_t n = begin; n < end; ++n) {
+        system->momenta.i[n] += system->force.i[n] * dt;
+        system->momenta.j[n] += system->force.j[n] * dt;
+        system->momenta.k[n] += system->force.k[n] * dt;
+    }
+}
+
+void integrator__drift(particle_system_t *system, const size_t begin, const size_t end, const double dt,
+                       const vector3d_t periodic_box)
+{
+    for (size_t n = begin; n < end; ++n) {
+        const double period_over_mass = dt / system->mass[n];
+        system->pos.i[n] += system->momenta.i[n] * period_over_mass;
+        system->pos.j[n] += system->momenta.j[n] * period_over_mass;
+        system->pos.k[n] += system->momenta.k[n] * period_over_mass;
+    }
+
+    wrap_range(system, begin, end, periodic_box);
+}
+
+void integrator__spin(particle_system_t *system, const size_t begin, const size_t end, const double dt)
+{
+    for (size_t n = begin; n < end; ++n) {
+        const double moment_of_inertia_of_a_sphere = 1.4 * system->mass[n] * system->radius[n] * system->radius[n];
+        const double period_over_inertia = dt / moment_of_inertia_of_a_sphere;
+        system->orientation.i[n] += system->angular_momenta.i[n] * period_over_inertia;
+        system->orientation.j[n] += system->angular_momenta.j[n] * period_over_inertia;
+        system->orientation.k[n] += system->angular_momenta.k[n] * period_over_inertia;
+    }
+}
+
+/**
+ * Boris, "Relativistic plasma simulation-optimization of a hybrid code".
+ * With t = q B dt / 2m and s = 2t / (1 + t.t),
+ *
+ *     p' = p + p x t
+ *     p  = p + p' x s
+ *
+ * is a rotation by 2 atan(|t|), no trigonometry needed.
+ */
+void integrator__boris_rotate(particle_system_t *system, const size_t begin, const size_t end, const double dt,
+                              const vector3d_t magnetic_field)
+{
+    for (size_t n = begin; n < end; ++n) {
+
+        const vector3d_t t = vector3d__scale(magnetic_field, system->charge[n] * dt / (2 * system->mass[n]));
+        const vector3d_t s = vector3d__scale(t, 2 / (1 + vector3d__dot_product(t, t)));
+        const vector3d_t p = {system->momenta.i[n], system->momenta.j[n], system->momenta.k[n]};
+        const vector3d_t p_prime = vector3d__add(p, vector3d__cross_product(p, t));
+        const vector3d_t p_rotated = vector3d__add(p, vector3d__cross_product(p_prime, s));
+
+        system->momenta.i[n] = p_rotated.i;
+        system->momenta.j[n] = p_rotated.j;
+        system->momenta.k[n] = p_rotated.k;
+    }
+}
+
+int integrator__rk4_reserve(rk4_workspace_t *workspace, const size_t capacity)
+{
+    if (capacity <= workspace->capacity)
+        return 0;
+
+    double *block = malloc(RK4_ARRAY_COUNT * capacity * sizeof(double));
+    vector3d_array_t *arrays[] = {&workspace->pos0, &workspace->momenta0, &workspace->pos_slope, &workspace->momenta_slope};
+
+    if (!block)
+        return 1;
+
+    integrator__rk4_free(workspace);
+
+    /* One block sliced into the twelve arrays, freed through pos0.i */
+    for (size_t a = 0; a < RK4_ARRAY_COUNT / 3; ++a) {
+        arrays[a]->i = block + (3 * a + 0) * capacity;
+        arrays[a]->j = block + (3 * a + 1) * capacity;
+        arrays[a]->k = block + (3 * a + 2) * capacity;
+    }
+
+    workspace->capacity = capacity;
+
+    return 0;
+}
+
+void integrator__rk4_free(rk4_workspace_t *workspace)
+{
+    free(workspace->pos0.i);
+    *workspace = (rk4_workspace_t){0};
+}
+
+/**
+ * The state is y = (pos, momenta) with slope (momenta / mass, force).
+ * Slopes are summed with the 1, 2, 2, 1 weights as the stages go.
+ */
+void integrator__rk4_stage(rk4_workspace_t *workspace, particle_system_t *system, const size_t begin, const size_t end,
+                           const double dt, const unsigned int stage, const vector3d_t periodic_box)
+{
+    const double weight = (stage == 1 || stage == 2) ? 2 : 1;
+    const double step_to_next = stage < 2 ? dt / 2 : dt;
+    vector3d_array_t pos0 = workspace->pos0, momenta0 = workspace->momenta0;
+    vector3d_array_t pos_slope = workspace->pos_slope, momenta_slope = workspace->momenta_slope;
+
+    for (size_t n = begin; n < end; ++n) {
+
+        const double inverse_mass = 1 / system->mass[n];
+        const vector3d_t velocity = {system->momenta.i[n] * inverse_mass, system->momenta.j[n] * inverse_mass, system->momenta.k[n] * inverse_mass};
+        const vector3d_t force = {system->force.i[n], system->force.j[n], system->force.k[n]};
+
+        if (stage == 0) {
+            pos0.i[n] = system->pos.i[n];
+            pos0.j[n] = system->pos.j[n];
+            pos0.k[n] = system->pos.k[n];
+            momenta0.i[n] = system->momenta.i[n];
+            momenta0.j[n] = system->momenta.j[n];
+            momenta0.k[n] = system->momenta.k[n];
+            pos_slope.i[n] = pos_slope.j[n] = pos_slope.k[n] = 0;
+            momenta_slope.i[n] = momenta_slope.j[n] = momenta_slope.k[n] = 0;
+        }
+
+        pos_slope.i[n] += weight * velocity.i;
+        pos_slope.j[n] += weight * velocity.j;
+        pos_slope.k[n] += weight * velocity.k;
+        momenta_slope.i[n] += weight * force.i;
+        momenta_slope.j[n] += weight * force.j;
+        momenta_slope.k[n] += weight * force.k;
+
+        if (stage < 3) {
+            system->pos.i[n] = pos0.i[n] + step_to_next * velocity.i;
+            system->pos.j[n] = pos0.j[n] + step_to_next * velocity.j;
+            system->pos.k[n] = pos0.k[n] + step_to_next * velocity.k;
+            system->momenta.i[n] = momenta0.i[n] + step_to_next * force.i;
+            system->momenta.j[n] = momenta0.j[n] + step_to_next * force.j;
+            system->momenta.k[n] = momenta0.k[n] + step_to_next * force.k;
+        }
+        else {
+            system->pos.i[n] = pos0.i[n] + dt / 6 * pos_slope.i[n];
+            system->pos.j[n] = pos0.j[n] + dt / 6 * pos_slope.j[n];
+            system->pos.k[n] = pos0.k[n] + dt / 6 * pos_slope.k[n];
+            system->momenta.i[n] = momenta0.i[n] + dt / 6 * momenta_slope.i[n];
+            system->momenta.j[n] = momenta0.j[n] + dt / 6 * momenta_slope.j[n];
+            system->momenta.k[n] = momenta0.k[n] + dt / 6 * momenta_slope.k[n];
+        }
+    }
+
+    wrap_range(system, begin, end, periodic_box);
+}
+
+const char *integrator_name(const integrator_t integrator)
+{
+    switch (integrator) {
+    case INTEGRATOR_EXPLICIT_EULER:     return "explicit_euler";
+    case INTEGRATOR_SYMPLECTIC_EULER:   return "symplectic_euler";
+    case INTEGRATOR_VELOCITY_VERLET:    return "velocity_verlet";
+    case INTEGRATOR_RK4:                return "rk4";
+    case INTEGRATOR_BORIS:              return "boris";
+    case INTEGRATOR_BLOCK_TIMESTEP:     return "block_timestep";
+    default:                            return "unknown";
+    }
+}
+
+/* Private function definitions */
+static void wrap_range(particle_system_t *system, const size_t begin, const size_t end, const vector3d_t periodic_box)
+{
+    if (periodic_box.i <= 0 && periodic_box.j <= 0 && periodic_box.k <= 0)
+        return;
+
+    for (size_t n = begin; n < end; ++n) {
+        system->pos.i[n] = periodic__wrap(system->pos.i[n], periodic_box.i);
+        system->pos.j[n] = periodic__wrap(system->pos.j[n], periodic_box.j);
+        system->pos.k[n] = periodic__wrap(system->pos.k[n], periodic_box.k);
+    }
+}
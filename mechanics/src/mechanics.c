@@ -1,29 +1,140 @@
 #include "mechanics.h"
 
 #include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
 
+#include "async_log.h"
+#include "barnes_hut.h"
+#include "block_timestep.h"
+#include "instrumentation.h"
+#include "integrator.h"
+#include "neighbour_list.h"
+#include "pair_kernel.h"
+#include "periodic.h"
+#include "spatial_hash.h"
+#include "thread_pool.h"
 #include "log.h"
 
 
-// #define __USE_GRAVITY
-
 #define LOCAL_EPSILON               1E-128
 
-#define UNIVERSAL_GRAVITY_CONST     6.6743E-17 // (N*m^2)/(g^2)
-#define COULOMB_CONST               8.9875E9  // (N*m^2)/(C^2)
+/* Particles per tile of work handed to a thread */
+#define FORCE_TILE_SIZE             16
+#define INTEGRATION_TILE_SIZE       1024
+#define COLLISION_TILE_SIZE         256
 
 
 extern log_t *log_handle;
 
+static force_solver_t force_solver = FORCE_SOLVER_DIRECT;
+static double opening_angle = DEFAULT_OPENING_ANGLE;
+static barnes_hut_t *tree;
+static size_t mesh_size = DEFAULT_MESH_SIZE;
+static mesh_assignment_t mesh_assignment = MESH_ASSIGNMENT_CIC;
+static particle_mesh_t *mesh;
+static double cutoff;
+static double skin;
+static neighbour_list_t *neighbours;
+static vector3d_t periodic_box;
+static spatial_hash_t *collision_hash;
+static integrator_t integrator = INTEGRATOR_SYMPLECTIC_EULER;
+static vector3d_t magnetic_field;
+static rk4_workspace_t rk4_workspace;
+static block_timestep_t block = {.max_level = DEFAULT_BLOCK_MAX_LEVEL};
+static double block_accuracy = DEFAULT_BLOCK_ACCURACY;
+static const particle_system_t *block_system;  // system and particle count the levels in block belong to
+static size_t block_count;
+static unsigned long long int block_force_evaluations;
+static unsigned int thread_count;
+static int deterministic;
+static thread_pool_t *pool;
+static pair_sources_t float_sources;
+static int text_logging;
+static async_log_t *async_log;
+
+/* Broad phase candidates of each collision tile, kept in tile order so the result does not depend on scheduling */
+typedef struct
+{
+    pair_list_t list;
+    int failed;
+
+} collision_tile_t;
+
+static collision_tile_t *collision_tiles;
+static size_t collision_tile_count;
+
+/**
+ * Forces on the particles listed in active, or on every particle if
+ * active is NULL.  The direct sum reads sources instead of the system
+ * when they are set.
+ */
+typedef struct
+{
+    particle_system_t *system;
+    const size_t *active;
+    const pair_sources_t *sources;
+
+} force_context_t;
+
+typedef enum
+{
+    PHASE_KICK,
+    PHASE_DRIFT,
+    PHASE_SPIN,
+    PHASE_BORIS_ROTATE,
+    PHASE_RK4_STAGE,
+
+} integration_phase_t;
+
+typedef struct
+{
+    particle_system_t *system;
+    integration_phase_t phase;
+    double dt;
+    unsigned int stage;
+
+} step_context_t;
+
+/* Pair potential energy summed per tile, added up in tile order afterwards */
+typedef struct
+{
+    const particle_system_t *system;
+    double *tile_energy;
+    double cutoff;      // shifted-force potential within it, the plain one if 0
+
+} energy_context_t;
+
 
 /* Private function declarations */
 static void update_momenta(particle_t *particle, const vector3d_t F, const double sample_period);
 static void update_position(particle_t *particle, const double sample_period);
 static void update_angular_momenta(particle_t *particle, const vector3d_t r, const vector3d_t momentum);
 static void update_orientation(particle_t *particle, const double sample_period);
-static vector3d_t resultant_force_from_fields(particle_t **particles, const size_t particle_count, const size_t this);
 static void elastic_collision_linear_momenta_update(particle_t *this, particle_t *that);
 static void update_angular_momenta_after_collision(particle_t *this, particle_t *that);
+static thread_pool_t *worker_pool(void);
+static const pair_sources_t *float_sources_of(const particle_system_t *system);
+static void direct_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count, const pair_sources_t *sources);
+static void direct_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static int barnes_hut_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count);
+static void barnes_hut_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static int particle_mesh_forces_soa(particle_system_t *system);
+static int neighbour_list_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count);
+static void neighbour_list_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static void forces_soa(particle_system_t *system);
+static void integrate_soa(particle_system_t *system, const double sample_period);
+static void block_step_soa(particle_system_t *system, const double sample_period);
+static void active_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count);
+static void run_phase(particle_system_t *system, const integration_phase_t phase, const double dt, const unsigned int stage);
+static void integrate_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static void potential_energy_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static void collisions_soa(particle_system_t *system, const double sample_period);
+static void collision_candidates_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static int detect_collision_soa(const particle_system_t *system, const size_t this, const size_t that);
+static void resolve_collision_soa(particle_system_t *system, const size_t this, const size_t that, const double sample_period);
+static void write_log(const log_level_t level, const char *format, ...);
+static void log_particle_soa(const particle_system_t *system, const size_t n);
 
 /* Public function definitions */
 double gravitational_force(const double m1, const double m2, double r)
@@ -74,6 +185,9 @@ vector3d_t componentize_force_3d(const double F, const vector3d_t direction_vect
 
 void time_evolution(particle_t **particles, const size_t particle_count, const double sample_period)
 {
+    INSTRUMENT_SCOPE(TIMER_STEP);
+
+    /* Phases interleave per particle here, so only the whole step is timed */
     for (size_t this = 0; this < particle_count; ++this) {
 
         update_momenta(particles[this], resultant_force_from_fields(particles, particle_count, this), sample_period);
@@ -82,7 +196,7 @@ void time_evolution(particle_t **particles, const size_t particle_count, const d
 
         /* Simple check for collision with another particle and perform momentum update */
         for (size_t that = 0; that < particle_count; ++that) {
-            
+        
             if (particles[this]->id == particles[that]->id) continue;
 
             if (detect_collision(particles[this], particles[that])) {
@@ -96,55 +210,348 @@ void time_evolution(particle_t **particles, const size_t particle_count, const d
             }
         }
 
-        log__write(log_handle, LOG_DATA, "%i,%E,%E,%E,%E,%E,%f,%f,%f,%E,%E,%E,%f,%f,%f",
-        particles[this]->id, particles[this]->mass, particles[this]->charge, 
-        particles[this]->momenta.i, particles[this]->momenta.j, particles[this]->momenta.k,
-        particles[this]->pos.i, particles[this]->pos.j, particles[this]->pos.k,
-        particles[this]->angular_momenta.i,particles[this]->angular_momenta.j,particles[this]->angular_momenta.k,
-        particles[this]->orientation.i,particles[this]->orientation.j,particles[this]->orientation.k);
+        if (text_logging) {
+            write_log(LOG_DATA, "%i,%E,%E,%E,%E,%E,%f,%f,%f,%E,%E,%E,%f,%f,%f",
+            particles[this]->id, particles[this]->mass, particles[this]->charge,
+            particles[this]->momenta.i, particles[this]->momenta.j, particles[this]->momenta.k,
+            particles[this]->pos.i, particles[this]->pos.j, particles[this]->pos.k,
+            particles[this]->angular_momenta.i,particles[this]->angular_momenta.j,particles[this]->angular_momenta.k,
+            particles[this]->orientation.i,particles[this]->orientation.j,particles[this]->orientation.k);
+        }
     }
 
-    log__write(log_handle, LOG_NONE, "");
+    if (text_logging)
+        write_log(LOG_NONE, "");
 }
 
-int detect_collision(const particle_t *this, const particle_t *that)
+void time_evolution_soa(particle_system_t *system, const double sample_period)
 {
-    return vector3d__distance(this->pos, that->pos) < (this->radius + that->radius);
+    INSTRUMENT_SCOPE(TIMER_STEP);
+
+    integrate_soa(system, sample_period);
+    collisions_soa(system, sample_period);
+
+    system->time += sample_period;
+    system->step_count++;
+
+    if (!text_logging)
+        return;
+
+    INSTRUMENT_SCOPE(TIMER_LOGGING);
+
+    for (size_t n = 0; n < system->count; ++n)
+        log_particle_soa(system, n);
+
+    write_log(LOG_NONE, "");
 }
 
-/* Private function definitions */
-static void update_momenta(particle_t *particle, const vector3d_t F, const double sample_period)
+void set_force_solver(const force_solver_t solver)
 {
-    particle->momenta = vector3d__add(particle->momenta, vector3d__scale(F, sample_period));
+    force_solver = solver;
 }
 
-static void update_position(particle_t *particle, const double sample_period)
+force_solver_t get_force_solver(void)
 {
-    const vector3d_t change_in_velocity = vector3d__scale(particle->momenta, 1 / particle->mass);
-    particle->pos = vector3d__add(particle->pos, vector3d__scale(change_in_velocity, sample_period));
+    return force_solver;
 }
 
-static void update_angular_momenta(particle_t *particle, const vector3d_t r, const vector3d_t momentum)
+void set_opening_angle(const double theta)
 {
-    /**
-     * Violating conservation of momentum and angular momentum here for the sake of simplicity.
-     * TODO: Don't violate the laws of nature!
-     */
-    particle->angular_momenta = vector3d__add(particle->angular_momenta, vector3d__cross_product(r, momentum));
+    opening_angle = theta;
 }
 
-static void update_orientation(particle_t *particle, const double sample_period)
+void set_mesh(const size_t grid_size, const mesh_assignment_t assignment)
 {
-    /**
-     * Moment of inertia of a sphere about its axis is 4/5 M R^2
-     * with respect to its surface is 7/5 M R^2
-     */
-    const double moment_of_inertia_of_a_sphere = 1.4 * particle->mass * particle->radius * particle->radius;
-    const vector3d_t change_in_orientation = vector3d__scale(particle->angular_momenta, 1 / moment_of_inertia_of_a_sphere);
-    particle->orientation = vector3d__add(particle->orientation, vector3d__scale(change_in_orientation, sample_period));
+    mesh_size = grid_size;
+    mesh_assignment = assignment;
+}
+
+void set_cutoff(const double radius, const double skin_width)
+{
+    cutoff = radius;
+    skin = skin_width;
+}
+
+unsigned long long int get_neighbour_list_builds(void)
+{
+    return neighbours ? neighbour_list__build_count(neighbours) : 0;
+}
+
+void free_mechanics_workspace(void)
+{
+    barnes_hut__delete(tree);
+    tree = NULL;
+    particle_mesh__delete(mesh);
+    mesh = NULL;
+    neighbour_list__delete(neighbours);
+    neighbours = NULL;
+    spatial_hash__delete(collision_hash);
+    collision_hash = NULL;
+    for (size_t n = 0; n < collision_tile_count; ++n)
+        pair_list__free(&collision_tiles[n].list);
+    free(collision_tiles);
+    integrator__rk4_free(&rk4_workspace);
+    block_timestep__free(&block);
+    block_system = NULL;
+    collision_tiles = NULL;
+    collision_tile_count = 0;
+    thread_pool__delete(pool);
+    pool = NULL;
+    pair_sources__free(&float_sources);
+}
+
+void set_integrator(const integrator_t scheme)
+{
+    integrator = scheme;
+}
+
+integrator_t get_integrator(void)
+{
+    return integrator;
+}
+
+void set_magnetic_field(const vector3d_t B)
+{
+    magnetic_field = B;
+}
+
+vector3d_t get_magnetic_field(void)
+{
+    return magnetic_field;
+}
+
+void set_text_logging(const int enabled)
+{
+    if (enabled && !text_logging)
+        write_log(LOG_DATA, "particle_id,mass,charge,x_momenta,y_momenta,z_momenta,x_pos,y_pos,z_pos,pitch_momenta,roll_momenta,yaw_momenta,pitch,roll,yaw");
+
+    text_logging = enabled;
+}
+
+int get_text_logging(void)
+{
+    return text_logging;
+}
+
+void set_async_log(async_log_t *log)
+{
+    async_log = log;
+}
+
+double kinetic_energy(const particle_system_t *system)
+{
+    double energy = 0;
+
+    for (size_t n = 0; n < system->count; ++n)
+        energy += (system->momenta.i[n] * system->momenta.i[n] +
+                   system->momenta.j[n] * system->momenta.j[n] +
+                   system->momenta.k[n] * system->momenta.k[n]) / (2 * system->mass[n]);
+
+    return energy * UNIT_ENERGY;
+}
+
+double potential_energy(const particle_system_t *system)
+{
+    const size_t tile_count = (system->count + FORCE_TILE_SIZE - 1) / FORCE_TILE_SIZE;
+    energy_context_t context = {
+        .system = system,
+        .tile_energy = calloc(tile_count ? tile_count : 1, sizeof(double)),
+        .cutoff = force_solver == FORCE_SOLVER_NEIGHBOUR_LIST ? cutoff : 0
+    };
+    double energy = 0;
+
+    if (!context.tile_energy)
+        return NAN;
+
+    thread_pool__parallel_for(worker_pool(), system->count, FORCE_TILE_SIZE, potential_energy_tile, &context);
+
+    for (size_t t = 0; t < tile_count; ++t)
+        energy += context.tile_energy[t];
+
+    free(context.tile_energy);
+
+    return energy * UNIT_ENERGY;
+}
+
+double total_energy(const particle_system_t *system)
+{
+    return kinetic_energy(system) + potential_energy(system);
+}
+
+double energy_drift(const particle_system_t *system, const double reference_energy)
+{
+    const double energy = total_energy(system);
+
+    return reference_energy != 0 ? (energy - reference_energy) / fabs(reference_energy) : energy;
+}
+
+void set_block_timestep(const unsigned int max_level, const double accuracy)
+{
+    const unsigned int level = max_level < MAX_BLOCK_LEVEL ? max_level : MAX_BLOCK_LEVEL;
+
+    if (level != block.max_level)
+        block_system = NULL;
+
+    block.max_level = level;
+    block_accuracy = accuracy;
+}
+
+unsigned long long int get_block_force_evaluations(void)
+{
+    return block_force_evaluations;
+}
+
+const unsigned char *get_block_levels(const particle_system_t *system)
+{
+    return system == block_system && system->count == block_count ? block.level : NULL;
+}
+
+int set_block_levels(const particle_system_t *system, const unsigned char *levels)
+{
+    if (block_timestep__reserve(&block, system->count))
+        return 1;
+
+    for (size_t n = 0; n < system->count; ++n)
+        block.level[n] = levels[n] < block.max_level ? levels[n] : (unsigned char)block.max_level;
+
+    block_system = system;
+    block_count = system->count;
+
+    return 0;
 }
 
-static vector3d_t resultant_force_from_fields(particle_t **particles, const size_t particle_count, const size_t this)
+mechanics_settings_t get_mechanics_settings(void)
+{
+    return (mechanics_settings_t){
+        .solver = force_solver,
+        .opening_angle = opening_angle,
+        .mesh_size = mesh_size,
+        .mesh_assignment = mesh_assignment,
+        .periodic_box = periodic_box,
+        .integrator = integrator,
+        .magnetic_field = magnetic_field,
+        .block_max_level = block.max_level,
+        .block_accuracy = block_accuracy,
+        .cutoff = cutoff,
+        .skin = skin,
+    };
+}
+
+void set_mechanics_settings(const mechanics_settings_t *settings)
+{
+    set_force_solver(settings->solver);
+    set_opening_angle(settings->opening_angle);
+    set_mesh(settings->mesh_size, settings->mesh_assignment);
+    set_periodic_box(settings->periodic_box);
+    set_integrator(settings->integrator);
+    set_magnetic_field(settings->magnetic_field);
+    set_block_timestep(settings->block_max_level, settings->block_accuracy);
+    set_cutoff(settings->cutoff, settings->skin);
+}
+
+void set_thread_count(const unsigned int count)
+{
+    if (count == thread_count) return;
+
+    thread_pool__delete(pool);
+    pool = NULL;
+    thread_count = count;
+}
+
+unsigned int get_thread_count(void)
+{
+    return thread_count ? thread_count : thread_pool__processor_count();
+}
+
+void set_deterministic(const int enabled)
+{
+    deterministic = enabled;
+}
+
+int get_deterministic(void)
+{
+    return deterministic;
+}
+
+void set_periodic_box(const vector3d_t length)
+{
+    periodic_box = length;
+}
+
+vector3d_t get_periodic_box(void)
+{
+    return periodic_box;
+}
+
+int compute_forces(particle_system_t *system)
+{
+    switch (force_solver) {
+
+    case FORCE_SOLVER_BARNES_HUT:
+        if (barnes_hut_forces_soa(system, NULL, system->count))
+            return 1;
+        break;
+
+    case FORCE_SOLVER_PARTICLE_MESH:
+        if (particle_mesh_forces_soa(system))
+            return 1;
+        break;
+
+    case FORCE_SOLVER_NEIGHBOUR_LIST:
+        if (neighbour_list_forces_soa(system, NULL, system->count))
+            return 1;
+        break;
+
+    case FORCE_SOLVER_DIRECT:
+    default:
+        direct_forces_soa(system, NULL, system->count, float_sources_of(system));
+        break;
+    }
+
+    system->forces_current = 1;
+
+    return 0;
+}
+
+force_error_t force_solver_error(particle_system_t *system)
+{
+    force_error_t error = {0};
+    double difference_sum = 0, reference_sum = 0;
+    vector3d_t *reference = malloc(system->count * sizeof(vector3d_t));
+
+    if (!reference)
+        return (force_error_t){.rms_relative = INFINITY, .max_relative = INFINITY};
+
+    direct_forces_soa(system, NULL, system->count, NULL);
+    for (size_t n = 0; n < system->count; ++n)
+        reference[n] = (vector3d_t){system->force.i[n], system->force.j[n], system->force.k[n]};
+
+    if (compute_forces(system)) {
+        free(reference);
+        return (force_error_t){.rms_relative = INFINITY, .max_relative = INFINITY};
+    }
+
+    for (size_t n = 0; n < system->count; ++n) {
+
+        const vector3d_t F = {system->force.i[n], system->force.j[n], system->force.k[n]};
+        const double difference = vector3d__distance(F, reference[n]);
+        const double magnitude = vector3d__mag(reference[n]);
+
+        difference_sum += difference * difference;
+        reference_sum += magnitude * magnitude;
+
+        if (magnitude > 0 && difference / magnitude > error.max_relative)
+            error.max_relative = difference / magnitude;
+    }
+
+    error.rms_relative = reference_sum > 0 ? sqrt(difference_sum / reference_sum) : sqrt(difference_sum);
+
+    free(reference);
+
+    return error;
+}
+
+vector3d_t resultant_force_from_fields(particle_t **particles, const size_t particle_count, const size_t this)
 {
     vector3d_t F_resultant = {0};
 
@@ -176,6 +583,47 @@ static vector3d_t resultant_force_from_fields(particle_t **particles, const size
     return F_resultant;
 }
 
+int detect_collision(const particle_t *this, const particle_t *that)
+{
+    return vector3d__distance(this->pos, that->pos) < (this->radius + that->radius);
+}
+
+/* Private function definitions */
+static void update_momenta(particle_t *particle, const vector3d_t F, const double sample_period)
+{
+    particle->momenta = vector3d__add(particle->momenta, vector3d__scale(F, sample_period));
+}
+
+static void update_position(particle_t *particle, const double sample_period)
+{
+    const vector3d_t change_in_velocity = vector3d__scale(particle->momenta, 1 / particle->mass);
+    particle->pos = vector3d__add(particle->pos, vector3d__scale(change_in_velocity, sample_period));
+
+    particle->pos.i = periodic__wrap(particle->pos.i, periodic_box.i);
+    particle->pos.j = periodic__wrap(particle->pos.j, periodic_box.j);
+    particle->pos.k = periodic__wrap(particle->pos.k, periodic_box.k);
+}
+
+static void update_angular_momenta(particle_t *particle, const vector3d_t r, const vector3d_t momentum)
+{
+    /**
+     * Violating conservation of momentum and angular momentum here for the sake of simplicity.
+     * TODO: Don't violate the laws of nature!
+     */
+    particle->angular_momenta = vector3d__add(particle->angular_momenta, vector3d__cross_product(r, momentum));
+}
+
+static void update_orientation(particle_t *particle, const double sample_period)
+{
+    /**
+     * Moment of inertia of a sphere about its axis is 4/5 M R^2
+     * with respect to its surface is 7/5 M R^2
+     */
+    const double moment_of_inertia_of_a_sphere = 1.4 * particle->mass * particle->radius * particle->radius;
+    const vector3d_t change_in_orientation = vector3d__scale(particle->angular_momenta, 1 / moment_of_inertia_of_a_sphere);
+    particle->orientation = vector3d__add(particle->orientation, vector3d__scale(change_in_orientation, sample_period));
+}
+
 /**
  * Simple 2-body elastic collision for linear momentum
  * 
@@ -223,3 +671,524 @@ static void update_angular_momenta_after_collision(particle_t *this, particle_t
     this->angular_momenta = vector3d__cross_product(r_that_to_this, that->momenta);
     that->angular_momenta = vector3d__cross_product(r_this_to_that, this->momenta);
 }
+
+/* Started on first use so programs that never step pay nothing for it */
+static thread_pool_t *worker_pool(void)
+{
+    if (!pool && get_thread_count() > 1 && !(pool = thread_pool__new(thread_count)))
+        write_log(LOG_ERROR, "Could not start %u threads, running on one.", get_thread_count());
+
+    return pool;
+}
+
+/* Without memory for the copy the double kernels do the step */
+static const pair_sources_t *float_sources_of(const particle_system_t *system)
+{
+    #ifdef __USE_FLOAT_FORCES
+    if (!pair_sources__fill(&float_sources, system))
+        return &float_sources;
+    #else
+    (void)system;
+    #endif
+
+    return NULL;
+}
+
+/* Single precision when sources is set, in double otherwise */
+static void direct_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count, const pair_sources_t *sources)
+{
+    force_context_t context = {.system = system, .active = active, .sources = sources};
+
+    thread_pool__parallel_for(worker_pool(), active_count, FORCE_TILE_SIZE, direct_forces_tile, &context);
+}
+
+static void direct_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const force_context_t *forces = context;
+    particle_system_t *system = forces->system;
+    const pair_kernel_t kernel = deterministic ? pair_kernel_for(PAIR_KERNEL_SCALAR) : pair_kernel();
+    const pair_kernel_float_t float_kernel = deterministic ? pair_kernel_float_for(PAIR_KERNEL_SCALAR) : pair_kernel_float();
+
+    for (size_t a = begin; a < end; ++a) {
+
+        const size_t this = forces->active ? forces->active[a] : a;
+        const vector3d_t this_pos = {system->pos.i[this], system->pos.j[this], system->pos.k[this]};
+        const vector3d_t F_resultant = forces->sources ?
+            float_kernel(this_pos, system->charge[this], forces->sources, 0, forces->sources->count, periodic_box) :
+            kernel(this_pos, system->charge[this], system->mass[this], system, 0, system->count, periodic_box);
+
+        system->force.i[this] = F_resultant.i;
+        system->force.j[this] = F_resultant.j;
+        system->force.k[this] = F_resultant.k;
+    }
+}
+
+static int barnes_hut_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count)
+{
+    force_context_t context = {.system = system, .active = active};
+
+    if (!tree && !(tree = barnes_hut__new()))
+        return 1;
+
+    if (barnes_hut__build(tree, system))
+        return 1;
+
+    thread_pool__parallel_for(worker_pool(), active_count, FORCE_TILE_SIZE, barnes_hut_forces_tile, &context);
+
+    return 0;
+}
+
+/* The walk only reads the tree, so threads can share it */
+static void barnes_hut_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const force_context_t *forces = context;
+    particle_system_t *system = forces->system;
+
+    for (size_t a = begin; a < end; ++a) {
+
+        const size_t this = forces->active ? forces->active[a] : a;
+        const vector3d_t F = barnes_hut__force(tree, system, this, opening_angle, periodic_box);
+
+        system->force.i[this] = F.i;
+        system->force.j[this] = F.j;
+        system->force.k[this] = F.k;
+    }
+}
+
+static int particle_mesh_forces_soa(particle_system_t *system)
+{
+    if (periodic_box.i <= 0 || periodic_box.j <= 0 || periodic_box.k <= 0)
+        return 1;
+
+    /* Rebuild the grid if any of its parameters changed since the last step */
+    if (mesh) {
+
+        const vector3d_t mesh_box = particle_mesh__box_length(mesh);
+
+        if (particle_mesh__grid_size(mesh) != mesh_size || particle_mesh__assignment(mesh) != mesh_assignment ||
+            mesh_box.i != periodic_box.i || mesh_box.j != periodic_box.j || mesh_box.k != periodic_box.k) {
+            particle_mesh__delete(mesh);
+            mesh = NULL;
+        }
+    }
+
+    if (!mesh && !(mesh = particle_mesh__new(mesh_size, periodic_box, mesh_assignment)))
+        return 1;
+
+    particle_mesh__forces(mesh, system);
+
+    return 0;
+}
+
+/* Fails without a cutoff as well, the direct sum then stands in */
+static int neighbour_list_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count)
+{
+    force_context_t context = {.system = system, .active = active};
+
+    if (cutoff <= 0)
+        return 1;
+
+    if (!neighbours && !(neighbours = neighbour_list__new()))
+        return 1;
+
+    if (neighbour_list__stale(neighbours, system, cutoff, skin, periodic_box) &&
+        neighbour_list__build(neighbours, system, cutoff, skin, periodic_box))
+        return 1;
+
+    thread_pool__parallel_for(worker_pool(), active_count, FORCE_TILE_SIZE, neighbour_list_forces_tile, &context);
+
+    return 0;
+}
+
+static void neighbour_list_forces_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const force_context_t *forces = context;
+    particle_system_t *system = forces->system;
+
+    for (size_t a = begin; a < end; ++a) {
+
+        const size_t this = forces->active ? forces->active[a] : a;
+        const vector3d_t F = neighbour_list__force(neighbours, system, this);
+
+        system->force.i[this] = F.i;
+        system->force.j[this] = F.j;
+        system->force.k[this] = F.k;
+    }
+}
+
+static void forces_soa(particle_system_t *system)
+{
+    INSTRUMENT_SCOPE(TIMER_FORCES);
+
+    if (compute_forces(system)) {
+        write_log(LOG_ERROR, "Force solver %i failed, falling back to the direct sum.", force_solver);
+        direct_forces_soa(system, NULL, system->count, float_sources_of(system));
+        system->forces_current = 1;
+    }
+}
+
+/**
+ * Advances positions and momenta by one step with the selected
+ * integrator, evaluating forces as the scheme needs them.  The
+ * magnetic field only acts through the Boris pusher.
+ */
+static void integrate_soa(particle_system_t *system, const double sample_period)
+{
+    integrator_t scheme = integrator;
+
+    if (scheme == INTEGRATOR_RK4 && integrator__rk4_reserve(&rk4_workspace, system->count)) {
+        write_log(LOG_ERROR, "No memory for RK4, falling back to symplectic Euler.");
+        scheme = INTEGRATOR_SYMPLECTIC_EULER;
+    }
+
+    switch (scheme) {
+
+    case INTEGRATOR_EXPLICIT_EULER:
+        forces_soa(system);
+        run_phase(system, PHASE_DRIFT, sample_period, 0);
+        run_phase(system, PHASE_KICK, sample_period, 0);
+        break;
+
+    /* The closing forces of one step open the next, unless something moved the particles in between */
+    case INTEGRATOR_VELOCITY_VERLET:
+        if (!system->forces_current)
+            forces_soa(system);
+        run_phase(system, PHASE_KICK, sample_period / 2, 0);
+        run_phase(system, PHASE_DRIFT, sample_period, 0);
+        forces_soa(system);
+        run_phase(system, PHASE_KICK, sample_period / 2, 0);
+        break;
+
+    case INTEGRATOR_RK4:
+        for (unsigned int stage = 0; stage < 4; ++stage) {
+            forces_soa(system);
+            run_phase(system, PHASE_RK4_STAGE, sample_period, stage);
+        }
+        break;
+
+    /* Momenta live half a step behind the positions, as in leapfrog */
+    case INTEGRATOR_BORIS:
+        forces_soa(system);
+        run_phase(system, PHASE_KICK, sample_period / 2, 0);
+        run_phase(system, PHASE_BORIS_ROTATE, sample_period, 0);
+        run_phase(system, PHASE_KICK, sample_period / 2, 0);
+        run_phase(system, PHASE_DRIFT, sample_period, 0);
+        break;
+
+    case INTEGRATOR_BLOCK_TIMESTEP:
+        block_step_soa(system, sample_period);
+        break;
+
+    case INTEGRATOR_SYMPLECTIC_EULER:
+    default:
+        forces_soa(system);
+        run_phase(system, PHASE_KICK, sample_period, 0);
+        run_phase(system, PHASE_DRIFT, sample_period, 0);
+        break;
+    }
+
+    run_phase(system, PHASE_SPIN, sample_period, 0);
+}
+
+/**
+ * One step of sample_period on the block timestep hierarchy.  All
+ * particles drift every stretch, only those at the end of their own
+ * step get new forces, so a tight pair on a fine level costs force
+ * evaluations for two particles rather than for the whole system.
+ */
+static void block_step_soa(particle_system_t *system, const double sample_period)
+{
+    if (block_timestep__reserve(&block, system->count)) {
+        write_log(LOG_ERROR, "No memory for block timesteps, falling back to one shared step.");
+        forces_soa(system);
+        run_phase(system, PHASE_KICK, sample_period, 0);
+        run_phase(system, PHASE_DRIFT, sample_period, 0);
+        return;
+    }
+
+    /* Start over from fresh forces whenever the levels may not match the particles any more */
+    if (!system->forces_current || system != block_system || system->count != block_count) {
+        forces_soa(system);
+        block_timestep__initial_levels(&block, system, sample_period, block_accuracy);
+        block_system = system;
+        block_count = system->count;
+    }
+
+    const unsigned long long int substep_count = 1ULL << block.max_level;
+    const double substep_period = ldexp(sample_period, -(int)block.max_level);
+    unsigned long long int substeps;
+
+    for (unsigned long long int substep = 0; substep < substep_count; substep += substeps) {
+
+        substeps = block_timestep__select(&block, system->count, substep);
+
+        block_timestep__begin_steps(&block, system, sample_period);
+        run_phase(system, PHASE_DRIFT, substeps * substep_period, 0);
+
+        active_forces_soa(system, block.ending, block.ending_count);
+        block_force_evaluations += block.ending_count;
+        block_timestep__end_steps(&block, system, substep + substeps, sample_period, block_accuracy);
+    }
+
+    /* Every step ends on the last substep, so all forces are at the final positions */
+    system->forces_current = 1;
+}
+
+/* The mesh solves for every particle at once, the other solvers can pick */
+static void active_forces_soa(particle_system_t *system, const size_t *active, const size_t active_count)
+{
+    /* Scoped so the fallback is not timed twice, forces_soa() times itself */
+    {
+        INSTRUMENT_SCOPE(TIMER_FORCES);
+
+        if (force_solver == FORCE_SOLVER_BARNES_HUT && !barnes_hut_forces_soa(system, active, active_count))
+            return;
+
+        if (force_solver == FORCE_SOLVER_NEIGHBOUR_LIST && !neighbour_list_forces_soa(system, active, active_count))
+            return;
+
+        if (force_solver == FORCE_SOLVER_DIRECT) {
+            direct_forces_soa(system, active, active_count, float_sources_of(system));
+            return;
+        }
+    }
+
+    forces_soa(system);
+}
+
+static void run_phase(particle_system_t *system, const integration_phase_t phase, const double dt, const unsigned int stage)
+{
+    INSTRUMENT_SCOPE(TIMER_INTEGRATION);
+
+    step_context_t step = {.system = system, .phase = phase, .dt = dt, .stage = stage};
+
+    thread_pool__parallel_for(worker_pool(), system->count, INTEGRATION_TILE_SIZE, integrate_tile, &step);
+
+    if (phase == PHASE_DRIFT || phase == PHASE_RK4_STAGE)
+        system->forces_current = 0;
+}
+
+static void integrate_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const step_context_t *step = context;
+
+    switch (step->phase) {
+
+    case PHASE_KICK:
+        integrator__kick(step->system, begin, end, step->dt);
+        break;
+
+    case PHASE_DRIFT:
+        integrator__drift(step->system, begin, end, step->dt, periodic_box);
+        break;
+
+    case PHASE_SPIN:
+        integrator__spin(step->system, begin, end, step->dt);
+        break;
+
+    case PHASE_BORIS_ROTATE:
+        integrator__boris_rotate(step->system, begin, end, step->dt, vector3d__scale(magnetic_field, 1 / UNIT_MAGNETIC_FIELD));
+        break;
+
+    case PHASE_RK4_STAGE:
+        integrator__rk4_stage(&rk4_workspace, step->system, begin, end, step->dt, step->stage, periodic_box);
+        break;
+    }
+}
+
+/* Each pair is counted once, by its lower index */
+static void potential_energy_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const energy_context_t *energy = context;
+    const particle_system_t *system = energy->system;
+    double tile_energy = 0;
+
+    for (size_t this = begin; this < end; ++this) {
+
+        const vector3d_t this_pos = {system->pos.i[this], system->pos.j[this], system->pos.k[this]};
+
+        for (size_t that = this + 1; that < system->count; ++that) {
+
+            const vector3d_t that_pos = {system->pos.i[that], system->pos.j[that], system->pos.k[that]};
+            const double r = vector3d__mag(periodic__minimum_image(vector3d__sub(this_pos, that_pos), periodic_box));
+
+            if (r == 0) continue;
+
+            #ifdef __USE_GRAVITY
+            const double coefficient = REDUCED_COULOMB_CONST * system->charge[this] * system->charge[that] -
+                                       REDUCED_GRAVITY_CONST * system->mass[this] * system->mass[that];
+            #else
+            const double coefficient = REDUCED_COULOMB_CONST * system->charge[this] * system->charge[that];
+            #endif
+
+            tile_energy += energy->cutoff > 0 ? neighbour_list__potential(coefficient, r, energy->cutoff) : coefficient / r;
+        }
+    }
+
+    energy->tile_energy[begin / FORCE_TILE_SIZE] = tile_energy;
+}
+
+/**
+ * Broad phase on a spatial hash with cells as wide as the largest
+ * particle, so only particles in neighbouring cells can touch.  Each
+ * candidate pair comes out once and goes through the narrow phase.
+ * Candidates are gathered in parallel, one list per tile, but pairs
+ * share particles so they are resolved on one thread in tile order.
+ */
+static void collisions_soa(particle_system_t *system, const double sample_period)
+{
+    INSTRUMENT_SCOPE(TIMER_COLLISIONS);
+
+    double max_radius = 0;
+
+    for (size_t n = 0; n < system->count; ++n)
+        if (system->radius[n] > max_radius)
+            max_radius = system->radius[n];
+
+    if (max_radius <= 0)
+        return;
+
+    if ((!collision_hash && !(collision_hash = spatial_hash__new())) ||
+        spatial_hash__build(collision_hash, system, 2 * max_radius, periodic_box)) {
+
+        write_log(LOG_ERROR, "Collision broad phase failed, testing every pair.");
+
+        for (size_t this = 0; this < system->count; ++this)
+            for (size_t that = this + 1; that < system->count; ++that)
+                if (detect_collision_soa(system, this, that))
+                    resolve_collision_soa(system, this, that, sample_period);
+        return;
+    }
+
+    const size_t tile_count = (system->count + COLLISION_TILE_SIZE - 1) / COLLISION_TILE_SIZE;
+
+    if (tile_count > collision_tile_count) {
+
+        collision_tile_t *tiles = realloc(collision_tiles, tile_count * sizeof(collision_tile_t));
+
+        if (!tiles) {
+            write_log(LOG_ERROR, "Collision broad phase ran out of memory, collisions were skipped.");
+            return;
+        }
+
+        for (size_t n = collision_tile_count; n < tile_count; ++n)
+            tiles[n] = (collision_tile_t){0};
+
+        collision_tiles = tiles;
+        collision_tile_count = tile_count;
+    }
+
+    thread_pool__parallel_for(worker_pool(), system->count, COLLISION_TILE_SIZE, collision_candidates_tile, NULL);
+
+    for (size_t t = 0; t < tile_count; ++t) {
+
+        const pair_list_t *candidates = &collision_tiles[t].list;
+
+        if (collision_tiles[t].failed)
+            write_log(LOG_ERROR, "Collision broad phase ran out of memory, some pairs were skipped.");
+
+        for (size_t n = 0; n < candidates->count; ++n) {
+
+            const particle_pair_t pair = candidates->pairs[n];
+
+            if (detect_collision_soa(system, pair.this, pair.that))
+                resolve_collision_soa(system, pair.this, pair.that, sample_period);
+        }
+    }
+}
+
+static void collision_candidates_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    collision_tile_t *tile = &collision_tiles[begin / COLLISION_TILE_SIZE];
+
+    tile->list.count = 0;
+    tile->failed = spatial_hash__pairs(collision_hash, begin, end, &tile->list);
+}
+
+/* Narrow phase, detect_collision() on the nearest periodic image */
+static int detect_collision_soa(const particle_system_t *system, const size_t this, const size_t that)
+{
+    const vector3d_t d = periodic__minimum_image((vector3d_t){
+        system->pos.i[this] - system->pos.i[that],
+        system->pos.j[this] - system->pos.j[that],
+        system->pos.k[this] - system->pos.k[that]
+    }, periodic_box);
+    const double contact_distance = system->radius[this] + system->radius[that];
+
+    return d.i*d.i + d.j*d.j + d.k*d.k < contact_distance * contact_distance;
+}
+
+/**
+ * Collisions are rare, so the pair is pulled out into particle_t views
+ * and resolved with the same routines as time_evolution().
+ */
+static void resolve_collision_soa(particle_system_t *system, const size_t this, const size_t that, const double sample_period)
+{
+    particle_t this_view = particle_system__get(system, this);
+    particle_t that_view = particle_system__get(system, that);
+
+    /* Resolve against the periodic image of "that" touching "this" */
+    that_view.pos = vector3d__sub(this_view.pos, periodic__minimum_image(vector3d__sub(this_view.pos, that_view.pos), periodic_box));
+
+    /* Unconserved angular momentum portion */
+    update_angular_momenta_after_collision(&this_view, &that_view);
+    update_orientation(&this_view, sample_period);
+    update_orientation(&that_view, sample_period);
+
+    elastic_collision_linear_momenta_update(&this_view, &that_view);
+    update_position(&this_view, sample_period);
+    update_position(&that_view, sample_period);
+
+    particle_system__set(system, this, &this_view);
+    particle_system__set(system, that, &that_view);
+}
+
+/* Through the asynchronous log when there is one, formatted on the calling thread */
+static void write_log(const log_level_t level, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+
+    if (async_log) {
+        async_log__vwrite(async_log, level, format, args);
+    }
+    else {
+        char message[ASYNC_LOG_MESSAGE_SIZE];
+        vsnprintf(message, sizeof(message), format, args);
+        log__write(log_handle, level, "%s", message);
+    }
+
+    va_end(args);
+}
+
+/* Logged in the physical units time_evolution() logs in */
+static void log_particle_soa(const particle_system_t *system, const size_t n)
+{
+    const particle_t reduced = particle_system__get(system, n);
+    const particle_t p = units__to_physical(&reduced);
+
+    /* The asynchronous log formats the numbers on its own thread, the id is not exact as a double */
+    if (async_log) {
+        char id[24];
+        const double values[] = {
+            p.mass, p.charge,
+            p.momenta.i, p.momenta.j, p.momenta.k,
+            p.pos.i, p.pos.j, p.pos.k,
+            p.angular_momenta.i, p.angular_momenta.j, p.angular_momenta.k,
+            p.orientation.i, p.orientation.j, p.orientation.k
+        };
+
+        snprintf(id, sizeof(id), "%llu,", p.id);
+        async_log__write_prefixed_values(async_log, LOG_DATA, id, "%E,%E,%E,%E,%E,%f,%f,%f,%E,%E,%E,%f,%f,%f",
+                                         values, sizeof(values) / sizeof(double));
+        return;
+    }
+
+    write_log(LOG_DATA, "%llu,%E,%E,%E,%E,%E,%f,%f,%f,%E,%E,%E,%f,%f,%f",
+    p.id, p.mass, p.charge,
+    p.momenta.i, p.momenta.j, p.momenta.k,
+    p.pos.i, p.pos.j, p.pos.k,
+    p.angular_momenta.i, p.angular_momenta.j, p.angular_momenta.k,
+    p.orientation.i, p.orientation.j, p.orientation.k);
+}
@@ -0,0 +1,277 @@
+#include "neighbour_list.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "mechanics.h"
+#include "periodic.h"
+#include "spatial_hash.h"
+
+
+struct neighbour_list
+{
+    spatial_hash_t *hash;
+    pair_list_t candidates;
+
+    /* The neighbours of particle n are neighbours[offsets[n]] up to neighbours[offsets[n + 1]] */
+    size_t *offsets;
+    size_t *neighbours;
+    size_t neighbour_capacity;
+
+    /* Positions at the last build, what the displacements are measured from, and whose they were */
+    vector3d_array_t reference;
+    unsigned long long int *reference_id;
+    size_t particle_capacity;
+
+    /* What the lists were built for */
+    int built;
+    size_t count;
+    double cutoff;
+    double skin;
+    vector3d_t periodic_box;
+
+    unsigned long long int build_count;
+};
+
+
+/* Private function declarations */
+static int reserve(neighbour_list_t *list, const size_t count);
+static vector3d_t separation(const particle_system_t *system, const size_t this, const size_t that, const vector3d_t periodic_box);
+static int compare_pairs(const void *a, const void *b);
+
+/* Public function definitions */
+neighbour_list_t *neighbour_list__new(void)
+{
+    return calloc(1, sizeof(neighbour_list_t));
+}
+
+void neighbour_list__delete(neighbour_list_t *list)
+{
+    if (!list) return;
+
+    spatial_hash__delete(list->hash);
+    pair_list__free(&list->candidates);
+    free(list->offsets);
+    free(list->neighbours);
+    free(list->reference.i);
+    free(list->reference_id);
+    free(list);
+}
+
+int neighbour_list__stale(const neighbour_list_t *list, const particle_system_t *system, const double cutoff, const double skin,
+                          const vector3d_t periodic_box)
+{
+    const double limit = skin * skin / 4;
+
+    if (!list->built || list->count != system->count || list->cutoff != cutoff || list->skin != skin ||
+        list->periodic_box.i != periodic_box.i || list->periodic_box.j != periodic_box.j || list->periodic_box.k != periodic_box.k)
+        return 1;
+
+    /* Lists are by index, a particle that changed places takes the wrong list with it */
+    if (memcmp(list->reference_id, system->id, system->count * sizeof(unsigned long long int)))
+        return 1;
+
+    for (size_t n = 0; n < system->count; ++n) {
+
+        const double dx = periodic__wrap(system->pos.i[n] - list->reference.i[n], periodic_box.i);
+        const double dy = periodic__wrap(system->pos.j[n] - list->reference.j[n], periodic_box.j);
+        const double dz = periodic__wrap(system->pos.k[n] - list->reference.k[n], periodic_box.k);
+
+        if (dx*dx + dy*dy + dz*dz > limit)
+            return 1;
+    }
+
+    return 0;
+}
+
+int neighbour_list__build(neighbour_list_t *list, const particle_system_t *system, const double cutoff, const double skin,
+                          const vector3d_t periodic_box)
+{
+    const double range = cutoff + skin;
+    const double box[3] = {periodic_box.i, periodic_box.j, periodic_box.k};
+    const size_t count = system->count;
+    size_t kept = 0;
+
+    list->built = 0;
+
+    if (!(cutoff > 0) || skin < 0)
+        return 1;
+
+    for (int d = 0; d < 3; ++d)
+        if (box[d] > 0 && 2 * range >= box[d])
+            return 1;
+
+    if (!list->hash && !(list->hash = spatial_hash__new()))
+        return 1;
+
+    if (reserve(list, count))
+        return 1;
+
+    list->candidates.count = 0;
+
+    if (spatial_hash__build(list->hash, system, range, periodic_box) ||
+        spatial_hash__pairs(list->hash, 0, count, &list->candidates))
+        return 1;
+
+    /* Keep the candidates within range, counting each particle's neighbours one place ahead */
+    memset(list->offsets, 0, (count + 1) * sizeof(size_t));
+
+    for (size_t p = 0; p < list->candidates.count; ++p) {
+
+        const particle_pair_t pair = list->candidates.pairs[p];
+        const vector3d_t d = separation(system, pair.this, pair.that, periodic_box);
+
+        if (d.i*d.i + d.j*d.j + d.k*d.k < range * range) {
+            list->candidates.pairs[kept++] = pair;
+            list->offsets[pair.this + 1]++;
+            list->offsets[pair.that + 1]++;
+        }
+    }
+
+    /**
+     * Candidates come in the order of the cells the particles sat in.
+     * Sorted, every list is in ascending index order, so the force sums
+     * run in the same order whenever the lists were built, and a run
+     * restarted from a checkpoint stays bit for bit on the original.
+     */
+    qsort(list->candidates.pairs, kept, sizeof(particle_pair_t), compare_pairs);
+
+    for (size_t n = 0; n < count; ++n)
+        list->offsets[n + 1] += list->offsets[n];
+
+    if (list->offsets[count] > list->neighbour_capacity) {
+
+        size_t *neighbours = realloc(list->neighbours, list->offsets[count] * sizeof(size_t));
+
+        if (!neighbours)
+            return 1;
+
+        list->neighbours = neighbours;
+        list->neighbour_capacity = list->offsets[count];
+    }
+
+    for (size_t p = 0; p < kept; ++p) {
+        const particle_pair_t pair = list->candidates.pairs[p];
+        list->neighbours[list->offsets[pair.this]++] = pair.that;
+        list->neighbours[list->offsets[pair.that]++] = pair.this;
+    }
+
+    /* The fill above advanced every offset to the next particle's */
+    memmove(&list->offsets[1], &list->offsets[0], count * sizeof(size_t));
+    list->offsets[0] = 0;
+
+    memcpy(list->reference.i, system->pos.i, count * sizeof(double));
+    memcpy(list->reference.j, system->pos.j, count * sizeof(double));
+    memcpy(list->reference.k, system->pos.k, count * sizeof(double));
+    memcpy(list->reference_id, system->id, count * sizeof(unsigned long long int));
+
+    list->built = 1;
+    list->count = count;
+    list->cutoff = cutoff;
+    list->skin = skin;
+    list->periodic_box = periodic_box;
+    list->build_count++;
+
+    return 0;
+}
+
+vector3d_t neighbour_list__force(const neighbour_list_t *list, const particle_system_t *system, const size_t this)
+{
+    const double cutoff_squared = list->cutoff * list->cutoff;
+    const double inverse_cutoff_squared = 1 / cutoff_squared;
+    const double this_coulomb = REDUCED_COULOMB_CONST * system->charge[this];
+    #ifdef __USE_GRAVITY
+    const double this_gravity = REDUCED_GRAVITY_CONST * system->mass[this];
+    #endif
+    vector3d_t F = {0};
+
+    for (size_t s = list->offsets[this]; s < list->offsets[this + 1]; ++s) {
+
+        const size_t that = list->neighbours[s];
+        const vector3d_t d = separation(system, this, that, list->periodic_box);
+        const double r_squared = d.i*d.i + d.j*d.j + d.k*d.k;
+
+        if (r_squared >= cutoff_squared || r_squared == 0) continue;
+
+        #ifdef __USE_GRAVITY
+        const double coefficient = this_coulomb * system->charge[that] - this_gravity * system->mass[that];
+        #else
+        const double coefficient = this_coulomb * system->charge[that];
+        #endif
+        const double scale = coefficient * (1 / r_squared - inverse_cutoff_squared) / sqrt(r_squared);
+
+        F.i += scale * d.i;
+        F.j += scale * d.j;
+        F.k += scale * d.k;
+    }
+
+    return F;
+}
+
+double neighbour_list__potential(const double coefficient, const double r, const double cutoff)
+{
+    if (r >= cutoff)
+        return 0;
+
+    return coefficient * (1 / r - 1 / cutoff + (r - cutoff) / (cutoff * cutoff));
+}
+
+size_t neighbour_list__entry_count(const neighbour_list_t *list)
+{
+    return list->built ? list->offsets[list->count] : 0;
+}
+
+unsigned long long int neighbour_list__build_count(const neighbour_list_t *list)
+{
+    return list->build_count;
+}
+
+/* Private function definitions */
+static int reserve(neighbour_list_t *list, const size_t count)
+{
+    if (count <= list->particle_capacity && list->offsets)
+        return 0;
+
+    size_t *offsets = malloc((count + 1) * sizeof(size_t));
+    double *reference = malloc((count ? count : 1) * 3 * sizeof(double));
+    unsigned long long int *reference_id = malloc((count ? count : 1) * sizeof(unsigned long long int));
+
+    if (!offsets || !reference || !reference_id) {
+        free(offsets);
+        free(reference);
+        free(reference_id);
+        return 1;
+    }
+
+    free(list->offsets);
+    free(list->reference.i);
+    free(list->reference_id);
+
+    list->offsets = offsets;
+    list->reference = (vector3d_array_t){reference, reference + count, reference + 2 * count};
+    list->reference_id = reference_id;
+    list->particle_capacity = count;
+
+    return 0;
+}
+
+/* this - that, nearest image on periodic axes */
+static vector3d_t separation(const particle_system_t *system, const size_t this, const size_t that, const vector3d_t periodic_box)
+{
+    return (vector3d_t){
+        periodic__wrap(system->pos.i[this] - system->pos.i[that], periodic_box.i),
+        periodic__wrap(system->pos.j[this] - system->pos.j[that], periodic_box.j),
+        periodic__wrap(system->pos.k[this] - system->pos.k[that], periodic_box.k)
+    };
+}
+
+/* By this, then that; with this < that each particle's neighbours fill in ascending order */
+static int compare_pairs(const void *a, const void *b)
+{
+    const particle_pair_t *x = a, *y = b;
+
+    if (x->this != y->this)
+        return (x->this > y->this) - (x->this < y->this);
+
+    return (x->that > y->that) - (x->that < y->that);
+}
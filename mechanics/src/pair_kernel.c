@@ -0,0 +1,607 @@
+#include "pair_kernel.h"
+
+#include <math.h>
+
+#include "mechanics.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PAIR_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+
+/* Private function declarations */
+static vector3d_t pairwise_force_scalar(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                        const particle_system_t *system, const size_t begin, const size_t end,
+                                        const vector3d_t periodic_box);
+#ifdef PAIR_KERNEL_X86
+static vector3d_t pairwise_force_sse2(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                      const particle_system_t *system, const size_t begin, const size_t end,
+                                      const vector3d_t periodic_box);
+static vector3d_t pairwise_force_avx2(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                      const particle_system_t *system, const size_t begin, const size_t end,
+                                      const vector3d_t periodic_box);
+static vector3d_t pairwise_force_avx512(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                        const particle_system_t *system, const size_t begin, const size_t end,
+                                        const vector3d_t periodic_box);
+#endif
+static vector3d_t pairwise_force_float_scalar(const vector3d_t this_pos, const double this_charge,
+                                              const pair_sources_t *sources, const size_t begin, const size_t end,
+                                              const vector3d_t periodic_box);
+#ifdef PAIR_KERNEL_X86
+static vector3d_t pairwise_force_float_sse2(const vector3d_t this_pos, const double this_charge,
+                                            const pair_sources_t *sources, const size_t begin, const size_t end,
+                                            const vector3d_t periodic_box);
+static vector3d_t pairwise_force_float_avx2(const vector3d_t this_pos, const double this_charge,
+                                            const pair_sources_t *sources, const size_t begin, const size_t end,
+                                            const vector3d_t periodic_box);
+static vector3d_t pairwise_force_float_avx512(const vector3d_t this_pos, const double this_charge,
+                                              const pair_sources_t *sources, const size_t begin, const size_t end,
+                                              const vector3d_t periodic_box);
+#endif
+static int is_periodic(const vector3d_t periodic_box);
+static double inverse_length(const double length);
+
+/* Public function definitions */
+pair_kernel_t pair_kernel(void)
+{
+    return pair_kernel_for(pair_kernel_isa());
+}
+
+/**
+ * libgcc runs cpuid, and checks the OS saves the wide registers,
+ * before main(), so this only reads the recorded feature bits.
+ */
+pair_kernel_isa_t pair_kernel_isa(void)
+{
+    #ifdef PAIR_KERNEL_X86
+    if (__builtin_cpu_supports("avx512f"))
+        return PAIR_KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return PAIR_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return PAIR_KERNEL_SSE2;
+    #endif
+
+    return PAIR_KERNEL_SCALAR;
+}
+
+pair_kernel_t pair_kernel_for(const pair_kernel_isa_t isa)
+{
+    switch (isa) {
+
+    #ifdef PAIR_KERNEL_X86
+    case PAIR_KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f") ? pairwise_force_avx512 : NULL;
+
+    case PAIR_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? pairwise_force_avx2 : NULL;
+
+    case PAIR_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2") ? pairwise_force_sse2 : NULL;
+    #endif
+
+    case PAIR_KERNEL_SCALAR:
+        return pairwise_force_scalar;
+
+    default:
+        return NULL;
+    }
+}
+
+const char *pair_kernel_name(const pair_kernel_isa_t isa)
+{
+    switch (isa) {
+    case PAIR_KERNEL_SCALAR:    return "scalar";
+    case PAIR_KERNEL_SSE2:      return "sse2";
+    case PAIR_KERNEL_AVX2:      return "avx2";
+    case PAIR_KERNEL_AVX512:    return "avx512";
+    default:                    return "unknown";
+    }
+}
+
+pair_kernel_float_t pair_kernel_float(void)
+{
+    return pair_kernel_float_for(pair_kernel_isa());
+}
+
+pair_kernel_float_t pair_kernel_float_for(const pair_kernel_isa_t isa)
+{
+    switch (isa) {
+
+    #ifdef PAIR_KERNEL_X86
+    case PAIR_KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f") ? pairwise_force_float_avx512 : NULL;
+
+    case PAIR_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? pairwise_force_float_avx2 : NULL;
+
+    case PAIR_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2") ? pairwise_force_float_sse2 : NULL;
+    #endif
+
+    case PAIR_KERNEL_SCALAR:
+        return pairwise_force_float_scalar;
+
+    default:
+        return NULL;
+    }
+}
+
+int pair_sources__fill(pair_sources_t *sources, const particle_system_t *system)
+{
+    if (system->count > sources->capacity) {
+
+        float *block = malloc(4 * system->count * sizeof(float));
+
+        if (!block)
+            return 1;
+
+        pair_sources__free(sources);
+        sources->capacity = system->count;
+        sources->x = block;
+        sources->y = block + system->count;
+        sources->z = block + 2 * system->count;
+        sources->charge = block + 3 * system->count;
+    }
+
+    for (size_t n = 0; n < system->count; ++n) {
+        sources->x[n] = (float)system->pos.i[n];
+        sources->y[n] = (float)system->pos.j[n];
+        sources->z[n] = (float)system->pos.k[n];
+        sources->charge[n] = (float)system->charge[n];
+    }
+
+    sources->count = system->count;
+
+    return 0;
+}
+
+void pair_sources__free(pair_sources_t *sources)
+{
+    free(sources->x);
+    *sources = (pair_sources_t){0};
+}
+
+vector3d_t project_force_3d(const double F, const vector3d_t direction_vector)
+{
+    return vector3d__scale(direction_vector, F / vector3d__mag(direction_vector));
+}
+
+/* Private function definitions */
+static vector3d_t pairwise_force_scalar(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                        const particle_system_t *system, const size_t begin, const size_t end,
+                                        const vector3d_t periodic_box)
+{
+    const double this_coulomb = REDUCED_COULOMB_CONST * this_charge;
+    #ifdef __USE_GRAVITY
+    const double this_gravity = REDUCED_GRAVITY_CONST * this_mass;
+    #else
+    (void)this_mass;
+    #endif
+    const int periodic = is_periodic(periodic_box);
+    const vector3d_t inverse_box = {inverse_length(periodic_box.i), inverse_length(periodic_box.j), inverse_length(periodic_box.k)};
+    vector3d_t F = {0};
+
+    for (size_t that = begin; that < end; ++that) {
+
+        double dx = this_pos.i - system->pos.i[that];
+        double dy = this_pos.j - system->pos.j[that];
+        double dz = this_pos.k - system->pos.k[that];
+
+        if (periodic) {
+            dx -= periodic_box.i * nearbyint(dx * inverse_box.i);
+            dy -= periodic_box.j * nearbyint(dy * inverse_box.j);
+            dz -= periodic_box.k * nearbyint(dz * inverse_box.k);
+        }
+
+        const double r_squared = dx*dx + dy*dy + dz*dz;
+
+        if (r_squared == 0) continue;
+
+        const double inverse_r = 1 / sqrt(r_squared);
+        #ifdef __USE_GRAVITY
+        const double coefficient = this_coulomb * system->charge[that] - this_gravity * system->mass[that];
+        #else
+        const double coefficient = this_coulomb * system->charge[that];
+        #endif
+        const double scale = coefficient * inverse_r * inverse_r * inverse_r;
+
+        F.i += scale * dx;
+        F.j += scale * dy;
+        F.k += scale * dz;
+    }
+
+    return F;
+}
+
+#ifdef PAIR_KERNEL_X86
+
+__attribute__((target("sse2")))
+static vector3d_t pairwise_force_sse2(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                      const particle_system_t *system, const size_t begin, const size_t end,
+                                      const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m128d x = _mm_set1_pd(this_pos.i), y = _mm_set1_pd(this_pos.j), z = _mm_set1_pd(this_pos.k);
+    const __m128d box_x = _mm_set1_pd(periodic_box.i), box_y = _mm_set1_pd(periodic_box.j), box_z = _mm_set1_pd(periodic_box.k);
+    const __m128d inverse_box_x = _mm_set1_pd(inverse_length(periodic_box.i));
+    const __m128d inverse_box_y = _mm_set1_pd(inverse_length(periodic_box.j));
+    const __m128d inverse_box_z = _mm_set1_pd(inverse_length(periodic_box.k));
+    const __m128d this_coulomb = _mm_set1_pd(REDUCED_COULOMB_CONST * this_charge);
+    #ifdef __USE_GRAVITY
+    const __m128d this_gravity = _mm_set1_pd(REDUCED_GRAVITY_CONST * this_mass);
+    #endif
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1);
+    __m128d Fx = zero, Fy = zero, Fz = zero;
+    double lanes[3][2];
+    size_t that = begin;
+
+    for (; that + 2 <= end; that += 2) {
+
+        __m128d dx = _mm_sub_pd(x, _mm_loadu_pd(&system->pos.i[that]));
+        __m128d dy = _mm_sub_pd(y, _mm_loadu_pd(&system->pos.j[that]));
+        __m128d dz = _mm_sub_pd(z, _mm_loadu_pd(&system->pos.k[that]));
+
+        /* SSE2 has no rounding instruction, the int32 conversion rounds to nearest */
+        if (periodic) {
+            dx = _mm_sub_pd(dx, _mm_mul_pd(box_x, _mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_mul_pd(dx, inverse_box_x)))));
+            dy = _mm_sub_pd(dy, _mm_mul_pd(box_y, _mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_mul_pd(dy, inverse_box_y)))));
+            dz = _mm_sub_pd(dz, _mm_mul_pd(box_z, _mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_mul_pd(dz, inverse_box_z)))));
+        }
+
+        const __m128d r_squared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+        const __m128d inverse_r = _mm_div_pd(one, _mm_sqrt_pd(r_squared));
+        const __m128d inverse_r_cubed = _mm_mul_pd(_mm_mul_pd(inverse_r, inverse_r), inverse_r);
+        __m128d coefficient = _mm_mul_pd(this_coulomb, _mm_loadu_pd(&system->charge[that]));
+        #ifdef __USE_GRAVITY
+        coefficient = _mm_sub_pd(coefficient, _mm_mul_pd(this_gravity, _mm_loadu_pd(&system->mass[that])));
+        #endif
+
+        /* Coincident lanes divided by zero, the mask clears them */
+        const __m128d scale = _mm_and_pd(_mm_mul_pd(coefficient, inverse_r_cubed), _mm_cmpneq_pd(r_squared, zero));
+
+        Fx = _mm_add_pd(Fx, _mm_mul_pd(scale, dx));
+        Fy = _mm_add_pd(Fy, _mm_mul_pd(scale, dy));
+        Fz = _mm_add_pd(Fz, _mm_mul_pd(scale, dz));
+    }
+
+    _mm_storeu_pd(lanes[0], Fx);
+    _mm_storeu_pd(lanes[1], Fy);
+    _mm_storeu_pd(lanes[2], Fz);
+
+    const vector3d_t F = {lanes[0][0] + lanes[0][1], lanes[1][0] + lanes[1][1], lanes[2][0] + lanes[2][1]};
+
+    return vector3d__add(F, pairwise_force_scalar(this_pos, this_charge, this_mass, system, that, end, periodic_box));
+}
+
+__attribute__((target("avx2,fma")))
+static vector3d_t pairwise_force_avx2(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                      const particle_system_t *system, const size_t begin, const size_t end,
+                                      const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m256d x = _mm256_set1_pd(this_pos.i), y = _mm256_set1_pd(this_pos.j), z = _mm256_set1_pd(this_pos.k);
+    const __m256d box_x = _mm256_set1_pd(periodic_box.i), box_y = _mm256_set1_pd(periodic_box.j), box_z = _mm256_set1_pd(periodic_box.k);
+    const __m256d inverse_box_x = _mm256_set1_pd(inverse_length(periodic_box.i));
+    const __m256d inverse_box_y = _mm256_set1_pd(inverse_length(periodic_box.j));
+    const __m256d inverse_box_z = _mm256_set1_pd(inverse_length(periodic_box.k));
+    const __m256d this_coulomb = _mm256_set1_pd(REDUCED_COULOMB_CONST * this_charge);
+    #ifdef __USE_GRAVITY
+    const __m256d this_gravity = _mm256_set1_pd(REDUCED_GRAVITY_CONST * this_mass);
+    #endif
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1);
+    __m256d Fx = zero, Fy = zero, Fz = zero;
+    double lanes[3][4];
+    size_t that = begin;
+
+    for (; that + 4 <= end; that += 4) {
+
+        __m256d dx = _mm256_sub_pd(x, _mm256_loadu_pd(&system->pos.i[that]));
+        __m256d dy = _mm256_sub_pd(y, _mm256_loadu_pd(&system->pos.j[that]));
+        __m256d dz = _mm256_sub_pd(z, _mm256_loadu_pd(&system->pos.k[that]));
+
+        if (periodic) {
+            dx = _mm256_fnmadd_pd(box_x, _mm256_round_pd(_mm256_mul_pd(dx, inverse_box_x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dx);
+            dy = _mm256_fnmadd_pd(box_y, _mm256_round_pd(_mm256_mul_pd(dy, inverse_box_y), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dy);
+            dz = _mm256_fnmadd_pd(box_z, _mm256_round_pd(_mm256_mul_pd(dz, inverse_box_z), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dz);
+        }
+
+        const __m256d r_squared = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+        const __m256d inverse_r = _mm256_div_pd(one, _mm256_sqrt_pd(r_squared));
+        const __m256d inverse_r_cubed = _mm256_mul_pd(_mm256_mul_pd(inverse_r, inverse_r), inverse_r);
+        __m256d coefficient = _mm256_mul_pd(this_coulomb, _mm256_loadu_pd(&system->charge[that]));
+        #ifdef __USE_GRAVITY
+        coefficient = _mm256_fnmadd_pd(this_gravity, _mm256_loadu_pd(&system->mass[that]), coefficient);
+        #endif
+
+        const __m256d scale = _mm256_and_pd(_mm256_mul_pd(coefficient, inverse_r_cubed), _mm256_cmp_pd(r_squared, zero, _CMP_NEQ_OQ));
+
+        Fx = _mm256_fmadd_pd(scale, dx, Fx);
+        Fy = _mm256_fmadd_pd(scale, dy, Fy);
+        Fz = _mm256_fmadd_pd(scale, dz, Fz);
+    }
+
+    _mm256_storeu_pd(lanes[0], Fx);
+    _mm256_storeu_pd(lanes[1], Fy);
+    _mm256_storeu_pd(lanes[2], Fz);
+
+    const vector3d_t F = {
+        (lanes[0][0] + lanes[0][1]) + (lanes[0][2] + lanes[0][3]),
+        (lanes[1][0] + lanes[1][1]) + (lanes[1][2] + lanes[1][3]),
+        (lanes[2][0] + lanes[2][1]) + (lanes[2][2] + lanes[2][3])
+    };
+
+    return vector3d__add(F, pairwise_force_scalar(this_pos, this_charge, this_mass, system, that, end, periodic_box));
+}
+
+__attribute__((target("avx512f")))
+static vector3d_t pairwise_force_avx512(const vector3d_t this_pos, const double this_charge, const double this_mass,
+                                        const particle_system_t *system, const size_t begin, const size_t end,
+                                        const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m512d x = _mm512_set1_pd(this_pos.i), y = _mm512_set1_pd(this_pos.j), z = _mm512_set1_pd(this_pos.k);
+    const __m512d box_x = _mm512_set1_pd(periodic_box.i), box_y = _mm512_set1_pd(periodic_box.j), box_z = _mm512_set1_pd(periodic_box.k);
+    const __m512d inverse_box_x = _mm512_set1_pd(inverse_length(periodic_box.i));
+    const __m512d inverse_box_y = _mm512_set1_pd(inverse_length(periodic_box.j));
+    const __m512d inverse_box_z = _mm512_set1_pd(inverse_length(periodic_box.k));
+    const __m512d this_coulomb = _mm512_set1_pd(REDUCED_COULOMB_CONST * this_charge);
+    #ifdef __USE_GRAVITY
+    const __m512d this_gravity = _mm512_set1_pd(REDUCED_GRAVITY_CONST * this_mass);
+    #endif
+    const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1);
+    __m512d Fx = zero, Fy = zero, Fz = zero;
+    size_t that = begin;
+
+    for (; that + 8 <= end; that += 8) {
+
+        __m512d dx = _mm512_sub_pd(x, _mm512_loadu_pd(&system->pos.i[that]));
+        __m512d dy = _mm512_sub_pd(y, _mm512_loadu_pd(&system->pos.j[that]));
+        __m512d dz = _mm512_sub_pd(z, _mm512_loadu_pd(&system->pos.k[that]));
+
+        if (periodic) {
+            dx = _mm512_fnmadd_pd(box_x, _mm512_roundscale_pd(_mm512_mul_pd(dx, inverse_box_x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dx);
+            dy = _mm512_fnmadd_pd(box_y, _mm512_roundscale_pd(_mm512_mul_pd(dy, inverse_box_y), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dy);
+            dz = _mm512_fnmadd_pd(box_z, _mm512_roundscale_pd(_mm512_mul_pd(dz, inverse_box_z), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dz);
+        }
+
+        const __m512d r_squared = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+        const __mmask8 nonzero = _mm512_cmp_pd_mask(r_squared, zero, _CMP_NEQ_OQ);
+        const __m512d inverse_r = _mm512_div_pd(one, _mm512_sqrt_pd(r_squared));
+        const __m512d inverse_r_cubed = _mm512_mul_pd(_mm512_mul_pd(inverse_r, inverse_r), inverse_r);
+        __m512d coefficient = _mm512_mul_pd(this_coulomb, _mm512_loadu_pd(&system->charge[that]));
+        #ifdef __USE_GRAVITY
+        coefficient = _mm512_fnmadd_pd(this_gravity, _mm512_loadu_pd(&system->mass[that]), coefficient);
+        #endif
+
+        const __m512d scale = _mm512_maskz_mul_pd(nonzero, coefficient, inverse_r_cubed);
+
+        Fx = _mm512_fmadd_pd(scale, dx, Fx);
+        Fy = _mm512_fmadd_pd(scale, dy, Fy);
+        Fz = _mm512_fmadd_pd(scale, dz, Fz);
+    }
+
+    const vector3d_t F = {_mm512_reduce_add_pd(Fx), _mm512_reduce_add_pd(Fy), _mm512_reduce_add_pd(Fz)};
+
+    return vector3d__add(F, pairwise_force_scalar(this_pos, this_charge, this_mass, system, that, end, periodic_box));
+}
+
+#endif
+
+static vector3d_t pairwise_force_float_scalar(const vector3d_t this_pos, const double this_charge,
+                                              const pair_sources_t *sources, const size_t begin, const size_t end,
+                                              const vector3d_t periodic_box)
+{
+    const float this_coulomb = (float)(REDUCED_COULOMB_CONST * this_charge);
+    const float x = (float)this_pos.i, y = (float)this_pos.j, z = (float)this_pos.k;
+    const float box_x = (float)periodic_box.i, box_y = (float)periodic_box.j, box_z = (float)periodic_box.k;
+    const float inverse_box_x = (float)inverse_length(periodic_box.i);
+    const float inverse_box_y = (float)inverse_length(periodic_box.j);
+    const float inverse_box_z = (float)inverse_length(periodic_box.k);
+    const int periodic = is_periodic(periodic_box);
+    float Fx = 0, Fy = 0, Fz = 0;
+
+    for (size_t that = begin; that < end; ++that) {
+
+        float dx = x - sources->x[that];
+        float dy = y - sources->y[that];
+        float dz = z - sources->z[that];
+
+        if (periodic) {
+            dx -= box_x * nearbyintf(dx * inverse_box_x);
+            dy -= box_y * nearbyintf(dy * inverse_box_y);
+            dz -= box_z * nearbyintf(dz * inverse_box_z);
+        }
+
+        const float r_squared = dx*dx + dy*dy + dz*dz;
+
+        if (r_squared == 0) continue;
+
+        const float inverse_r = 1 / sqrtf(r_squared);
+        const float scale = this_coulomb * sources->charge[that] * inverse_r * inverse_r * inverse_r;
+
+        Fx += scale * dx;
+        Fy += scale * dy;
+        Fz += scale * dz;
+    }
+
+    return (vector3d_t){Fx, Fy, Fz};
+}
+
+#ifdef PAIR_KERNEL_X86
+
+__attribute__((target("sse2")))
+static vector3d_t pairwise_force_float_sse2(const vector3d_t this_pos, const double this_charge,
+                                            const pair_sources_t *sources, const size_t begin, const size_t end,
+                                            const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m128 x = _mm_set1_ps((float)this_pos.i), y = _mm_set1_ps((float)this_pos.j), z = _mm_set1_ps((float)this_pos.k);
+    const __m128 box_x = _mm_set1_ps((float)periodic_box.i), box_y = _mm_set1_ps((float)periodic_box.j), box_z = _mm_set1_ps((float)periodic_box.k);
+    const __m128 inverse_box_x = _mm_set1_ps((float)inverse_length(periodic_box.i));
+    const __m128 inverse_box_y = _mm_set1_ps((float)inverse_length(periodic_box.j));
+    const __m128 inverse_box_z = _mm_set1_ps((float)inverse_length(periodic_box.k));
+    const __m128 this_coulomb = _mm_set1_ps((float)(REDUCED_COULOMB_CONST * this_charge));
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+    __m128 Fx = zero, Fy = zero, Fz = zero;
+    float lanes[3][4];
+    size_t that = begin;
+
+    for (; that + 4 <= end; that += 4) {
+
+        __m128 dx = _mm_sub_ps(x, _mm_loadu_ps(&sources->x[that]));
+        __m128 dy = _mm_sub_ps(y, _mm_loadu_ps(&sources->y[that]));
+        __m128 dz = _mm_sub_ps(z, _mm_loadu_ps(&sources->z[that]));
+
+        if (periodic) {
+            dx = _mm_sub_ps(dx, _mm_mul_ps(box_x, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dx, inverse_box_x)))));
+            dy = _mm_sub_ps(dy, _mm_mul_ps(box_y, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dy, inverse_box_y)))));
+            dz = _mm_sub_ps(dz, _mm_mul_ps(box_z, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dz, inverse_box_z)))));
+        }
+
+        const __m128 r_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        const __m128 inverse_r = _mm_div_ps(one, _mm_sqrt_ps(r_squared));
+        const __m128 inverse_r_cubed = _mm_mul_ps(_mm_mul_ps(inverse_r, inverse_r), inverse_r);
+        const __m128 coefficient = _mm_mul_ps(this_coulomb, _mm_loadu_ps(&sources->charge[that]));
+        const __m128 scale = _mm_and_ps(_mm_mul_ps(coefficient, inverse_r_cubed), _mm_cmpneq_ps(r_squared, zero));
+
+        Fx = _mm_add_ps(Fx, _mm_mul_ps(scale, dx));
+        Fy = _mm_add_ps(Fy, _mm_mul_ps(scale, dy));
+        Fz = _mm_add_ps(Fz, _mm_mul_ps(scale, dz));
+    }
+
+    _mm_storeu_ps(lanes[0], Fx);
+    _mm_storeu_ps(lanes[1], Fy);
+    _mm_storeu_ps(lanes[2], Fz);
+
+    const vector3d_t F = {
+        ((double)lanes[0][0] + lanes[0][1]) + ((double)lanes[0][2] + lanes[0][3]),
+        ((double)lanes[1][0] + lanes[1][1]) + ((double)lanes[1][2] + lanes[1][3]),
+        ((double)lanes[2][0] + lanes[2][1]) + ((double)lanes[2][2] + lanes[2][3])
+    };
+
+    return vector3d__add(F, pairwise_force_float_scalar(this_pos, this_charge, sources, that, end, periodic_box));
+}
+
+__attribute__((target("avx2,fma")))
+static vector3d_t pairwise_force_float_avx2(const vector3d_t this_pos, const double this_charge,
+                                            const pair_sources_t *sources, const size_t begin, const size_t end,
+                                            const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m256 x = _mm256_set1_ps((float)this_pos.i), y = _mm256_set1_ps((float)this_pos.j), z = _mm256_set1_ps((float)this_pos.k);
+    const __m256 box_x = _mm256_set1_ps((float)periodic_box.i), box_y = _mm256_set1_ps((float)periodic_box.j), box_z = _mm256_set1_ps((float)periodic_box.k);
+    const __m256 inverse_box_x = _mm256_set1_ps((float)inverse_length(periodic_box.i));
+    const __m256 inverse_box_y = _mm256_set1_ps((float)inverse_length(periodic_box.j));
+    const __m256 inverse_box_z = _mm256_set1_ps((float)inverse_length(periodic_box.k));
+    const __m256 this_coulomb = _mm256_set1_ps((float)(REDUCED_COULOMB_CONST * this_charge));
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+    __m256 Fx = zero, Fy = zero, Fz = zero;
+    float lanes[3][8];
+    vector3d_t F = {0};
+    size_t that = begin;
+
+    for (; that + 8 <= end; that += 8) {
+
+        __m256 dx = _mm256_sub_ps(x, _mm256_loadu_ps(&sources->x[that]));
+        __m256 dy = _mm256_sub_ps(y, _mm256_loadu_ps(&sources->y[that]));
+        __m256 dz = _mm256_sub_ps(z, _mm256_loadu_ps(&sources->z[that]));
+
+        if (periodic) {
+            dx = _mm256_fnmadd_ps(box_x, _mm256_round_ps(_mm256_mul_ps(dx, inverse_box_x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dx);
+            dy = _mm256_fnmadd_ps(box_y, _mm256_round_ps(_mm256_mul_ps(dy, inverse_box_y), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dy);
+            dz = _mm256_fnmadd_ps(box_z, _mm256_round_ps(_mm256_mul_ps(dz, inverse_box_z), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dz);
+        }
+
+        const __m256 r_squared = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        const __m256 inverse_r = _mm256_div_ps(one, _mm256_sqrt_ps(r_squared));
+        const __m256 inverse_r_cubed = _mm256_mul_ps(_mm256_mul_ps(inverse_r, inverse_r), inverse_r);
+        const __m256 coefficient = _mm256_mul_ps(this_coulomb, _mm256_loadu_ps(&sources->charge[that]));
+        const __m256 scale = _mm256_and_ps(_mm256_mul_ps(coefficient, inverse_r_cubed), _mm256_cmp_ps(r_squared, zero, _CMP_NEQ_OQ));
+
+        Fx = _mm256_fmadd_ps(scale, dx, Fx);
+        Fy = _mm256_fmadd_ps(scale, dy, Fy);
+        Fz = _mm256_fmadd_ps(scale, dz, Fz);
+    }
+
+    _mm256_storeu_ps(lanes[0], Fx);
+    _mm256_storeu_ps(lanes[1], Fy);
+    _mm256_storeu_ps(lanes[2], Fz);
+
+    for (unsigned int lane = 0; lane < 8; ++lane) {
+        F.i += lanes[0][lane];
+        F.j += lanes[1][lane];
+        F.k += lanes[2][lane];
+    }
+
+    return vector3d__add(F, pairwise_force_float_scalar(this_pos, this_charge, sources, that, end, periodic_box));
+}
+
+__attribute__((target("avx512f")))
+static vector3d_t pairwise_force_float_avx512(const vector3d_t this_pos, const double this_charge,
+                                              const pair_sources_t *sources, const size_t begin, const size_t end,
+                                              const vector3d_t periodic_box)
+{
+    const int periodic = is_periodic(periodic_box);
+    const __m512 x = _mm512_set1_ps((float)this_pos.i), y = _mm512_set1_ps((float)this_pos.j), z = _mm512_set1_ps((float)this_pos.k);
+    const __m512 box_x = _mm512_set1_ps((float)periodic_box.i), box_y = _mm512_set1_ps((float)periodic_box.j), box_z = _mm512_set1_ps((float)periodic_box.k);
+    const __m512 inverse_box_x = _mm512_set1_ps((float)inverse_length(periodic_box.i));
+    const __m512 inverse_box_y = _mm512_set1_ps((float)inverse_length(periodic_box.j));
+    const __m512 inverse_box_z = _mm512_set1_ps((float)inverse_length(periodic_box.k));
+    const __m512 this_coulomb = _mm512_set1_ps((float)(REDUCED_COULOMB_CONST * this_charge));
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1);
+    __m512 Fx = zero, Fy = zero, Fz = zero;
+    float lanes[3][16];
+    vector3d_t F = {0};
+    size_t that = begin;
+
+    for (; that + 16 <= end; that += 16) {
+
+        __m512 dx = _mm512_sub_ps(x, _mm512_loadu_ps(&sources->x[that]));
+        __m512 dy = _mm512_sub_ps(y, _mm512_loadu_ps(&sources->y[that]));
+        __m512 dz = _mm512_sub_ps(z, _mm512_loadu_ps(&sources->z[that]));
+
+        if (periodic) {
+            dx = _mm512_fnmadd_ps(box_x, _mm512_roundscale_ps(_mm512_mul_ps(dx, inverse_box_x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dx);
+            dy = _mm512_fnmadd_ps(box_y, _mm512_roundscale_ps(_mm512_mul_ps(dy, inverse_box_y), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dy);
+            dz = _mm512_fnmadd_ps(box_z, _mm512_roundscale_ps(_mm512_mul_ps(dz, inverse_box_z), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), dz);
+        }
+
+        const __m512 r_squared = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        const __mmask16 nonzero = _mm512_cmp_ps_mask(r_squared, zero, _CMP_NEQ_OQ);
+        const __m512 inverse_r = _mm512_div_ps(one, _mm512_sqrt_ps(r_squared));
+        const __m512 inverse_r_cubed = _mm512_mul_ps(_mm512_mul_ps(inverse_r, inverse_r), inverse_r);
+        const __m512 coefficient = _mm512_mul_ps(this_coulomb, _mm512_loadu_ps(&sources->charge[that]));
+        const __m512 scale = _mm512_maskz_mul_ps(nonzero, coefficient, inverse_r_cubed);
+
+        Fx = _mm512_fmadd_ps(scale, dx, Fx);
+        Fy = _mm512_fmadd_ps(scale, dy, Fy);
+        Fz = _mm512_fmadd_ps(scale, dz, Fz);
+    }
+
+    _mm512_storeu_ps(lanes[0], Fx);
+    _mm512_storeu_ps(lanes[1], Fy);
+    _mm512_storeu_ps(lanes[2], Fz);
+
+    for (unsigned int lane = 0; lane < 16; ++lane) {
+        F.i += lanes[0][lane];
+        F.j += lanes[1][lane];
+        F.k += lanes[2][lane];
+    }
+
+    return vector3d__add(F, pairwise_force_float_scalar(this_pos, this_charge, sources, that, end, periodic_box));
+}
+
+#endif
+
+static int is_periodic(const vector3d_t periodic_box)
+{
+    return periodic_box.i > 0 || periodic_box.j > 0 || periodic_box.k > 0;
+}
+
+/* Zero on open axes so the image shift rounds to nothing */
+static double inverse_length(const double length)
+{
+    return length > 0 ? 1 / length : 0;
+}
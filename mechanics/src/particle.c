@@ -1,8 +1,51 @@
 #include "particle.h"
 
-#include <stdlib.h>
+#include <string.h>
 
 
+#define SLOT_FREE           UINT32_MAX
+#define INDEX_LIMIT         UINT32_MAX      // slot and handle indices stay below it
+
+#define HANDLE_INDEX(h)     ((uint32_t)((h) & 0xffffffffu))
+#define HANDLE_GENERATION(h) ((uint32_t)((h) >> 32))
+
+
+/* Entry of the handle table, slot is SLOT_FREE while nothing holds the entry */
+struct handle_entry
+{
+    uint32_t slot;
+    uint32_t generation;
+};
+
+struct particle_pool
+{
+    particle_t **slabs;
+    size_t slab_count;
+    size_t used_slots;          // slots ever taken since the last compaction, live or released
+    size_t live_count;
+
+    /* One per slot of every slab */
+    uint32_t *slot_owner;       // handle entry of the particle in the slot, SLOT_FREE once released
+    uint32_t *free_slots;       // released slots below used_slots, the last one is taken first
+    size_t free_slot_count;
+
+    struct handle_entry *handles;
+    uint32_t *free_handles;     // entries no particle holds, below handle_count
+    size_t handle_count;
+    size_t free_handle_count;
+    size_t handle_capacity;
+};
+
+
+/* Private function declarations */
+static int reserve_slots(particle_pool_t *pool, const size_t slot_count);
+static int reserve_handles(particle_pool_t *pool, const size_t handle_count);
+static void *aligned_slab_alloc(void);
+static void aligned_slab_free(void *p);
+static particle_t *slot_particle(const particle_pool_t *pool, const size_t slot);
+
+
+/* Public function definitions */
 particle_t *particle__new(const unsigned long long int id,
                           const vector3d_t initial_pos, const vector3d_t initial_momentum,
                           const vector3d_t initial_orientation, const vector3d_t initial_angular_momentum,
@@ -28,3 +71,236 @@ void particle__delete(particle_t *p)
 {
     free(p);
 }
+
+particle_pool_t *particle_pool__new(const size_t capacity)
+{
+    particle_pool_t *pool = calloc(1, sizeof(particle_pool_t));
+
+    if (pool && (reserve_slots(pool, capacity) || reserve_handles(pool, capacity))) {
+        particle_pool__delete(pool);
+        pool = NULL;
+    }
+
+    return pool;
+}
+
+void particle_pool__delete(particle_pool_t *pool)
+{
+    if (!pool) return;
+
+    for (size_t s = 0; s < pool->slab_count; ++s)
+        aligned_slab_free(pool->slabs[s]);
+
+    free(pool->slabs);
+    free(pool->slot_owner);
+    free(pool->free_slots);
+    free(pool->handles);
+    free(pool->free_handles);
+    free(pool);
+}
+
+int particle__new_n(particle_pool_t *pool, const particle_t *initial, const size_t count, particle_handle_t *handles)
+{
+    const size_t new_slots = count > pool->free_slot_count ? count - pool->free_slot_count : 0;
+    const size_t new_handles = count > pool->free_handle_count ? count - pool->free_handle_count : 0;
+
+    /* Everything is reserved up front so a failure leaves the pool as it was */
+    if (pool->used_slots + new_slots >= INDEX_LIMIT || pool->handle_count + new_handles >= INDEX_LIMIT ||
+        reserve_slots(pool, pool->used_slots + new_slots) || reserve_handles(pool, pool->handle_count + new_handles))
+        return 1;
+
+    for (size_t n = 0; n < count; ++n) {
+
+        const uint32_t slot = pool->free_slot_count ? pool->free_slots[--pool->free_slot_count] : (uint32_t)pool->used_slots++;
+        const uint32_t entry = pool->free_handle_count ? pool->free_handles[--pool->free_handle_count] : (uint32_t)pool->handle_count++;
+        particle_t *p = slot_particle(pool, slot);
+
+        if (initial)
+            *p = initial[n];
+        else
+            memset(p, 0, sizeof(particle_t));
+
+        pool->slot_owner[slot] = entry;
+        pool->handles[entry].slot = slot;
+        handles[n] = (particle_handle_t)pool->handles[entry].generation << 32 | entry;
+    }
+
+    pool->live_count += count;
+
+    return 0;
+}
+
+size_t particle__release_n(particle_pool_t *pool, const particle_handle_t *handles, const size_t count)
+{
+    size_t released = 0;
+
+    for (size_t n = 0; n < count; ++n) {
+
+        if (!particle_pool__get(pool, handles[n]))
+            continue;
+
+        struct handle_entry *entry = &pool->handles[HANDLE_INDEX(handles[n])];
+
+        pool->slot_owner[entry->slot] = SLOT_FREE;
+        pool->free_slots[pool->free_slot_count++] = entry->slot;
+
+        /* Old handles to the entry no longer match */
+        entry->slot = SLOT_FREE;
+        ++entry->generation;
+        pool->free_handles[pool->free_handle_count++] = HANDLE_INDEX(handles[n]);
+
+        ++released;
+    }
+
+    pool->live_count -= released;
+
+    return released;
+}
+
+particle_t *particle_pool__get(const particle_pool_t *pool, const particle_handle_t handle)
+{
+    const uint32_t index = HANDLE_INDEX(handle);
+
+    if (index >= pool->handle_count || pool->handles[index].slot == SLOT_FREE ||
+        pool->handles[index].generation != HANDLE_GENERATION(handle))
+        return NULL;
+
+    return slot_particle(pool, pool->handles[index].slot);
+}
+
+size_t particle_pool__count(const particle_pool_t *pool)
+{
+    return pool->live_count;
+}
+
+void particle_pool__compact(particle_pool_t *pool)
+{
+    size_t hole = 0;
+    size_t last = pool->used_slots;
+
+    /* Two ends closing in, the last live particle goes into the first hole */
+    while (1) {
+
+        while (hole < pool->live_count && pool->slot_owner[hole] != SLOT_FREE)
+            ++hole;
+
+        while (last > pool->live_count && pool->slot_owner[last - 1] == SLOT_FREE)
+            --last;
+
+        if (hole >= pool->live_count || last <= pool->live_count)
+            break;
+
+        const uint32_t entry = pool->slot_owner[last - 1];
+
+        *slot_particle(pool, hole) = *slot_particle(pool, last - 1);
+        pool->slot_owner[hole] = entry;
+        pool->slot_owner[last - 1] = SLOT_FREE;
+        pool->handles[entry].slot = (uint32_t)hole;
+    }
+
+    pool->used_slots = pool->live_count;
+    pool->free_slot_count = 0;
+
+    /* At least one slab is kept so a pool that empties and fills again does not churn */
+    const size_t slabs_needed = (pool->live_count + PARTICLE_SLAB_SIZE - 1) / PARTICLE_SLAB_SIZE;
+
+    while (pool->slab_count > (slabs_needed ? slabs_needed : 1))
+        aligned_slab_free(pool->slabs[--pool->slab_count]);
+}
+
+particle_t *particle_pool__at(const particle_pool_t *pool, const size_t n)
+{
+    return slot_particle(pool, n);
+}
+
+
+/* Private function definitions */
+
+/* Whole slabs for slot_count slots, with the per slot arrays grown to match */
+static int reserve_slots(particle_pool_t *pool, const size_t slot_count)
+{
+    const size_t slab_count = (slot_count + PARTICLE_SLAB_SIZE - 1) / PARTICLE_SLAB_SIZE;
+
+    if (slab_count <= pool->slab_count)
+        return 0;
+
+    particle_t **slabs = realloc(pool->slabs, slab_count * sizeof(particle_t *));
+    if (!slabs)
+        return 1;
+    pool->slabs = slabs;
+
+    uint32_t *slot_owner = realloc(pool->slot_owner, slab_count * PARTICLE_SLAB_SIZE * sizeof(uint32_t));
+    if (!slot_owner)
+        return 1;
+    pool->slot_owner = slot_owner;
+
+    uint32_t *free_slots = realloc(pool->free_slots, slab_count * PARTICLE_SLAB_SIZE * sizeof(uint32_t));
+    if (!free_slots)
+        return 1;
+    pool->free_slots = free_slots;
+
+    while (pool->slab_count < slab_count) {
+
+        if (!(pool->slabs[pool->slab_count] = aligned_slab_alloc()))
+            return 1;
+
+        ++pool->slab_count;
+    }
+
+    return 0;
+}
+
+/* Doubles the table, entries keep their place so handles stay valid */
+static int reserve_handles(particle_pool_t *pool, const size_t handle_count)
+{
+    size_t capacity = pool->handle_capacity ? pool->handle_capacity : 64;
+
+    if (handle_count <= pool->handle_capacity)
+        return 0;
+
+    while (capacity < handle_count)
+        capacity *= 2;
+
+    struct handle_entry *handles = realloc(pool->handles, capacity * sizeof(struct handle_entry));
+    if (!handles)
+        return 1;
+    pool->handles = handles;
+
+    uint32_t *free_handles = realloc(pool->free_handles, capacity * sizeof(uint32_t));
+    if (!free_handles)
+        return 1;
+    pool->free_handles = free_handles;
+
+    /* Generations start at zero, slot marks the entry unused */
+    for (size_t n = pool->handle_capacity; n < capacity; ++n)
+        pool->handles[n] = (struct handle_entry){.slot = SLOT_FREE, .generation = 0};
+
+    pool->handle_capacity = capacity;
+
+    return 0;
+}
+
+static void *aligned_slab_alloc(void)
+{
+    const size_t size = PARTICLE_SLAB_SIZE * sizeof(particle_t);
+
+    #ifdef _WIN32
+    return _aligned_malloc(size, PARTICLE_POOL_ALIGNMENT);
+    #else
+    return aligned_alloc(PARTICLE_POOL_ALIGNMENT, size);
+    #endif
+}
+
+static void aligned_slab_free(void *p)
+{
+    #ifdef _WIN32
+    _aligned_free(p);
+    #else
+    free(p);
+    #endif
+}
+
+static particle_t *slot_particle(const particle_pool_t *pool, const size_t slot)
+{
+    return &pool->slabs[slot / PARTICLE_SLAB_SIZE][slot % PARTICLE_SLAB_SIZE];
+}
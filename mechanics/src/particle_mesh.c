@@ -0,0 +1,338 @@
+#include "particle_mesh.h"
+
+#include <complex.h>
+#include <math.h>
+#include <string.h>
+
+#include "mechanics.h"
+
+
+#define PI                  3.14159265358979323846264338327950
+#define MAX_STENCIL_SIZE    3
+
+
+struct particle_mesh
+{
+    size_t n;
+    vector3d_t box_length;
+    vector3d_t cell_size;
+    mesh_assignment_t assignment;
+
+    /* Charge density, transformed in place into the potential */
+    double complex *density;
+    double *field[3];
+
+    /* 4*pi/k^2, zero at k = 0 */
+    double *green;
+
+    /* FFT tables and a line buffer for the strided passes */
+    double complex *twiddle;
+    size_t *bit_reverse;
+    double complex *line;
+};
+
+
+/* Private function declarations */
+static void solve(particle_mesh_t *mesh, particle_system_t *system, const double *source, const double coupling);
+static size_t stencil(const mesh_assignment_t assignment, const double u, const size_t n, size_t *cell, double *weight);
+static double wave_number(const size_t m, const size_t n, const double length);
+static void fft_3d(particle_mesh_t *mesh, double complex *data, const int inverse);
+static void fft_1d(double complex *a, const size_t n, const double complex *twiddle, const size_t *bit_reverse, const int inverse);
+
+/* Public function definitions */
+particle_mesh_t *particle_mesh__new(const size_t grid_size, const vector3d_t box_length, const mesh_assignment_t assignment)
+{
+    const size_t n = grid_size;
+    const size_t point_count = n * n * n;
+    const double length[3] = {box_length.i, box_length.j, box_length.k};
+    particle_mesh_t *mesh;
+
+    if (n < 2 || (n & (n - 1)) || box_length.i <= 0 || box_length.j <= 0 || box_length.k <= 0)
+        return NULL;
+
+    if (!(mesh = calloc(1, sizeof(particle_mesh_t))))
+        return NULL;
+
+    mesh->n = n;
+    mesh->box_length = box_length;
+    mesh->cell_size = vector3d__scale(box_length, 1.0 / (double)n);
+    mesh->assignment = assignment;
+
+    mesh->density = malloc(point_count * sizeof(double complex));
+    mesh->green = malloc(point_count * sizeof(double));
+    mesh->twiddle = malloc(n / 2 * sizeof(double complex));
+    mesh->bit_reverse = malloc(n * sizeof(size_t));
+    mesh->line = malloc(n * sizeof(double complex));
+    for (int d = 0; d < 3; ++d)
+        mesh->field[d] = malloc(point_count * sizeof(double));
+
+    if (!mesh->density || !mesh->green || !mesh->twiddle || !mesh->bit_reverse || !mesh->line ||
+        !mesh->field[0] || !mesh->field[1] || !mesh->field[2]) {
+        particle_mesh__delete(mesh);
+        return NULL;
+    }
+
+    for (size_t k = 0; k < n / 2; ++k)
+        mesh->twiddle[k] = cexp(-2 * PI * I * (double)k / (double)n);
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t reversed = 0;
+        for (size_t bit = 1, mirror = n >> 1; bit < n; bit <<= 1, mirror >>= 1)
+            if (i & bit) reversed |= mirror;
+        mesh->bit_reverse[i] = reversed;
+    }
+
+    for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t z = 0; z < n; ++z) {
+
+                const double kx = wave_number(x, n, length[0]);
+                const double ky = wave_number(y, n, length[1]);
+                const double kz = wave_number(z, n, length[2]);
+                const double k_squared = kx*kx + ky*ky + kz*kz;
+
+                /**
+                 * No deconvolution of the assignment window, dividing by it
+                 * amplifies aliasing near the Nyquist frequency more than it
+                 * removes smoothing.
+                 */
+                mesh->green[(x * n + y) * n + z] = k_squared > 0 ? 4 * PI / k_squared : 0;
+            }
+        }
+    }
+
+    return mesh;
+}
+
+void particle_mesh__delete(particle_mesh_t *mesh)
+{
+    if (!mesh) return;
+
+    free(mesh->density);
+    free(mesh->green);
+    free(mesh->twiddle);
+    free(mesh->bit_reverse);
+    free(mesh->line);
+    for (int d = 0; d < 3; ++d)
+        free(mesh->field[d]);
+    free(mesh);
+}
+
+size_t particle_mesh__grid_size(const particle_mesh_t *mesh)
+{
+    return mesh->n;
+}
+
+vector3d_t particle_mesh__box_length(const particle_mesh_t *mesh)
+{
+    return mesh->box_length;
+}
+
+mesh_assignment_t particle_mesh__assignment(const particle_mesh_t *mesh)
+{
+    return mesh->assignment;
+}
+
+void particle_mesh__forces(particle_mesh_t *mesh, particle_system_t *system)
+{
+    memset(system->force.i, 0, system->count * sizeof(double));
+    memset(system->force.j, 0, system->count * sizeof(double));
+    memset(system->force.k, 0, system->count * sizeof(double));
+
+    solve(mesh, system, system->charge, REDUCED_COULOMB_CONST);
+    #ifdef __USE_GRAVITY
+    /* Gravity is Poisson's equation again with an attractive coupling */
+    solve(mesh, system, system->mass, -REDUCED_GRAVITY_CONST);
+    #endif
+}
+
+/* Private function definitions */
+
+/**
+ * Adds source[p] * E(pos[p]) to the force on every particle, where E
+ * is the field of the deposited source with the given coupling.
+ */
+static void solve(particle_mesh_t *mesh, particle_system_t *system, const double *source, const double coupling)
+{
+    const size_t n = mesh->n;
+    const size_t point_count = n * n * n;
+    const double cell_volume = mesh->cell_size.i * mesh->cell_size.j * mesh->cell_size.k;
+
+    memset(mesh->density, 0, point_count * sizeof(double complex));
+
+    for (size_t p = 0; p < system->count; ++p) {
+
+        size_t cx[MAX_STENCIL_SIZE], cy[MAX_STENCIL_SIZE], cz[MAX_STENCIL_SIZE];
+        double wx[MAX_STENCIL_SIZE], wy[MAX_STENCIL_SIZE], wz[MAX_STENCIL_SIZE];
+        const double density = source[p] / cell_volume;
+
+        const size_t size = stencil(mesh->assignment, (system->pos.i[p] + mesh->box_length.i / 2) / mesh->cell_size.i, n, cx, wx);
+        stencil(mesh->assignment, (system->pos.j[p] + mesh->box_length.j / 2) / mesh->cell_size.j, n, cy, wy);
+        stencil(mesh->assignment, (system->pos.k[p] + mesh->box_length.k / 2) / mesh->cell_size.k, n, cz, wz);
+
+        for (size_t a = 0; a < size; ++a)
+            for (size_t b = 0; b < size; ++b)
+                for (size_t c = 0; c < size; ++c)
+                    mesh->density[(cx[a] * n + cy[b]) * n + cz[c]] += density * wx[a] * wy[b] * wz[c];
+    }
+
+    fft_3d(mesh, mesh->density, 0);
+
+    for (size_t index = 0; index < point_count; ++index)
+        mesh->density[index] *= coupling * mesh->green[index];
+
+    /* The density grid now holds the potential */
+    fft_3d(mesh, mesh->density, 1);
+
+    /* E = -grad(phi) at the grid points with a centred difference */
+    for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t z = 0; z < n; ++z) {
+
+                const size_t index = (x * n + y) * n + z;
+                const size_t x_up = ((x + 1) % n * n + y) * n + z, x_down = ((x + n - 1) % n * n + y) * n + z;
+                const size_t y_up = (x * n + (y + 1) % n) * n + z, y_down = (x * n + (y + n - 1) % n) * n + z;
+                const size_t z_up = (x * n + y) * n + (z + 1) % n, z_down = (x * n + y) * n + (z + n - 1) % n;
+
+                mesh->field[0][index] = creal(mesh->density[x_down] - mesh->density[x_up]) / (2 * mesh->cell_size.i);
+                mesh->field[1][index] = creal(mesh->density[y_down] - mesh->density[y_up]) / (2 * mesh->cell_size.j);
+                mesh->field[2][index] = creal(mesh->density[z_down] - mesh->density[z_up]) / (2 * mesh->cell_size.k);
+            }
+        }
+    }
+
+    for (size_t p = 0; p < system->count; ++p) {
+
+        size_t cx[MAX_STENCIL_SIZE], cy[MAX_STENCIL_SIZE], cz[MAX_STENCIL_SIZE];
+        double wx[MAX_STENCIL_SIZE], wy[MAX_STENCIL_SIZE], wz[MAX_STENCIL_SIZE];
+        vector3d_t E = {0};
+
+        const size_t size = stencil(mesh->assignment, (system->pos.i[p] + mesh->box_length.i / 2) / mesh->cell_size.i, n, cx, wx);
+        stencil(mesh->assignment, (system->pos.j[p] + mesh->box_length.j / 2) / mesh->cell_size.j, n, cy, wy);
+        stencil(mesh->assignment, (system->pos.k[p] + mesh->box_length.k / 2) / mesh->cell_size.k, n, cz, wz);
+
+        for (size_t a = 0; a < size; ++a) {
+            for (size_t b = 0; b < size; ++b) {
+                for (size_t c = 0; c < size; ++c) {
+                    const size_t index = (cx[a] * n + cy[b]) * n + cz[c];
+                    const double w = wx[a] * wy[b] * wz[c];
+                    E.i += mesh->field[0][index] * w;
+                    E.j += mesh->field[1][index] * w;
+                    E.k += mesh->field[2][index] * w;
+                }
+            }
+        }
+
+        system->force.i[p] += source[p] * E.i;
+        system->force.j[p] += source[p] * E.j;
+        system->force.k[p] += source[p] * E.k;
+    }
+}
+
+/**
+ * Grid points and weights for a particle at grid coordinate u, with
+ * the grid points wrapped into [0, n).
+ *
+ * @return Number of grid points in the stencil
+ */
+static size_t stencil(const mesh_assignment_t assignment, const double u, const size_t n, size_t *cell, double *weight)
+{
+    const long long int size = (long long int)n;
+
+    if (assignment == MESH_ASSIGNMENT_TSC) {
+
+        const double nearest = floor(u + 0.5);
+        const double d = u - nearest;
+
+        weight[0] = 0.5 * (0.5 - d) * (0.5 - d);
+        weight[1] = 0.75 - d * d;
+        weight[2] = 0.5 * (0.5 + d) * (0.5 + d);
+
+        for (long long int s = 0; s < 3; ++s)
+            cell[s] = (size_t)((((long long int)nearest + s - 1) % size + size) % size);
+
+        return 3;
+    }
+
+    const double lower = floor(u);
+    const double f = u - lower;
+
+    weight[0] = 1 - f;
+    weight[1] = f;
+
+    for (long long int s = 0; s < 2; ++s)
+        cell[s] = (size_t)((((long long int)lower + s) % size + size) % size);
+
+    return 2;
+}
+
+/* FFT ordering, indices from n/2 up are the negative frequencies */
+static double wave_number(const size_t m, const size_t n, const double length)
+{
+    return 2 * PI * ((double)m - (m < n / 2 ? 0 : (double)n)) / length;
+}
+
+static void fft_3d(particle_mesh_t *mesh, double complex *data, const int inverse)
+{
+    const size_t n = mesh->n;
+    const size_t stride[3] = {n * n, n, 1};
+
+    for (int d = 0; d < 3; ++d) {
+
+        /* The two dimensions not being transformed enumerate the lines */
+        const size_t outer_stride = stride[d == 0 ? 1 : 0];
+        const size_t inner_stride = stride[d == 2 ? 1 : 2];
+
+        for (size_t a = 0; a < n; ++a) {
+            for (size_t b = 0; b < n; ++b) {
+
+                double complex *start = data + a * outer_stride + b * inner_stride;
+
+                for (size_t m = 0; m < n; ++m)
+                    mesh->line[m] = start[m * stride[d]];
+
+                fft_1d(mesh->line, n, mesh->twiddle, mesh->bit_reverse, inverse);
+
+                for (size_t m = 0; m < n; ++m)
+                    start[m * stride[d]] = mesh->line[m];
+            }
+        }
+    }
+
+    if (inverse) {
+        const double scale = 1.0 / (double)(n * n * n);
+        for (size_t index = 0; index < n * n * n; ++index)
+            data[index] *= scale;
+    }
+}
+
+/* Iterative radix-2 Cooley-Tukey, unscaled in both directions */
+static void fft_1d(double complex *a, const size_t n, const double complex *twiddle, const size_t *bit_reverse, const int inverse)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const size_t j = bit_reverse[i];
+        if (i < j) {
+            const double complex swap = a[i];
+            a[i] = a[j];
+            a[j] = swap;
+        }
+    }
+
+    for (size_t length = 2; length <= n; length <<= 1) {
+
+        const size_t half = length / 2;
+        const size_t step = n / length;
+
+        for (size_t i = 0; i < n; i += length) {
+            for (size_t k = 0; k < half; ++k) {
+
+                const double complex w = inverse ? conj(twiddle[k * step]) : twiddle[k * step];
+                const double complex u = a[i + k];
+                const double complex v = a[i + k + half] * w;
+
+                a[i + k] = u + v;
+                a[i + k + half] = u - v;
+            }
+        }
+    }
+}
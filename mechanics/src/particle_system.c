@@ -0,0 +1,237 @@
+#include "particle_system.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "units.h"
+
+
+#define DOUBLE_ARRAY_COUNT  (sizeof(double_array_offsets)/sizeof(size_t))
+#define STATE_ARRAY_COUNT   (DOUBLE_ARRAY_COUNT - 3)    // the force scratch comes last
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+
+/* Every double array in the store, used to allocate and move them as a group */
+static const size_t double_array_offsets[] = {
+    offsetof(particle_system_t, pos.i),
+    offsetof(particle_system_t, pos.j),
+    offsetof(particle_system_t, pos.k),
+    offsetof(particle_system_t, momenta.i),
+    offsetof(particle_system_t, momenta.j),
+    offsetof(particle_system_t, momenta.k),
+    offsetof(particle_system_t, mass),
+    offsetof(particle_system_t, charge),
+    offsetof(particle_system_t, radius),
+    offsetof(particle_system_t, orientation.i),
+    offsetof(particle_system_t, orientation.j),
+    offsetof(particle_system_t, orientation.k),
+    offsetof(particle_system_t, angular_momenta.i),
+    offsetof(particle_system_t, angular_momenta.j),
+    offsetof(particle_system_t, angular_momenta.k),
+    offsetof(particle_system_t, force.i),
+    offsetof(particle_system_t, force.j),
+    offsetof(particle_system_t, force.k),
+};
+
+
+/* Private function declarations */
+static void *aligned_array_alloc(const size_t size);
+static void aligned_array_free(void *p);
+static double **double_array(particle_system_t *system, const size_t n);
+static uint64_t fnv1a(uint64_t hash, const void *data, const size_t size);
+
+/* Public function definitions */
+particle_system_t *particle_system__new(const size_t capacity)
+{
+    particle_system_t *system = calloc(1, sizeof(particle_system_t));
+
+    if (system && particle_system__reserve(system, capacity)) {
+        particle_system__delete(system);
+        system = NULL;
+    }
+
+    return system;
+}
+
+particle_system_t *particle_system__from_particles(particle_t **particles, const size_t particle_count)
+{
+    particle_system_t *system = particle_system__new(particle_count);
+
+    if (system)
+        for (size_t n = 0; n < particle_count; ++n) {
+            const particle_t reduced = units__to_reduced(particles[n]);
+            particle_system__add(system, &reduced);
+        }
+
+    return system;
+}
+
+void particle_system__delete(particle_system_t *system)
+{
+    if (!system) return;
+
+    for (size_t n = 0; n < DOUBLE_ARRAY_COUNT; ++n)
+        aligned_array_free(*double_array(system, n));
+    aligned_array_free(system->id);
+
+    free(system);
+}
+
+int particle_system__reserve(particle_system_t *system, const size_t capacity)
+{
+    double *new_arrays[DOUBLE_ARRAY_COUNT];
+    unsigned long long int *new_id;
+
+    if (capacity <= system->capacity && system->id)
+        return 0;
+
+    if (capacity > particle_system__max_capacity())
+        return 1;
+
+    new_id = aligned_array_alloc(capacity * sizeof(unsigned long long int));
+    if (!new_id)
+        return 1;
+
+    for (size_t n = 0; n < DOUBLE_ARRAY_COUNT; ++n) {
+
+        new_arrays[n] = aligned_array_alloc(capacity * sizeof(double));
+
+        if (!new_arrays[n]) {
+            for (size_t m = 0; m < n; ++m)
+                aligned_array_free(new_arrays[m]);
+            aligned_array_free(new_id);
+            return 1;
+        }
+    }
+
+    if (system->count) {
+        memcpy(new_id, system->id, system->count * sizeof(unsigned long long int));
+        for (size_t n = 0; n < DOUBLE_ARRAY_COUNT; ++n)
+            memcpy(new_arrays[n], *double_array(system, n), system->count * sizeof(double));
+    }
+
+    aligned_array_free(system->id);
+    system->id = new_id;
+    for (size_t n = 0; n < DOUBLE_ARRAY_COUNT; ++n) {
+        aligned_array_free(*double_array(system, n));
+        *double_array(system, n) = new_arrays[n];
+    }
+
+    system->capacity = capacity;
+
+    return 0;
+}
+
+size_t particle_system__max_capacity(void)
+{
+    /* Less one alignment, which aligned_array_alloc() may round an array up by */
+    return (SIZE_MAX - PARTICLE_SYSTEM_ALIGNMENT) / (DOUBLE_ARRAY_COUNT * sizeof(double) + sizeof(unsigned long long int));
+}
+
+int particle_system__add(particle_system_t *system, const particle_t *p)
+{
+    if (system->count == system->capacity &&
+        particle_system__reserve(system, system->capacity ? 2 * system->capacity : 16))
+        return 1;
+
+    particle_system__set(system, system->count++, p);
+
+    return 0;
+}
+
+particle_t particle_system__get(const particle_system_t *system, const size_t index)
+{
+    particle_t p = {
+        .id = system->id[index],
+        .pos = {system->pos.i[index], system->pos.j[index], system->pos.k[index]},
+        .momenta = {system->momenta.i[index], system->momenta.j[index], system->momenta.k[index]},
+        .orientation = {system->orientation.i[index], system->orientation.j[index], system->orientation.k[index]},
+        .angular_momenta = {system->angular_momenta.i[index], system->angular_momenta.j[index], system->angular_momenta.k[index]},
+        .mass = system->mass[index],
+        .charge = system->charge[index],
+        .radius = system->radius[index]
+    };
+
+    return p;
+}
+
+void particle_system__set(particle_system_t *system, const size_t index, const particle_t *p)
+{
+    system->id[index] = p->id;
+
+    system->pos.i[index] = p->pos.i;
+    system->pos.j[index] = p->pos.j;
+    system->pos.k[index] = p->pos.k;
+
+    system->momenta.i[index] = p->momenta.i;
+    system->momenta.j[index] = p->momenta.j;
+    system->momenta.k[index] = p->momenta.k;
+
+    system->orientation.i[index] = p->orientation.i;
+    system->orientation.j[index] = p->orientation.j;
+    system->orientation.k[index] = p->orientation.k;
+
+    system->angular_momenta.i[index] = p->angular_momenta.i;
+    system->angular_momenta.j[index] = p->angular_momenta.j;
+    system->angular_momenta.k[index] = p->angular_momenta.k;
+
+    system->mass[index] = p->mass;
+    system->charge[index] = p->charge;
+    system->radius[index] = p->radius;
+
+    system->forces_current = 0;
+}
+
+uint64_t particle_system__checksum(const particle_system_t *system)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    hash = fnv1a(hash, &system->count, sizeof(system->count));
+    hash = fnv1a(hash, &system->time, sizeof(system->time));
+    hash = fnv1a(hash, &system->step_count, sizeof(system->step_count));
+    hash = fnv1a(hash, system->id, system->count * sizeof(unsigned long long int));
+
+    for (size_t n = 0; n < STATE_ARRAY_COUNT; ++n)
+        hash = fnv1a(hash, *(double *const *)((const char *)system + double_array_offsets[n]), system->count * sizeof(double));
+
+    return hash;
+}
+
+/* Private function definitions */
+static void *aligned_array_alloc(const size_t size)
+{
+    /* Round up so the size is a multiple of the alignment as aligned_alloc requires */
+    const size_t padded_size = (size + PARTICLE_SYSTEM_ALIGNMENT - 1) & ~(size_t)(PARTICLE_SYSTEM_ALIGNMENT - 1);
+
+    #ifdef _WIN32
+    return _aligned_malloc(padded_size ? padded_size : PARTICLE_SYSTEM_ALIGNMENT, PARTICLE_SYSTEM_ALIGNMENT);
+    #else
+    return aligned_alloc(PARTICLE_SYSTEM_ALIGNMENT, padded_size ? padded_size : PARTICLE_SYSTEM_ALIGNMENT);
+    #endif
+}
+
+static void aligned_array_free(void *p)
+{
+    #ifdef _WIN32
+    _aligned_free(p);
+    #else
+    free(p);
+    #endif
+}
+
+static double **double_array(particle_system_t *system, const size_t n)
+{
+    return (double **)((char *)system + double_array_offsets[n]);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, const size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t n = 0; n < size; ++n)
+        hash = (hash ^ bytes[n]) * FNV_PRIME;
+
+    return hash;
+}
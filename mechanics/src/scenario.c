@@ -0,0 +1,589 @@
+#include "scenario.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "thread_pool.h"
+#include "units.h"
+
+
+#define MAX_LINE_LENGTH     1024
+#define MAX_LATTICE_CELLS   (1 << 20)   // per side, keeps 2 cells^3 in 64 bits, valid_group() bounds it further
+#define PLUMMER_CUTOFF      10          // scale radii, the few particles further out are drawn again
+#define GOLDEN_GAMMA        0x9e3779b97f4a7c15ULL
+#define PI                  3.14159265358979323846
+
+#define KEY(name)           (!strcmp(key, name))
+
+
+/* Counter based stream, the n-th number only depends on the key and n */
+typedef struct
+{
+    uint64_t key;
+    uint64_t counter;
+
+} random_stream_t;
+
+typedef struct
+{
+    const scenario_group_t *group;
+    particle_system_t *system;
+    size_t offset;
+    uint64_t key;
+
+} generation_t;
+
+static const struct
+{
+    const char *name;
+    scenario_generator_t generator;
+
+} generator_names[] = {
+    {"particle", SCENARIO_PARTICLE},
+    {"uniform_box", SCENARIO_UNIFORM_BOX},
+    {"plummer_sphere", SCENARIO_PLUMMER_SPHERE},
+    {"lattice_plasma", SCENARIO_LATTICE_PLASMA},
+    {"random_ions", SCENARIO_RANDOM_IONS},
+};
+
+
+/* Private function declarations */
+static int parse_line(char *line, scenario_t *scenario, scenario_group_t *group, int *has_group);
+static int parse_group_value(scenario_group_t *group, const char *key, const char *value);
+static int valid_group(const scenario_group_t *group);
+static char *next_token(char **cursor);
+static int parse_double(const char *text, double *value);
+static int parse_count(const char *text, size_t *value);
+static int parse_vector(const char *text, vector3d_t *value);
+static void generate_tile(void *context, const size_t begin, const size_t end, const unsigned int worker);
+static particle_t generate(const scenario_group_t *group, const size_t index, random_stream_t *stream);
+static vector3d_t isotropic(const double length, random_stream_t *stream);
+static vector3d_t thermal_momentum(const double mass, const double speed, random_stream_t *stream);
+static uint64_t mix(uint64_t x);
+static double uniform(random_stream_t *stream);
+static double gaussian(random_stream_t *stream);
+
+/* Public function definitions */
+scenario_t *scenario__new(void)
+{
+    return calloc(1, sizeof(scenario_t));
+}
+
+void scenario__delete(scenario_t *scenario)
+{
+    if (!scenario) return;
+
+    free(scenario->groups);
+    free(scenario);
+}
+
+scenario_t *scenario__parse(const char *text, size_t *error_line)
+{
+    scenario_t *scenario = scenario__new();
+    char line[MAX_LINE_LENGTH];
+    size_t line_number = 0;
+
+    *error_line = 0;
+
+    if (!scenario)
+        return NULL;
+
+    while (*text) {
+
+        const size_t length = strcspn(text, "\n");
+        scenario_group_t group;
+        int has_group = 0;
+
+        ++line_number;
+
+        if (length >= sizeof(line)) {
+            *error_line = line_number;
+            scenario__delete(scenario);
+            return NULL;
+        }
+
+        memcpy(line, text, length);
+        line[length] = '\0';
+        text += text[length] ? length + 1 : length;
+
+        if (parse_line(line, scenario, &group, &has_group)) {
+            *error_line = line_number;
+            scenario__delete(scenario);
+            return NULL;
+        }
+
+        if (has_group && scenario__add_group(scenario, &group)) {
+            scenario__delete(scenario);
+            return NULL;
+        }
+    }
+
+    return scenario;
+}
+
+scenario_t *scenario__load(const char *filepath, size_t *error_line)
+{
+    FILE *file = fopen(filepath, "rb");
+    scenario_t *scenario = NULL;
+    char *text = NULL;
+    long length;
+
+    *error_line = 0;
+
+    if (!file)
+        return NULL;
+
+    if (!fseek(file, 0, SEEK_END) && (length = ftell(file)) >= 0 && !fseek(file, 0, SEEK_SET) &&
+        (text = malloc((size_t)length + 1)) && fread(text, 1, (size_t)length, file) == (size_t)length) {
+        text[length] = '\0';
+        scenario = scenario__parse(text, error_line);
+    }
+
+    free(text);
+    fclose(file);
+
+    return scenario;
+}
+
+int scenario__add_group(scenario_t *scenario, const scenario_group_t *group)
+{
+    if (scenario->group_count == scenario->group_capacity) {
+
+        const size_t capacity = scenario->group_capacity ? 2 * scenario->group_capacity : 8;
+        scenario_group_t *groups = realloc(scenario->groups, capacity * sizeof(scenario_group_t));
+
+        if (!groups)
+            return 1;
+
+        scenario->groups = groups;
+        scenario->group_capacity = capacity;
+    }
+
+    scenario->groups[scenario->group_count++] = *group;
+
+    return 0;
+}
+
+size_t scenario__group_size(const scenario_group_t *group)
+{
+    switch (group->generator) {
+
+    case SCENARIO_PARTICLE:
+        return 1;
+
+    case SCENARIO_LATTICE_PLASMA:
+        return 2 * group->cells * group->cells * group->cells;
+
+    default:
+        return group->count;
+    }
+}
+
+size_t scenario__particle_count(const scenario_t *scenario)
+{
+    size_t count = 0;
+
+    /* Saturates, so groups added past the parser still cannot wrap the total round to a small one */
+    for (size_t g = 0; g < scenario->group_count; ++g) {
+
+        const size_t size = scenario__group_size(&scenario->groups[g]);
+
+        count = size > SIZE_MAX - count ? SIZE_MAX : count + size;
+    }
+
+    return count;
+}
+
+particle_system_t *scenario__build(const scenario_t *scenario, const unsigned int thread_count)
+{
+    const size_t count = scenario__particle_count(scenario);
+    particle_system_t *system = particle_system__new(count ? count : 1);
+    thread_pool_t *pool = NULL;
+    size_t offset = 0;
+
+    if (!system)
+        return NULL;
+
+    /* Without a pool the tiles run on this thread, same particles either way */
+    if ((thread_count ? thread_count : thread_pool__processor_count()) > 1)
+        pool = thread_pool__new(thread_count);
+
+    for (size_t g = 0; g < scenario->group_count; ++g) {
+
+        generation_t generation = {
+            .group = &scenario->groups[g],
+            .system = system,
+            .offset = offset,
+            .key = mix(scenario->seed + GOLDEN_GAMMA * (g + 1)),
+        };
+
+        thread_pool__parallel_for(pool, scenario__group_size(generation.group), SCENARIO_TILE_SIZE, generate_tile, &generation);
+        offset += scenario__group_size(generation.group);
+    }
+
+    thread_pool__delete(pool);
+
+    system->count = count;
+
+    return system;
+}
+
+/* Private function definitions */
+
+/* @return 0 for a good line, which sets has_group if it describes particles, 1 otherwise */
+static int parse_line(char *line, scenario_t *scenario, scenario_group_t *group, int *has_group)
+{
+    char *comment = strchr(line, '#');
+    char *cursor = line;
+    char *directive, *value;
+
+    if (comment)
+        *comment = '\0';
+
+    if (!(directive = next_token(&cursor)))
+        return 0;
+
+    if (!strcmp(directive, "seed") || !strcmp(directive, "dt") || !strcmp(directive, "box")) {
+
+        char *end = NULL;
+
+        if (!(value = next_token(&cursor)) || next_token(&cursor))
+            return 1;
+
+        if (!strcmp(directive, "seed"))
+            scenario->seed = strtoull(value, &end, 0);
+        else if (!strcmp(directive, "dt"))
+            return parse_double(value, &scenario->sample_period) || !(scenario->sample_period > 0);
+        else
+            return parse_double(value, &scenario->box_length) || !(scenario->box_length >= 0);
+
+        return end == value || *end;
+    }
+
+    *group = (scenario_group_t){.charge_states = 1, .electron_mass = ELECTRON_MASS};
+
+    size_t g = 0;
+    while (g < sizeof(generator_names)/sizeof(generator_names[0]) && strcmp(directive, generator_names[g].name))
+        ++g;
+
+    if (g == sizeof(generator_names)/sizeof(generator_names[0]))
+        return 1;
+
+    group->generator = generator_names[g].generator;
+
+    while ((value = next_token(&cursor))) {
+
+        char *separator = strchr(value, '=');
+
+        if (!separator)
+            return 1;
+
+        *separator = '\0';
+
+        if (parse_group_value(group, value, separator + 1))
+            return 1;
+    }
+
+    *has_group = 1;
+
+    /* Every particle so far has to fit into one particle system together with these */
+    return !valid_group(group) || scenario__group_size(group) > particle_system__max_capacity() - scenario__particle_count(scenario);
+}
+
+/* @return 0 on success, 1 for an unknown key, one the generator does not take or a bad value */
+static int parse_group_value(scenario_group_t *group, const char *key, const char *value)
+{
+    const int single = group->generator == SCENARIO_PARTICLE;
+    const int lattice = group->generator == SCENARIO_LATTICE_PLASMA;
+
+    if (KEY("mass"))
+        return parse_double(value, single ? &group->particle.mass : &group->mass);
+    if (KEY("charge"))
+        return parse_double(value, single ? &group->particle.charge : &group->charge);
+    if (KEY("radius"))
+        return parse_double(value, single ? &group->particle.radius : &group->radius);
+
+    if (single) {
+        if (KEY("pos"))
+            return parse_vector(value, &group->particle.pos);
+        if (KEY("momentum"))
+            return parse_vector(value, &group->particle.momenta);
+        if (KEY("orientation"))
+            return parse_vector(value, &group->particle.orientation);
+        if (KEY("angular_momentum"))
+            return parse_vector(value, &group->particle.angular_momenta);
+        return 1;
+    }
+
+    if (KEY("size"))
+        return parse_double(value, &group->size);
+    if (KEY("speed"))
+        return parse_double(value, &group->speed);
+    if (KEY("center"))
+        return parse_vector(value, &group->center);
+    if (KEY("count") && !lattice)
+        return parse_count(value, &group->count);
+    if (KEY("cells") && lattice)
+        return parse_count(value, &group->cells);
+    if (KEY("electron_mass") && lattice)
+        return parse_double(value, &group->electron_mass);
+
+    if (KEY("charge_states") && group->generator == SCENARIO_RANDOM_IONS) {
+
+        size_t states;
+
+        if (parse_count(value, &states) || states > 64)
+            return 1;
+
+        group->charge_states = (unsigned int)states;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int valid_group(const scenario_group_t *group)
+{
+    switch (group->generator) {
+
+    case SCENARIO_PARTICLE:
+        return group->particle.mass > 0 && group->particle.radius >= 0;
+
+    case SCENARIO_LATTICE_PLASMA:
+        if (!group->cells || group->cells > MAX_LATTICE_CELLS || !(group->electron_mass > 0))
+            return 0;
+        break;
+
+    default:
+        if (!group->count || !group->charge_states)
+            return 0;
+        break;
+    }
+
+    if (scenario__group_size(group) > particle_system__max_capacity())
+        return 0;
+
+    return group->mass > 0 && group->radius >= 0 && group->size > 0 && group->speed >= 0;
+}
+
+/* Splits off the next whitespace separated token in place, NULL at the end of the line */
+static char *next_token(char **cursor)
+{
+    char *token = *cursor + strspn(*cursor, " \t\r");
+    char *end = token + strcspn(token, " \t\r");
+
+    if (!*token)
+        return NULL;
+
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+
+    return token;
+}
+
+/* @return 0 if the whole of text is a finite number, 1 otherwise */
+static int parse_double(const char *text, double *value)
+{
+    char *end;
+
+    *value = strtod(text, &end);
+
+    return end == text || *end || !isfinite(*value);
+}
+
+static int parse_count(const char *text, size_t *value)
+{
+    char *end;
+
+    if (*text == '-')
+        return 1;
+
+    *value = strtoull(text, &end, 10);
+
+    return end == text || *end;
+}
+
+/* Three numbers separated by commas */
+static int parse_vector(const char *text, vector3d_t *value)
+{
+    double components[3];
+    char copy[MAX_LINE_LENGTH];
+    char *cursor = copy;
+
+    strcpy(copy, text);
+
+    for (int c = 0; c < 3; ++c) {
+
+        char *separator = strchr(cursor, ',');
+
+        if ((c < 2) != (separator != NULL))
+            return 1;
+
+        if (separator)
+            *separator = '\0';
+
+        if (parse_double(cursor, &components[c]))
+            return 1;
+
+        if (separator)
+            cursor = separator + 1;
+    }
+
+    *value = (vector3d_t){components[0], components[1], components[2]};
+
+    return 0;
+}
+
+static void generate_tile(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    const generation_t *generation = context;
+    particle_system_t *system = generation->system;
+
+    for (size_t n = begin; n < end; ++n) {
+
+        random_stream_t stream = {.key = mix(generation->key ^ mix(n))};
+        const size_t index = generation->offset + n;
+        const particle_t generated = generate(generation->group, n, &stream);
+        const particle_t p = units__to_reduced(&generated);
+
+        system->id[index] = index;
+        system->pos.i[index] = p.pos.i;
+        system->pos.j[index] = p.pos.j;
+        system->pos.k[index] = p.pos.k;
+        system->momenta.i[index] = p.momenta.i;
+        system->momenta.j[index] = p.momenta.j;
+        system->momenta.k[index] = p.momenta.k;
+        system->mass[index] = p.mass;
+        system->charge[index] = p.charge;
+        system->radius[index] = p.radius;
+        system->orientation.i[index] = p.orientation.i;
+        system->orientation.j[index] = p.orientation.j;
+        system->orientation.k[index] = p.orientation.k;
+        system->angular_momenta.i[index] = p.angular_momenta.i;
+        system->angular_momenta.j[index] = p.angular_momenta.j;
+        system->angular_momenta.k[index] = p.angular_momenta.k;
+        system->force.i[index] = 0;
+        system->force.j[index] = 0;
+        system->force.k[index] = 0;
+    }
+}
+
+/* The index-th particle of the group, every random number drawn from stream */
+static particle_t generate(const scenario_group_t *group, const size_t index, random_stream_t *stream)
+{
+    const vector3d_t c = group->center;
+    particle_t p = {.mass = group->mass, .charge = group->charge, .radius = group->radius};
+
+    switch (group->generator) {
+
+    case SCENARIO_PARTICLE:
+        return group->particle;
+
+    case SCENARIO_UNIFORM_BOX:
+    case SCENARIO_RANDOM_IONS:
+        p.pos.i = c.i + group->size * (uniform(stream) - 0.5);
+        p.pos.j = c.j + group->size * (uniform(stream) - 0.5);
+        p.pos.k = c.k + group->size * (uniform(stream) - 0.5);
+        p.momenta = thermal_momentum(p.mass, group->speed, stream);
+
+        if (group->generator == SCENARIO_RANDOM_IONS) {
+
+            const unsigned int state = 1 + (unsigned int)(uniform(stream) * group->charge_states);
+
+            p.charge *= (uniform(stream) < 0.5 ? -1.0 : 1.0) * state;
+        }
+        break;
+
+    case SCENARIO_PLUMMER_SPHERE: {
+
+        /* Aarseth, Henon and Wielen (1974): radius from the inverted cumulative mass, speed by rejection */
+        double x, r, q, g;
+
+        do {
+            x = uniform(stream);
+            r = x > 0 ? 1 / sqrt(pow(x, -2.0 / 3.0) - 1) : 0;
+        } while (!(x > 0) || r > PLUMMER_CUTOFF);
+
+        do {
+            q = uniform(stream);
+            g = 0.1 * uniform(stream);
+        } while (g > q * q * pow(1 - q * q, 3.5));
+
+        const vector3d_t offset = isotropic(r * group->size, stream);
+        const vector3d_t velocity = isotropic(q * sqrt(2.0) * pow(1 + r * r, -0.25) * group->speed, stream);
+
+        p.pos = (vector3d_t){c.i + offset.i, c.j + offset.j, c.k + offset.k};
+        p.momenta = (vector3d_t){p.mass * velocity.i, p.mass * velocity.j, p.mass * velocity.k};
+        break;
+    }
+
+    case SCENARIO_LATTICE_PLASMA: {
+
+        /* Ion and electron of a cell are neighbours in memory */
+        const size_t n = group->cells;
+        const size_t cell = index / 2;
+        const double half_width = 0.5 * (double)(n - 1);
+        const double shift = index % 2 ? 0.5 : 0;
+
+        p.pos.i = c.i + group->size * ((double)(cell % n) - half_width + shift);
+        p.pos.j = c.j + group->size * ((double)(cell / n % n) - half_width + shift);
+        p.pos.k = c.k + group->size * ((double)(cell / (n * n)) - half_width + shift);
+
+        if (index % 2) {
+            p.mass = group->electron_mass;
+            p.charge = -group->charge;
+            p.radius = group->radius / 8;
+        }
+
+        /* Equal temperatures, m v^2 the same for both species */
+        p.momenta = thermal_momentum(p.mass, group->speed * sqrt(group->mass / p.mass), stream);
+        break;
+    }
+    }
+
+    return p;
+}
+
+static vector3d_t isotropic(const double length, random_stream_t *stream)
+{
+    const double cos_theta = 2 * uniform(stream) - 1;
+    const double sin_theta = sqrt(1 - cos_theta * cos_theta);
+    const double phi = 2 * PI * uniform(stream);
+
+    return (vector3d_t){length * sin_theta * cos(phi), length * sin_theta * sin(phi), length * cos_theta};
+}
+
+static vector3d_t thermal_momentum(const double mass, const double speed, random_stream_t *stream)
+{
+    if (!(speed > 0))
+        return (vector3d_t){0};
+
+    return (vector3d_t){mass * speed * gaussian(stream), mass * speed * gaussian(stream), mass * speed * gaussian(stream)};
+}
+
+/* SplitMix64 output function */
+static uint64_t mix(uint64_t x)
+{
+    x += GOLDEN_GAMMA;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+    return x ^ (x >> 31);
+}
+
+/* [0, 1) with 53 random bits */
+static double uniform(random_stream_t *stream)
+{
+    return (double)(mix(stream->key + GOLDEN_GAMMA * stream->counter++) >> 11) * 0x1.0p-53;
+}
+
+/* Box-Muller, one of the pair is thrown away so every draw costs the same two numbers */
+static double gaussian(random_stream_t *stream)
+{
+    const double u = 1 - uniform(stream);
+    const double v = uniform(stream);
+
+    return sqrt(-2 * log(u)) * cos(2 * PI * v);
+}
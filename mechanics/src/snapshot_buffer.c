@@ -0,0 +1,153 @@
+#include "snapshot_buffer.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+
+#define SLOT_COUNT          4
+#define FRESH               4u      // set next to the middle index while the reader has not taken it
+#define INDEX_MASK          3u
+
+/* Doubles per particle in a slot: pos, orientation and charge */
+#define FIELD_COUNT         7
+
+
+struct snapshot_buffer
+{
+    snapshot_t slots[SLOT_COUNT];
+    size_t count;
+
+    _Atomic unsigned int middle;
+
+    /* Only touched by the writer */
+    unsigned int back;
+
+    /* Only touched by the reader */
+    unsigned int front;
+    unsigned int previous;
+};
+
+
+/* Private function declarations */
+static int slot_init(snapshot_t *slot, const size_t count);
+static void capture(snapshot_t *slot, const particle_system_t *system);
+static uint64_t now(void);
+
+
+/* Public function definitions */
+snapshot_buffer_t *snapshot_buffer__new(const particle_system_t *system)
+{
+    snapshot_buffer_t *buffer = calloc(1, sizeof(snapshot_buffer_t));
+
+    if (!buffer)
+        return NULL;
+
+    buffer->count = system->count;
+
+    for (unsigned int s = 0; s < SLOT_COUNT; ++s) {
+        if (slot_init(&buffer->slots[s], system->count)) {
+            snapshot_buffer__delete(buffer);
+            return NULL;
+        }
+        capture(&buffer->slots[s], system);
+    }
+
+    buffer->back = 0;
+    atomic_init(&buffer->middle, 1);
+    buffer->front = 2;
+    buffer->previous = 3;
+
+    return buffer;
+}
+
+void snapshot_buffer__delete(snapshot_buffer_t *buffer)
+{
+    if (!buffer)
+        return;
+
+    for (unsigned int s = 0; s < SLOT_COUNT; ++s)
+        free(buffer->slots[s].pos.i);
+
+    free(buffer);
+}
+
+int snapshot_buffer__publish(snapshot_buffer_t *buffer, const particle_system_t *system)
+{
+    if (system->count != buffer->count)
+        return 1;
+
+    capture(&buffer->slots[buffer->back], system);
+
+    /* Release so the reader sees the copy complete, acquire to get the slot back after the reader let go of it */
+    buffer->back = atomic_exchange_explicit(&buffer->middle, buffer->back | FRESH, memory_order_acq_rel) & INDEX_MASK;
+
+    return 0;
+}
+
+const snapshot_t *snapshot_buffer__acquire(snapshot_buffer_t *buffer, const snapshot_t **previous)
+{
+    if (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & FRESH) {
+
+        /* The slot before last is the one handed back, the reader is done with it */
+        const unsigned int newest = atomic_exchange_explicit(&buffer->middle, buffer->previous, memory_order_acq_rel);
+
+        buffer->previous = buffer->front;
+        buffer->front = newest & INDEX_MASK;
+    }
+
+    if (previous)
+        *previous = &buffer->slots[buffer->previous];
+
+    return &buffer->slots[buffer->front];
+}
+
+
+/* Private function definitions */
+
+/* One allocation per slot, the arrays follow each other */
+static int slot_init(snapshot_t *slot, const size_t count)
+{
+    double *block = malloc((count ? count : 1) * FIELD_COUNT * sizeof(double));
+
+    if (!block)
+        return 1;
+
+    slot->count = count;
+    slot->pos.i = block;
+    slot->pos.j = block + count;
+    slot->pos.k = block + 2 * count;
+    slot->orientation.i = block + 3 * count;
+    slot->orientation.j = block + 4 * count;
+    slot->orientation.k = block + 5 * count;
+    slot->charge = block + 6 * count;
+
+    return 0;
+}
+
+static void capture(snapshot_t *slot, const particle_system_t *system)
+{
+    const size_t size = system->count * sizeof(double);
+
+    slot->time = system->time;
+    slot->step_count = system->step_count;
+
+    memcpy(slot->pos.i, system->pos.i, size);
+    memcpy(slot->pos.j, system->pos.j, size);
+    memcpy(slot->pos.k, system->pos.k, size);
+    memcpy(slot->orientation.i, system->orientation.i, size);
+    memcpy(slot->orientation.j, system->orientation.j, size);
+    memcpy(slot->orientation.k, system->orientation.k, size);
+    memcpy(slot->charge, system->charge, size);
+
+    slot->published = now();
+}
+
+static uint64_t now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
@@ -0,0 +1,233 @@
+#include "spatial_hash.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define MAX_CELL_COORDINATE     1000000000.0
+
+
+typedef struct
+{
+    long long int x;
+    long long int y;
+    long long int z;
+
+} cell_t;
+
+struct spatial_hash
+{
+    size_t particle_count;
+    size_t particle_capacity;
+    cell_t *cell;           // cell of each particle
+    size_t *bucket_of;      // table bucket of each particle
+
+    /* Particle indices sorted by bucket, bucket b owns [bucket_start[b], bucket_start[b+1]) */
+    size_t *sorted;
+    size_t *bucket_start;
+    size_t table_size;
+
+    /* Cells per periodic axis, 0 on open axes */
+    long long int wrap[3];
+
+    /* Neighbour offsets per axis, fewer than three when a periodic axis has fewer than three cells */
+    int offset[3][3];
+    int offset_count[3];
+};
+
+
+/* Private function declarations */
+static size_t hash_cell(const cell_t cell, const size_t table_size);
+static long long int cell_coordinate(const double x, const double cell_size, const double box_length, const long long int wrap);
+static long long int wrap_coordinate(const long long int c, const long long int wrap);
+
+/* Public function definitions */
+spatial_hash_t *spatial_hash__new(void)
+{
+    return calloc(1, sizeof(spatial_hash_t));
+}
+
+void spatial_hash__delete(spatial_hash_t *hash)
+{
+    if (!hash) return;
+
+    free(hash->cell);
+    free(hash->bucket_of);
+    free(hash->sorted);
+    free(hash->bucket_start);
+    free(hash);
+}
+
+int spatial_hash__build(spatial_hash_t *hash, const particle_system_t *system, const double cell_size, const vector3d_t periodic_box)
+{
+    const double box[3] = {periodic_box.i, periodic_box.j, periodic_box.k};
+    double axis_cell_size[3];
+    size_t table_size = 1;
+
+    /* Twice as many buckets as particles keeps the chains short */
+    while (table_size < 2 * system->count)
+        table_size <<= 1;
+
+    if (system->count > hash->particle_capacity) {
+
+        cell_t *cell = realloc(hash->cell, system->count * sizeof(cell_t));
+        size_t *bucket_of = cell ? realloc(hash->bucket_of, system->count * sizeof(size_t)) : NULL;
+        size_t *sorted = bucket_of ? realloc(hash->sorted, system->count * sizeof(size_t)) : NULL;
+
+        if (cell) hash->cell = cell;
+        if (bucket_of) hash->bucket_of = bucket_of;
+        if (sorted) hash->sorted = sorted;
+        if (!sorted)
+            return 1;
+
+        hash->particle_capacity = system->count;
+    }
+
+    if (table_size != hash->table_size) {
+
+        size_t *bucket_start = realloc(hash->bucket_start, (table_size + 1) * sizeof(size_t));
+
+        if (!bucket_start)
+            return 1;
+
+        hash->bucket_start = bucket_start;
+        hash->table_size = table_size;
+    }
+
+    hash->particle_count = system->count;
+
+    /* A periodic axis is split into a whole number of cells no smaller than cell_size */
+    for (int d = 0; d < 3; ++d) {
+
+        hash->wrap[d] = 0;
+        axis_cell_size[d] = cell_size;
+
+        if (box[d] > 0) {
+            hash->wrap[d] = (long long int)fmax(1, floor(box[d] / cell_size));
+            axis_cell_size[d] = box[d] / (double)hash->wrap[d];
+        }
+
+        hash->offset_count[d] = 0;
+        for (int offset = -1; offset <= 1; ++offset) {
+            /* Skip offsets that wrap onto a cell already in the list */
+            if (hash->wrap[d] == 1 && offset != 0) continue;
+            if (hash->wrap[d] == 2 && offset == -1) continue;
+            hash->offset[d][hash->offset_count[d]++] = offset;
+        }
+    }
+
+    memset(hash->bucket_start, 0, (table_size + 1) * sizeof(size_t));
+
+    for (size_t n = 0; n < system->count; ++n) {
+
+        hash->cell[n] = (cell_t){
+            .x = cell_coordinate(system->pos.i[n], axis_cell_size[0], box[0], hash->wrap[0]),
+            .y = cell_coordinate(system->pos.j[n], axis_cell_size[1], box[1], hash->wrap[1]),
+            .z = cell_coordinate(system->pos.k[n], axis_cell_size[2], box[2], hash->wrap[2])
+        };
+        hash->bucket_of[n] = hash_cell(hash->cell[n], table_size);
+        hash->bucket_start[hash->bucket_of[n] + 1]++;
+    }
+
+    /* Counting sort, leaves the particles of each bucket in index order */
+    for (size_t b = 0; b < table_size; ++b)
+        hash->bucket_start[b + 1] += hash->bucket_start[b];
+
+    for (size_t n = 0; n < system->count; ++n)
+        hash->sorted[hash->bucket_start[hash->bucket_of[n]]++] = n;
+
+    /* The fill above advanced every start to the next bucket's start */
+    memmove(&hash->bucket_start[1], &hash->bucket_start[0], table_size * sizeof(size_t));
+    hash->bucket_start[0] = 0;
+
+    return 0;
+}
+
+int spatial_hash__pairs(const spatial_hash_t *hash, const size_t begin, const size_t end, pair_list_t *list)
+{
+    for (size_t this = begin; this < end && this < hash->particle_count; ++this) {
+
+        const cell_t home = hash->cell[this];
+
+        for (int a = 0; a < hash->offset_count[0]; ++a) {
+            for (int b = 0; b < hash->offset_count[1]; ++b) {
+                for (int c = 0; c < hash->offset_count[2]; ++c) {
+
+                    const cell_t neighbour = {
+                        .x = wrap_coordinate(home.x + hash->offset[0][a], hash->wrap[0]),
+                        .y = wrap_coordinate(home.y + hash->offset[1][b], hash->wrap[1]),
+                        .z = wrap_coordinate(home.z + hash->offset[2][c], hash->wrap[2])
+                    };
+                    const size_t bucket = hash_cell(neighbour, hash->table_size);
+
+                    for (size_t s = hash->bucket_start[bucket]; s < hash->bucket_start[bucket + 1]; ++s) {
+
+                        const size_t that = hash->sorted[s];
+
+                        /* Other cells can share the bucket, only take particles really in this cell */
+                        if (that <= this ||
+                            hash->cell[that].x != neighbour.x || hash->cell[that].y != neighbour.y || hash->cell[that].z != neighbour.z)
+                            continue;
+
+                        if (pair_list__append(list, this, that))
+                            return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int pair_list__append(pair_list_t *list, const size_t this, const size_t that)
+{
+    if (list->count == list->capacity) {
+
+        const size_t capacity = list->capacity ? 2 * list->capacity : 256;
+        particle_pair_t *pairs = realloc(list->pairs, capacity * sizeof(particle_pair_t));
+
+        if (!pairs)
+            return 1;
+
+        list->pairs = pairs;
+        list->capacity = capacity;
+    }
+
+    list->pairs[list->count++] = (particle_pair_t){.this = this, .that = that};
+
+    return 0;
+}
+
+void pair_list__free(pair_list_t *list)
+{
+    free(list->pairs);
+    *list = (pair_list_t){0};
+}
+
+/* Private function definitions */
+static size_t hash_cell(const cell_t cell, const size_t table_size)
+{
+    /* Large primes from Teschner et al., "Optimized Spatial Hashing for Collision Detection of Deformable Objects" */
+    const unsigned long long int h = ((unsigned long long int)cell.x * 73856093ULL) ^
+                                     ((unsigned long long int)cell.y * 19349663ULL) ^
+                                     ((unsigned long long int)cell.z * 83492791ULL);
+
+    return (size_t)(h & (table_size - 1));
+}
+
+static long long int cell_coordinate(const double x, const double cell_size, const double box_length, const long long int wrap)
+{
+    if (wrap)
+        return wrap_coordinate((long long int)floor((x + box_length / 2) / cell_size), wrap);
+
+    /* Far away particles share a clamped cell instead of overflowing */
+    return (long long int)fmax(-MAX_CELL_COORDINATE, fmin(MAX_CELL_COORDINATE, floor(x / cell_size)));
+}
+
+static long long int wrap_coordinate(const long long int c, const long long int wrap)
+{
+    if (!wrap) return c;
+
+    return (c % wrap + wrap) % wrap;
+}
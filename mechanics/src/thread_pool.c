@@ -0,0 +1,302 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+#define CACHE_LINE_SIZE     64
+#define MAX_TILE_COUNT      UINT32_MAX
+
+
+/**
+ * Tiles [begin, end) still to be run by one thread, packed in a single
+ * word so the owner taking from the front and thieves taking from the
+ * back agree through one compare and swap.
+ */
+typedef struct
+{
+    _Atomic uint64_t tiles;
+    char padding[CACHE_LINE_SIZE - sizeof(_Atomic uint64_t)];   // one line per thread
+
+} tile_range_t;
+
+typedef struct
+{
+    thread_pool_t *pool;
+    unsigned int index;
+
+} worker_t;
+
+struct thread_pool
+{
+    unsigned int thread_count;
+    pthread_t *threads;
+    worker_t *workers;
+    tile_range_t *ranges;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long long int generation;  // bumped once per loop to wake the workers
+    unsigned int busy;                  // workers still running the current loop
+    int stop;
+
+    /* Current loop, the tiles handed out count from first_tile */
+    size_t count;
+    size_t tile_size;
+    size_t first_tile;
+    thread_pool_task_t task;
+    void *context;
+};
+
+
+/* Private function declarations */
+static void *worker_main(void *arg);
+static void run_batch(thread_pool_t *pool, const size_t first_tile, const uint64_t tile_count);
+static void run_tiles(thread_pool_t *pool, const unsigned int worker);
+static int take_tile(tile_range_t *range, size_t *tile);
+static int steal_tiles(thread_pool_t *pool, const unsigned int thief);
+static void run_tile(thread_pool_t *pool, const size_t tile, const unsigned int worker);
+static uint64_t pack(const uint64_t begin, const uint64_t end);
+static uint64_t range_begin(const uint64_t tiles);
+static uint64_t range_end(const uint64_t tiles);
+
+/* Public function definitions */
+thread_pool_t *thread_pool__new(const unsigned int thread_count)
+{
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+
+    if (!pool)
+        return NULL;
+
+    pool->thread_count = thread_count ? thread_count : thread_pool__processor_count();
+    pool->threads = calloc(pool->thread_count, sizeof(pthread_t));
+    pool->workers = calloc(pool->thread_count, sizeof(worker_t));
+    pool->ranges = calloc(pool->thread_count, sizeof(tile_range_t));
+
+    if (!pool->threads || !pool->workers || !pool->ranges) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->ranges);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (unsigned int n = 0; n < pool->thread_count; ++n) {
+
+        pool->workers[n] = (worker_t){.pool = pool, .index = n};
+        atomic_init(&pool->ranges[n].tiles, 0);
+
+        /* Thread 0 is whoever calls thread_pool__parallel_for() */
+        if (n && pthread_create(&pool->threads[n], NULL, worker_main, &pool->workers[n])) {
+            pool->thread_count = n;
+            thread_pool__delete(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void thread_pool__delete(thread_pool_t *pool)
+{
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int n = 1; n < pool->thread_count; ++n)
+        pthread_join(pool->threads[n], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->ranges);
+    free(pool);
+}
+
+unsigned int thread_pool__thread_count(const thread_pool_t *pool)
+{
+    return pool ? pool->thread_count : 1;
+}
+
+void thread_pool__parallel_for(thread_pool_t *pool, const size_t count, const size_t tile_size,
+                               thread_pool_task_t task, void *context)
+{
+    const size_t tile = tile_size ? tile_size : 1;
+
+    if (!pool || pool->thread_count == 1 || count <= tile) {
+        for (size_t begin = 0; begin < count; begin += tile)
+            task(context, begin, begin + tile < count ? begin + tile : count, 0);
+        return;
+    }
+
+    const size_t tile_count = (count + tile - 1) / tile;
+
+    pool->count = count;
+    pool->tile_size = tile;
+    pool->task = task;
+    pool->context = context;
+
+    /* Tile indices have to fit in half a word, longer loops run in batches of tiles the caller asked for */
+    for (size_t first_tile = 0; first_tile < tile_count; first_tile += MAX_TILE_COUNT)
+        run_batch(pool, first_tile, tile_count - first_tile < MAX_TILE_COUNT ? tile_count - first_tile : MAX_TILE_COUNT);
+}
+
+unsigned int thread_pool__processor_count(void)
+{
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const long count = (long)info.dwNumberOfProcessors;
+    #else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+
+    return count > 0 ? (unsigned int)count : 1;
+}
+
+/* Private function definitions */
+
+/* Runs tiles first_tile up to first_tile + tile_count of the current loop over every thread */
+static void run_batch(thread_pool_t *pool, const size_t first_tile, const uint64_t tile_count)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->first_tile = first_tile;
+
+    for (unsigned int n = 0; n < pool->thread_count; ++n)
+        atomic_store(&pool->ranges[n].tiles, pack(tile_count * n / pool->thread_count,
+                                                  tile_count * (n + 1) / pool->thread_count));
+
+    pool->busy = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tiles(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg)
+{
+    const worker_t *worker = arg;
+    thread_pool_t *pool = worker->pool;
+    unsigned long long int seen = 0;
+
+    for (;;) {
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tiles(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void run_tiles(thread_pool_t *pool, const unsigned int worker)
+{
+    size_t tile;
+
+    do {
+        while (take_tile(&pool->ranges[worker], &tile))
+            run_tile(pool, tile, worker);
+    } while (steal_tiles(pool, worker));
+}
+
+/* Owner side, takes the first tile of its own range */
+static int take_tile(tile_range_t *range, size_t *tile)
+{
+    uint64_t tiles = atomic_load(&range->tiles);
+
+    while (range_begin(tiles) < range_end(tiles)) {
+        if (atomic_compare_exchange_weak(&range->tiles, &tiles, pack(range_begin(tiles) + 1, range_end(tiles)))) {
+            *tile = (size_t)range_begin(tiles);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Thief side, moves the back half of the first non-empty range found
+ * into the thief's own range, which must be empty.  The owner of that
+ * range is the only one who refills it, so a plain store is enough.
+ */
+static int steal_tiles(thread_pool_t *pool, const unsigned int thief)
+{
+    for (unsigned int n = 1; n < pool->thread_count; ++n) {
+
+        tile_range_t *victim = &pool->ranges[(thief + n) % pool->thread_count];
+        uint64_t tiles = atomic_load(&victim->tiles);
+
+        while (range_begin(tiles) < range_end(tiles)) {
+
+            const uint64_t split = range_end(tiles) - (range_end(tiles) - range_begin(tiles) + 1) / 2;
+
+            if (atomic_compare_exchange_weak(&victim->tiles, &tiles, pack(range_begin(tiles), split))) {
+                atomic_store(&pool->ranges[thief].tiles, pack(split, range_end(tiles)));
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void run_tile(thread_pool_t *pool, const size_t tile, const unsigned int worker)
+{
+    const size_t begin = (pool->first_tile + tile) * pool->tile_size;
+    const size_t end = begin + pool->tile_size < pool->count ? begin + pool->tile_size : pool->count;
+
+    pool->task(pool->context, begin, end, worker);
+}
+
+static uint64_t pack(const uint64_t begin, const uint64_t end)
+{
+    return begin << 32 | end;
+}
+
+static uint64_t range_begin(const uint64_t tiles)
+{
+    return tiles >> 32;
+}
+
+static uint64_t range_end(const uint64_t tiles)
+{
+    return tiles & UINT32_MAX;
+}
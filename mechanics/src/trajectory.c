@@ -0,0 +1,362 @@
+#include "trajectory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+#define FIELD_COUNT     9
+#define MAX_SPAN_COUNT  (2 + 3 * FIELD_COUNT)
+
+
+/* Piece of a frame, written without copying when it can be */
+typedef struct
+{
+    const void *data;
+    size_t size;
+
+} span_t;
+
+struct trajectory
+{
+    #ifdef _WIN32
+    FILE *file;
+    #else
+    int fd;
+    #endif
+
+    size_t particle_count;
+    unsigned int field_mask;
+    size_t frame_size;
+
+    unsigned char *buffer;
+    size_t buffered;
+    int failed;
+};
+
+
+/* Private function declarations */
+static trajectory_t *new_trajectory(const size_t particle_count, const unsigned int field_mask);
+static void encode_header(const trajectory_t *trajectory, const double sample_period, unsigned char *header);
+static size_t frame_spans(const trajectory_t *trajectory, const particle_system_t *system, uint64_t *prefix, span_t *spans);
+static int buffer_span(trajectory_t *trajectory, const span_t span);
+static int write_spans(trajectory_t *trajectory, span_t *spans, size_t span_count);
+static int host_is_little_endian(void);
+static void store_little_endian(unsigned char *bytes, const uint64_t value, const size_t size);
+static void copy_little_endian(unsigned char *destination, const unsigned char *source, const size_t size);
+
+/* Public function definitions */
+trajectory_t *trajectory__open(const char *filepath, const size_t particle_count, const double sample_period,
+                               const unsigned int field_mask)
+{
+    trajectory_t *trajectory = new_trajectory(particle_count, field_mask);
+    unsigned char header[TRAJECTORY_HEADER_SIZE];
+
+    if (!trajectory)
+        return NULL;
+
+    #ifdef _WIN32
+    if (!(trajectory->file = fopen(filepath, "wb"))) {
+    #else
+    if ((trajectory->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    #endif
+        free(trajectory->buffer);
+        free(trajectory);
+        return NULL;
+    }
+
+    encode_header(trajectory, sample_period, header);
+
+    span_t span = {header, sizeof(header)};
+
+    if (write_spans(trajectory, &span, 1)) {
+        trajectory__close(trajectory);
+        return NULL;
+    }
+
+    return trajectory;
+}
+
+trajectory_t *trajectory__append(const char *filepath, const size_t particle_count, const double sample_period,
+                                 const unsigned int field_mask, const unsigned long long int frame_count)
+{
+    trajectory_t *trajectory = new_trajectory(particle_count, field_mask);
+    unsigned char expected[TRAJECTORY_HEADER_SIZE], found[TRAJECTORY_HEADER_SIZE];
+    int failed;
+
+    if (!trajectory)
+        return NULL;
+
+    encode_header(trajectory, sample_period, expected);
+
+    const unsigned long long int kept_size = TRAJECTORY_HEADER_SIZE + frame_count * trajectory->frame_size;
+
+    #ifdef _WIN32
+    if (!(trajectory->file = fopen(filepath, "r+b"))) {
+        free(trajectory->buffer);
+        free(trajectory);
+        return NULL;
+    }
+
+    failed = fread(found, 1, sizeof(found), trajectory->file) != sizeof(found) || memcmp(found, expected, sizeof(found)) ||
+             _fseeki64(trajectory->file, 0, SEEK_END) || (unsigned long long int)_ftelli64(trajectory->file) < kept_size ||
+             _chsize_s(_fileno(trajectory->file), (long long int)kept_size) || _fseeki64(trajectory->file, 0, SEEK_END);
+    #else
+    if ((trajectory->fd = open(filepath, O_RDWR)) < 0) {
+        free(trajectory->buffer);
+        free(trajectory);
+        return NULL;
+    }
+
+    const off_t size = lseek(trajectory->fd, 0, SEEK_END);
+
+    failed = pread(trajectory->fd, found, sizeof(found), 0) != (ssize_t)sizeof(found) || memcmp(found, expected, sizeof(found)) ||
+             size < 0 || (unsigned long long int)size < kept_size ||
+             ftruncate(trajectory->fd, (off_t)kept_size) || lseek(trajectory->fd, 0, SEEK_END) < 0;
+    #endif
+
+    if (failed) {
+        trajectory__close(trajectory);
+        return NULL;
+    }
+
+    return trajectory;
+}
+
+int trajectory__close(trajectory_t *trajectory)
+{
+    if (!trajectory) return 0;
+
+    int failed = trajectory__flush(trajectory);
+
+    #ifdef _WIN32
+    failed |= fclose(trajectory->file) != 0;
+    #else
+    failed |= close(trajectory->fd) != 0;
+    #endif
+
+    free(trajectory->buffer);
+    free(trajectory);
+
+    return failed;
+}
+
+int trajectory__write_frame(trajectory_t *trajectory, const particle_system_t *system)
+{
+    uint64_t prefix[2];
+    span_t spans[MAX_SPAN_COUNT];
+
+    if (system->count != trajectory->particle_count)
+        return 1;
+
+    const size_t span_count = frame_spans(trajectory, system, prefix, spans);
+
+    /* Small frames are gathered into one large write, so are all frames on a big-endian host */
+    if (trajectory->frame_size <= TRAJECTORY_BUFFER_SIZE - trajectory->buffered || !host_is_little_endian()) {
+
+        for (size_t s = 0; s < span_count; ++s)
+            if (buffer_span(trajectory, spans[s]))
+                return 1;
+
+        return 0;
+    }
+
+    return trajectory__flush(trajectory) || write_spans(trajectory, spans, span_count);
+}
+
+int trajectory__flush(trajectory_t *trajectory)
+{
+    span_t span = {trajectory->buffer, trajectory->buffered};
+
+    if (!trajectory->buffered)
+        return trajectory->failed;
+
+    trajectory->buffered = 0;
+
+    return write_spans(trajectory, &span, 1);
+}
+
+size_t trajectory__frame_size(const trajectory_t *trajectory)
+{
+    return trajectory->frame_size;
+}
+
+/* Private function definitions */
+/* Everything but the file */
+static trajectory_t *new_trajectory(const size_t particle_count, const unsigned int field_mask)
+{
+    trajectory_t *trajectory = calloc(1, sizeof(trajectory_t));
+    size_t array_count = 0;
+
+    if (!trajectory)
+        return NULL;
+
+    if (!(trajectory->buffer = malloc(TRAJECTORY_BUFFER_SIZE))) {
+        free(trajectory);
+        return NULL;
+    }
+
+    for (unsigned int field = 0; field < FIELD_COUNT; ++field)
+        if (field_mask & (1u << field))
+            array_count += (1u << field) >= TRAJECTORY_POSITION ? 3 : 1;
+
+    trajectory->particle_count = particle_count;
+    trajectory->field_mask = field_mask;
+    trajectory->frame_size = 2 * sizeof(uint64_t) + array_count * particle_count * sizeof(uint64_t);
+
+    return trajectory;
+}
+
+static void encode_header(const trajectory_t *trajectory, const double sample_period, unsigned char *header)
+{
+    const double unit_mass = UNIT_MASS, unit_charge = UNIT_CHARGE;
+    uint64_t period_bits, unit_mass_bits, unit_charge_bits;
+
+    memcpy(&period_bits, &sample_period, sizeof(double));
+    memcpy(&unit_mass_bits, &unit_mass, sizeof(double));
+    memcpy(&unit_charge_bits, &unit_charge, sizeof(double));
+    memset(header, 0, TRAJECTORY_HEADER_SIZE);
+    memcpy(header, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+    store_little_endian(header + 8, TRAJECTORY_VERSION, 4);
+    store_little_endian(header + 12, TRAJECTORY_HEADER_SIZE, 4);
+    store_little_endian(header + 16, trajectory->particle_count, 8);
+    store_little_endian(header + 24, period_bits, 8);
+    store_little_endian(header + 32, trajectory->field_mask, 4);
+    store_little_endian(header + 40, trajectory->frame_size, 8);
+    store_little_endian(header + 48, unit_mass_bits, 8);
+    store_little_endian(header + 56, unit_charge_bits, 8);
+}
+
+/* Host byte order, prefix holds the time and step count */
+static size_t frame_spans(const trajectory_t *trajectory, const particle_system_t *system, uint64_t *prefix, span_t *spans)
+{
+    const size_t array_size = system->count * sizeof(double);
+    const void *scalars[] = {system->id, system->mass, system->charge, system->radius};
+    const vector3d_array_t *vectors[] = {&system->pos, &system->momenta, &system->orientation, &system->angular_momenta, &system->force};
+    size_t span_count = 0;
+
+    memcpy(&prefix[0], &system->time, sizeof(double));
+    prefix[1] = system->step_count;
+    spans[span_count++] = (span_t){prefix, 2 * sizeof(uint64_t)};
+
+    for (unsigned int field = 0; field < FIELD_COUNT; ++field) {
+
+        if (!(trajectory->field_mask & (1u << field)))
+            continue;
+
+        if (field < 4) {
+            spans[span_count++] = (span_t){scalars[field], array_size};
+        }
+        else {
+            spans[span_count++] = (span_t){vectors[field - 4]->i, array_size};
+            spans[span_count++] = (span_t){vectors[field - 4]->j, array_size};
+            spans[span_count++] = (span_t){vectors[field - 4]->k, array_size};
+        }
+    }
+
+    return span_count;
+}
+
+/**
+ * Copies a span of 8 byte elements into the buffer, little-endian,
+ * writing the buffer out whenever it fills up.
+ */
+static int buffer_span(trajectory_t *trajectory, const span_t span)
+{
+    const unsigned char *source = span.data;
+    size_t remaining = span.size;
+
+    while (remaining) {
+
+        const size_t chunk = remaining < TRAJECTORY_BUFFER_SIZE - trajectory->buffered ?
+                             remaining : TRAJECTORY_BUFFER_SIZE - trajectory->buffered;
+
+        copy_little_endian(trajectory->buffer + trajectory->buffered, source, chunk);
+        trajectory->buffered += chunk;
+        source += chunk;
+        remaining -= chunk;
+
+        if (trajectory->buffered == TRAJECTORY_BUFFER_SIZE && trajectory__flush(trajectory))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Writes the spans in order, retrying short writes.  Errors stick, later writes fail too. */
+static int write_spans(trajectory_t *trajectory, span_t *spans, size_t span_count)
+{
+    if (trajectory->failed)
+        return 1;
+
+    #ifdef _WIN32
+    for (size_t s = 0; s < span_count; ++s)
+        if (fwrite(spans[s].data, 1, spans[s].size, trajectory->file) != spans[s].size)
+            trajectory->failed = 1;
+    #else
+    struct iovec iov[MAX_SPAN_COUNT];
+    struct iovec *next = iov;
+
+    for (size_t s = 0; s < span_count; ++s)
+        iov[s] = (struct iovec){(void *)(uintptr_t)spans[s].data, spans[s].size};
+
+    while (span_count) {
+
+        ssize_t written = writev(trajectory->fd, next, (int)span_count);
+
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            trajectory->failed = 1;
+            break;
+        }
+
+        while (span_count && (size_t)written >= next->iov_len) {
+            written -= (ssize_t)next->iov_len;
+            ++next;
+            --span_count;
+        }
+
+        if (span_count) {
+            next->iov_base = (unsigned char *)next->iov_base + written;
+            next->iov_len -= (size_t)written;
+        }
+    }
+    #endif
+
+    return trajectory->failed;
+}
+
+static int host_is_little_endian(void)
+{
+    const uint16_t probe = 1;
+
+    return *(const unsigned char *)&probe == 1;
+}
+
+static void store_little_endian(unsigned char *bytes, const uint64_t value, const size_t size)
+{
+    for (size_t b = 0; b < size; ++b)
+        bytes[b] = (unsigned char)(value >> (8 * b));
+}
+
+/* size is a multiple of 8, every element of a frame is 8 bytes wide */
+static void copy_little_endian(unsigned char *destination, const unsigned char *source, const size_t size)
+{
+    if (host_is_little_endian()) {
+        memcpy(destination, source, size);
+        return;
+    }
+
+    for (size_t element = 0; element < size; element += 8)
+        for (size_t b = 0; b < 8; ++b)
+            destination[element + b] = source[element + 7 - b];
+}
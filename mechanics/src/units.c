@@ -0,0 +1,31 @@
+#include "units.h"
+
+
+/* Private function declarations */
+static particle_t scale(const particle_t *p, const double mass, const double charge);
+
+/* Public function definitions */
+particle_t units__to_reduced(const particle_t *p)
+{
+    return scale(p, 1 / UNIT_MASS, 1 / UNIT_CHARGE);
+}
+
+particle_t units__to_physical(const particle_t *p)
+{
+    return scale(p, UNIT_MASS, UNIT_CHARGE);
+}
+
+/* Private function definitions */
+
+/* Momenta and angular momenta are multiples of UNIT_MASS like the mass itself */
+static particle_t scale(const particle_t *p, const double mass, const double charge)
+{
+    particle_t scaled = *p;
+
+    scaled.mass *= mass;
+    scaled.charge *= charge;
+    scaled.momenta = vector3d__scale(p->momenta, mass);
+    scaled.angular_momenta = vector3d__scale(p->angular_momenta, mass);
+
+    return scaled;
+}
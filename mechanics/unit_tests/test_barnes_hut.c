@@ -0,0 +1,101 @@
+#include "barnes_hut.h"
+
+#include "mechanics.h"
+#include "log.h"
+
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define CLOUD_SIZE      500
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static particle_system_t *cloud;
+
+
+void setUp(void)
+{
+    unsigned long long int state = 42;
+
+    cloud = particle_system__new(CLOUD_SIZE);
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+
+        const particle_t p = {
+            .id = n,
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .mass = n % 2 ? ELECTRON_MASS : PROTON_MASS,
+            .charge = n % 2 ? ELECTRON_CHARGE : PROTON_CHARGE,
+            .radius = ELECTRON_RADIUS
+        };
+
+        particle_system__add(cloud, &p);
+    }
+}
+
+void tearDown(void)
+{
+    particle_system__delete(cloud);
+    free_mechanics_workspace();
+    set_force_solver(FORCE_SOLVER_DIRECT);
+    set_opening_angle(DEFAULT_OPENING_ANGLE);
+    set_periodic_box((vector3d_t){0});
+}
+
+void test_zero_opening_angle_matches_direct_sum(void)
+{
+    set_force_solver(FORCE_SOLVER_BARNES_HUT);
+    set_opening_angle(0);
+
+    const force_error_t error = force_solver_error(cloud);
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9, 0, error.max_relative);
+}
+
+void test_error_grows_with_opening_angle(void)
+{
+    set_force_solver(FORCE_SOLVER_BARNES_HUT);
+
+    set_opening_angle(0.3);
+    const force_error_t narrow = force_solver_error(cloud);
+
+    set_opening_angle(0.8);
+    const force_error_t wide = force_solver_error(cloud);
+
+    TEST_ASSERT_LESS_THAN_DOUBLE(1E-2, narrow.rms_relative);
+    TEST_ASSERT_LESS_THAN_DOUBLE(1E-1, wide.rms_relative);
+    TEST_ASSERT_GREATER_THAN_DOUBLE(narrow.rms_relative, wide.rms_relative);
+}
+
+/* force_solver_error() compares against the minimum image direct sum */
+void test_periodic_box_takes_nearest_images(void)
+{
+    set_force_solver(FORCE_SOLVER_BARNES_HUT);
+    set_periodic_box((vector3d_t){1, 1, 1});
+
+    set_opening_angle(0);
+    const force_error_t exact = force_solver_error(cloud);
+
+    set_opening_angle(0.3);
+    const force_error_t narrow = force_solver_error(cloud);
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9, 0, exact.max_relative);
+    TEST_ASSERT_LESS_THAN_DOUBLE(1E-2, narrow.rms_relative);
+}
+
+void test_tree_handles_coincident_particles(void)
+{
+    barnes_hut_t *tree = barnes_hut__new();
+    const particle_t p = {.pos = {0.1, 0.1, 0.1}, .mass = 1, .charge = 1};
+
+    for (size_t n = 0; n < 2 * BARNES_HUT_LEAF_CAPACITY; ++n)
+        particle_system__add(cloud, &p);
+
+    TEST_ASSERT_EQUAL(0, barnes_hut__build(tree, cloud));
+    TEST_ASSERT_GREATER_THAN(1, barnes_hut__node_count(tree));
+
+    barnes_hut__delete(tree);
+}
@@ -0,0 +1,158 @@
+#include "block_timestep.h"
+
+#include <math.h>
+
+#include "unity.h"
+
+
+#define MAX_LEVEL       8
+#define STEP_COUNT      20
+
+
+static particle_system_t *system_under_test;
+static block_timestep_t block;
+
+
+/* Unit attraction between every pair, F = -d/|d|^3 */
+static void attraction(particle_system_t *system, const size_t *active, const size_t active_count)
+{
+    for (size_t a = 0; a < active_count; ++a) {
+
+        const size_t this = active[a];
+        vector3d_t F = {0};
+
+        for (size_t that = 0; that < system->count; ++that) {
+
+            if (this == that) continue;
+
+            const vector3d_t d = {system->pos.i[this] - system->pos.i[that], system->pos.j[this] - system->pos.j[that], 0};
+            const double r = sqrt(d.i * d.i + d.j * d.j);
+
+            F.i -= d.i / (r * r * r);
+            F.j -= d.j / (r * r * r);
+        }
+
+        system->force.i[this] = F.i;
+        system->force.j[this] = F.j;
+        system->force.k[this] = 0;
+    }
+}
+
+static double energy(const particle_system_t *system)
+{
+    double total = 0;
+
+    for (size_t this = 0; this < system->count; ++this) {
+
+        total += (system->momenta.i[this] * system->momenta.i[this] + system->momenta.j[this] * system->momenta.j[this]) / (2 * system->mass[this]);
+
+        for (size_t that = this + 1; that < system->count; ++that)
+            total -= 1 / hypot(system->pos.i[this] - system->pos.i[that], system->pos.j[this] - system->pos.j[that]);
+    }
+
+    return total;
+}
+
+/* What time_evolution_soa() does for INTEGRATOR_BLOCK_TIMESTEP, with the forces above */
+static unsigned long long int block_step(const double max_period)
+{
+    const double substep_period = ldexp(max_period, -MAX_LEVEL);
+    unsigned long long int evaluations = 0, substeps;
+
+    for (unsigned long long int substep = 0; substep < (1ULL << MAX_LEVEL); substep += substeps) {
+
+        substeps = block_timestep__select(&block, system_under_test->count, substep);
+        block_timestep__begin_steps(&block, system_under_test, max_period);
+
+        for (size_t n = 0; n < system_under_test->count; ++n) {
+            system_under_test->pos.i[n] += system_under_test->momenta.i[n] / system_under_test->mass[n] * substeps * substep_period;
+            system_under_test->pos.j[n] += system_under_test->momenta.j[n] / system_under_test->mass[n] * substeps * substep_period;
+        }
+
+        attraction(system_under_test, block.ending, block.ending_count);
+        evaluations += block.ending_count;
+        block_timestep__end_steps(&block, system_under_test, substep + substeps, max_period, DEFAULT_BLOCK_ACCURACY);
+    }
+
+    return evaluations;
+}
+
+
+void setUp(void)
+{
+    system_under_test = particle_system__new(4);
+    block = (block_timestep_t){.max_level = MAX_LEVEL};
+    block_timestep__reserve(&block, 4);
+}
+
+void tearDown(void)
+{
+    block_timestep__free(&block);
+    particle_system__delete(system_under_test);
+}
+
+void test_select_lists(void)
+{
+    const unsigned char levels[] = {0, 8, 7, 8};
+
+    for (size_t n = 0; n < 4; ++n) {
+        const particle_t p = {.mass = 1};
+        particle_system__add(system_under_test, &p);
+        block.level[n] = levels[n];
+    }
+
+    /* Finest level is 8, one substep per stretch */
+    TEST_ASSERT_EQUAL(1, block_timestep__select(&block, 4, 0));
+    TEST_ASSERT_EQUAL(4, block.starting_count);
+    TEST_ASSERT_EQUAL(2, block.ending_count);
+    TEST_ASSERT_EQUAL(1, block.ending[0]);
+    TEST_ASSERT_EQUAL(3, block.ending[1]);
+
+    TEST_ASSERT_EQUAL(1, block_timestep__select(&block, 4, 255));
+    TEST_ASSERT_EQUAL(2, block.starting_count);
+    TEST_ASSERT_EQUAL(4, block.ending_count);
+
+    /* With the finest particles gone to level 7 the stretch doubles */
+    block.level[1] = block.level[3] = 7;
+    TEST_ASSERT_EQUAL(2, block_timestep__select(&block, 4, 2));
+    TEST_ASSERT_EQUAL(3, block.ending_count);
+}
+
+/**
+ * A tight binary far from a wide one.  The tight pair has to sit on
+ * finer levels than the wide one, and the wide one must not be
+ * dragged down with it.
+ */
+void test_tight_pair_does_not_slow_the_rest(void)
+{
+    const double tight = 0.01, wide = 1;
+    const double tight_speed = sqrt(1 / (2 * tight)), wide_speed = sqrt(1 / (2 * wide));
+    const particle_t particles[] = {
+        {.pos = {-10 + tight / 2, 0, 0}, .momenta = {0, tight_speed, 0}, .mass = 1},
+        {.pos = {-10 - tight / 2, 0, 0}, .momenta = {0, -tight_speed, 0}, .mass = 1},
+        {.pos = {10 + wide / 2, 0, 0}, .momenta = {0, wide_speed, 0}, .mass = 1},
+        {.pos = {10 - wide / 2, 0, 0}, .momenta = {0, -wide_speed, 0}, .mass = 1},
+    };
+    const size_t all[] = {0, 1, 2, 3};
+    const double max_period = 0.01;
+    unsigned long long int evaluations = 0;
+
+    for (size_t n = 0; n < 4; ++n)
+        particle_system__add(system_under_test, &particles[n]);
+
+    attraction(system_under_test, all, 4);
+    block_timestep__initial_levels(&block, system_under_test, max_period, DEFAULT_BLOCK_ACCURACY);
+
+    const double reference = energy(system_under_test);
+
+    for (unsigned int step = 0; step < STEP_COUNT; ++step)
+        evaluations += block_step(max_period);
+
+    TEST_ASSERT_GREATER_THAN(block.level[2] + 2, block.level[0]);
+    TEST_ASSERT_EQUAL(block.level[0], block.level[1]);
+
+    /* Stepping everyone at the tight pair's level would cost twice as much */
+    const unsigned long long int shared_step_evaluations = 4ULL * STEP_COUNT << block.level[0];
+    TEST_ASSERT_LESS_THAN(shared_step_evaluations * 6 / 10, evaluations);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-3 * fabs(reference), reference, energy(system_under_test));
+}
@@ -0,0 +1,254 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mechanics.h"
+#include "units.h"
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define TEST_FILEPATH       "test_checkpoint.bin"
+#define SIDE                4
+#define SAMPLE_PERIOD       1E-16
+#define STEPS               5
+
+#define PLASMA_COUNT        400
+#define PLASMA_BOX          1E-8
+#define PLASMA_CUTOFF       2E-9
+#define PLASMA_SKIN         6E-10
+#define PLASMA_PERIOD       1E-14
+#define PLASMA_MOMENTUM     3E6         // reduced, kinetic and Coulomb energies of the same order
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static particle_system_t *original;
+static particle_system_t *restored;
+
+
+/* Alternating charges on a slightly jittered lattice */
+static particle_system_t *lattice(void)
+{
+    particle_system_t *system = particle_system__new(SIDE * SIDE * SIDE);
+
+    for (size_t n = 0; n < SIDE * SIDE * SIDE; ++n) {
+        const double jitter = 1E-11 * (double)((n * 7919) % 13);
+        const particle_t p = {
+            .id = n,
+            .pos = {1E-9 * (double)(n % SIDE) + jitter, 1E-9 * (double)(n / SIDE % SIDE), 1E-9 * (double)(n / (SIDE * SIDE)) - jitter},
+            .momenta = {1E-24 * (double)(n % 3), 0, -1E-24},
+            .angular_momenta = {0, 1E-30, 0},
+            .mass = n % 2 ? 9.11E-28 : 1.67E-24,
+            .charge = n % 2 ? -1.602E-19 : 1.602E-19,
+            .radius = 1E-15,
+        };
+        particle_system__add(system, &p);
+    }
+
+    return system;
+}
+
+static void assert_same_state(const particle_system_t *a, const particle_system_t *b)
+{
+    TEST_ASSERT_EQUAL(a->count, b->count);
+    TEST_ASSERT_EQUAL(a->step_count, b->step_count);
+    TEST_ASSERT_EQUAL_MEMORY(&a->time, &b->time, sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->pos.i, b->pos.i, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->pos.j, b->pos.j, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->pos.k, b->pos.k, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->momenta.i, b->momenta.i, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->momenta.j, b->momenta.j, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->momenta.k, b->momenta.k, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->orientation.j, b->orientation.j, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->id, b->id, a->count * sizeof(unsigned long long int));
+}
+
+/* Checkpoints after STEPS steps, then both copies take STEPS more */
+static void run_and_restore(void)
+{
+    double sample_period = 0;
+
+    for (unsigned int step = 0; step < STEPS; ++step)
+        time_evolution_soa(original, SAMPLE_PERIOD);
+
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+
+    restored = checkpoint__read(TEST_FILEPATH, CHECKPOINT_ANY_COUNT, &sample_period);
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL_DOUBLE(SAMPLE_PERIOD, sample_period);
+    assert_same_state(original, restored);
+
+    for (unsigned int step = 0; step < STEPS; ++step) {
+        time_evolution_soa(original, SAMPLE_PERIOD);
+        time_evolution_soa(restored, sample_period);
+    }
+}
+
+
+void setUp(void)
+{
+    original = lattice();
+    restored = NULL;
+}
+
+void tearDown(void)
+{
+    particle_system__delete(original);
+    particle_system__delete(restored);
+    free_mechanics_workspace();
+    set_integrator(INTEGRATOR_SYMPLECTIC_EULER);
+    set_force_solver(FORCE_SOLVER_DIRECT);
+    set_cutoff(0, 0);
+    set_periodic_box((vector3d_t){0});
+    remove(TEST_FILEPATH);
+}
+
+void test_restart_is_bit_exact(void)
+{
+    set_integrator(INTEGRATOR_VELOCITY_VERLET);
+
+    run_and_restore();
+
+    /* The restored run reused the saved forces instead of recomputing them */
+    assert_same_state(original, restored);
+}
+
+/* The restored run builds its neighbour lists at other steps, from other positions */
+void test_neighbour_list_restart_is_bit_exact(void)
+{
+    const unsigned int steps[2] = {37, 60};
+    unsigned long long int state = 3;
+    double sample_period = 0;
+
+    particle_system__delete(original);
+    original = particle_system__new(PLASMA_COUNT);
+
+    for (size_t n = 0; n < PLASMA_COUNT; ++n) {
+        const particle_t p = {
+            .id = n,
+            .pos = {PLASMA_BOX * (next_random(&state) - 0.5), PLASMA_BOX * (next_random(&state) - 0.5), PLASMA_BOX * (next_random(&state) - 0.5)},
+            .momenta = {PLASMA_MOMENTUM * (next_random(&state) - 0.5), PLASMA_MOMENTUM * (next_random(&state) - 0.5),
+                        PLASMA_MOMENTUM * (next_random(&state) - 0.5)},
+            .mass = PROTON_MASS / UNIT_MASS,
+            .charge = n % 2 ? -1 : 1,
+            .radius = 1E-15,
+        };
+        particle_system__add(original, &p);
+    }
+
+    set_integrator(INTEGRATOR_VELOCITY_VERLET);
+    set_force_solver(FORCE_SOLVER_NEIGHBOUR_LIST);
+    set_cutoff(PLASMA_CUTOFF, PLASMA_SKIN);
+    set_periodic_box((vector3d_t){PLASMA_BOX, PLASMA_BOX, PLASMA_BOX});
+
+    for (unsigned int step = 0; step < steps[0]; ++step)
+        time_evolution_soa(original, PLASMA_PERIOD);
+
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, PLASMA_PERIOD));
+
+    const unsigned long long int builds = get_neighbour_list_builds();
+
+    for (unsigned int step = 0; step < steps[1]; ++step)
+        time_evolution_soa(original, PLASMA_PERIOD);
+
+    TEST_ASSERT_TRUE(get_neighbour_list_builds() > builds);
+
+    /* A new process, which starts without the lists of the run that wrote the checkpoint */
+    free_mechanics_workspace();
+    restored = checkpoint__read(TEST_FILEPATH, CHECKPOINT_ANY_COUNT, &sample_period);
+    TEST_ASSERT_NOT_NULL(restored);
+
+    for (unsigned int step = 0; step < steps[1]; ++step)
+        time_evolution_soa(restored, sample_period);
+
+    assert_same_state(original, restored);
+}
+
+void test_restart_keeps_block_levels(void)
+{
+    set_integrator(INTEGRATOR_BLOCK_TIMESTEP);
+    set_block_timestep(4, DEFAULT_BLOCK_ACCURACY);
+
+    run_and_restore();
+
+    assert_same_state(original, restored);
+    set_block_timestep(DEFAULT_BLOCK_MAX_LEVEL, DEFAULT_BLOCK_ACCURACY);
+}
+
+void test_settings_are_restored(void)
+{
+    double sample_period;
+
+    set_integrator(INTEGRATOR_RK4);
+    set_magnetic_field((vector3d_t){0, 0, 2});
+    set_cutoff(0.3, 0.03);
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+
+    set_integrator(INTEGRATOR_EXPLICIT_EULER);
+    set_magnetic_field((vector3d_t){0});
+    set_cutoff(0, 0);
+    restored = checkpoint__read(TEST_FILEPATH, CHECKPOINT_ANY_COUNT, &sample_period);
+
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL(INTEGRATOR_RK4, get_integrator());
+    TEST_ASSERT_EQUAL_DOUBLE(2, get_magnetic_field().k);
+    TEST_ASSERT_EQUAL_DOUBLE(0.3, get_mechanics_settings().cutoff);
+    TEST_ASSERT_EQUAL_DOUBLE(0.03, get_mechanics_settings().skin);
+    set_magnetic_field((vector3d_t){0});
+    set_cutoff(0, 0);
+}
+
+void test_refused_count_leaves_settings_alone(void)
+{
+    double sample_period;
+
+    set_integrator(INTEGRATOR_RK4);
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+
+    set_integrator(INTEGRATOR_VELOCITY_VERLET);
+
+    TEST_ASSERT_NULL(checkpoint__read(TEST_FILEPATH, original->count + 1, &sample_period));
+    TEST_ASSERT_EQUAL(INTEGRATOR_VELOCITY_VERLET, get_integrator());
+
+    restored = checkpoint__read(TEST_FILEPATH, original->count, &sample_period);
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL(INTEGRATOR_RK4, get_integrator());
+}
+
+void test_damaged_checkpoint_is_refused(void)
+{
+    double sample_period;
+    FILE *file;
+
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+
+    /* Flip one bit in the middle of the arrays */
+    file = fopen(TEST_FILEPATH, "r+b");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 1000, SEEK_SET);
+    const int byte = fgetc(file);
+    fseek(file, 1000, SEEK_SET);
+    fputc(byte ^ 0x10, file);
+    fclose(file);
+
+    TEST_ASSERT_NULL(checkpoint__read(TEST_FILEPATH, CHECKPOINT_ANY_COUNT, &sample_period));
+    TEST_ASSERT_NULL(checkpoint__read("no_such_checkpoint.bin", CHECKPOINT_ANY_COUNT, &sample_period));
+}
+
+void test_write_replaces_without_leftovers(void)
+{
+    double sample_period;
+
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+    original->step_count = 42;
+    TEST_ASSERT_EQUAL(0, checkpoint__write(TEST_FILEPATH, original, SAMPLE_PERIOD));
+
+    TEST_ASSERT_NULL(fopen(TEST_FILEPATH ".tmp", "rb"));
+
+    restored = checkpoint__read(TEST_FILEPATH, CHECKPOINT_ANY_COUNT, &sample_period);
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL(42, restored->step_count);
+}
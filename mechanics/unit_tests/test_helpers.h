@@ -0,0 +1,12 @@
+#pragma once
+
+
+/**
+ * Uniform in [0, 1) from a 64 bit LCG, the same sequence on every
+ * platform and every rank, so the test scenes do not depend on rand().
+ */
+static inline double next_random(unsigned long long int *state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double)(*state >> 11) / (double)(1ULL << 53);
+}
@@ -0,0 +1,190 @@
+#include "integrator.h"
+
+#include <math.h>
+
+#include "unity.h"
+
+
+#define STR_BUF_SIZE    256
+#define ORBIT_STEPS     2000
+
+
+static particle_system_t *system_under_test;
+static rk4_workspace_t rk4;
+
+
+/* Unit attraction between two particles, F = -d/|d|^3, potential -1/|d| */
+static void attraction(particle_system_t *pair)
+{
+    const double dx = pair->pos.i[0] - pair->pos.i[1];
+    const double dy = pair->pos.j[0] - pair->pos.j[1];
+    const double dz = pair->pos.k[0] - pair->pos.k[1];
+    const double r = sqrt(dx*dx + dy*dy + dz*dz);
+    const double scale = -1 / (r * r * r);
+
+    pair->force.i[0] = scale * dx;   pair->force.i[1] = -scale * dx;
+    pair->force.j[0] = scale * dy;   pair->force.j[1] = -scale * dy;
+    pair->force.k[0] = scale * dz;   pair->force.k[1] = -scale * dz;
+}
+
+static double orbit_energy(const particle_system_t *pair)
+{
+    const double dx = pair->pos.i[0] - pair->pos.i[1];
+    const double dy = pair->pos.j[0] - pair->pos.j[1];
+    double energy = -1 / sqrt(dx*dx + dy*dy);
+
+    for (size_t n = 0; n < 2; ++n)
+        energy += (pair->momenta.i[n] * pair->momenta.i[n] + pair->momenta.j[n] * pair->momenta.j[n]) / (2 * pair->mass[n]);
+
+    return energy;
+}
+
+/* Two unit masses on a circular orbit of radius 1/2 about their centre */
+static void start_orbit(void)
+{
+    const particle_t a = {.pos = {0.5, 0, 0}, .momenta = {0, sqrt(0.5), 0}, .mass = 1};
+    const particle_t b = {.pos = {-0.5, 0, 0}, .momenta = {0, -sqrt(0.5), 0}, .mass = 1};
+
+    system_under_test->count = 0;
+    particle_system__add(system_under_test, &a);
+    particle_system__add(system_under_test, &b);
+}
+
+static double worst_drift(const integrator_t scheme, const double dt)
+{
+    particle_system_t *pair = system_under_test;
+    const double reference = orbit_energy(pair);
+    double worst = 0;
+
+    for (unsigned int step = 0; step < ORBIT_STEPS; ++step) {
+
+        switch (scheme) {
+        case INTEGRATOR_EXPLICIT_EULER:
+            attraction(pair);
+            integrator__drift(pair, 0, 2, dt, (vector3d_t){0});
+            integrator__kick(pair, 0, 2, dt);
+            break;
+
+        case INTEGRATOR_VELOCITY_VERLET:
+            attraction(pair);
+            integrator__kick(pair, 0, 2, dt / 2);
+            integrator__drift(pair, 0, 2, dt, (vector3d_t){0});
+            attraction(pair);
+            integrator__kick(pair, 0, 2, dt / 2);
+            break;
+
+        case INTEGRATOR_RK4:
+            for (unsigned int stage = 0; stage < 4; ++stage) {
+                attraction(pair);
+                integrator__rk4_stage(&rk4, pair, 0, 2, dt, stage, (vector3d_t){0});
+            }
+            break;
+
+        default:
+            attraction(pair);
+            integrator__kick(pair, 0, 2, dt);
+            integrator__drift(pair, 0, 2, dt, (vector3d_t){0});
+            break;
+        }
+
+        const double drift = fabs((orbit_energy(pair) - reference) / reference);
+        if (drift > worst) worst = drift;
+    }
+
+    return worst;
+}
+
+
+void setUp(void)
+{
+    system_under_test = particle_system__new(2);
+    integrator__rk4_reserve(&rk4, 2);
+}
+
+void tearDown(void)
+{
+    integrator__rk4_free(&rk4);
+    particle_system__delete(system_under_test);
+}
+
+/* Under a constant force RK4 has no truncation error, x = x0 + v dt + F dt^2 / 2m */
+void test_rk4_exact_for_constant_force(void)
+{
+    const particle_t p = {.pos = {1, 2, 3}, .momenta = {2, 0, -1}, .mass = 2};
+    const vector3d_t F = {0.5, -1, 4};
+    const double dt = 0.25;
+
+    particle_system__add(system_under_test, &p);
+
+    for (unsigned int stage = 0; stage < 4; ++stage) {
+        system_under_test->force.i[0] = F.i;
+        system_under_test->force.j[0] = F.j;
+        system_under_test->force.k[0] = F.k;
+        integrator__rk4_stage(&rk4, system_under_test, 0, 1, dt, stage, (vector3d_t){0});
+    }
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, 1 + 1 * dt + F.i / 4 * dt * dt, system_under_test->pos.i[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, 2 + 0 * dt + F.j / 4 * dt * dt, system_under_test->pos.j[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, 3 - 0.5 * dt + F.k / 4 * dt * dt, system_under_test->pos.k[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, 2 + F.i * dt, system_under_test->momenta.i[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, F.j * dt, system_under_test->momenta.j[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, -1 + F.k * dt, system_under_test->momenta.k[0]);
+}
+
+void test_boris_rotation(void)
+{
+    const particle_t p = {.momenta = {3, 0, 1}, .mass = 2, .charge = 4};
+    const vector3d_t B = {0, 0, 0.5};
+    const double dt = 0.1;
+    const double angle = 2 * atan(p.charge * B.k * dt / (2 * p.mass));
+
+    particle_system__add(system_under_test, &p);
+    integrator__boris_rotate(system_under_test, 0, 1, dt, B);
+
+    /* Positive charge gyrates clockwise about B */
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, 3 * cos(angle), system_under_test->momenta.i[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, -3 * sin(angle), system_under_test->momenta.j[0]);
+    TEST_ASSERT_EQUAL_DOUBLE(1, system_under_test->momenta.k[0]);
+}
+
+void test_drift_wraps_into_box(void)
+{
+    const particle_t p = {.pos = {0.45, 0, 0}, .momenta = {1, 0, 0}, .mass = 1};
+
+    particle_system__add(system_under_test, &p);
+    integrator__drift(system_under_test, 0, 1, 0.1, (vector3d_t){1, 0, 0});
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-14, -0.45, system_under_test->pos.i[0]);
+}
+
+/**
+ * Over many orbits the symplectic schemes keep the energy error
+ * bounded while explicit Euler spirals outwards, and RK4 is fourth
+ * order so halving the step shrinks its error about sixteen fold.
+ */
+void test_orbit_energy_drift(void)
+{
+    const double dt = 0.02;
+    double drift[4];
+    char msg_buf[STR_BUF_SIZE];
+
+    start_orbit();
+    drift[0] = worst_drift(INTEGRATOR_EXPLICIT_EULER, dt);
+    start_orbit();
+    drift[1] = worst_drift(INTEGRATOR_SYMPLECTIC_EULER, dt);
+    start_orbit();
+    drift[2] = worst_drift(INTEGRATOR_VELOCITY_VERLET, dt);
+    start_orbit();
+    drift[3] = worst_drift(INTEGRATOR_RK4, dt);
+
+    snprintf(msg_buf, sizeof(msg_buf), "Drifts %e %e %e %e", drift[0], drift[1], drift[2], drift[3]);
+    TEST_ASSERT_TRUE_MESSAGE(drift[0] > 0.1, msg_buf);
+    TEST_ASSERT_TRUE_MESSAGE(drift[1] < 0.05, msg_buf);
+    TEST_ASSERT_TRUE_MESSAGE(drift[2] < 1E-4, msg_buf);
+    TEST_ASSERT_TRUE_MESSAGE(drift[3] < 1E-6, msg_buf);
+
+    start_orbit();
+    const double half_step_drift = worst_drift(INTEGRATOR_RK4, dt / 2);
+    snprintf(msg_buf, sizeof(msg_buf), "RK4 drift %e at dt, %e at dt/2", drift[3], half_step_drift);
+    TEST_ASSERT_TRUE_MESSAGE(drift[3] / half_step_drift > 10, msg_buf);
+}
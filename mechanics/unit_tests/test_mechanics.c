@@ -1,9 +1,13 @@
 #include "mechanics.h"
 
+#include <string.h>
+
+#include "pair_kernel.h"
 #include "vector.h"
 #include "log.h"
 
 #include "unity.h"
+#include "test_helpers.h"
 
 
 #define __SKIP_LOG_DATA
@@ -22,7 +26,11 @@ void setUp(void)
 
 void tearDown(void)
 {
-
+    set_force_solver(FORCE_SOLVER_DIRECT);
+    set_cutoff(0, 0);
+    set_thread_count(0);
+    set_deterministic(0);
+    free_mechanics_workspace();
 }
 
 /**
@@ -171,3 +179,163 @@ void test_detect_collision(void)
         resetTest();
     }
 }
+
+/* Each particle's force is summed by one thread, so threading must not change a single bit */
+void test_forces_do_not_depend_on_thread_count(void)
+{
+    const force_solver_t solvers[] = {FORCE_SOLVER_DIRECT, FORCE_SOLVER_BARNES_HUT, FORCE_SOLVER_NEIGHBOUR_LIST};
+    const size_t particle_count = 300;
+    particle_system_t *system = particle_system__new(particle_count);
+    double *serial = malloc(3 * particle_count * sizeof(double));
+    unsigned long long int state = 3;
+    char msg_buf[STR_BUF_SIZE];
+
+    for (size_t n = 0; n < particle_count; ++n) {
+        const particle_t p = {
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .mass = 1,
+            .charge = n % 2 ? PROTON_CHARGE : ELECTRON_CHARGE
+        };
+        particle_system__add(system, &p);
+    }
+
+    set_cutoff(0.2, 0.02);
+
+    for (unsigned int s = 0; s < sizeof(solvers)/sizeof(force_solver_t); ++s) {
+
+        set_force_solver(solvers[s]);
+
+        set_thread_count(1);
+        TEST_ASSERT_EQUAL(0, compute_forces(system));
+        memcpy(&serial[0], system->force.i, particle_count * sizeof(double));
+        memcpy(&serial[particle_count], system->force.j, particle_count * sizeof(double));
+        memcpy(&serial[2 * particle_count], system->force.k, particle_count * sizeof(double));
+
+        set_thread_count(4);
+        TEST_ASSERT_EQUAL(0, compute_forces(system));
+
+        snprintf(msg_buf, sizeof(msg_buf), "Failure with solver %i", solvers[s]);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&serial[0], system->force.i, particle_count * sizeof(double), msg_buf);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&serial[particle_count], system->force.j, particle_count * sizeof(double), msg_buf);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&serial[2 * particle_count], system->force.k, particle_count * sizeof(double), msg_buf);
+    }
+
+    free(serial);
+    particle_system__delete(system);
+}
+
+/* The lists outlive steps that move particles less than half the skin, and without a cutoff the solver refuses */
+void test_neighbour_lists_are_reused(void)
+{
+    const size_t particle_count = 200;
+    particle_system_t *system = particle_system__new(particle_count);
+    unsigned long long int state = 5;
+
+    /* Uncharged, so every particle drifts 3E-4 a step and covers half the skin, 0.01, during the 34th step */
+    for (size_t n = 0; n < particle_count; ++n) {
+        const particle_t p = {
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .momenta = {n % 2 ? 300 : -300, 0, 0},
+            .mass = 1,
+        };
+        particle_system__add(system, &p);
+    }
+
+    set_force_solver(FORCE_SOLVER_NEIGHBOUR_LIST);
+    TEST_ASSERT_EQUAL(1, compute_forces(system));
+
+    const unsigned long long int builds = get_neighbour_list_builds();
+
+    set_cutoff(0.2, 0.02);
+    TEST_ASSERT_EQUAL(0, compute_forces(system));
+    TEST_ASSERT_EQUAL(builds + 1, get_neighbour_list_builds());
+
+    /* Forces come before the drift, the lists first go stale for the forces of step 35 */
+    for (int step = 0; step < 34; ++step)
+        time_evolution_soa(system, 1E-6);
+
+    TEST_ASSERT_EQUAL(builds + 1, get_neighbour_list_builds());
+
+    for (int step = 0; step < 10; ++step)
+        time_evolution_soa(system, 1E-6);
+
+    TEST_ASSERT_EQUAL(builds + 2, get_neighbour_list_builds());
+    TEST_ASSERT_EQUAL(FORCE_SOLVER_NEIGHBOUR_LIST, get_mechanics_settings().solver);
+    TEST_ASSERT_EQUAL_DOUBLE(0.2, get_mechanics_settings().cutoff);
+    TEST_ASSERT_EQUAL_DOUBLE(0.02, get_mechanics_settings().skin);
+
+    particle_system__delete(system);
+}
+
+/* In deterministic mode the direct sum is the scalar kernel's, and every step checksums the same whatever the thread count */
+void test_deterministic_steps_match_across_thread_counts(void)
+{
+    const size_t particle_count = 150;
+    const int step_count = 10;
+    particle_system_t *systems[2];
+    const unsigned int threads[2] = {1, 4};
+    uint64_t checksums[2][10];
+    unsigned long long int state;
+
+    for (int run = 0; run < 2; ++run) {
+
+        systems[run] = particle_system__new(particle_count);
+        state = 7;
+
+        for (size_t n = 0; n < particle_count; ++n) {
+            const particle_t p = {
+                .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+                .momenta = {1E3 * (next_random(&state) - 0.5), 0, 0},
+                .mass = 1,
+                .charge = n % 2 ? 1 : -1
+            };
+            particle_system__add(systems[run], &p);
+        }
+    }
+
+    set_deterministic(1);
+    TEST_ASSERT_EQUAL(0, compute_forces(systems[0]));
+
+    /* The direct solver runs on whichever kernel family mechanics.h selects */
+#ifdef __USE_FLOAT_FORCES
+    const pair_kernel_float_t scalar = pair_kernel_float_for(PAIR_KERNEL_SCALAR);
+    pair_sources_t sources = {0};
+
+    TEST_ASSERT_EQUAL(0, pair_sources__fill(&sources, systems[0]));
+#else
+    const pair_kernel_t scalar = pair_kernel_for(PAIR_KERNEL_SCALAR);
+#endif
+
+    for (size_t n = 0; n < particle_count; ++n) {
+        const vector3d_t pos = {systems[0]->pos.i[n], systems[0]->pos.j[n], systems[0]->pos.k[n]};
+#ifdef __USE_FLOAT_FORCES
+        const vector3d_t F = scalar(pos, systems[0]->charge[n], &sources, 0, sources.count, get_periodic_box());
+#else
+        const vector3d_t F = scalar(pos, systems[0]->charge[n], systems[0]->mass[n], systems[0], 0, particle_count, get_periodic_box());
+#endif
+
+        TEST_ASSERT_EQUAL_MEMORY(&F.i, &systems[0]->force.i[n], sizeof(double));
+        TEST_ASSERT_EQUAL_MEMORY(&F.j, &systems[0]->force.j[n], sizeof(double));
+        TEST_ASSERT_EQUAL_MEMORY(&F.k, &systems[0]->force.k[n], sizeof(double));
+    }
+
+#ifdef __USE_FLOAT_FORCES
+    pair_sources__free(&sources);
+#endif
+
+    for (int run = 0; run < 2; ++run) {
+
+        set_thread_count(threads[run]);
+
+        for (int step = 0; step < step_count; ++step) {
+            time_evolution_soa(systems[run], 1E-6);
+            checksums[run][step] = particle_system__checksum(systems[run]);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_MEMORY(checksums[0], checksums[1], sizeof(checksums[0]));
+    TEST_ASSERT_TRUE(checksums[0][0] != checksums[0][1]);
+
+    particle_system__delete(systems[0]);
+    particle_system__delete(systems[1]);
+}
@@ -0,0 +1,224 @@
+#include "neighbour_list.h"
+
+#include <math.h>
+
+#include "mechanics.h"
+#include "periodic.h"
+#include "log.h"
+
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define CLOUD_SIZE      400
+#define CUTOFF          0.12
+#define SKIN            0.02
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static particle_system_t *cloud;
+static neighbour_list_t *list;
+
+
+static vector3d_t separation(const size_t this, const size_t that, const vector3d_t box)
+{
+    return (vector3d_t){
+        periodic__wrap(cloud->pos.i[this] - cloud->pos.i[that], box.i),
+        periodic__wrap(cloud->pos.j[this] - cloud->pos.j[that], box.j),
+        periodic__wrap(cloud->pos.k[this] - cloud->pos.k[that], box.k)
+    };
+}
+
+/* The lists hold every pair within range and nothing else, and the forces match an all-pairs shifted-force sum */
+static void check_against_brute_force(const vector3d_t box)
+{
+    const double range = CUTOFF + SKIN;
+    size_t pairs = 0;
+    char msg_buf[256];
+
+    for (size_t this = 0; this < CLOUD_SIZE; ++this) {
+
+        vector3d_t expected = {0};
+
+        for (size_t that = 0; that < CLOUD_SIZE; ++that) {
+
+            const vector3d_t d = separation(this, that, box);
+            const double r = sqrt(d.i*d.i + d.j*d.j + d.k*d.k);
+
+            if (that == this) continue;
+
+            pairs += this < that && r < range;
+
+            if (r < CUTOFF) {
+                const double scale = REDUCED_COULOMB_CONST * cloud->charge[this] * cloud->charge[that] *
+                                     (1 / (r * r) - 1 / (CUTOFF * CUTOFF)) / r;
+                expected = vector3d__add(expected, vector3d__scale(d, scale));
+            }
+        }
+
+        const vector3d_t F = neighbour_list__force(list, cloud, this);
+
+        snprintf(msg_buf, sizeof(msg_buf), "Force on particle %zu", this);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-9 * (1 + fabs(expected.i)), expected.i, F.i, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-9 * (1 + fabs(expected.j)), expected.j, F.j, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-9 * (1 + fabs(expected.k)), expected.k, F.k, msg_buf);
+    }
+
+    TEST_ASSERT_EQUAL(2 * pairs, neighbour_list__entry_count(list));
+}
+
+
+void setUp(void)
+{
+    unsigned long long int state = 11;
+
+    cloud = particle_system__new(CLOUD_SIZE);
+    list = neighbour_list__new();
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+        const particle_t p = {
+            .id = n,
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .mass = 1,
+            .charge = n % 2 ? 1 : -1
+        };
+        particle_system__add(cloud, &p);
+    }
+}
+
+void tearDown(void)
+{
+    neighbour_list__delete(list);
+    particle_system__delete(cloud);
+}
+
+void test_open_lists_match_brute_force(void)
+{
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, CUTOFF, SKIN, (vector3d_t){0}));
+    TEST_ASSERT_EQUAL(1, neighbour_list__build_count(list));
+
+    check_against_brute_force((vector3d_t){0});
+}
+
+void test_periodic_lists_match_brute_force(void)
+{
+    const vector3d_t box = {1, 1, 1};
+
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, CUTOFF, SKIN, box));
+
+    check_against_brute_force(box);
+}
+
+/* Moved less than half the skin the old lists still cover every pair within the cutoff */
+void test_lists_hold_within_half_the_skin(void)
+{
+    const vector3d_t box = {1, 1, 1};
+
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, CUTOFF, SKIN, box));
+    TEST_ASSERT_EQUAL(0, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+
+    /* Alternate directions so pairs close in on each other */
+    for (size_t n = 0; n < CLOUD_SIZE; ++n)
+        cloud->pos.i[n] += (n % 2 ? 0.4 : -0.4) * SKIN / 2;
+
+    TEST_ASSERT_EQUAL(0, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+
+    for (size_t this = 0; this < CLOUD_SIZE; ++this) {
+
+        vector3d_t expected = {0};
+
+        for (size_t that = 0; that < CLOUD_SIZE; ++that) {
+
+            const vector3d_t d = separation(this, that, box);
+            const double r = sqrt(d.i*d.i + d.j*d.j + d.k*d.k);
+
+            if (that != this && r < CUTOFF)
+                expected = vector3d__add(expected, vector3d__scale(d, REDUCED_COULOMB_CONST * cloud->charge[this] * cloud->charge[that] *
+                                                                      (1 / (r * r) - 1 / (CUTOFF * CUTOFF)) / r));
+        }
+
+        const vector3d_t F = neighbour_list__force(list, cloud, this);
+
+        TEST_ASSERT_DOUBLE_WITHIN(1E-9 * (1 + fabs(expected.i)), expected.i, F.i);
+        TEST_ASSERT_DOUBLE_WITHIN(1E-9 * (1 + fabs(expected.j)), expected.j, F.j);
+    }
+
+    cloud->pos.j[7] += 0.6 * SKIN;
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+}
+
+void test_stale_after_a_setting_changes(void)
+{
+    const vector3d_t box = {1, 1, 1};
+
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, CUTOFF, SKIN, box));
+
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, 1.1 * CUTOFF, SKIN, box));
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, 2 * SKIN, box));
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, SKIN, (vector3d_t){0}));
+
+    particle_system__add(cloud, &(particle_t){.id = CLOUD_SIZE, .mass = 1});
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+}
+
+/* Two particles a hair apart trade places, nothing moves far but each list is at the other's index */
+void test_stale_after_particles_are_reordered(void)
+{
+    const vector3d_t box = {1, 1, 1};
+
+    cloud->pos.i[1] = cloud->pos.i[0] + 1E-3 * SKIN;
+    cloud->pos.j[1] = cloud->pos.j[0];
+    cloud->pos.k[1] = cloud->pos.k[0];
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, CUTOFF, SKIN, box));
+
+    const particle_t first = particle_system__get(cloud, 0);
+    const particle_t second = particle_system__get(cloud, 1);
+
+    particle_system__set(cloud, 0, &second);
+    particle_system__set(cloud, 1, &first);
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, CUTOFF, SKIN, box));
+}
+
+void test_range_must_fit_the_box(void)
+{
+    TEST_ASSERT_EQUAL(1, neighbour_list__build(list, cloud, 0.45, 0.05, (vector3d_t){1, 1, 1}));
+    TEST_ASSERT_EQUAL(1, neighbour_list__build(list, cloud, 0, SKIN, (vector3d_t){0}));
+    TEST_ASSERT_EQUAL(1, neighbour_list__stale(list, cloud, 0.45, 0.05, (vector3d_t){1, 1, 1}));
+    TEST_ASSERT_EQUAL(0, neighbour_list__entry_count(list));
+
+    /* Open axes have no limit */
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(list, cloud, 0.45, 0.05, (vector3d_t){0, 0, 1.2}));
+}
+
+/* Force and potential vanish at the cutoff and the force is -dV/dr inside it */
+void test_shifted_force_is_consistent(void)
+{
+    const double h = 1E-6;
+
+    TEST_ASSERT_EQUAL_DOUBLE(0, neighbour_list__potential(-1, CUTOFF, CUTOFF));
+    TEST_ASSERT_EQUAL_DOUBLE(0, neighbour_list__potential(-1, 2 * CUTOFF, CUTOFF));
+
+    for (double r = 0.2 * CUTOFF; r < 0.95 * CUTOFF; r += 0.1 * CUTOFF) {
+
+        const double force = 1 / (r * r) - 1 / (CUTOFF * CUTOFF);
+        const double slope = (neighbour_list__potential(1, r + h, CUTOFF) - neighbour_list__potential(1, r - h, CUTOFF)) / (2 * h);
+
+        TEST_ASSERT_DOUBLE_WITHIN(1E-6 * force + 1E-9, force, -slope);
+    }
+
+    particle_system_t *pair = particle_system__new(2);
+    neighbour_list_t *pair_list = neighbour_list__new();
+
+    particle_system__add(pair, &(particle_t){.id = 0, .mass = 1, .charge = 1});
+    particle_system__add(pair, &(particle_t){.id = 1, .pos = {CUTOFF, 0, 0}, .mass = 1, .charge = 1});
+
+    TEST_ASSERT_EQUAL(0, neighbour_list__build(pair_list, pair, CUTOFF, SKIN, (vector3d_t){0}));
+    TEST_ASSERT_EQUAL(2, neighbour_list__entry_count(pair_list));
+    TEST_ASSERT_EQUAL_DOUBLE(0, neighbour_list__force(pair_list, pair, 0).i);
+
+    neighbour_list__delete(pair_list);
+    particle_system__delete(pair);
+}
@@ -0,0 +1,227 @@
+#include "pair_kernel.h"
+
+#include <math.h>
+
+#include "mechanics.h"
+#include "log.h"
+
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define STR_BUF_SIZE    256
+#define CLOUD_SIZE      203     // odd so every vector width leaves a tail
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static particle_system_t *cloud;
+
+
+static void check_against_scalar(const pair_kernel_isa_t isa, const vector3d_t box)
+{
+    const pair_kernel_t reference = pair_kernel_for(PAIR_KERNEL_SCALAR);
+    const pair_kernel_t kernel = pair_kernel_for(isa);
+    char msg_buf[STR_BUF_SIZE];
+
+    if (!kernel) return;
+
+    for (size_t this = 0; this < CLOUD_SIZE; ++this) {
+
+        const vector3d_t this_pos = {cloud->pos.i[this], cloud->pos.j[this], cloud->pos.k[this]};
+        /* Odd begin so the vector loads are unaligned */
+        const vector3d_t expected = reference(this_pos, cloud->charge[this], cloud->mass[this], cloud, 1, CLOUD_SIZE, box);
+        const vector3d_t actual = kernel(this_pos, cloud->charge[this], cloud->mass[this], cloud, 1, CLOUD_SIZE, box);
+        const double tolerance = 1E-12 * vector3d__mag(expected);
+
+        snprintf(msg_buf, sizeof(msg_buf), "Failure at particle %zu with %s kernel", this, pair_kernel_name(isa));
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(tolerance, expected.i, actual.i, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(tolerance, expected.j, actual.j, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(tolerance, expected.k, actual.k, msg_buf);
+    }
+}
+
+/**
+ * Single precision positions put an error of about 1E-7 on every pair
+ * term, so the sums are compared to the double scalar kernel as a
+ * whole, the way force_solver_error() compares solvers.
+ */
+static void check_float_against_double(const pair_kernel_isa_t isa, const vector3d_t box)
+{
+    const pair_kernel_t reference = pair_kernel_for(PAIR_KERNEL_SCALAR);
+    const pair_kernel_float_t kernel = pair_kernel_float_for(isa);
+    pair_sources_t sources = {0};
+    double difference_sum = 0, reference_sum = 0;
+    char msg_buf[STR_BUF_SIZE];
+
+    if (!kernel) return;
+
+    TEST_ASSERT_EQUAL(0, pair_sources__fill(&sources, cloud));
+
+    for (size_t this = 0; this < CLOUD_SIZE; ++this) {
+
+        const vector3d_t this_pos = {cloud->pos.i[this], cloud->pos.j[this], cloud->pos.k[this]};
+        const vector3d_t expected = reference(this_pos, cloud->charge[this], cloud->mass[this], cloud, 1, CLOUD_SIZE, box);
+        const vector3d_t actual = kernel(this_pos, cloud->charge[this], &sources, 1, CLOUD_SIZE, box);
+        const double difference = vector3d__distance(actual, expected);
+        const double magnitude = vector3d__mag(expected);
+
+        difference_sum += difference * difference;
+        reference_sum += magnitude * magnitude;
+    }
+
+    pair_sources__free(&sources);
+
+    snprintf(msg_buf, sizeof(msg_buf), "%s float kernel is %e off in RMS", pair_kernel_name(isa), sqrt(difference_sum / reference_sum));
+    TEST_ASSERT_TRUE_MESSAGE(sqrt(difference_sum / reference_sum) < 1E-5, msg_buf);
+}
+
+
+void setUp(void)
+{
+    unsigned long long int state = 11;
+
+    cloud = particle_system__new(CLOUD_SIZE);
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+        const particle_t p = {
+            .id = n,
+            .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5},
+            .mass = 1,
+            .charge = n % 2 ? 1 : -1
+        };
+        particle_system__add(cloud, &p);
+    }
+}
+
+void tearDown(void)
+{
+    particle_system__delete(cloud);
+}
+
+void test_project_force_3d(void)
+{
+    const vector3d_t distance_vector[] = {
+        {.i = 1,    .j = 0,     .k = 1},
+        {.i = 1,    .j = 1,     .k = 1},
+        {.i = 0,    .j = 1,     .k = 1},
+        {.i = -1,   .j = 1,     .k = 1},
+        {.i = -1,   .j = 0,     .k = 1},
+        {.i = -1,   .j = -1,    .k = 1},
+        {.i = 0,    .j = -1,    .k = 1},
+        {.i = 1,    .j = -1,    .k = 1},
+
+        {.i = 1,    .j = 0,     .k = -1},
+        {.i = 1,    .j = 1,     .k = -1},
+        {.i = 0,    .j = 1,     .k = -1},
+        {.i = -1,   .j = 1,     .k = -1},
+        {.i = -1,   .j = 0,     .k = -1},
+        {.i = -1,   .j = -1,    .k = -1},
+        {.i = 0,    .j = -1,    .k = -1},
+        {.i = 1,    .j = -1,    .k = -1},
+    };
+    const unsigned int test_count = sizeof(distance_vector)/sizeof(vector3d_t);
+    const double F_scalar = 1;
+    char msg_buf[STR_BUF_SIZE];
+
+    for (unsigned int i = 0; i < test_count; ++i) {
+
+        const vector3d_t F_expected = componentize_force_3d(F_scalar, distance_vector[i]);
+        const vector3d_t F_actual = project_force_3d(F_scalar, distance_vector[i]);
+
+        snprintf(msg_buf, sizeof(msg_buf), "Failure at %i loop iteration", i);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, F_expected.i, F_actual.i, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, F_expected.j, F_actual.j, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, F_expected.k, F_actual.k, msg_buf);
+
+        resetTest();
+    }
+}
+
+/**
+ * With unit source charge and this_charge = r^2 / k the kernel should
+ * return the unit vector pointing from the source to this_pos.
+ */
+void test_kernel_matches_projection(void)
+{
+    const vector3d_t direction[] = {{1, 0, 1}, {-1, 1, 1}, {0, -2, 0.5}, {3, -1, -1}};
+    const unsigned int test_count = sizeof(direction)/sizeof(vector3d_t);
+    const particle_t source = {.pos = {0, 0, 0}, .mass = 1, .charge = 1};
+    char msg_buf[STR_BUF_SIZE];
+
+    cloud->count = 0;
+    particle_system__add(cloud, &source);
+
+    for (unsigned int i = 0; i < test_count; ++i) {
+
+        const double r = vector3d__mag(direction[i]);
+        const vector3d_t expected = project_force_3d(1, direction[i]);
+        const vector3d_t actual = pair_kernel()(direction[i], r * r / REDUCED_COULOMB_CONST, 1, cloud, 0, 1, (vector3d_t){0});
+
+        snprintf(msg_buf, sizeof(msg_buf), "Failure at %i loop iteration", i);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, expected.i, actual.i, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, expected.j, actual.j, msg_buf);
+        TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(10E-15, expected.k, actual.k, msg_buf);
+
+        resetTest();
+    }
+}
+
+void test_coincident_particles_are_skipped(void)
+{
+    const vector3d_t this_pos = {cloud->pos.i[0], cloud->pos.j[0], cloud->pos.k[0]};
+    const vector3d_t F = pair_kernel()(this_pos, cloud->charge[0], cloud->mass[0], cloud, 0, CLOUD_SIZE, (vector3d_t){0});
+
+    TEST_ASSERT_TRUE(isfinite(F.i) && isfinite(F.j) && isfinite(F.k));
+}
+
+void test_vector_kernels_match_scalar(void)
+{
+    TEST_ASSERT_NOT_NULL(pair_kernel_for(PAIR_KERNEL_SCALAR));
+    TEST_ASSERT_NOT_NULL(pair_kernel_for(pair_kernel_isa()));
+
+    for (pair_kernel_isa_t isa = PAIR_KERNEL_SSE2; isa <= PAIR_KERNEL_AVX512; ++isa)
+        check_against_scalar(isa, (vector3d_t){0});
+}
+
+void test_vector_kernels_match_scalar_periodic(void)
+{
+    for (pair_kernel_isa_t isa = PAIR_KERNEL_SSE2; isa <= PAIR_KERNEL_AVX512; ++isa)
+        check_against_scalar(isa, (vector3d_t){1, 1, 0});
+}
+
+void test_float_kernels_match_double(void)
+{
+    TEST_ASSERT_NOT_NULL(pair_kernel_float_for(PAIR_KERNEL_SCALAR));
+    TEST_ASSERT_NOT_NULL(pair_kernel_float());
+
+    for (pair_kernel_isa_t isa = PAIR_KERNEL_SCALAR; isa <= PAIR_KERNEL_AVX512; ++isa) {
+        check_float_against_double(isa, (vector3d_t){0});
+        check_float_against_double(isa, (vector3d_t){1, 1, 0});
+    }
+}
+
+void test_float_sources_follow_the_system(void)
+{
+    pair_sources_t sources = {0};
+    const particle_t extra = {.pos = {0.25, 0, 0}, .mass = 1, .charge = 1};
+
+    TEST_ASSERT_EQUAL(0, pair_sources__fill(&sources, cloud));
+    TEST_ASSERT_EQUAL(CLOUD_SIZE, sources.count);
+
+    /* Growing the system regrows the copy, shrinking it reuses it */
+    particle_system__add(cloud, &extra);
+    TEST_ASSERT_EQUAL(0, pair_sources__fill(&sources, cloud));
+    TEST_ASSERT_EQUAL(CLOUD_SIZE + 1, sources.count);
+    TEST_ASSERT_EQUAL_DOUBLE(0.25, sources.x[CLOUD_SIZE]);
+    TEST_ASSERT_EQUAL_DOUBLE(1, sources.charge[CLOUD_SIZE]);
+
+    cloud->count = 2;
+    TEST_ASSERT_EQUAL(0, pair_sources__fill(&sources, cloud));
+    TEST_ASSERT_EQUAL(2, sources.count);
+    TEST_ASSERT_EQUAL_DOUBLE((float)cloud->pos.j[1], sources.y[1]);
+
+    pair_sources__free(&sources);
+    TEST_ASSERT_NULL(sources.x);
+}
@@ -1,14 +1,123 @@
 #include "particle.h"
 
+#include <stdint.h>
+
 #include "unity.h"
 
 
+#define POOL_TEST_COUNT     (2 * PARTICLE_SLAB_SIZE + 100)      // spills into a third slab
+
+
+static particle_pool_t *pool;
+static particle_handle_t handles[POOL_TEST_COUNT];
+static particle_t initial[POOL_TEST_COUNT];
+
+
+static particle_t numbered(const size_t n)
+{
+    return (particle_t){.id = n, .pos = {(double)n, 0, 0}, .mass = 1, .charge = n % 2 ? 1 : -1};
+}
+
+
 void setUp(void)
 {
+    for (size_t n = 0; n < POOL_TEST_COUNT; ++n)
+        initial[n] = numbered(n);
 
+    pool = particle_pool__new(16);
+    TEST_ASSERT_NOT_NULL(pool);
+    TEST_ASSERT_EQUAL(0, particle__new_n(pool, initial, POOL_TEST_COUNT, handles));
 }
 
 void tearDown(void)
 {
-    
+    particle_pool__delete(pool);
+}
+
+void test_new_n_copies_and_hands_out_handles(void)
+{
+    TEST_ASSERT_EQUAL(POOL_TEST_COUNT, particle_pool__count(pool));
+
+    for (size_t n = 0; n < POOL_TEST_COUNT; ++n) {
+        const particle_t *p = particle_pool__get(pool, handles[n]);
+
+        TEST_ASSERT_NOT_NULL(p);
+        TEST_ASSERT_EQUAL(n, p->id);
+        TEST_ASSERT_EQUAL_DOUBLE((double)n, p->pos.i);
+    }
+}
+
+void test_slabs_are_cache_line_aligned(void)
+{
+    for (size_t n = 0; n < POOL_TEST_COUNT; n += PARTICLE_SLAB_SIZE)
+        TEST_ASSERT_EQUAL(0, (uintptr_t)particle_pool__at(pool, n) % PARTICLE_POOL_ALIGNMENT);
+}
+
+void test_new_n_zeroes_without_initial(void)
+{
+    particle_handle_t handle;
+
+    TEST_ASSERT_EQUAL(0, particle__new_n(pool, NULL, 1, &handle));
+    TEST_ASSERT_EQUAL(0, particle_pool__get(pool, handle)->id);
+    TEST_ASSERT_EQUAL_DOUBLE(0, particle_pool__get(pool, handle)->mass);
+}
+
+void test_released_handles_go_stale(void)
+{
+    particle_handle_t reused;
+
+    TEST_ASSERT_EQUAL(2, particle__release_n(pool, handles, 2));
+    TEST_ASSERT_NULL(particle_pool__get(pool, handles[0]));
+    TEST_ASSERT_NULL(particle_pool__get(pool, handles[1]));
+    TEST_ASSERT_EQUAL(POOL_TEST_COUNT - 2, particle_pool__count(pool));
+
+    /* Releasing twice does nothing */
+    TEST_ASSERT_EQUAL(0, particle__release_n(pool, handles, 1));
+
+    /* The entry and slot are taken again, the old handle still misses */
+    TEST_ASSERT_EQUAL(0, particle__new_n(pool, NULL, 1, &reused));
+    TEST_ASSERT_NOT_EQUAL(handles[1], reused);
+    TEST_ASSERT_NULL(particle_pool__get(pool, handles[1]));
+    TEST_ASSERT_NOT_NULL(particle_pool__get(pool, reused));
+    TEST_ASSERT_NULL(particle_pool__get(pool, PARTICLE_HANDLE_NONE));
+}
+
+void test_compact_keeps_handles(void)
+{
+    particle_handle_t even[POOL_TEST_COUNT / 2];
+
+    for (size_t n = 0; n < POOL_TEST_COUNT / 2; ++n)
+        even[n] = handles[2 * n];
+
+    TEST_ASSERT_EQUAL(POOL_TEST_COUNT / 2, particle__release_n(pool, even, POOL_TEST_COUNT / 2));
+
+    particle_pool__compact(pool);
+
+    /* Every odd particle, somewhere in the first half, none twice */
+    double id_sum = 0;
+
+    for (size_t n = 0; n < particle_pool__count(pool); ++n) {
+        TEST_ASSERT_EQUAL(1, particle_pool__at(pool, n)->id % 2);
+        id_sum += (double)particle_pool__at(pool, n)->id;
+    }
+    TEST_ASSERT_EQUAL_DOUBLE((double)(POOL_TEST_COUNT / 2) * (POOL_TEST_COUNT / 2), id_sum);
+
+    for (size_t n = 1; n < POOL_TEST_COUNT; n += 2) {
+        const particle_t *p = particle_pool__get(pool, handles[n]);
+
+        TEST_ASSERT_NOT_NULL(p);
+        TEST_ASSERT_EQUAL(n, p->id);
+    }
+}
+
+void test_compact_of_an_empty_pool(void)
+{
+    particle_handle_t handle;
+
+    particle__release_n(pool, handles, POOL_TEST_COUNT);
+    particle_pool__compact(pool);
+    TEST_ASSERT_EQUAL(0, particle_pool__count(pool));
+
+    TEST_ASSERT_EQUAL(0, particle__new_n(pool, NULL, 1, &handle));
+    TEST_ASSERT_TRUE(particle_pool__get(pool, handle) == particle_pool__at(pool, 0));
 }
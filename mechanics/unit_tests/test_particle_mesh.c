@@ -0,0 +1,84 @@
+#include "particle_mesh.h"
+
+#include "mechanics.h"
+#include "log.h"
+
+#include "unity.h"
+
+
+#define STR_BUF_SIZE    256
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+static particle_system_t *pair;
+
+
+void setUp(void)
+{
+    pair = particle_system__new(2);
+}
+
+void tearDown(void)
+{
+    particle_system__delete(pair);
+    free_mechanics_workspace();
+    set_force_solver(FORCE_SOLVER_DIRECT);
+    set_periodic_box((vector3d_t){0});
+}
+
+/**
+ * A close neutral pair in a large box barely feels its periodic
+ * images, so the mesh force should be near the plain Coulomb force.
+ */
+void test_close_pair_matches_coulomb(void)
+{
+    const double separations[] = {0.05, 0.1, 0.15};
+    const unsigned int test_count = sizeof(separations)/sizeof(double);
+    const mesh_assignment_t assignments[] = {MESH_ASSIGNMENT_CIC, MESH_ASSIGNMENT_TSC};
+    char msg_buf[STR_BUF_SIZE];
+
+    for (unsigned int a = 0; a < 2; ++a) {
+        for (unsigned int i = 0; i < test_count; ++i) {
+
+            const particle_t positive = {.pos = {-separations[i]/2, 0.01, 0.02}, .mass = 1, .charge = 1};
+            const particle_t negative = {.pos = {separations[i]/2, 0.01, 0.02}, .mass = 1, .charge = -1};
+            const double coulomb = REDUCED_COULOMB_CONST / (separations[i] * separations[i]);
+            particle_mesh_t *mesh = particle_mesh__new(64, (vector3d_t){1, 1, 1}, assignments[a]);
+
+            pair->count = 0;
+            particle_system__add(pair, &positive);
+            particle_system__add(pair, &negative);
+            particle_mesh__forces(mesh, pair);
+
+            snprintf(msg_buf, sizeof(msg_buf), "Failure at %i loop iteration with assignment %i", i, a);
+            TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(0.15 * coulomb, coulomb, pair->force.i[0], msg_buf);
+            TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-6 * coulomb, -pair->force.i[0], pair->force.i[1], msg_buf);
+            TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-3 * coulomb, 0, pair->force.j[0], msg_buf);
+            TEST_ASSERT_DOUBLE_WITHIN_MESSAGE(1E-3 * coulomb, 0, pair->force.k[0], msg_buf);
+
+            particle_mesh__delete(mesh);
+            resetTest();
+        }
+    }
+}
+
+void test_invalid_grid_is_rejected(void)
+{
+    TEST_ASSERT_NULL(particle_mesh__new(24, (vector3d_t){1, 1, 1}, MESH_ASSIGNMENT_CIC));
+    TEST_ASSERT_NULL(particle_mesh__new(32, (vector3d_t){1, 0, 1}, MESH_ASSIGNMENT_CIC));
+}
+
+void test_solver_needs_periodic_box(void)
+{
+    const particle_t p = {.pos = {0.1, 0, 0}, .mass = 1, .charge = PROTON_CHARGE};
+
+    particle_system__add(pair, &p);
+    set_force_solver(FORCE_SOLVER_PARTICLE_MESH);
+
+    TEST_ASSERT_EQUAL(1, compute_forces(pair));
+
+    set_periodic_box((vector3d_t){1, 1, 1});
+    TEST_ASSERT_EQUAL(0, compute_forces(pair));
+}
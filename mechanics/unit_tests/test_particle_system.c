@@ -0,0 +1,158 @@
+#include "particle_system.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#include "units.h"
+
+#include "unity.h"
+
+
+#define STR_BUF_SIZE    256
+
+
+static particle_t make_particle(const unsigned long long int id)
+{
+    const double n = (double)id;
+
+    particle_t p = {
+        .id = id,
+        .pos = {n, 2*n, 3*n},
+        .momenta = {-n, -2*n, -3*n},
+        .orientation = {0.5*n, 0, 0},
+        .angular_momenta = {0, 0.25*n, 0},
+        .mass = 1 + n,
+        .charge = n - 2,
+        .radius = 0.1 * n
+    };
+
+    return p;
+}
+
+
+void setUp(void)
+{
+
+}
+
+void tearDown(void)
+{
+
+}
+
+void test_add_and_get(void)
+{
+    const size_t test_count = 5;
+    particle_system_t *system = particle_system__new(test_count);
+    char msg_buf[STR_BUF_SIZE];
+
+    TEST_ASSERT_NOT_NULL(system);
+
+    for (size_t i = 0; i < test_count; ++i) {
+        const particle_t p = make_particle(i);
+        TEST_ASSERT_EQUAL(0, particle_system__add(system, &p));
+    }
+
+    TEST_ASSERT_EQUAL(test_count, system->count);
+
+    for (size_t i = 0; i < test_count; ++i) {
+
+        const particle_t expected = make_particle(i);
+        const particle_t actual = particle_system__get(system, i);
+
+        snprintf(msg_buf, sizeof(msg_buf), "Failure at %zu loop iteration", i);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&expected, &actual, sizeof(particle_t), msg_buf);
+    }
+
+    particle_system__delete(system);
+}
+
+void test_growth_keeps_contents_and_alignment(void)
+{
+    const size_t test_count = 1000;
+    particle_system_t *system = particle_system__new(0);
+
+    for (size_t i = 0; i < test_count; ++i) {
+        const particle_t p = make_particle(i);
+        TEST_ASSERT_EQUAL(0, particle_system__add(system, &p));
+    }
+
+    TEST_ASSERT_EQUAL(test_count, system->count);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)system->pos.i % PARTICLE_SYSTEM_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)system->momenta.k % PARTICLE_SYSTEM_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)system->charge % PARTICLE_SYSTEM_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)system->id % PARTICLE_SYSTEM_ALIGNMENT);
+
+    TEST_ASSERT_EQUAL_DOUBLE(3.0 * 999, system->pos.k[999]);
+    TEST_ASSERT_EQUAL_DOUBLE(1.0, system->mass[0]);
+    TEST_ASSERT_EQUAL(517, system->id[517]);
+
+    particle_system__delete(system);
+}
+
+void test_capacities_too_large_to_size_are_refused(void)
+{
+    particle_system_t *system = particle_system__new(4);
+    const particle_t p = make_particle(3);
+
+    TEST_ASSERT_EQUAL(0, particle_system__add(system, &p));
+
+    /* Sized in bytes this wraps round to zero */
+    TEST_ASSERT_EQUAL(1, particle_system__reserve(system, SIZE_MAX / sizeof(double) + 1));
+    TEST_ASSERT_EQUAL(1, particle_system__reserve(system, particle_system__max_capacity() + 1));
+    TEST_ASSERT_NULL(particle_system__new(SIZE_MAX));
+
+    TEST_ASSERT_EQUAL(4, system->capacity);
+    TEST_ASSERT_EQUAL(3, system->id[0]);
+
+    particle_system__delete(system);
+}
+
+void test_from_particles(void)
+{
+    particle_t a = make_particle(7);
+    particle_t b = make_particle(9);
+    particle_t *particles[] = {&a, &b};
+
+    particle_system_t *system = particle_system__from_particles(particles, 2);
+
+    TEST_ASSERT_EQUAL(2, system->count);
+    TEST_ASSERT_EQUAL(9, system->id[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(a.charge / UNIT_CHARGE, system->charge[0]);
+
+    b.pos.i = -4;
+    particle_system__set(system, 1, &b);
+    TEST_ASSERT_EQUAL_DOUBLE(-4, system->pos.i[1]);
+
+    particle_system__delete(system);
+}
+
+/* Any changed bit of the state changes the checksum, the force scratch does not */
+void test_checksum_follows_the_state(void)
+{
+    particle_system_t *system = particle_system__new(4);
+
+    for (unsigned long long int id = 0; id < 4; ++id) {
+        const particle_t p = make_particle(id);
+        particle_system__add(system, &p);
+    }
+
+    const uint64_t checksum = particle_system__checksum(system);
+
+    system->force.i[2] = 5;
+    TEST_ASSERT_TRUE(checksum == particle_system__checksum(system));
+
+    system->angular_momenta.k[3] = nextafter(system->angular_momenta.k[3], 1);
+    TEST_ASSERT_TRUE(checksum != particle_system__checksum(system));
+    system->angular_momenta.k[3] = 0;
+    TEST_ASSERT_TRUE(checksum == particle_system__checksum(system));
+
+    system->step_count++;
+    TEST_ASSERT_TRUE(checksum != particle_system__checksum(system));
+    system->step_count--;
+
+    system->pos.i[0] = -0.0;
+    TEST_ASSERT_TRUE(checksum != particle_system__checksum(system));
+
+    particle_system__delete(system);
+}
@@ -0,0 +1,237 @@
+#include "scenario.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "units.h"
+
+#include "unity.h"
+
+
+#define TEST_FILEPATH       "test_scenario.txt"
+#define STR_BUF_SIZE        256
+
+
+static const char example[] =
+    "# Two groups and a test charge\n"
+    "seed 7\n"
+    "dt 1E-15\n"
+    "box 2E-6\n"
+    "\n"
+    "uniform_box count=5000 mass=1.6727E-24 charge=0 radius=1E-15 size=1E-6 speed=100 center=1E-6,0,0\n"
+    "lattice_plasma cells=6 mass=1.6727E-24 charge=1.602E-19 radius=1E-15 size=1E-8   # 432 particles\n"
+    "particle mass=9.11E-28 charge=-1.602E-19 radius=0.0125 pos=0.3,0.5,0 momentum=0,1,0\n";
+
+static scenario_t *scenario;
+static particle_system_t *first;
+static particle_system_t *second;
+
+
+static scenario_t *parse(const char *text)
+{
+    size_t error_line;
+    scenario_t *parsed = scenario__parse(text, &error_line);
+    char msg_buf[STR_BUF_SIZE];
+
+    snprintf(msg_buf, STR_BUF_SIZE, "line %zu", error_line);
+    TEST_ASSERT_NOT_NULL_MESSAGE(parsed, msg_buf);
+
+    return parsed;
+}
+
+static size_t error_line_of(const char *text)
+{
+    size_t error_line;
+    scenario_t *parsed = scenario__parse(text, &error_line);
+
+    TEST_ASSERT_NULL(parsed);
+
+    return error_line;
+}
+
+static void assert_same_particles(const particle_system_t *a, const particle_system_t *b)
+{
+    TEST_ASSERT_EQUAL(a->count, b->count);
+    TEST_ASSERT_EQUAL_MEMORY(a->pos.i, b->pos.i, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->pos.k, b->pos.k, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->momenta.j, b->momenta.j, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->charge, b->charge, a->count * sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(a->id, b->id, a->count * sizeof(unsigned long long int));
+}
+
+
+void setUp(void)
+{
+    scenario = NULL;
+    first = NULL;
+    second = NULL;
+}
+
+void tearDown(void)
+{
+    scenario__delete(scenario);
+    particle_system__delete(first);
+    particle_system__delete(second);
+    remove(TEST_FILEPATH);
+}
+
+void test_parse_example(void)
+{
+    scenario = parse(example);
+
+    TEST_ASSERT_EQUAL(7, scenario->seed);
+    TEST_ASSERT_EQUAL_DOUBLE(1E-15, scenario->sample_period);
+    TEST_ASSERT_EQUAL_DOUBLE(2E-6, scenario->box_length);
+    TEST_ASSERT_EQUAL(3, scenario->group_count);
+    TEST_ASSERT_EQUAL(SCENARIO_UNIFORM_BOX, scenario->groups[0].generator);
+    TEST_ASSERT_EQUAL_DOUBLE(1E-6, scenario->groups[0].center.i);
+    TEST_ASSERT_EQUAL(6, scenario->groups[1].cells);
+    TEST_ASSERT_EQUAL_DOUBLE(ELECTRON_MASS, scenario->groups[1].electron_mass);
+    TEST_ASSERT_EQUAL_DOUBLE(0.5, scenario->groups[2].particle.pos.j);
+    TEST_ASSERT_EQUAL(5000 + 432 + 1, scenario__particle_count(scenario));
+}
+
+void test_bad_lines_are_reported(void)
+{
+    TEST_ASSERT_EQUAL(2, error_line_of("seed 1\nspiral count=10 mass=1 size=1\n"));
+    TEST_ASSERT_EQUAL(1, error_line_of("uniform_box mass=1 size=1\n"));                    // no count
+    TEST_ASSERT_EQUAL(1, error_line_of("uniform_box count=10 mass=1 size=1 cells=3\n"));   // not a lattice
+    TEST_ASSERT_EQUAL(1, error_line_of("particle mass=1 pos=1,2\n"));
+    TEST_ASSERT_EQUAL(1, error_line_of("particle mass=1 center=1,2,3\n"));
+    TEST_ASSERT_EQUAL(1, error_line_of("dt -1\n"));
+    TEST_ASSERT_EQUAL(3, error_line_of("\n# fine\nrandom_ions count=10 mass=1 size=1 charge_states=0\n"));
+}
+
+void test_counts_past_a_particle_system_are_refused(void)
+{
+    /* Sized in bytes these wrap round to next to nothing */
+    TEST_ASSERT_EQUAL(1, error_line_of("uniform_box count=2305843009213693952 mass=1 radius=0 size=1\n"));
+    TEST_ASSERT_EQUAL(1, error_line_of("lattice_plasma cells=1048576 mass=1 size=1\n"));
+
+    /* Each fits on its own, not both */
+    TEST_ASSERT_EQUAL(2, error_line_of("uniform_box count=100000000000000000 mass=1 size=1\n"
+                                       "uniform_box count=100000000000000000 mass=1 size=1\n"));
+}
+
+void test_load_file(void)
+{
+    FILE *file = fopen(TEST_FILEPATH, "w");
+    size_t error_line;
+
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(example, file);
+    fclose(file);
+
+    scenario = scenario__load(TEST_FILEPATH, &error_line);
+    TEST_ASSERT_NOT_NULL(scenario);
+    TEST_ASSERT_EQUAL(3, scenario->group_count);
+
+    TEST_ASSERT_NULL(scenario__load("no_such_scenario.txt", &error_line));
+    TEST_ASSERT_EQUAL(0, error_line);
+}
+
+void test_build_does_not_depend_on_thread_count(void)
+{
+    scenario = parse(example);
+
+    first = scenario__build(scenario, 1);
+    second = scenario__build(scenario, 3);
+
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    assert_same_particles(first, second);
+
+    /* ids follow the order of the groups */
+    for (size_t n = 0; n < first->count; ++n)
+        TEST_ASSERT_EQUAL(n, first->id[n]);
+}
+
+void test_seed_changes_the_particles(void)
+{
+    scenario = parse(example);
+    first = scenario__build(scenario, 1);
+
+    scenario->seed = 8;
+    second = scenario__build(scenario, 1);
+
+    TEST_ASSERT_NOT_EQUAL(0, memcmp(first->pos.i, second->pos.i, 5000 * sizeof(double)));
+}
+
+void test_uniform_box_stays_inside(void)
+{
+    scenario = parse(example);
+    first = scenario__build(scenario, 0);
+
+    double mean = 0;
+
+    for (size_t n = 0; n < 5000; ++n) {
+        TEST_ASSERT_DOUBLE_WITHIN(0.5E-6, 1E-6, first->pos.i[n]);
+        TEST_ASSERT_DOUBLE_WITHIN(0.5E-6, 0, first->pos.j[n]);
+        TEST_ASSERT_DOUBLE_WITHIN(0.5E-6, 0, first->pos.k[n]);
+        mean += first->momenta.i[n] / first->mass[n] / 5000;
+    }
+
+    TEST_ASSERT_DOUBLE_WITHIN(5, 0, mean);
+}
+
+void test_lattice_plasma_is_neutral(void)
+{
+    scenario = parse("lattice_plasma cells=4 mass=1.6727E-24 charge=1.602E-19 radius=1E-15 size=1E-8 speed=10\n");
+    first = scenario__build(scenario, 2);
+
+    double charge = 0;
+
+    TEST_ASSERT_EQUAL(128, first->count);
+
+    for (size_t n = 0; n < first->count; ++n)
+        charge += first->charge[n];
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-30, 0, charge);
+
+    /* The electron of a cell sits in its centre */
+    TEST_ASSERT_DOUBLE_WITHIN(1E-20, -1.5E-8, first->pos.i[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-20, -1.0E-8, first->pos.i[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(ELECTRON_MASS / UNIT_MASS, first->mass[1]);
+}
+
+void test_plummer_half_mass_radius(void)
+{
+    const size_t count = 20000;
+    size_t inside = 0;
+
+    scenario = parse("plummer_sphere count=20000 mass=1 radius=0 size=2 speed=1\n");
+    first = scenario__build(scenario, 0);
+
+    for (size_t n = 0; n < count; ++n) {
+
+        const double r = sqrt(first->pos.i[n] * first->pos.i[n] + first->pos.j[n] * first->pos.j[n] +
+                              first->pos.k[n] * first->pos.k[n]);
+
+        TEST_ASSERT_TRUE(r <= 10 * 2.0);
+        inside += r < 1.305 * 2;
+    }
+
+    /* 1.305 scale radii holds half the mass of an untruncated sphere */
+    TEST_ASSERT_UINT_WITHIN(count / 50, count / 2, inside);
+}
+
+void test_random_ion_charge_states(void)
+{
+    size_t negative = 0;
+
+    scenario = parse("random_ions count=4000 mass=1 charge=1.602E-19 charge_states=3 size=1\n");
+    first = scenario__build(scenario, 0);
+
+    /* Built in proton charges */
+    for (size_t n = 0; n < first->count; ++n) {
+
+        const double state = nearbyint(fabs(first->charge[n]));
+
+        TEST_ASSERT_DOUBLE_WITHIN(1E-12, state, fabs(first->charge[n]));
+        TEST_ASSERT_TRUE(state == 1 || state == 2 || state == 3);
+        negative += first->charge[n] < 0;
+    }
+
+    TEST_ASSERT_UINT_WITHIN(200, 2000, negative);
+}
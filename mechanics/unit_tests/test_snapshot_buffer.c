@@ -0,0 +1,148 @@
+#include "snapshot_buffer.h"
+
+#include <pthread.h>
+
+#include "unity.h"
+
+
+#define PARTICLE_COUNT      64
+#define PUBLISH_COUNT       100000
+
+
+static particle_system_t *particles;
+static snapshot_buffer_t *buffer;
+
+
+/* Every position of step s is s, so a torn snapshot shows up as a mismatch */
+static void set_step(particle_system_t *target, const unsigned long long int step)
+{
+    target->step_count = step;
+    target->time = (double)step;
+
+    for (size_t n = 0; n < target->count; ++n) {
+        target->pos.i[n] = (double)step;
+        target->pos.k[n] = (double)step;
+        target->orientation.j[n] = (double)step;
+    }
+}
+
+static int consistent(const snapshot_t *snapshot)
+{
+    for (size_t n = 0; n < snapshot->count; ++n)
+        if (snapshot->pos.i[n] != (double)snapshot->step_count || snapshot->pos.k[n] != (double)snapshot->step_count ||
+            snapshot->orientation.j[n] != (double)snapshot->step_count)
+            return 0;
+
+    return snapshot->time == (double)snapshot->step_count;
+}
+
+static void *writer(void *arg)
+{
+    particle_system_t *source = arg;
+
+    for (unsigned long long int step = 1; step <= PUBLISH_COUNT; ++step) {
+        set_step(source, step);
+        snapshot_buffer__publish(buffer, source);
+    }
+
+    return NULL;
+}
+
+
+void setUp(void)
+{
+    particles = particle_system__new(PARTICLE_COUNT);
+
+    for (size_t n = 0; n < PARTICLE_COUNT; ++n)
+        particle_system__add(particles, &(particle_t){.id = n, .mass = 1, .charge = n % 2 ? 1 : -1});
+
+    set_step(particles, 0);
+    buffer = snapshot_buffer__new(particles);
+}
+
+void tearDown(void)
+{
+    snapshot_buffer__delete(buffer);
+    particle_system__delete(particles);
+}
+
+void test_starts_with_the_system(void)
+{
+    const snapshot_t *previous;
+    const snapshot_t *latest = snapshot_buffer__acquire(buffer, &previous);
+
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_EQUAL(PARTICLE_COUNT, latest->count);
+    TEST_ASSERT_EQUAL(0, latest->step_count);
+    TEST_ASSERT_EQUAL(0, previous->step_count);
+    TEST_ASSERT_EQUAL_DOUBLE(1, latest->charge[1]);
+    TEST_ASSERT_TRUE(consistent(latest));
+}
+
+void test_acquire_takes_the_newest(void)
+{
+    const snapshot_t *previous;
+    const snapshot_t *latest;
+
+    set_step(particles, 1);
+    TEST_ASSERT_EQUAL(0, snapshot_buffer__publish(buffer, particles));
+
+    latest = snapshot_buffer__acquire(buffer, &previous);
+    TEST_ASSERT_EQUAL(1, latest->step_count);
+    TEST_ASSERT_EQUAL(0, previous->step_count);
+
+    /* Nothing new, the same pair again */
+    TEST_ASSERT_EQUAL_PTR(latest, snapshot_buffer__acquire(buffer, &previous));
+    TEST_ASSERT_EQUAL(0, previous->step_count);
+
+    /* Unread snapshots are replaced by newer ones */
+    for (unsigned long long int step = 2; step <= 5; ++step) {
+        set_step(particles, step);
+        snapshot_buffer__publish(buffer, particles);
+    }
+
+    latest = snapshot_buffer__acquire(buffer, &previous);
+    TEST_ASSERT_EQUAL(5, latest->step_count);
+    TEST_ASSERT_EQUAL(1, previous->step_count);
+    TEST_ASSERT_TRUE(consistent(latest));
+    TEST_ASSERT_TRUE(consistent(previous));
+}
+
+void test_count_must_match(void)
+{
+    particle_system__add(particles, &(particle_t){.id = PARTICLE_COUNT, .mass = 1});
+
+    TEST_ASSERT_EQUAL(1, snapshot_buffer__publish(buffer, particles));
+}
+
+void test_concurrent_snapshots_are_whole(void)
+{
+    particle_system_t *source = particle_system__new(PARTICLE_COUNT);
+    unsigned long long int last_step = 0;
+    unsigned long long int acquired = 0;
+    pthread_t thread;
+
+    for (size_t n = 0; n < PARTICLE_COUNT; ++n)
+        particle_system__add(source, &(particle_t){.id = n, .mass = 1});
+
+    TEST_ASSERT_EQUAL(0, pthread_create(&thread, NULL, writer, source));
+
+    while (last_step < PUBLISH_COUNT) {
+
+        const snapshot_t *previous;
+        const snapshot_t *latest = snapshot_buffer__acquire(buffer, &previous);
+
+        TEST_ASSERT_TRUE(consistent(latest));
+        TEST_ASSERT_TRUE(consistent(previous));
+        TEST_ASSERT_TRUE(latest->step_count >= last_step);
+        TEST_ASSERT_TRUE(previous->step_count <= latest->step_count);
+
+        acquired += latest->step_count != last_step;
+        last_step = latest->step_count;
+    }
+
+    pthread_join(thread, NULL);
+    particle_system__delete(source);
+
+    TEST_ASSERT_TRUE(acquired > 0);
+}
@@ -0,0 +1,124 @@
+#include "spatial_hash.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "periodic.h"
+
+#include "unity.h"
+#include "test_helpers.h"
+
+
+#define CLOUD_SIZE      400
+#define CELL_SIZE       0.08
+
+
+static particle_system_t *cloud;
+static spatial_hash_t *hash;
+static pair_list_t list;
+
+
+/* Every pair closer than the cell size must be a candidate, and no candidate may repeat */
+static void check_pairs(const vector3d_t box)
+{
+    unsigned char *seen = calloc(CLOUD_SIZE * CLOUD_SIZE, 1);
+    char msg_buf[256];
+
+    for (size_t n = 0; n < list.count; ++n) {
+
+        const particle_pair_t pair = list.pairs[n];
+
+        TEST_ASSERT_TRUE(pair.this < pair.that);
+        TEST_ASSERT_EQUAL(0, seen[pair.this * CLOUD_SIZE + pair.that]);
+        seen[pair.this * CLOUD_SIZE + pair.that] = 1;
+    }
+
+    for (size_t this = 0; this < CLOUD_SIZE; ++this) {
+        for (size_t that = this + 1; that < CLOUD_SIZE; ++that) {
+
+            const double dx = periodic__wrap(cloud->pos.i[this] - cloud->pos.i[that], box.i);
+            const double dy = periodic__wrap(cloud->pos.j[this] - cloud->pos.j[that], box.j);
+            const double dz = periodic__wrap(cloud->pos.k[this] - cloud->pos.k[that], box.k);
+
+            if (dx*dx + dy*dy + dz*dz < CELL_SIZE * CELL_SIZE) {
+                snprintf(msg_buf, sizeof(msg_buf), "Missed pair %zu, %zu", this, that);
+                TEST_ASSERT_TRUE_MESSAGE(seen[this * CLOUD_SIZE + that], msg_buf);
+            }
+        }
+    }
+
+    free(seen);
+}
+
+
+void setUp(void)
+{
+    unsigned long long int state = 7;
+
+    cloud = particle_system__new(CLOUD_SIZE);
+    hash = spatial_hash__new();
+    list = (pair_list_t){0};
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+        const particle_t p = {.id = n, .pos = {next_random(&state) - 0.5, next_random(&state) - 0.5, next_random(&state) - 0.5}};
+        particle_system__add(cloud, &p);
+    }
+}
+
+void tearDown(void)
+{
+    pair_list__free(&list);
+    spatial_hash__delete(hash);
+    particle_system__delete(cloud);
+}
+
+void test_open_space_pairs(void)
+{
+    TEST_ASSERT_EQUAL(0, spatial_hash__build(hash, cloud, CELL_SIZE, (vector3d_t){0}));
+    TEST_ASSERT_EQUAL(0, spatial_hash__pairs(hash, 0, CLOUD_SIZE, &list));
+
+    check_pairs((vector3d_t){0});
+
+    /* The point of the broad phase, far fewer candidates than pairs */
+    TEST_ASSERT_LESS_THAN(CLOUD_SIZE * (CLOUD_SIZE - 1) / 2 / 10, list.count);
+}
+
+void test_periodic_pairs(void)
+{
+    const vector3d_t box = {1, 1, 1};
+
+    TEST_ASSERT_EQUAL(0, spatial_hash__build(hash, cloud, CELL_SIZE, box));
+    TEST_ASSERT_EQUAL(0, spatial_hash__pairs(hash, 0, CLOUD_SIZE, &list));
+
+    check_pairs(box);
+}
+
+void test_box_narrower_than_three_cells(void)
+{
+    const vector3d_t box = {1, 0.15, 0.05};
+
+    for (size_t n = 0; n < CLOUD_SIZE; ++n) {
+        cloud->pos.j[n] *= box.j;
+        cloud->pos.k[n] *= box.k;
+    }
+
+    TEST_ASSERT_EQUAL(0, spatial_hash__build(hash, cloud, CELL_SIZE, box));
+    TEST_ASSERT_EQUAL(0, spatial_hash__pairs(hash, 0, CLOUD_SIZE, &list));
+
+    check_pairs(box);
+}
+
+void test_split_ranges_give_the_same_pairs(void)
+{
+    pair_list_t split = {0};
+
+    spatial_hash__build(hash, cloud, CELL_SIZE, (vector3d_t){0});
+    spatial_hash__pairs(hash, 0, CLOUD_SIZE, &list);
+    spatial_hash__pairs(hash, 0, CLOUD_SIZE / 3, &split);
+    spatial_hash__pairs(hash, CLOUD_SIZE / 3, CLOUD_SIZE, &split);
+
+    TEST_ASSERT_EQUAL(list.count, split.count);
+    TEST_ASSERT_EQUAL_MEMORY(list.pairs, split.pairs, list.count * sizeof(particle_pair_t));
+
+    pair_list__free(&split);
+}
@@ -0,0 +1,98 @@
+#include "thread_pool.h"
+
+#include <stdatomic.h>
+
+#include "unity.h"
+
+
+#define STR_BUF_SIZE    256
+#define MAX_COUNT       10000
+#define THREAD_COUNT    4
+
+
+typedef struct
+{
+    _Atomic unsigned int visits[MAX_COUNT];
+    _Atomic unsigned int bad_tiles;
+    size_t tile_size;
+    unsigned int thread_count;
+
+} visit_log_t;
+
+
+static thread_pool_t *pool;
+static visit_log_t visit_log;
+
+
+static void visit(void *context, const size_t begin, const size_t end, const unsigned int worker)
+{
+    visit_log_t *log = context;
+
+    if (begin % log->tile_size || end - begin > log->tile_size || worker >= log->thread_count)
+        atomic_fetch_add(&log->bad_tiles, 1);
+
+    for (size_t n = begin; n < end; ++n)
+        atomic_fetch_add(&log->visits[n], 1);
+}
+
+static void check_every_index_once(thread_pool_t *pool, const size_t count, const size_t tile_size)
+{
+    char msg_buf[STR_BUF_SIZE];
+
+    for (size_t n = 0; n < MAX_COUNT; ++n)
+        atomic_store(&visit_log.visits[n], 0);
+    atomic_store(&visit_log.bad_tiles, 0);
+    visit_log.tile_size = tile_size;
+    visit_log.thread_count = thread_pool__thread_count(pool);
+
+    thread_pool__parallel_for(pool, count, tile_size, visit, &visit_log);
+
+    snprintf(msg_buf, sizeof(msg_buf), "Failure with count %zu and tile size %zu", count, tile_size);
+    TEST_ASSERT_EQUAL_MESSAGE(0, atomic_load(&visit_log.bad_tiles), msg_buf);
+    for (size_t n = 0; n < MAX_COUNT; ++n)
+        TEST_ASSERT_EQUAL_MESSAGE(n < count, atomic_load(&visit_log.visits[n]), msg_buf);
+}
+
+
+void setUp(void)
+{
+    pool = thread_pool__new(THREAD_COUNT);
+}
+
+void tearDown(void)
+{
+    thread_pool__delete(pool);
+}
+
+void test_thread_count(void)
+{
+    thread_pool_t *all = thread_pool__new(0);
+
+    TEST_ASSERT_EQUAL(THREAD_COUNT, thread_pool__thread_count(pool));
+    TEST_ASSERT_EQUAL(thread_pool__processor_count(), thread_pool__thread_count(all));
+    TEST_ASSERT_EQUAL(1, thread_pool__thread_count(NULL));
+
+    thread_pool__delete(all);
+}
+
+void test_every_index_runs_once(void)
+{
+    const size_t counts[] = {0, 1, 7, 64, 1000, 9999};
+    const size_t tile_sizes[] = {1, 3, 16, 1024};
+
+    for (unsigned int c = 0; c < sizeof(counts)/sizeof(size_t); ++c)
+        for (unsigned int t = 0; t < sizeof(tile_sizes)/sizeof(size_t); ++t)
+            check_every_index_once(pool, counts[c], tile_sizes[t]);
+}
+
+void test_serial_without_pool(void)
+{
+    check_every_index_once(NULL, 1000, 16);
+}
+
+/* Back to back loops reuse the same threads, each must see only its own tiles */
+void test_repeated_loops(void)
+{
+    for (unsigned int n = 0; n < 200; ++n)
+        check_every_index_once(pool, 257 + n, 8);
+}
@@ -0,0 +1,196 @@
+#include "trajectory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+
+#define TEST_FILEPATH       "test_trajectory.bin"
+#define LARGE_COUNT         10000   // frames too big for the buffer
+
+
+static particle_system_t *system_under_test;
+
+
+static void fill(const size_t count)
+{
+    for (size_t n = 0; n < count; ++n) {
+        const particle_t p = {
+            .id = n,
+            .pos = {n, 2.0 * n, 3.0 * n},
+            .momenta = {-1.0 * n, 0.5, 0},
+            .mass = 1 + n,
+            .charge = -1,
+            .radius = 0.25,
+        };
+        particle_system__add(system_under_test, &p);
+    }
+}
+
+static unsigned char *read_file(size_t *size)
+{
+    FILE *file = fopen(TEST_FILEPATH, "rb");
+    unsigned char *contents;
+
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents = malloc(*size);
+    TEST_ASSERT_EQUAL(*size, fread(contents, 1, *size, file));
+    fclose(file);
+
+    return contents;
+}
+
+static uint64_t load_little_endian(const unsigned char *bytes, const size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t b = 0; b < size; ++b)
+        value |= (uint64_t)bytes[b] << (8 * b);
+
+    return value;
+}
+
+static double load_double(const unsigned char *bytes)
+{
+    const uint64_t bits = load_little_endian(bytes, 8);
+    double value;
+
+    memcpy(&value, &bits, sizeof(double));
+
+    return value;
+}
+
+
+void setUp(void)
+{
+    system_under_test = particle_system__new(LARGE_COUNT);
+}
+
+void tearDown(void)
+{
+    particle_system__delete(system_under_test);
+    remove(TEST_FILEPATH);
+}
+
+void test_header_and_frames(void)
+{
+    const unsigned int mask = TRAJECTORY_ID | TRAJECTORY_MASS | TRAJECTORY_POSITION;
+    const size_t count = 3;
+    size_t size;
+
+    fill(count);
+
+    trajectory_t *trajectory = trajectory__open(TEST_FILEPATH, count, 0.125, mask);
+    TEST_ASSERT_NOT_NULL(trajectory);
+    TEST_ASSERT_EQUAL(16 + 5 * count * 8, trajectory__frame_size(trajectory));
+
+    for (unsigned int frame = 0; frame < 2; ++frame) {
+        system_under_test->time = 0.125 * frame;
+        system_under_test->step_count = frame;
+        TEST_ASSERT_EQUAL(0, trajectory__write_frame(trajectory, system_under_test));
+        system_under_test->pos.j[1] = -7;
+    }
+
+    TEST_ASSERT_EQUAL(0, trajectory__close(trajectory));
+
+    unsigned char *contents = read_file(&size);
+    const size_t frame_size = 16 + 5 * count * 8;
+    const unsigned char *second = contents + TRAJECTORY_HEADER_SIZE + frame_size;
+
+    TEST_ASSERT_EQUAL(TRAJECTORY_HEADER_SIZE + 2 * frame_size, size);
+    TEST_ASSERT_EQUAL_MEMORY(TRAJECTORY_MAGIC, contents, 8);
+    TEST_ASSERT_EQUAL(TRAJECTORY_VERSION, load_little_endian(contents + 8, 4));
+    TEST_ASSERT_EQUAL(TRAJECTORY_HEADER_SIZE, load_little_endian(contents + 12, 4));
+    TEST_ASSERT_EQUAL(count, load_little_endian(contents + 16, 8));
+    TEST_ASSERT_EQUAL_DOUBLE(0.125, load_double(contents + 24));
+    TEST_ASSERT_EQUAL(mask, load_little_endian(contents + 32, 4));
+    TEST_ASSERT_EQUAL(frame_size, load_little_endian(contents + 40, 8));
+
+    /* time, step, id[3], mass[3], pos.i[3], pos.j[3], pos.k[3] */
+    TEST_ASSERT_EQUAL_DOUBLE(0.125, load_double(second));
+    TEST_ASSERT_EQUAL(1, load_little_endian(second + 8, 8));
+    TEST_ASSERT_EQUAL(2, load_little_endian(second + 16 + 2 * 8, 8));
+    TEST_ASSERT_EQUAL_DOUBLE(3, load_double(second + 16 + (3 + 2) * 8));
+    TEST_ASSERT_EQUAL_DOUBLE(-7, load_double(second + 16 + (9 + 1) * 8));
+    TEST_ASSERT_EQUAL_DOUBLE(6, load_double(second + 16 + (12 + 2) * 8));
+
+    free(contents);
+}
+
+void test_large_frames_match_buffered_layout(void)
+{
+    size_t size;
+
+    fill(LARGE_COUNT);
+
+    trajectory_t *trajectory = trajectory__open(TEST_FILEPATH, LARGE_COUNT, 1, TRAJECTORY_DEFAULT_FIELDS);
+    TEST_ASSERT_NOT_NULL(trajectory);
+    TEST_ASSERT_GREATER_THAN(TRAJECTORY_BUFFER_SIZE, trajectory__frame_size(trajectory));
+
+    for (unsigned int frame = 0; frame < 2; ++frame)
+        TEST_ASSERT_EQUAL(0, trajectory__write_frame(trajectory, system_under_test));
+
+    TEST_ASSERT_EQUAL(0, trajectory__close(trajectory));
+
+    unsigned char *contents = read_file(&size);
+    const size_t frame_size = 16 + 15 * LARGE_COUNT * 8;
+    const unsigned char *momenta_i = contents + TRAJECTORY_HEADER_SIZE + frame_size + 16 + 6 * LARGE_COUNT * 8;
+
+    TEST_ASSERT_EQUAL(TRAJECTORY_HEADER_SIZE + 2 * frame_size, size);
+    TEST_ASSERT_EQUAL_DOUBLE(-1234.0, load_double(momenta_i + 1234 * 8));
+
+    free(contents);
+}
+
+void test_particle_count_change_is_refused(void)
+{
+    fill(2);
+
+    trajectory_t *trajectory = trajectory__open(TEST_FILEPATH, 3, 1, TRAJECTORY_DEFAULT_FIELDS);
+    TEST_ASSERT_NOT_NULL(trajectory);
+    TEST_ASSERT_EQUAL(1, trajectory__write_frame(trajectory, system_under_test));
+    TEST_ASSERT_EQUAL(0, trajectory__close(trajectory));
+}
+
+void test_append_cuts_frames_after_the_restart(void)
+{
+    const size_t count = 2;
+    size_t size;
+
+    fill(count);
+
+    trajectory_t *trajectory = trajectory__open(TEST_FILEPATH, count, 0.5, TRAJECTORY_DEFAULT_FIELDS);
+    TEST_ASSERT_NOT_NULL(trajectory);
+
+    for (unsigned int frame = 1; frame <= 3; ++frame) {
+        system_under_test->step_count = frame;
+        trajectory__write_frame(trajectory, system_under_test);
+    }
+
+    const size_t frame_size = trajectory__frame_size(trajectory);
+    TEST_ASSERT_EQUAL(0, trajectory__close(trajectory));
+
+    /* A different sample period is a different run */
+    TEST_ASSERT_NULL(trajectory__append(TEST_FILEPATH, count, 0.25, TRAJECTORY_DEFAULT_FIELDS, 2));
+    TEST_ASSERT_NULL(trajectory__append(TEST_FILEPATH, count, 0.5, TRAJECTORY_DEFAULT_FIELDS, 4));
+
+    /* Restarted from a checkpoint taken at step 2 */
+    trajectory = trajectory__append(TEST_FILEPATH, count, 0.5, TRAJECTORY_DEFAULT_FIELDS, 2);
+    TEST_ASSERT_NOT_NULL(trajectory);
+    system_under_test->step_count = 30;
+    TEST_ASSERT_EQUAL(0, trajectory__write_frame(trajectory, system_under_test));
+    TEST_ASSERT_EQUAL(0, trajectory__close(trajectory));
+
+    unsigned char *contents = read_file(&size);
+
+    TEST_ASSERT_EQUAL(TRAJECTORY_HEADER_SIZE + 3 * frame_size, size);
+    TEST_ASSERT_EQUAL(2, load_little_endian(contents + TRAJECTORY_HEADER_SIZE + frame_size + 8, 8));
+    TEST_ASSERT_EQUAL(30, load_little_endian(contents + TRAJECTORY_HEADER_SIZE + 2 * frame_size + 8, 8));
+
+    free(contents);
+}
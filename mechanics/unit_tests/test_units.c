@@ -0,0 +1,75 @@
+#include "units.h"
+
+#include <math.h>
+
+#include "mechanics.h"
+#include "pair_kernel.h"
+#include "log.h"
+
+#include "unity.h"
+
+
+/* Unused but needs to be defined */
+log_t *log_handle;
+
+
+void setUp(void)
+{
+
+}
+
+void tearDown(void)
+{
+
+}
+
+void test_round_trip(void)
+{
+    const particle_t p = {
+        .id = 3,
+        .pos = {0.1, -0.2, 0.3},
+        .momenta = {1E-24, -2E-24, 3E-25},
+        .orientation = {1, 2, 3},
+        .angular_momenta = {4E-30, 0, -5E-30},
+        .mass = PROTON_MASS,
+        .charge = ELECTRON_CHARGE,
+        .radius = HELIUM_NUCLEUS_RADIUS
+    };
+    const particle_t reduced = units__to_reduced(&p);
+    const particle_t back = units__to_physical(&reduced);
+
+    /* Lengths, angles and ids are left alone */
+    TEST_ASSERT_EQUAL(3, reduced.id);
+    TEST_ASSERT_EQUAL_DOUBLE(p.pos.j, reduced.pos.j);
+    TEST_ASSERT_EQUAL_DOUBLE(p.orientation.k, reduced.orientation.k);
+    TEST_ASSERT_EQUAL_DOUBLE(p.radius, reduced.radius);
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-12, -1, reduced.charge);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * PROTON_MASS, PROTON_MASS, back.mass);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * PROTON_CHARGE, ELECTRON_CHARGE, back.charge);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * 2E-24, p.momenta.j, back.momenta.j);
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * 5E-30, p.angular_momenta.k, back.angular_momenta.k);
+
+    /* Velocity is the same number in both */
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * fabs(p.momenta.i / p.mass), p.momenta.i / p.mass, reduced.momenta.i / reduced.mass);
+}
+
+/* The reduced Coulomb force of a pair, scaled by UNIT_FORCE, is the physical one */
+void test_coulomb_force_in_reduced_units(void)
+{
+    const particle_t proton = {.pos = {0.3, 0, 0}, .mass = PROTON_MASS, .charge = PROTON_CHARGE};
+    const particle_t electron = {.mass = ELECTRON_MASS, .charge = ELECTRON_CHARGE};
+    const particle_t reduced_proton = units__to_reduced(&proton);
+    const particle_t reduced_electron = units__to_reduced(&electron);
+    particle_system_t *source = particle_system__new(1);
+
+    particle_system__add(source, &reduced_electron);
+
+    const vector3d_t F = pair_kernel_for(PAIR_KERNEL_SCALAR)(reduced_proton.pos, reduced_proton.charge, reduced_proton.mass,
+                                                             source, 0, 1, (vector3d_t){0});
+    const double expected = electric_force(PROTON_CHARGE, ELECTRON_CHARGE, 0.3);
+
+    TEST_ASSERT_DOUBLE_WITHIN(1E-9 * fabs(expected), expected, F.i * UNIT_FORCE);
+
+    particle_system__delete(source);
+}
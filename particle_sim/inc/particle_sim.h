@@ -3,50 +3,39 @@
 #include "vector.h"
 
 
-#define __DRAW_SPHERE
-#define CIRCLE_Y_SEGMENTS       64
-#define CIRCLE_Z_SEGMENTS       64
-#ifdef __DRAW_SPHERE
-#define NUM_SEGMENTS            (CIRCLE_Y_SEGMENTS * CIRCLE_Z_SEGMENTS) + 2
-#else
-#define NUM_SEGMENTS            CIRCLE_Y_SEGMENTS
-#endif
-
-#define P_COUNT             1   // Temporary solution to "simulate" a nucleus
-#define E_COUNT             2
-
-
-/* Main parameters that will effect the behavior */
-static const double sample_period = 8E-3;
-
-static const vector3d_t initial_pos[P_COUNT+E_COUNT] = {
-    /* Positively charged */
-    {.i = 0, .j = 0, .k = 0},
-    /* Negatively charged */
-    {.i = 0.3, .j = 0.5, .k = 0},
-    {.i = 0.5, .j = 0.3, .k = 0},
-};
-
-static const vector3d_t initial_momentum[P_COUNT+E_COUNT] = {
-    /* Positively charged */
-    {.i = 0, .j = 0, .k = 0},
-    /* Negatively charged */
-    {.i = 0, .j = 0, .k = 0},
-    {.i = 0, .j = 0, .k = 0},
-};
-
-static const vector3d_t initial_orientation[P_COUNT+E_COUNT] = {
-    /* Positively charged */
-    {.i = 0, .j = 0, .k = 0},
-    /* Negatively charged */
-    {.i = 0, .j = 0, .k = 0},
-    {.i = 0, .j = 0, .k = 0},
-};
-
-static const vector3d_t initial_angular_momentum[P_COUNT+E_COUNT] = {
-    /* Positively charged */
-    {.i = 0, .j = 0, .k = 0},
-    /* Negatively charged */
-    {.i = 0, .j = 0, .k = 0},
-    {.i = 0, .j = 0, .k = 0},
-};
+#define ICOSPHERE_LOD_COUNT         3       // 1, 2 and 3 subdivisions, when impostors are off or unsupported
+#define ICOSPHERE_LOD_PIXELS        6.0     // on screen radius the coarsest level is used up to, 4 times that per level
+
+#define INITIAL_WINDOW_WIDTH        1280
+#define INITIAL_WINDOW_HEIGHT       960
+
+#define CAPTURE_DEFAULT_FRAMES      600
+#define CAPTURE_DEFAULT_WIDTH       1280
+#define CAPTURE_DEFAULT_HEIGHT      720     // even sides, as most encoders want for yuv420p
+
+#define TRAJECTORY_OUTPUT_FILEPATH  "trajectory.bin"
+#define CHECKPOINT_FILEPATH         "checkpoint.bin"    // F5 saves, F9 loads
+#define TIMINGS_OUTPUT_FILEPATH     "timings.json"      // phase histograms, written at exit
+#define TIMINGS_REPORT_PERIOD       10E9                // nanoseconds between timing reports in the log
+
+#define DEFAULT_SAMPLE_PERIOD       8E-3    // when the scenario has no dt
+#define SIMULATION_STEP_RATE        0       // steps per second, 0 steps as fast as the machine allows
+
+
+/**
+ * Scene used without a scenario file, see scenario.h for the format.
+ * Currently initializing the "nucleus" as a stable (equal neutrons to
+ * protons to electrons) helium-like one, with the values the old
+ * compiled in arrays had.
+ *
+ * In reality the nucleus is likely in motion along with spin, which
+ * would generate magnetic fields, further complicating this simulation.
+ * Something to work on in the future.
+ */
+static const char default_scenario[] =
+    "dt 8E-3\n"
+    "# Positively charged, 2 (PROTON_MASS + NEUTRON_MASS), 2 PROTON_CHARGE\n"
+    "particle mass=6.695399999999999E-24 charge=3.204E-19 radius=0.1 pos=0,0,0\n"
+    "# Negatively charged\n"
+    "particle mass=9.11E-28 charge=-1.602E-19 radius=0.0125 pos=0.3,0.5,0\n"
+    "particle mass=9.11E-28 charge=-1.602E-19 radius=0.0125 pos=0.5,0.3,0\n";
@@ -1,79 +1,163 @@
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
 #include "particle_sim.h"
 #include "graphic_helpers.h"
+#include "frame_capture.h"
 #include "particle.h"
+#include "particle_system.h"
 #include "mechanics.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+#include "scenario.h"
+#include "snapshot_buffer.h"
+#include "instrumentation.h"
+#include "async_log.h"
 #include "log.h"
 
 
+static int parse_options(const int argc, char **argv);
+static void print_usage(const char *program);
+static int open_capture_output(void);
+static GLFWwindow *create_window(void);
 static void pre_exit_calls(void);
 
 static void error_callback(int error, const char *description);
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+static void load_checkpoint(void);
+static void reset_positions(void);
 static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 
-static void render_loop(GLFWwindow *window, const GLuint program, GLuint *VBO);
-static void busy_wait_ms(const float delay_in_ms);
+static void *simulation_loop(void *arg);
+static void run_commands(const unsigned int commands);
+#if SIMULATION_STEP_RATE > 0
+static void pace_step(struct timespec *next_step);
+#endif
+
+static int create_meshes(void);
+static void delete_meshes(void);
+static double lerp(const double previous, const double latest, const double alpha, const double box_length);
+static size_t fill_instances(const snapshot_t *latest, const snapshot_t *previous, const double alpha);
+static double interpolation_weight(const snapshot_t *latest, const snapshot_t *previous);
+static void draw_particles(const int height);
+static void render_loop(GLFWwindow *window);
 
 
 /* Global variables */
 log_t *log_handle;
 
-static particle_t *particles[P_COUNT+E_COUNT];
+static async_log_t *async_log;
+
+static scenario_t *scenario;
+static particle_system_t *particles;
+static trajectory_t *trajectory;
+static double sample_period;
+
+/**
+ * Only the simulation thread touches particles and trajectory once it
+ * runs.  The window hands it keys as command bits and gets snapshots back.
+ */
+enum command
+{
+    COMMAND_RESET = 1,
+    COMMAND_SAVE = 2,
+    COMMAND_LOAD = 4
+};
+
+static snapshot_buffer_t *snapshots;
+static pthread_t simulation_thread;
+static atomic_bool simulation_running;
+static atomic_uint pending_commands;
+
+/* Nuclei are drawn first, then electrons */
+static const double species_radius[2] = {FAKE_NUCLEUS_RADIUS, FAKE_NUCLEUS_RADIUS / 8};
+
+static struct instanced_mesh impostors[2];
+static struct instanced_mesh icospheres[2][ICOSPHERE_LOD_COUNT];
+static int use_impostors;
+
+static struct instance *instances;
+static size_t instance_count;
+
+/* Command line, a scenario file and the offscreen capture settings */
+static const char *scenario_filepath;
+static const char *capture_filepath;        // NULL to draw to a window, "-" for standard output
+static unsigned long long int capture_frame_count = CAPTURE_DEFAULT_FRAMES;
+static GLsizei capture_width = CAPTURE_DEFAULT_WIDTH;
+static GLsizei capture_height = CAPTURE_DEFAULT_HEIGHT;
+
+static FILE *capture_output;
+static struct frame_capture capture;
 
 
 /* View scalar initial value determined from experimentation, but not sure it's source */
-static struct draw_variables draw_vars = {.num_segments = NUM_SEGMENTS, .view_scalar = 10E-20};
+static struct draw_variables draw_vars = {.view_scalar = 10E-20};
 
 
-/* Entry point */
-int main(void)
+/* Entry point, see print_usage() */
+int main(int argc, char **argv)
 {
-    const int initial_window_width = 1280;
-    const int initial_window_height = 960;
-    
-    const vector3d_t sphere_center = {0};
-    struct vertex p_vertices[NUM_SEGMENTS];
-    struct vertex e_vertices[NUM_SEGMENTS];
-    
-    GLuint VBO[P_COUNT+E_COUNT], program;
+    size_t error_line;
 
 
+    if (parse_options(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
     if (!(log_handle=log__open(DEBUG_OUTPUT_FILEPATH, "w")))
         return 1;
 
-    log__write(log_handle, LOG_STATUS, "Log file opened.");
+    /* Everything after this point is written to the log file by a background thread */
+    if (!(async_log = async_log__new(log_handle, DEFAULT_ASYNC_LOG_CAPACITY, ASYNC_LOG_BLOCK))) {
+        pre_exit_calls();
+        return 1;
+    }
+    set_async_log(async_log);
 
-    /**
-     * Populate particle vertex point array for drawing with OpenGL
-     */
-    #ifdef __DRAW_SPHERE
-    create_sphere_vertex_array(p_vertices, sphere_center, FAKE_NUCLEUS_RADIUS, CIRCLE_Y_SEGMENTS, CIRCLE_Z_SEGMENTS, p_color);
-    create_sphere_vertex_array(e_vertices, sphere_center, FAKE_NUCLEUS_RADIUS/8, CIRCLE_Y_SEGMENTS, CIRCLE_Z_SEGMENTS, e_color);
-    #else
-    const vector2d_t circle_center = {0};
-    create_circle_vertex_array(p_vertices, circle_center, FAKE_NUCLEUS_RADIUS, CIRCLE_Y_SEGMENTS, p_color);
-    create_circle_vertex_array(e_vertices, circle_center, FAKE_NUCLEUS_RADIUS/8, CIRCLE_Y_SEGMENTS, e_color);
-    #endif
+    async_log__write(async_log, LOG_STATUS, "Log file opened.");
 
-    for (int i = 0; i < NUM_SEGMENTS; ++i)
-        log__write(log_handle, LOG_INFO, "p_vertex[%i] = <%.3f,%.3f,%.3f>", i, p_vertices[i].pos.i, p_vertices[i].pos.j, p_vertices[i].pos.k);
+    scenario = scenario_filepath ? scenario__load(scenario_filepath, &error_line) : scenario__parse(default_scenario, &error_line);
+    if (!scenario) {
+        async_log__write(async_log, LOG_ERROR, "Could not read the scenario %s, line %zu.", scenario_filepath ? scenario_filepath : "built in", error_line);
+        pre_exit_calls();
+        return 1;
+    }
 
-    /**
-     * Creation of particle struct
-     * 
-     * Currently initializing the "nucleus" as a stable (equal neutrons to protons to electrons)
-     * 
-     * In reality the nucleus is likely in motion along with spin, which would generate magnetic fields,
-     * further complicating this simulation.  Something to work on in the future.
-     */
-    for (size_t i = 0; i < P_COUNT; ++i)
-        particles[i] = particle__new(i, initial_pos[i], initial_momentum[i], initial_orientation[i], initial_angular_momentum[i], E_COUNT*(PROTON_MASS+NEUTRON_MASS), E_COUNT*PROTON_CHARGE, FAKE_NUCLEUS_RADIUS);
-    for (size_t i = P_COUNT; i < P_COUNT+E_COUNT; ++i)
-        particles[i] = particle__new(i, initial_pos[i], initial_momentum[i], initial_orientation[i], initial_angular_momentum[i], ELECTRON_MASS, ELECTRON_CHARGE, FAKE_NUCLEUS_RADIUS/8);
+    sample_period = scenario->sample_period ? scenario->sample_period : DEFAULT_SAMPLE_PERIOD;
+    if (scenario->box_length)
+        set_periodic_box((vector3d_t){scenario->box_length, scenario->box_length, scenario->box_length});
+
+    if (!(particles = scenario__build(scenario, get_thread_count()))) {
+        pre_exit_calls();
+        return 1;
+    }
+
+    if (!(instances = malloc(particles->count * sizeof(struct instance)))) {
+        pre_exit_calls();
+        return 1;
+    }
+    instance_count = particles->count;
+
+    if (!(trajectory = trajectory__open(TRAJECTORY_OUTPUT_FILEPATH, particles->count, sample_period, TRAJECTORY_DEFAULT_FIELDS)))
+        async_log__write(async_log, LOG_ERROR, "Could not open %s, the run is not recorded.", TRAJECTORY_OUTPUT_FILEPATH);
+
+    if (capture_filepath && open_capture_output()) {
+        async_log__write(async_log, LOG_ERROR, "Could not open %s for the captured frames.", capture_filepath);
+        pre_exit_calls();
+        return 1;
+    }
 
     glfwSetErrorCallback(error_callback);
     if (!glfwInit()) {
@@ -81,7 +165,7 @@ int main(void)
         return 1;
     }
 
-    GLFWwindow *window = glfwCreateWindow(initial_window_width, initial_window_height, "Particle Sim", NULL, NULL);
+    GLFWwindow *window = create_window();
     if (!window) {
         pre_exit_calls();
         return 1;
@@ -90,28 +174,58 @@ int main(void)
     glfwSetScrollCallback(window, scroll_callback);
     glfwMakeContextCurrent(window);
     gladLoadGL();
-    glfwSwapInterval(1);
-    
-    if (shader_compile_and_link(&program)) {
+
+    /* Captured frames are never shown, nothing to wait for */
+    glfwSwapInterval(capture_output ? 0 : 1);
+
+    if (create_meshes()) {
         pre_exit_calls();
         exit(1);
     }
 
-    draw_vars.shader_vars.mvp_location = glGetUniformLocation(program, "MVP");
-    draw_vars.shader_vars.vpos_location = glGetAttribLocation(program, "vPos");
-    draw_vars.shader_vars.vcol_location = glGetAttribLocation(program, "vCol");
+    glEnable(GL_DEPTH_TEST);
+
+    if (capture_output && frame_capture_init(&capture, capture_width, capture_height, capture_output)) {
+        async_log__write(async_log, LOG_ERROR, "Could not create a %dx%d framebuffer to capture.", capture_width, capture_height);
+        delete_meshes();
+        pre_exit_calls();
+        return 1;
+    }
+
+    if (!(snapshots = snapshot_buffer__new(particles))) {
+        if (capture_output)
+            frame_capture_delete(&capture);
+        delete_meshes();
+        pre_exit_calls();
+        return 1;
+    }
 
-    for (size_t i = 0; i < P_COUNT; ++i)
-        vertex_buffer_init(&VBO[i], p_vertices, sizeof(p_vertices));
+    atomic_store(&simulation_running, 1);
+    if (pthread_create(&simulation_thread, NULL, simulation_loop, NULL)) {
+        async_log__write(async_log, LOG_ERROR, "Could not start the simulation thread.");
+        if (capture_output)
+            frame_capture_delete(&capture);
+        delete_meshes();
+        pre_exit_calls();
+        return 1;
+    }
 
-    for (size_t i = P_COUNT; i < P_COUNT+E_COUNT; ++i)
-        vertex_buffer_init(&VBO[i], e_vertices, sizeof(e_vertices));
+    render_loop(window);
 
+    atomic_store(&simulation_running, 0);
+    pthread_join(simulation_thread, NULL);
 
-    log__write(log_handle, LOG_DATA, "particle_id,mass,charge,x_momenta,y_momenta,z_momenta,x_pos,y_pos,z_pos,pitch_momenta,roll_momenta,yaw_momenta,pitch,roll,yaw");
-    render_loop(window, program, VBO);
+    if (capture_output) {
+        if (frame_capture_finish(&capture))
+            async_log__write(async_log, LOG_ERROR, "Writing frames to %s failed.", capture_filepath);
+        async_log__write(async_log, LOG_STATUS, "Captured %llu frames of %dx%d to %s.",
+                         capture.frames_written, capture_width, capture_height, capture_filepath);
+        frame_capture_delete(&capture);
+    }
+
+    delete_meshes();
 
-    log__write(log_handle, LOG_STATUS, "Program terminated correctly.");
+    async_log__write(async_log, LOG_STATUS, "Program terminated correctly.");
 
     glfwDestroyWindow(window);
     pre_exit_calls();
@@ -121,19 +235,147 @@ int main(void)
 
 
 /* Local function definitions */
+
+/* @return 0 on success, 1 on an unknown option or a bad value */
+static int parse_options(const int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;   // left NULL by options that do not take a number
+
+        if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+            return 1;
+
+        /* Anything else not starting with a dash is the scenario */
+        if (option[0] != '-') {
+            scenario_filepath = option;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return 1;
+        }
+
+        if (!strcmp(option, "--capture"))
+            capture_filepath = value;
+        else if (!strcmp(option, "--frames"))
+            capture_frame_count = strtoull(value, &end, 10);
+        else if (!strcmp(option, "--size")) {
+            capture_width = (GLsizei)strtol(value, &end, 10);
+            capture_height = *end == 'x' ? (GLsizei)strtol(end + 1, &end, 10) : 0;
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+
+        if (end && (end == value || *end != '\0')) {
+            fprintf(stderr, "Bad value %s for %s\n", value, option);
+            return 1;
+        }
+
+        ++i;
+    }
+
+    if (capture_frame_count == 0 || capture_width <= 0 || capture_height <= 0) {
+        fprintf(stderr, "The frame count and size must be positive\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] [scenario]\n", program);
+    printf("\n");
+    printf("Without a scenario file the built in scene is used, see scenario.h for the format.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help                  print this message\n");
+    printf("      --capture <file>        draw offscreen and write raw RGB frames, - for standard output\n");
+    printf("      --frames <count>        frames to capture, default %d\n", CAPTURE_DEFAULT_FRAMES);
+    printf("      --size <width>x<height> captured frame size, default %dx%d\n", CAPTURE_DEFAULT_WIDTH, CAPTURE_DEFAULT_HEIGHT);
+}
+
+/* A closed pipe shows up as a failed write rather than killing the program */
+static int open_capture_output(void)
+{
+    if (strcmp(capture_filepath, "-")) {
+        capture_output = fopen(capture_filepath, "wb");
+        return !capture_output;
+    }
+
+    #ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+    #else
+        signal(SIGPIPE, SIG_IGN);
+    #endif
+
+    capture_output = stdout;
+
+    return 0;
+}
+
+/**
+ * Captures draw into a hidden window's context.  Without a display the
+ * native context can fail, OSMesa then renders in software, for which
+ * GLFW 3.4 needs no display at all.
+ */
+static GLFWwindow *create_window(void)
+{
+    GLFWwindow *window;
+
+    if (!capture_output)
+        return glfwCreateWindow(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT, "Particle Sim", NULL, NULL);
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    if ((window = glfwCreateWindow(1, 1, "Particle Sim", NULL, NULL)))
+        return window;
+
+    async_log__write(async_log, LOG_WARNING, "No native context for the capture, trying OSMesa.");
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+
+    return glfwCreateWindow(1, 1, "Particle Sim", NULL, NULL);
+}
+
 static void pre_exit_calls(void)
 {
     glfwTerminate();
+
+    if (capture_output && capture_output != stdout)
+        fclose(capture_output);
+    capture_output = NULL;
+
+    if (trajectory__close(trajectory))
+        async_log__write(async_log, LOG_ERROR, "Trajectory file %s is incomplete.", TRAJECTORY_OUTPUT_FILEPATH);
+    trajectory = NULL;
+
+    instrumentation__report(async_log);
+    if (instrumentation__export(TIMINGS_OUTPUT_FILEPATH))
+        async_log__write(async_log, LOG_ERROR, "Could not write %s.", TIMINGS_OUTPUT_FILEPATH);
+
+    set_async_log(NULL);
+    async_log__delete(async_log);
+    async_log = NULL;
+
     log__close(log_handle);
     log__delete(log_handle);
 
-    for (size_t i = 0; i < P_COUNT+E_COUNT; ++i)
-        particle__delete(particles[i]);
+    snapshot_buffer__delete(snapshots);
+    particle_system__delete(particles);
+    free_mechanics_workspace();
+    scenario__delete(scenario);
+    free(instances);
 }
 
 static void error_callback(int error, const char *description)
 {
-    log__write(log_handle, LOG_ERROR, "Error: %s\n", description);
+    async_log__write(async_log, LOG_ERROR, "Error: %s", description);
 }
 
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
@@ -147,8 +389,24 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
 
     // reset particle locations... but not momenta!
     case GLFW_KEY_R:
-        for (size_t i = 0; i < P_COUNT+E_COUNT; ++i)
-            particles[i]->pos = initial_pos[i];
+        if (action == GLFW_PRESS)
+            atomic_fetch_or(&pending_commands, COMMAND_RESET);
+        break;
+
+    case GLFW_KEY_F5:
+        if (action == GLFW_PRESS)
+            atomic_fetch_or(&pending_commands, COMMAND_SAVE);
+        break;
+
+    case GLFW_KEY_F9:
+        if (action == GLFW_PRESS)
+            atomic_fetch_or(&pending_commands, COMMAND_LOAD);
+        break;
+
+    /* Impostors are only built when the driver compiles their shaders */
+    case GLFW_KEY_I:
+        if (action == GLFW_PRESS && impostors[0].program)
+            use_impostors = !use_impostors;
         break;
 
     default:
@@ -156,6 +414,47 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
     }
 }
 
+/* Only checkpoints of this scene fit the instance buffer */
+static void load_checkpoint(void)
+{
+    double saved_period;
+    particle_system_t *restored = checkpoint__read(CHECKPOINT_FILEPATH, instance_count, &saved_period);
+
+    /* A checkpoint of another scene is refused before it changes any setting */
+    if (!restored) {
+        async_log__write(async_log, LOG_ERROR, "Could not load %s, or it does not hold %zu particles.",
+                         CHECKPOINT_FILEPATH, instance_count);
+        return;
+    }
+
+    if (saved_period != sample_period)
+        async_log__write(async_log, LOG_WARNING, "%s was saved with a %E s timestep, carrying on with %E s.",
+                         CHECKPOINT_FILEPATH, saved_period, sample_period);
+
+    particle_system__delete(particles);
+    particles = restored;
+    async_log__write(async_log, LOG_STATUS, "Loaded step %llu from %s.", particles->step_count, CHECKPOINT_FILEPATH);
+}
+
+/* Positions are generated again from the scenario, same seed, same places */
+static void reset_positions(void)
+{
+    particle_system_t *initial = scenario__build(scenario, get_thread_count());
+
+    if (!initial || initial->count != particles->count) {
+        async_log__write(async_log, LOG_ERROR, "Could not reset the particles to the scenario.");
+        particle_system__delete(initial);
+        return;
+    }
+
+    memcpy(particles->pos.i, initial->pos.i, particles->count * sizeof(double));
+    memcpy(particles->pos.j, initial->pos.j, particles->count * sizeof(double));
+    memcpy(particles->pos.k, initial->pos.k, particles->count * sizeof(double));
+    particles->forces_current = 0;
+
+    particle_system__delete(initial);
+}
+
 static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     const double magnify_scalar = 1.25;
@@ -177,39 +476,257 @@ static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     // fprintf(debug_fp, "DEBUG VIEW MAGNIFICATION: view_scalar value = %E\n", view_scalar);
 }
 
-static void render_loop(GLFWwindow *window, const GLuint program, GLuint *VBO)
+/* Steps until the window closes, every step is published as a snapshot */
+static void *simulation_loop(void *arg)
 {
-    while (!glfwWindowShouldClose(window)) {
-        
-        int width, height;
- 
-        glfwGetFramebufferSize(window, &width, &height);
-        draw_vars.ratio = (float)width / height;
-
-        glViewport(0, 0, width, height);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glUseProgram(program);
-        for (size_t i = 0; i < P_COUNT+E_COUNT; ++i) {
-            draw_vars.pos = particles[i]->pos;
-            draw_vars.angle = particles[i]->orientation;
-            vertex_buffer_draw(VBO[i], draw_vars);
+#if SIMULATION_STEP_RATE > 0
+    struct timespec next_step;
+
+    clock_gettime(CLOCK_MONOTONIC, &next_step);
+#endif
+
+    while (atomic_load_explicit(&simulation_running, memory_order_relaxed)) {
+
+        run_commands(atomic_exchange_explicit(&pending_commands, 0, memory_order_relaxed));
+
+        time_evolution_soa(particles, sample_period);
+
+        {
+            INSTRUMENT_SCOPE(TIMER_TRAJECTORY);
+
+            if (trajectory && trajectory__write_frame(trajectory, particles)) {
+                async_log__write(async_log, LOG_ERROR, "Writing %s failed, recording stopped.", TRAJECTORY_OUTPUT_FILEPATH);
+                trajectory__close(trajectory);
+                trajectory = NULL;
+            }
         }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        snapshot_buffer__publish(snapshots, particles);
+
+#if SIMULATION_STEP_RATE > 0
+        pace_step(&next_step);
+#endif
+    }
+
+    return NULL;
+}
+
+static void run_commands(const unsigned int commands)
+{
+    if (commands & COMMAND_RESET)
+        reset_positions();
+
+    if (commands & COMMAND_SAVE && checkpoint__write(CHECKPOINT_FILEPATH, particles, sample_period))
+        async_log__write(async_log, LOG_ERROR, "Could not write %s.", CHECKPOINT_FILEPATH);
+
+    if (commands & COMMAND_LOAD)
+        load_checkpoint();
+}
+
+#if SIMULATION_STEP_RATE > 0
+/* Sleeps to the next step's slot, a slow step is not made up for by skipping sleeps later */
+static void pace_step(struct timespec *next_step)
+{
+    const long step_ns = 1000000000L / SIMULATION_STEP_RATE;
+    struct timespec now;
+
+    next_step->tv_nsec += step_ns;
+    while (next_step->tv_nsec >= 1000000000L) {
+        next_step->tv_nsec -= 1000000000L;
+        ++next_step->tv_sec;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > next_step->tv_sec || (now.tv_sec == next_step->tv_sec && now.tv_nsec > next_step->tv_nsec)) {
+        *next_step = now;
+        return;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next_step, NULL);
+}
+#endif
+
+/**
+ * Icospheres always, sphere impostors if their shaders build, which
+ * are then drawn by default.
+ *
+ * @return 0 on success, 1 if the icospheres could not be made
+ */
+static int create_meshes(void)
+{
+    GLuint mesh_program, impostor_program;
+    struct icosphere sphere;
+
+    if (shader_compile_and_link(async_log, &mesh_program, "mesh", vs_vert_glsl, fs_frag_glsl))
+        return 1;
+
+    for (unsigned int lod = 0; lod < ICOSPHERE_LOD_COUNT; ++lod) {
+
+        if (create_icosphere(&sphere, lod + 1))
+            return 1;
+
+        for (size_t species = 0; species < 2; ++species)
+            instanced_mesh_init(&icospheres[species][lod], mesh_program, (const GLfloat (*)[3])sphere.vertices, sphere.vertex_count,
+                                sphere.triangles[0], 3 * sphere.triangle_count, GL_TRIANGLES, species_radius[species]);
+
+        free_icosphere(&sphere);
+    }
+
+    if (shader_compile_and_link(async_log, &impostor_program, "impostor", impostor_vert_glsl, impostor_frag_glsl)) {
+        async_log__write(async_log, LOG_WARNING, "Sphere impostors unavailable, drawing icospheres.");
+        return 0;
+    }
+
+    for (size_t species = 0; species < 2; ++species)
+        instanced_mesh_init(&impostors[species], impostor_program, impostor_quad, 4, NULL, 0, GL_TRIANGLE_STRIP, species_radius[species]);
 
-        time_evolution(particles, P_COUNT+E_COUNT, sample_period);
+    use_impostors = 1;
 
-        busy_wait_ms(10);
+    return 0;
+}
+
+static void delete_meshes(void)
+{
+    for (size_t species = 0; species < 2; ++species) {
+
+        if (impostors[species].program)
+            instanced_mesh_delete(&impostors[species]);
+
+        for (unsigned int lod = 0; lod < ICOSPHERE_LOD_COUNT; ++lod)
+            instanced_mesh_delete(&icospheres[species][lod]);
+    }
+}
+
+/* Linear from previous to latest, unless the particle went through a periodic wall in between */
+static double lerp(const double previous, const double latest, const double alpha, const double box_length)
+{
+    if (box_length > 0 && fabs(latest - previous) > box_length / 2)
+        return latest;
+
+    return previous + alpha * (latest - previous);
+}
+
+/**
+ * Positive charges are drawn as nuclei and packed from the front of
+ * the instance buffer, the rest as electrons from the back.  Angles are
+ * unscaled and wrapped in double so the floats the shader gets stay exact.
+ *
+ * @return the number of nuclei
+ */
+static size_t fill_instances(const snapshot_t *latest, const snapshot_t *previous, const double alpha)
+{
+    const vector3d_t box = get_periodic_box();
+    size_t front = 0;
+    size_t back = instance_count;
+
+    for (size_t i = 0; i < instance_count; ++i) {
+
+        struct instance *instance = latest->charge[i] > 0 ? &instances[front++] : &instances[--back];
+
+        instance->pos[0] = (GLfloat)lerp(previous->pos.i[i], latest->pos.i[i], alpha, box.i);
+        instance->pos[1] = (GLfloat)lerp(previous->pos.j[i], latest->pos.j[i], alpha, box.j);
+        instance->pos[2] = (GLfloat)lerp(previous->pos.k[i], latest->pos.k[i], alpha, box.k);
+        instance->angle[0] = (GLfloat)fmod(lerp(previous->orientation.i[i], latest->orientation.i[i], alpha, 0) / draw_vars.view_scalar, 2 * PI);
+        instance->angle[1] = (GLfloat)fmod(lerp(previous->orientation.j[i], latest->orientation.j[i], alpha, 0) / draw_vars.view_scalar, 2 * PI);
+        instance->angle[2] = (GLfloat)fmod(lerp(previous->orientation.k[i], latest->orientation.k[i], alpha, 0) / draw_vars.view_scalar, 2 * PI);
+        instance->color = latest->charge[i] > 0 ? p_color : e_color;
+    }
+
+    return front;
+}
+
+/**
+ * The frame shows the particles one publish interval behind the latest
+ * snapshot, moving from previous to latest over the time it took the
+ * simulation to go from one to the other.
+ */
+static double interpolation_weight(const snapshot_t *latest, const snapshot_t *previous)
+{
+    const uint64_t now = instrumentation__now();
+
+    if (latest->published <= previous->published)
+        return 1;
+
+    if (now <= latest->published)
+        return 0;
+
+    const double alpha = (double)(now - latest->published) / (double)(latest->published - previous->published);
+
+    return alpha < 1 ? alpha : 1;
+}
+
+/* Icospheres get finer as the particles grow on screen, one unit of the projection is half the height */
+static void draw_particles(const int height)
+{
+    const snapshot_t *previous;
+    const snapshot_t *latest = snapshot_buffer__acquire(snapshots, &previous);
+
+    const size_t nucleus_count = fill_instances(latest, previous, interpolation_weight(latest, previous));
+    const size_t counts[2] = {nucleus_count, instance_count - nucleus_count};
+    const struct instance *first[2] = {instances, instances + nucleus_count};
+
+    for (size_t species = 0; species < 2; ++species) {
+
+        const double pixel_radius = species_radius[species] * height / 2;
+        unsigned int lod = 0;
+
+        while (lod + 1 < ICOSPHERE_LOD_COUNT && pixel_radius > ICOSPHERE_LOD_PIXELS * (1 << (2 * lod)))
+            ++lod;
+
+        instanced_mesh_draw(use_impostors ? &impostors[species] : &icospheres[species][lod],
+                            first[species], (GLsizei)counts[species], draw_vars);
     }
 }
 
-static void busy_wait_ms(const float delay_in_ms)
+/* When capturing, frames go to the capture framebuffer until there are enough of them */
+static void render_loop(GLFWwindow *window)
 {
-    const float clocks_per_ms = (float)CLOCKS_PER_SEC / 1000;
-    const float start_tick = clocks_per_ms * clock();
-    const float end_tick = start_tick + (clocks_per_ms * delay_in_ms);
+    uint64_t last_report = instrumentation__now();
+    unsigned long long int frames_captured = 0;
+
+    while (!glfwWindowShouldClose(window)) {
+
+        INSTRUMENT_SCOPE(TIMER_FRAME);
+
+        int width = capture_width;
+        int height = capture_height;
 
-    while (clocks_per_ms * clock() <= end_tick);
+        {
+            INSTRUMENT_SCOPE(TIMER_RENDER_DRAW);
+
+            if (!capture_output)
+                glfwGetFramebufferSize(window, &width, &height);
+            draw_vars.ratio = (float)width / height;
+
+            glViewport(0, 0, width, height);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            draw_particles(height);
+        }
+
+        if (capture_output) {
+            INSTRUMENT_SCOPE(TIMER_RENDER_READBACK);
+
+            if (frame_capture_read(&capture)) {
+                async_log__write(async_log, LOG_ERROR, "Writing frames to %s failed, capture stopped.", capture_filepath);
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+            else if (++frames_captured == capture_frame_count)
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+        else {
+            INSTRUMENT_SCOPE(TIMER_RENDER_SWAP);
+            glfwSwapBuffers(window);
+        }
+
+        {
+            INSTRUMENT_SCOPE(TIMER_RENDER_EVENTS);
+            glfwPollEvents();
+        }
+
+        if (instrumentation__now() - last_report >= TIMINGS_REPORT_PERIOD) {
+            instrumentation__report(async_log);
+            last_report = instrumentation__now();
+        }
+    }
 }
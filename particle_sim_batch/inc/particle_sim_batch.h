@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "async_log.h"
+#include "mechanics.h"
+
+
+#define DEFAULT_STEP_COUNT          1000
+#define DEFAULT_OUTPUT_FILEPATH     "trajectory.bin"
+#define DEFAULT_LOG_FILEPATH        "batch_log.txt"
+#define DEFAULT_TIMINGS_FILEPATH    "timings.json"
+#define DEFAULT_SKIN_FRACTION       0.1     // of the cutoff, when no skin is given
+
+
+/* Command line settings of a batch run */
+typedef struct
+{
+    unsigned long long int step_count;  // total, a restarted run only takes the steps still missing
+    double sample_period;               // 0 for the one of the checkpoint or scenario
+    const char *scenario_filepath;      // NULL for the scene particle_sim starts with
+    unsigned long long int seed;        // replaces the scenario seed when seed_given is set
+    int seed_given;
+    const char *output_filepath;        // binary trajectory, see trajectory.h
+    const char *log_filepath;
+    const char *timings_filepath;       // phase histograms, see instrumentation.h
+    int text_logging;                   // per-particle text lines in the log as well
+    async_log_policy_t log_policy;      // what happens when the log writer falls behind
+    force_solver_t solver;
+    double cutoff;                      // interaction range of the neighbour list solver
+    double skin;                        // neighbour list margin, used when skin_given is set
+    int skin_given;
+    integrator_t integrator;
+    unsigned int thread_count;          // 0 for one per online processor
+    double box_length;                  // periodic box side, 0 for the scenario's
+    const char *checkpoint_filepath;
+    unsigned long long int checkpoint_interval;     // steps between checkpoints, 0 for only at the end
+    const char *restart_filepath;       // checkpoint to carry on from, settings come from it
+
+} batch_options_t;
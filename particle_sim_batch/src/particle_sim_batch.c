@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "particle_sim.h"
+#include "particle_sim_batch.h"
+#include "particle.h"
+#include "particle_system.h"
+#include "mechanics.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+#include "scenario.h"
+#include "instrumentation.h"
+#include "async_log.h"
+#include "log.h"
+
+
+static void pre_exit_calls(void);
+
+static particle_system_t *initial_particles(batch_options_t *options);
+static int write_checkpoint(const batch_options_t *options);
+static int parse_options(const int argc, char **argv, batch_options_t *options);
+static int parse_solver(const char *name, force_solver_t *solver);
+static int parse_integrator(const char *name, integrator_t *integrator);
+static void print_usage(const char *program);
+static double wall_seconds(void);
+
+
+/* Global variables */
+log_t *log_handle;
+
+static async_log_t *async_log;
+
+static particle_system_t *particles;
+static trajectory_t *trajectory;
+
+
+/* Entry point */
+int main(int argc, char **argv)
+{
+    batch_options_t options = {
+        .step_count = DEFAULT_STEP_COUNT,
+        .output_filepath = DEFAULT_OUTPUT_FILEPATH,
+        .log_filepath = DEFAULT_LOG_FILEPATH,
+        .timings_filepath = DEFAULT_TIMINGS_FILEPATH,
+        .solver = FORCE_SOLVER_DIRECT,
+        .integrator = INTEGRATOR_SYMPLECTIC_EULER,
+        .log_policy = ASYNC_LOG_BLOCK,
+    };
+
+    if (parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!(log_handle=log__open(options.log_filepath, "w"))) {
+        fprintf(stderr, "Could not open %s\n", options.log_filepath);
+        return 1;
+    }
+
+    if (!(async_log = async_log__new(log_handle, DEFAULT_ASYNC_LOG_CAPACITY, options.log_policy))) {
+        pre_exit_calls();
+        return 1;
+    }
+    set_async_log(async_log);
+
+    async_log__write(async_log, LOG_STATUS, "Log file opened.");
+
+    set_thread_count(options.thread_count);
+    set_text_logging(options.text_logging);
+
+    if (options.restart_filepath) {
+
+        double saved_period;
+
+        if (!(particles = checkpoint__read(options.restart_filepath, CHECKPOINT_ANY_COUNT, &saved_period))) {
+            fprintf(stderr, "Could not restore %s\n", options.restart_filepath);
+            pre_exit_calls();
+            return 1;
+        }
+
+        if (!options.sample_period)
+            options.sample_period = saved_period;
+
+        /* Frames past the checkpoint were never part of this run */
+        if (!(trajectory = trajectory__append(options.output_filepath, particles->count, options.sample_period,
+                                              TRAJECTORY_DEFAULT_FIELDS, particles->step_count))) {
+            fprintf(stderr, "%s does not continue the run in %s\n", options.output_filepath, options.restart_filepath);
+            pre_exit_calls();
+            return 1;
+        }
+
+        async_log__write(async_log, LOG_STATUS, "Restored step %llu from %s.", particles->step_count, options.restart_filepath);
+    }
+    else {
+
+        if (!(particles = initial_particles(&options))) {
+            pre_exit_calls();
+            return 1;
+        }
+
+        if (options.solver == FORCE_SOLVER_PARTICLE_MESH && !(options.box_length > 0)) {
+            fprintf(stderr, "The particle mesh solver needs a periodic box\n");
+            pre_exit_calls();
+            return 1;
+        }
+
+        if (options.solver == FORCE_SOLVER_NEIGHBOUR_LIST && !(options.cutoff > 0)) {
+            fprintf(stderr, "The neighbour list solver needs a cutoff\n");
+            pre_exit_calls();
+            return 1;
+        }
+
+        set_force_solver(options.solver);
+        set_cutoff(options.cutoff, options.skin_given ? options.skin : DEFAULT_SKIN_FRACTION * options.cutoff);
+        set_integrator(options.integrator);
+        set_periodic_box((vector3d_t){options.box_length, options.box_length, options.box_length});
+
+        if (!(trajectory = trajectory__open(options.output_filepath, particles->count, options.sample_period, TRAJECTORY_DEFAULT_FIELDS))) {
+            fprintf(stderr, "Could not open %s\n", options.output_filepath);
+            pre_exit_calls();
+            return 1;
+        }
+    }
+
+    const unsigned long long int first_step = particles->step_count;
+    const unsigned long long int steps = options.step_count > first_step ? options.step_count - first_step : 0;
+
+    async_log__write(async_log, LOG_STATUS, "Running %llu steps of %E s, %s integrator, %u threads.",
+               steps, options.sample_period, integrator_name(get_integrator()), options.thread_count);
+
+    const double start = wall_seconds();
+    uint64_t last_report = instrumentation__now();
+
+    while (particles->step_count < options.step_count) {
+
+        time_evolution_soa(particles, options.sample_period);
+
+        {
+            INSTRUMENT_SCOPE(TIMER_TRAJECTORY);
+
+            if (trajectory__write_frame(trajectory, particles)) {
+                fprintf(stderr, "Writing %s failed at step %llu\n", options.output_filepath, particles->step_count);
+                pre_exit_calls();
+                return 1;
+            }
+        }
+
+        if (options.checkpoint_interval && particles->step_count % options.checkpoint_interval == 0)
+            write_checkpoint(&options);
+
+        /* The report period is shared with particle_sim */
+        if (instrumentation__now() - last_report >= TIMINGS_REPORT_PERIOD) {
+            instrumentation__report(async_log);
+            last_report = instrumentation__now();
+        }
+    }
+
+    /* The last frames are still buffered, writing them out is part of the run */
+    const int incomplete = trajectory__flush(trajectory);
+
+    const double elapsed = wall_seconds() - start;
+    const double steps_per_second = elapsed > 0 ? steps / elapsed : 0;
+
+    printf("%llu steps in %.3f s, %.1f steps/s\n", steps, elapsed, steps_per_second);
+    async_log__write(async_log, LOG_STATUS, "%llu steps in %.3f s, %.1f steps/s", steps, elapsed, steps_per_second);
+
+    instrumentation__report(async_log);
+    if (instrumentation__export(options.timings_filepath))
+        fprintf(stderr, "Could not write %s\n", options.timings_filepath);
+
+    if (incomplete) {
+        fprintf(stderr, "Writing %s failed\n", options.output_filepath);
+        pre_exit_calls();
+        return 1;
+    }
+
+    if (steps && write_checkpoint(&options)) {
+        fprintf(stderr, "Could not write %s\n", options.checkpoint_filepath);
+        pre_exit_calls();
+        return 1;
+    }
+
+    async_log__write(async_log, LOG_STATUS, "Program terminated correctly.");
+
+    pre_exit_calls();
+
+    return 0;
+}
+
+
+/* Local function definitions */
+static void pre_exit_calls(void)
+{
+    trajectory__close(trajectory);
+    trajectory = NULL;
+
+    set_async_log(NULL);
+    async_log__delete(async_log);
+    async_log = NULL;
+
+    log__close(log_handle);
+    log__delete(log_handle);
+
+    particle_system__delete(particles);
+    free_mechanics_workspace();
+}
+
+/* Fills in the timestep and box the options leave to the scenario */
+static particle_system_t *initial_particles(batch_options_t *options)
+{
+    const char *name = options->scenario_filepath ? options->scenario_filepath : "the built in scenario";
+    size_t error_line;
+    scenario_t *scenario = options->scenario_filepath ? scenario__load(options->scenario_filepath, &error_line)
+                                                      : scenario__parse(default_scenario, &error_line);
+
+    if (!scenario) {
+        if (error_line)
+            fprintf(stderr, "%s:%zu: bad line\n", name, error_line);
+        else
+            fprintf(stderr, "Could not read %s\n", name);
+        return NULL;
+    }
+
+    if (options->seed_given)
+        scenario->seed = options->seed;
+    if (!options->sample_period)
+        options->sample_period = scenario->sample_period ? scenario->sample_period : DEFAULT_SAMPLE_PERIOD;
+    if (!options->box_length)
+        options->box_length = scenario->box_length;
+
+    const double start = wall_seconds();
+    particle_system_t *system = scenario__build(scenario, options->thread_count);
+
+    if (system)
+        async_log__write(async_log, LOG_STATUS, "Generated %zu particles from %s, seed %llu, in %.3f s.",
+                         system->count, name, scenario->seed, wall_seconds() - start);
+
+    scenario__delete(scenario);
+
+    return system;
+}
+
+/**
+ * The trajectory is flushed first, so after a crash it holds at least
+ * every frame up to the newest checkpoint.
+ *
+ * @return 0 on success or without a checkpoint file, 1 on failure
+ */
+static int write_checkpoint(const batch_options_t *options)
+{
+    if (!options->checkpoint_filepath)
+        return 0;
+
+    if (trajectory__flush(trajectory) || checkpoint__write(options->checkpoint_filepath, particles, options->sample_period)) {
+        async_log__write(async_log, LOG_ERROR, "Could not write checkpoint %s at step %llu.",
+                         options->checkpoint_filepath, particles->step_count);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* @return 0 on success, 1 on an unknown option or a bad value */
+static int parse_options(const int argc, char **argv, batch_options_t *options)
+{
+    for (int i = 1; i < argc; ++i) {
+
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;   // left NULL by options that do not take a number
+
+        if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+            return 1;
+
+        if (!strcmp(option, "--text")) {
+            options->text_logging = 1;
+            continue;
+        }
+
+        if (!strcmp(option, "--drop-logs")) {
+            options->log_policy = ASYNC_LOG_DROP;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return 1;
+        }
+
+        if (!strcmp(option, "-n") || !strcmp(option, "--steps"))
+            options->step_count = strtoull(value, &end, 10);
+        else if (!strcmp(option, "-t") || !strcmp(option, "--dt"))
+            options->sample_period = strtod(value, &end);
+        else if (!strcmp(option, "-j") || !strcmp(option, "--threads"))
+            options->thread_count = (unsigned int)strtoul(value, &end, 10);
+        else if (!strcmp(option, "-b") || !strcmp(option, "--box"))
+            options->box_length = strtod(value, &end);
+        else if (!strcmp(option, "-S") || !strcmp(option, "--scenario"))
+            options->scenario_filepath = value;
+        else if (!strcmp(option, "--seed")) {
+            options->seed = strtoull(value, &end, 0);
+            options->seed_given = 1;
+        }
+        else if (!strcmp(option, "-o") || !strcmp(option, "--output"))
+            options->output_filepath = value;
+        else if (!strcmp(option, "-l") || !strcmp(option, "--log"))
+            options->log_filepath = value;
+        else if (!strcmp(option, "--timings"))
+            options->timings_filepath = value;
+        else if (!strcmp(option, "-c") || !strcmp(option, "--checkpoint"))
+            options->checkpoint_filepath = value;
+        else if (!strcmp(option, "--checkpoint-every"))
+            options->checkpoint_interval = strtoull(value, &end, 10);
+        else if (!strcmp(option, "-r") || !strcmp(option, "--restart"))
+            options->restart_filepath = value;
+        else if (!strcmp(option, "-s") || !strcmp(option, "--solver")) {
+            if (parse_solver(value, &options->solver)) return 1;
+        }
+        else if (!strcmp(option, "--cutoff"))
+            options->cutoff = strtod(value, &end);
+        else if (!strcmp(option, "--skin")) {
+            options->skin = strtod(value, &end);
+            options->skin_given = 1;
+        }
+        else if (!strcmp(option, "-i") || !strcmp(option, "--integrator")) {
+            if (parse_integrator(value, &options->integrator)) return 1;
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+
+        if (end && (end == value || *end != '\0')) {
+            fprintf(stderr, "Bad value %s for %s\n", value, option);
+            return 1;
+        }
+
+        ++i;
+    }
+
+    if (options->sample_period < 0 || options->box_length < 0 || options->cutoff < 0 || options->skin < 0) {
+        fprintf(stderr, "The timestep, box length, cutoff and skin must be positive\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_solver(const char *name, force_solver_t *solver)
+{
+    if (!strcmp(name, "direct"))
+        *solver = FORCE_SOLVER_DIRECT;
+    else if (!strcmp(name, "barnes_hut"))
+        *solver = FORCE_SOLVER_BARNES_HUT;
+    else if (!strcmp(name, "particle_mesh"))
+        *solver = FORCE_SOLVER_PARTICLE_MESH;
+    else if (!strcmp(name, "neighbour_list"))
+        *solver = FORCE_SOLVER_NEIGHBOUR_LIST;
+    else {
+        fprintf(stderr, "Unknown solver %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_integrator(const char *name, integrator_t *integrator)
+{
+    for (integrator_t scheme = INTEGRATOR_EXPLICIT_EULER; scheme <= INTEGRATOR_BLOCK_TIMESTEP; ++scheme) {
+        if (!strcmp(name, integrator_name(scheme))) {
+            *integrator = scheme;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Unknown integrator %s\n", name);
+    return 1;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help                  print this message\n");
+    printf("  -n, --steps <count>         total number of steps, default %d\n", DEFAULT_STEP_COUNT);
+    printf("  -S, --scenario <file>       initial conditions, see scenario.h, default the particle_sim scene\n");
+    printf("      --seed <number>         replaces the seed of the scenario\n");
+    printf("  -t, --dt <seconds>          timestep, default the scenario's or %E, or the restored one\n", DEFAULT_SAMPLE_PERIOD);
+    printf("  -o, --output <file>         binary trajectory, default %s\n", DEFAULT_OUTPUT_FILEPATH);
+    printf("  -l, --log <file>            status and error log, default %s\n", DEFAULT_LOG_FILEPATH);
+    printf("      --text                  also log every particle of every step as text, slow\n");
+    printf("      --timings <file>        per-phase timing histograms as JSON, default %s\n", DEFAULT_TIMINGS_FILEPATH);
+    printf("  -c, --checkpoint <file>     checkpoint written at the end of the run\n");
+    printf("      --checkpoint-every <n>  and every n steps\n");
+    printf("  -r, --restart <file>        carry on from a checkpoint, appending to the output,\n");
+    printf("                              the solver, cutoff, integrator and box come from the checkpoint\n");
+    printf("      --drop-logs             drop log lines rather than wait when the log writer falls behind\n");
+    printf("  -s, --solver <name>         direct, barnes_hut, particle_mesh or neighbour_list\n");
+    printf("      --cutoff <length>       interaction range of neighbour_list\n");
+    printf("      --skin <length>         margin the neighbour lists cover beyond it, default %g of the cutoff\n", DEFAULT_SKIN_FRACTION);
+    printf("  -i, --integrator <name>     explicit_euler, symplectic_euler, velocity_verlet, rk4, boris or block_timestep\n");
+    printf("  -j, --threads <count>       worker threads, 0 for one per processor\n");
+    printf("  -b, --box <length>          periodic box side length, default the scenario's\n");
+}
+
+/* Wall clock rather than clock(), which adds up the time of every thread */
+static double wall_seconds(void)
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return now.tv_sec + now.tv_nsec * 1E-9;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "mechanics.h"
+
+
+#define DEFAULT_STEP_COUNT          1000
+#define DEFAULT_LOG_PREFIX          "mpi_log"   // one log per rank, mpi_log_<rank>.txt
+#define DEFAULT_SKIN_FRACTION       0.1         // of the cutoff, when no skin is given
+
+
+/* Command line settings of a decomposed run, the same on every rank */
+typedef struct
+{
+    unsigned long long int step_count;
+    double sample_period;               // 0 for the scenario's
+    const char *scenario_filepath;      // NULL for the scene particle_sim starts with
+    unsigned long long int seed;        // replaces the scenario seed when seed_given is set
+    int seed_given;
+    const char *log_prefix;
+    double cutoff;                      // interaction range, required
+    double skin;                        // neighbour list margin, used when skin_given is set
+    int skin_given;
+    integrator_t integrator;
+    unsigned int thread_count;          // per rank, 0 for one per online processor
+    double box_length;                  // periodic box side, 0 for the scenario's
+    const char *checkpoint_filepath;    // every particle gathered on rank 0 at the end, NULL for none
+
+} mpi_options_t;
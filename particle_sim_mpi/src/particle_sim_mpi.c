@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+#include "particle_sim.h"
+#include "particle_sim_mpi.h"
+#include "particle_system.h"
+#include "mechanics.h"
+#include "checkpoint.h"
+#include "scenario.h"
+#include "domain.h"
+#include "async_log.h"
+#include "log.h"
+
+
+static void pre_exit_calls(void);
+
+static particle_system_t *initial_particles(mpi_options_t *options);
+static int parse_options(const int argc, char **argv, mpi_options_t *options);
+static int parse_integrator(const char *name, integrator_t *integrator);
+static void print_usage(const char *program);
+
+
+/* Global variables */
+log_t *log_handle;
+
+static async_log_t *async_log;
+
+static domain_t *domain;
+static int rank;
+
+
+/* Entry point */
+int main(int argc, char **argv)
+{
+    mpi_options_t options = {
+        .step_count = DEFAULT_STEP_COUNT,
+        .log_prefix = DEFAULT_LOG_PREFIX,
+        .integrator = INTEGRATOR_SYMPLECTIC_EULER,
+    };
+    char log_filepath[256];
+    int size;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    /* Every rank sees the same arguments, so every rank takes the same way out */
+    if (parse_options(argc, argv, &options)) {
+        if (rank == 0)
+            print_usage(argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    snprintf(log_filepath, sizeof(log_filepath), "%s_%d.txt", options.log_prefix, rank);
+
+    int failed = !(log_handle=log__open(log_filepath, "w")) ||
+                 !(async_log = async_log__new(log_handle, DEFAULT_ASYNC_LOG_CAPACITY, ASYNC_LOG_BLOCK));
+
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+
+    if (failed) {
+        if (!log_handle)
+            fprintf(stderr, "Could not open %s\n", log_filepath);
+        pre_exit_calls();
+        return 1;
+    }
+    set_async_log(async_log);
+
+    async_log__write(async_log, LOG_STATUS, "Log file opened, rank %d of %d.", rank, size);
+
+    set_thread_count(options.thread_count);
+
+    /* Rank 0 builds the whole scene, the domain spreads it over the others */
+    particle_system_t *particles = rank == 0 ? initial_particles(&options) : particle_system__new(0);
+
+    failed = !particles;
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+
+    if (failed) {
+        particle_system__delete(particles);
+        pre_exit_calls();
+        return 1;
+    }
+
+    /* The timestep and box may come from the scenario, which only rank 0 read */
+    MPI_Bcast(&options.sample_period, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&options.box_length, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    set_force_solver(FORCE_SOLVER_NEIGHBOUR_LIST);
+    set_cutoff(options.cutoff, options.skin_given ? options.skin : DEFAULT_SKIN_FRACTION * options.cutoff);
+    set_integrator(options.integrator);
+    set_periodic_box((vector3d_t){options.box_length, options.box_length, options.box_length});
+
+    if (!(domain = domain__new(MPI_COMM_WORLD, particles))) {
+        if (rank == 0)
+            fprintf(stderr, "Could not decompose the run, see domain.h for the settings it needs\n");
+        pre_exit_calls();
+        return 1;
+    }
+
+    const unsigned long long int first_step = domain__particles(domain)->step_count;
+    const unsigned long long int steps = options.step_count > first_step ? options.step_count - first_step : 0;
+
+    async_log__write(async_log, LOG_STATUS, "Running %llu steps of %E s over %d ranks, %s integrator, %u threads.",
+                     steps, options.sample_period, size, integrator_name(get_integrator()), options.thread_count);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start = MPI_Wtime();
+
+    for (unsigned long long int step = 0; step < steps; ++step) {
+        if (domain__step(domain, options.sample_period)) {
+            if (rank == 0)
+                fprintf(stderr, "Step %llu failed\n", first_step + step + 1);
+            pre_exit_calls();
+            return 1;
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double elapsed = MPI_Wtime() - start;
+    const double steps_per_second = elapsed > 0 ? steps / elapsed : 0;
+
+    double lower, upper;
+
+    domain__bounds(domain, &lower, &upper);
+    async_log__write(async_log, LOG_STATUS, "%llu steps in %.3f s, %zu particles in [%E, %E).",
+                     steps, elapsed, domain__particles(domain)->count, lower, upper);
+
+    if (rank == 0)
+        printf("%llu steps in %.3f s, %.1f steps/s, %zu particles over %d ranks, imbalance %.3f, %llu rebalances\n",
+               steps, elapsed, steps_per_second, domain__global_count(domain), size,
+               domain__imbalance(domain), domain__rebalance_count(domain));
+
+    if (options.checkpoint_filepath) {
+
+        particle_system_t *gathered = domain__gather(domain, 0);
+
+        failed = rank == 0 && (!gathered || checkpoint__write(options.checkpoint_filepath, gathered, options.sample_period));
+        particle_system__delete(gathered);
+
+        MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (failed) {
+            if (rank == 0)
+                fprintf(stderr, "Could not write %s\n", options.checkpoint_filepath);
+            pre_exit_calls();
+            return 1;
+        }
+    }
+
+    async_log__write(async_log, LOG_STATUS, "Program terminated correctly.");
+
+    pre_exit_calls();
+
+    return 0;
+}
+
+
+/* Local function definitions */
+static void pre_exit_calls(void)
+{
+    domain__delete(domain);
+    domain = NULL;
+
+    set_async_log(NULL);
+    async_log__delete(async_log);
+    async_log = NULL;
+
+    log__close(log_handle);
+    log__delete(log_handle);
+
+    free_mechanics_workspace();
+
+    MPI_Finalize();
+}
+
+/* Fills in the timestep and box the options leave to the scenario */
+static particle_system_t *initial_particles(mpi_options_t *options)
+{
+    const char *name = options->scenario_filepath ? options->scenario_filepath : "the built in scenario";
+    size_t error_line;
+    scenario_t *scenario = options->scenario_filepath ? scenario__load(options->scenario_filepath, &error_line)
+                                                      : scenario__parse(default_scenario, &error_line);
+
+    if (!scenario) {
+        if (error_line)
+            fprintf(stderr, "%s:%zu: bad line\n", name, error_line);
+        else
+            fprintf(stderr, "Could not read %s\n", name);
+        return NULL;
+    }
+
+    if (options->seed_given)
+        scenario->seed = options->seed;
+    if (!options->sample_period)
+        options->sample_period = scenario->sample_period ? scenario->sample_period : DEFAULT_SAMPLE_PERIOD;
+    if (!options->box_length)
+        options->box_length = scenario->box_length;
+
+    particle_system_t *system = scenario__build(scenario, options->thread_count);
+
+    if (system)
+        async_log__write(async_log, LOG_STATUS, "Generated %zu particles from %s, seed %llu.",
+                         system->count, name, scenario->seed);
+
+    scenario__delete(scenario);
+
+    return system;
+}
+
+/* @return 0 on success, 1 on an unknown option or a bad value */
+static int parse_options(const int argc, char **argv, mpi_options_t *options)
+{
+    for (int i = 1; i < argc; ++i) {
+
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;   // left NULL by options that do not take a number
+
+        if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+            return 1;
+
+        if (!value) {
+            if (rank == 0)
+                fprintf(stderr, "Missing value for %s\n", option);
+            return 1;
+        }
+
+        if (!strcmp(option, "-n") || !strcmp(option, "--steps"))
+            options->step_count = strtoull(value, &end, 10);
+        else if (!strcmp(option, "-t") || !strcmp(option, "--dt"))
+            options->sample_period = strtod(value, &end);
+        else if (!strcmp(option, "-j") || !strcmp(option, "--threads"))
+            options->thread_count = (unsigned int)strtoul(value, &end, 10);
+        else if (!strcmp(option, "-b") || !strcmp(option, "--box"))
+            options->box_length = strtod(value, &end);
+        else if (!strcmp(option, "-S") || !strcmp(option, "--scenario"))
+            options->scenario_filepath = value;
+        else if (!strcmp(option, "--seed")) {
+            options->seed = strtoull(value, &end, 0);
+            options->seed_given = 1;
+        }
+        else if (!strcmp(option, "-l") || !strcmp(option, "--log"))
+            options->log_prefix = value;
+        else if (!strcmp(option, "-c") || !strcmp(option, "--checkpoint"))
+            options->checkpoint_filepath = value;
+        else if (!strcmp(option, "--cutoff"))
+            options->cutoff = strtod(value, &end);
+        else if (!strcmp(option, "--skin")) {
+            options->skin = strtod(value, &end);
+            options->skin_given = 1;
+        }
+        else if (!strcmp(option, "-i") || !strcmp(option, "--integrator")) {
+            if (parse_integrator(value, &options->integrator)) return 1;
+        }
+        else {
+            if (rank == 0)
+                fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+
+        if (end && (end == value || *end != '\0')) {
+            if (rank == 0)
+                fprintf(stderr, "Bad value %s for %s\n", value, option);
+            return 1;
+        }
+
+        ++i;
+    }
+
+    if (options->sample_period < 0 || options->box_length < 0 || options->cutoff < 0 || options->skin < 0) {
+        if (rank == 0)
+            fprintf(stderr, "The timestep, box length, cutoff and skin must be positive\n");
+        return 1;
+    }
+
+    if (!(options->cutoff > 0)) {
+        if (rank == 0)
+            fprintf(stderr, "Decomposed runs use the neighbour list solver, which needs a cutoff\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_integrator(const char *name, integrator_t *integrator)
+{
+    for (integrator_t scheme = INTEGRATOR_EXPLICIT_EULER; scheme <= INTEGRATOR_BLOCK_TIMESTEP; ++scheme) {
+        if (!strcmp(name, integrator_name(scheme))) {
+            *integrator = scheme;
+            return 0;
+        }
+    }
+
+    if (rank == 0)
+        fprintf(stderr, "Unknown integrator %s\n", name);
+    return 1;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: mpirun -np <ranks> %s --cutoff <length> [options]\n", program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help                  print this message\n");
+    printf("  -n, --steps <count>         total number of steps, default %d\n", DEFAULT_STEP_COUNT);
+    printf("  -S, --scenario <file>       initial conditions, see scenario.h, default the particle_sim scene\n");
+    printf("      --seed <number>         replaces the seed of the scenario\n");
+    printf("  -t, --dt <seconds>          timestep, default the scenario's or %E\n", DEFAULT_SAMPLE_PERIOD);
+    printf("  -l, --log <prefix>          per rank logs <prefix>_<rank>.txt, default %s\n", DEFAULT_LOG_PREFIX);
+    printf("  -c, --checkpoint <file>     every particle, written by rank 0 at the end of the run\n");
+    printf("      --cutoff <length>       interaction range of the neighbour list solver, required\n");
+    printf("      --skin <length>         margin the neighbour lists and ghosts cover beyond it, default %g of the cutoff\n", DEFAULT_SKIN_FRACTION);
+    printf("  -i, --integrator <name>     explicit_euler, symplectic_euler, velocity_verlet or boris\n");
+    printf("  -j, --threads <count>       worker threads per rank, 0 for one per processor\n");
+    printf("  -b, --box <length>          periodic box side length, default the scenario's\n");
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "mechanics.h"
+#include "trajectory.h"
+
+
+#define DEFAULT_GOLDEN_DIRECTORY    "golden"
+#define GOLDEN_EXTENSION            ".trj"      // trajectory.h files, one per reference scenario
+#define GOLDEN_FIELDS               (TRAJECTORY_DEFAULT_FIELDS | TRAJECTORY_RADIUS)    // enough to rebuild the system
+
+/* Largest error over every frame, relative to the largest magnitude of the field in the golden frame */
+#define DEFAULT_POSITION_TOLERANCE          1E-5
+#define DEFAULT_MOMENTA_TOLERANCE           1E-3
+#define DEFAULT_ORIENTATION_TOLERANCE       1E-5
+#define DEFAULT_ANGULAR_MOMENTA_TOLERANCE   1E-3
+
+/* Conserved quantities may drift this much further than they do in the golden run */
+#define DEFAULT_ENERGY_DRIFT_TOLERANCE      1E-3    // of the initial total energy
+#define DEFAULT_MOMENTUM_DRIFT_TOLERANCE    1E-9    // of the summed magnitudes of the initial momenta
+
+
+typedef enum
+{
+    VERIFY_RECORD,      // golden trajectories from time_evolution()
+    VERIFY_COMPARE,     // time_evolution_soa() with the chosen backend against them
+    VERIFY_REPRODUCE,   // deterministic runs on one and on several threads, checksum for checksum
+
+} verify_mode_t;
+
+/**
+ * A scene every backend is checked on.  Open space and no collisions,
+ * so time_evolution() and every solver describe the same physics.
+ */
+typedef struct
+{
+    const char *name;
+    const char *scenario;       // scenario.h text, it sets the timestep
+    unsigned long long int step_count;
+    unsigned long long int frame_interval;  // steps between stored frames
+
+} reference_t;
+
+/* Per-field and conserved-quantity limits of a comparison */
+typedef struct
+{
+    double position;
+    double momenta;
+    double orientation;
+    double angular_momenta;
+    double energy_drift;
+    double momentum_drift;
+
+} tolerances_t;
+
+/* Worst deviations of a run from its golden trajectory, the same quantities as tolerances_t */
+typedef struct
+{
+    tolerances_t error;
+    double golden_energy_drift;     // what time_evolution() itself drifted by
+    double golden_momentum_drift;
+    unsigned long long int frame_count;
+
+} comparison_t;
+
+/* Command line settings of a verification run */
+typedef struct
+{
+    verify_mode_t mode;
+    const char *golden_directory;
+    const char *filter;             // only references whose name contains this, NULL for all
+    force_solver_t solver;
+    double opening_angle;
+    double cutoff;
+    double skin;
+    integrator_t integrator;
+    unsigned int thread_count;      // 0 for one per online processor
+    int deterministic;              // see set_deterministic()
+    tolerances_t tolerances;
+    const char *checksum_filepath;  // per-step checksums of every run, NULL for none
+
+} verify_options_t;
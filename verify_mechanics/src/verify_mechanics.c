@@ -0,0 +1,830 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verify_mechanics.h"
+#include "particle.h"
+#include "particle_system.h"
+#include "mechanics.h"
+#include "trajectory.h"
+#include "scenario.h"
+#include "log.h"
+
+
+#define GOLDEN_FRAME_HEADER_SIZE    16  // time and step count
+#define GOLDEN_DOUBLE_ARRAYS        15  // what GOLDEN_FIELDS holds besides the ids, see golden_read_frame()
+
+
+/* Golden trajectory opened for reading, the header checked against the reference */
+typedef struct
+{
+    FILE *file;
+    size_t particle_count;
+    double sample_period;
+    unsigned char *frame;
+    size_t frame_size;
+
+} golden_t;
+
+
+static int parse_options(const int argc, char **argv, verify_options_t *options);
+static int parse_solver(const char *name, force_solver_t *solver);
+static int parse_integrator(const char *name, integrator_t *integrator);
+static void print_usage(const char *program);
+
+static particle_system_t *build_reference(const reference_t *reference, double *sample_period);
+static void golden_filepath(char *filepath, const size_t size, const verify_options_t *options, const reference_t *reference);
+static int record(const reference_t *reference, const verify_options_t *options);
+static int record_steps(const reference_t *reference, particle_t **particles, particle_system_t *system,
+                        trajectory_t *trajectory, const double sample_period);
+static int compare(const reference_t *reference, const verify_options_t *options, FILE *checksums, comparison_t *comparison);
+static int compare_steps(const reference_t *reference, const verify_options_t *options, golden_t *golden,
+                         particle_system_t *system, particle_system_t *frame, const double sample_period,
+                         FILE *checksums, comparison_t *comparison);
+static int reproduce(const reference_t *reference, const verify_options_t *options, FILE *checksums);
+static void apply_backend(const verify_options_t *options, const unsigned int thread_count, const int deterministic);
+static void report(const reference_t *reference, const comparison_t *comparison, const tolerances_t *tolerances, const int passed);
+static int within(const comparison_t *comparison, const tolerances_t *tolerances);
+
+static int golden_open(golden_t *golden, const char *filepath, const particle_system_t *initial, const double sample_period);
+static void golden_close(golden_t *golden);
+static int golden_read_frame(golden_t *golden, particle_system_t *frame);
+static uint64_t load_little_endian(const unsigned char *bytes, const size_t size);
+static double load_double(const unsigned char *bytes);
+
+static double worst(const double a, const double b);
+static int finite_state(const particle_system_t *system);
+static double field_error(const vector3d_array_t *field, const vector3d_array_t *golden, const size_t count);
+static vector3d_t total_momentum(const particle_system_t *system);
+static double momentum_scale(const particle_system_t *system);
+static double momentum_drift(const particle_system_t *system, const vector3d_t initial, const double scale);
+
+
+/* Global variables */
+log_t *log_handle;
+
+/**
+ * Each runs a few thousand steps of time_evolution() in well under a
+ * second, small enough to keep golden files out of the tree and record
+ * them on the machine that compares against them.  Nothing sits on a
+ * line parallel to an axis, where componentize_force_3d() divides zero
+ * by zero, which rules out the lattice.  The two bodies spin, so the
+ * orientations turn through about a radian and are compared as well.
+ */
+static const reference_t references[] = {
+    {"two_body",
+        "dt 1E-17\n"
+        "particle mass=1.6727E-24 charge=1.602E-19 radius=1E-15 pos=0,0,0 angular_momentum=3E-41,-2E-41,1E-40\n"
+        "particle mass=9.11E-28 charge=-1.602E-19 radius=1E-15 pos=1E-9,0,1E-11 momentum=0,4.58E-22,0 angular_momentum=0,5E-44,-2E-44\n",
+        2500, 25},
+    {"ion_cloud",
+        "seed 7\n"
+        "dt 1E-16\n"
+        "random_ions count=64 mass=6.6954E-24 charge=1.602E-19 charge_states=2 radius=1E-15 size=1E-8 speed=1000\n",
+        2000, 20},
+    {"proton_cloud",
+        "seed 11\n"
+        "dt 2E-16\n"
+        "uniform_box count=100 mass=1.6727E-24 charge=1.602E-19 radius=1E-15 size=1E-8 speed=100\n",
+        2000, 20},
+};
+
+
+/* Entry point */
+int main(int argc, char **argv)
+{
+    verify_options_t options = {
+        .mode = VERIFY_COMPARE,
+        .golden_directory = DEFAULT_GOLDEN_DIRECTORY,
+        .solver = FORCE_SOLVER_DIRECT,
+        .opening_angle = DEFAULT_OPENING_ANGLE,
+        .integrator = INTEGRATOR_SYMPLECTIC_EULER,
+        .tolerances = {
+            .position = DEFAULT_POSITION_TOLERANCE,
+            .momenta = DEFAULT_MOMENTA_TOLERANCE,
+            .orientation = DEFAULT_ORIENTATION_TOLERANCE,
+            .angular_momenta = DEFAULT_ANGULAR_MOMENTA_TOLERANCE,
+            .energy_drift = DEFAULT_ENERGY_DRIFT_TOLERANCE,
+            .momentum_drift = DEFAULT_MOMENTUM_DRIFT_TOLERANCE,
+        },
+    };
+    FILE *checksums = NULL;
+    int failures = 0;
+
+    if (parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (options.checksum_filepath && !(checksums = fopen(options.checksum_filepath, "w"))) {
+        fprintf(stderr, "Could not open %s\n", options.checksum_filepath);
+        return 1;
+    }
+
+    for (size_t r = 0; r < sizeof(references)/sizeof(references[0]); ++r) {
+
+        const reference_t *reference = &references[r];
+        comparison_t comparison;
+
+        if (options.filter && !strstr(reference->name, options.filter))
+            continue;
+
+        switch (options.mode) {
+
+            case VERIFY_RECORD:
+                failures += record(reference, &options);
+                break;
+
+            case VERIFY_COMPARE:
+                if (compare(reference, &options, checksums, &comparison)) {
+                    ++failures;
+                    break;
+                }
+
+                const int passed = within(&comparison, &options.tolerances);
+
+                report(reference, &comparison, &options.tolerances, passed);
+                failures += !passed;
+                break;
+
+            case VERIFY_REPRODUCE:
+                failures += reproduce(reference, &options, checksums);
+                break;
+        }
+
+        free_mechanics_workspace();
+    }
+
+    if (checksums && fclose(checksums)) {
+        fprintf(stderr, "Could not write %s\n", options.checksum_filepath);
+        ++failures;
+    }
+
+    return failures ? 1 : 0;
+}
+
+
+/* Local function definitions */
+static particle_system_t *build_reference(const reference_t *reference, double *sample_period)
+{
+    size_t error_line;
+    scenario_t *scenario = scenario__parse(reference->scenario, &error_line);
+
+    if (!scenario) {
+        fprintf(stderr, "%s: bad scenario line %zu\n", reference->name, error_line);
+        return NULL;
+    }
+
+    *sample_period = scenario->sample_period;
+
+    /* The generated particles do not depend on the thread count */
+    particle_system_t *system = scenario__build(scenario, 1);
+
+    scenario__delete(scenario);
+
+    if (!system)
+        fprintf(stderr, "%s: out of memory\n", reference->name);
+
+    return system;
+}
+
+static void golden_filepath(char *filepath, const size_t size, const verify_options_t *options, const reference_t *reference)
+{
+    snprintf(filepath, size, "%s/%s%s", options->golden_directory, reference->name, GOLDEN_EXTENSION);
+}
+
+/**
+ * Steps the reference with time_evolution() in physical units and
+ * stores every frame_interval-th state, the first one included.
+ *
+ * @return 0 on success, 1 on failure
+ */
+static int record(const reference_t *reference, const verify_options_t *options)
+{
+    char filepath[FILENAME_MAX];
+    double sample_period;
+    particle_system_t *system = build_reference(reference, &sample_period);
+
+    if (!system)
+        return 1;
+
+    const size_t count = system->count;
+    particle_pool_t *pool = particle_pool__new(count);
+    particle_handle_t *handles = malloc(count * sizeof(particle_handle_t));
+    particle_t **particles = malloc(count * sizeof(particle_t *));
+    trajectory_t *trajectory = NULL;
+    int failed = 1;
+
+    golden_filepath(filepath, sizeof(filepath), options, reference);
+
+    if (!pool || !handles || !particles || particle__new_n(pool, NULL, count, handles))
+        fprintf(stderr, "%s: out of memory\n", reference->name);
+    else if (!(trajectory = trajectory__open(filepath, count, sample_period, GOLDEN_FIELDS)))
+        fprintf(stderr, "Could not open %s\n", filepath);
+    else {
+        for (size_t n = 0; n < count; ++n) {
+            const particle_t reduced = particle_system__get(system, n);
+            particles[n] = particle_pool__get(pool, handles[n]);
+            *particles[n] = units__to_physical(&reduced);
+        }
+
+        failed = record_steps(reference, particles, system, trajectory, sample_period);
+    }
+
+    if (trajectory__close(trajectory) && !failed) {
+        fprintf(stderr, "Writing %s failed\n", filepath);
+        failed = 1;
+    }
+
+    if (!failed)
+        printf("%-16s recorded %llu steps of %E s to %s\n", reference->name, reference->step_count, sample_period, filepath);
+
+    free(particles);
+    free(handles);
+    particle_pool__delete(pool);
+    particle_system__delete(system);
+
+    return failed;
+}
+
+/* system is the scratch frames are written from, @return 0 on success, 1 on failure */
+static int record_steps(const reference_t *reference, particle_t **particles, particle_system_t *system,
+                        trajectory_t *trajectory, const double sample_period)
+{
+    const size_t count = system->count;
+
+    for (unsigned long long int step = 0; step <= reference->step_count; ++step) {
+
+        if (step) time_evolution(particles, count, sample_period);
+
+        if (step % reference->frame_interval) continue;
+
+        for (size_t n = 0; n < count; ++n) {
+            const particle_t reduced = units__to_reduced(particles[n]);
+            particle_system__set(system, n, &reduced);
+        }
+        system->time = (double)step * sample_period;
+        system->step_count = step;
+
+        /* A golden trajectory that is not finite would let every backend pass */
+        if (!finite_state(system)) {
+            fprintf(stderr, "%s: time_evolution() left non-finite values at step %llu\n", reference->name, step);
+            return 1;
+        }
+
+        if (trajectory__write_frame(trajectory, system)) {
+            fprintf(stderr, "%s: writing the golden trajectory failed\n", reference->name);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Steps the reference with time_evolution_soa() on the backend of the
+ * options and measures it against the golden trajectory frame by frame.
+ *
+ * @return 0 when the comparison could be made, whatever its outcome, 1 otherwise
+ */
+static int compare(const reference_t *reference, const verify_options_t *options, FILE *checksums, comparison_t *comparison)
+{
+    char filepath[FILENAME_MAX];
+    double sample_period;
+    golden_t golden = {0};
+    particle_system_t *system = build_reference(reference, &sample_period);
+    particle_system_t *frame = system ? particle_system__new(system->count) : NULL;
+    int failed = 1;
+
+    *comparison = (comparison_t){0};
+    golden_filepath(filepath, sizeof(filepath), options, reference);
+
+    if (system && !frame)
+        fprintf(stderr, "%s: out of memory\n", reference->name);
+
+    if (frame && !golden_open(&golden, filepath, system, sample_period))
+        failed = compare_steps(reference, options, &golden, system, frame, sample_period, checksums, comparison);
+
+    golden_close(&golden);
+    particle_system__delete(frame);
+    particle_system__delete(system);
+
+    return failed;
+}
+
+/**
+ * The first golden frame is the initial state, the drifts of both runs
+ * are measured from it.  Each run's energy is taken with its own
+ * potential, the shifted one for the neighbour list solver.
+ *
+ * @return 0 when every frame was compared, 1 otherwise
+ */
+static int compare_steps(const reference_t *reference, const verify_options_t *options, golden_t *golden,
+                         particle_system_t *system, particle_system_t *frame, const double sample_period,
+                         FILE *checksums, comparison_t *comparison)
+{
+    tolerances_t *error = &comparison->error;
+
+    if (golden_read_frame(golden, frame)) {
+        fprintf(stderr, "%s: the golden trajectory holds no frames\n", reference->name);
+        return 1;
+    }
+
+    set_force_solver(FORCE_SOLVER_DIRECT);
+
+    const double initial_energy = total_energy(frame);
+    const vector3d_t initial_momentum = total_momentum(frame);
+    const double scale = momentum_scale(frame);
+
+    apply_backend(options, options->thread_count, options->deterministic);
+
+    const double initial_backend_energy = total_energy(frame);
+
+    for (unsigned long long int step = 0; step <= reference->step_count; ++step) {
+
+        if (step) {
+            time_evolution_soa(system, sample_period);
+
+            if (checksums)
+                fprintf(checksums, "%s %llu %016llx\n", reference->name, step,
+                        (unsigned long long int)particle_system__checksum(system));
+        }
+
+        if (step % reference->frame_interval) continue;
+
+        if (step && golden_read_frame(golden, frame)) {
+            fprintf(stderr, "%s: the golden trajectory ends before step %llu, record it again\n", reference->name, step);
+            return 1;
+        }
+
+        if (memcmp(frame->id, system->id, system->count * sizeof(unsigned long long int))) {
+            fprintf(stderr, "%s: particles were reordered at step %llu\n", reference->name, step);
+            return 1;
+        }
+
+        error->position = worst(error->position, field_error(&system->pos, &frame->pos, system->count));
+        error->momenta = worst(error->momenta, field_error(&system->momenta, &frame->momenta, system->count));
+        error->orientation = worst(error->orientation, field_error(&system->orientation, &frame->orientation, system->count));
+        error->angular_momenta = worst(error->angular_momenta,
+                                       field_error(&system->angular_momenta, &frame->angular_momenta, system->count));
+        error->energy_drift = worst(error->energy_drift, fabs(energy_drift(system, initial_backend_energy)));
+        error->momentum_drift = worst(error->momentum_drift, momentum_drift(system, initial_momentum, scale));
+
+        /* The golden energy is the plain Coulomb one, as time_evolution() knows no other */
+        set_force_solver(FORCE_SOLVER_DIRECT);
+        comparison->golden_energy_drift = worst(comparison->golden_energy_drift, fabs(energy_drift(frame, initial_energy)));
+        comparison->golden_momentum_drift = worst(comparison->golden_momentum_drift,
+                                                  momentum_drift(frame, initial_momentum, scale));
+        set_force_solver(options->solver);
+
+        ++comparison->frame_count;
+    }
+
+    return 0;
+}
+
+/**
+ * Runs the reference twice in deterministic mode, on one thread and on
+ * the thread count of the options, and checks every step leaves the
+ * same bits behind.
+ *
+ * @return 0 if every checksum matched, 1 otherwise
+ */
+static int reproduce(const reference_t *reference, const verify_options_t *options, FILE *checksums)
+{
+    double sample_period;
+    particle_system_t *system = build_reference(reference, &sample_period);
+    uint64_t *serial = malloc(reference->step_count * sizeof(uint64_t));
+    unsigned long long int mismatch = 0;
+
+    if (!system || !serial) {
+        fprintf(stderr, "%s: out of memory\n", reference->name);
+        particle_system__delete(system);
+        free(serial);
+        return 1;
+    }
+
+    apply_backend(options, 1, 1);
+
+    for (unsigned long long int step = 0; step < reference->step_count; ++step) {
+
+        time_evolution_soa(system, sample_period);
+        serial[step] = particle_system__checksum(system);
+
+        if (checksums)
+            fprintf(checksums, "%s %llu %016llx\n", reference->name, step + 1, (unsigned long long int)serial[step]);
+    }
+
+    particle_system__delete(system);
+
+    if (!(system = build_reference(reference, &sample_period))) {
+        free(serial);
+        return 1;
+    }
+
+    apply_backend(options, options->thread_count, 1);
+
+    for (unsigned long long int step = 0; step < reference->step_count && !mismatch; ++step) {
+
+        time_evolution_soa(system, sample_period);
+
+        if (particle_system__checksum(system) != serial[step])
+            mismatch = step + 1;
+    }
+
+    if (mismatch)
+        printf("%-16s FAIL  1 and %u threads part at step %llu\n", reference->name, get_thread_count(), mismatch);
+    else
+        printf("%-16s PASS  1 and %u threads bitwise equal over %llu steps\n", reference->name, get_thread_count(),
+               reference->step_count);
+
+    free(serial);
+    particle_system__delete(system);
+
+    return mismatch ? 1 : 0;
+}
+
+static void apply_backend(const verify_options_t *options, const unsigned int thread_count, const int deterministic)
+{
+    set_force_solver(options->solver);
+    set_opening_angle(options->opening_angle ? options->opening_angle : DEFAULT_OPENING_ANGLE);
+    set_cutoff(options->cutoff, options->skin);
+    set_integrator(options->integrator);
+    set_thread_count(thread_count);
+    set_deterministic(deterministic);
+}
+
+static void report(const reference_t *reference, const comparison_t *comparison, const tolerances_t *tolerances, const int passed)
+{
+    const tolerances_t *error = &comparison->error;
+
+    printf("%-16s %s  %llu frames\n", reference->name, passed ? "PASS" : "FAIL", comparison->frame_count);
+    printf("    position          %.3E  limit %.3E\n", error->position, tolerances->position);
+    printf("    momenta           %.3E  limit %.3E\n", error->momenta, tolerances->momenta);
+    printf("    orientation       %.3E  limit %.3E\n", error->orientation, tolerances->orientation);
+    printf("    angular momenta   %.3E  limit %.3E\n", error->angular_momenta, tolerances->angular_momenta);
+    printf("    energy drift      %.3E  limit %.3E over golden %.3E\n", error->energy_drift, tolerances->energy_drift,
+           comparison->golden_energy_drift);
+    printf("    momentum drift    %.3E  limit %.3E over golden %.3E\n", error->momentum_drift, tolerances->momentum_drift,
+           comparison->golden_momentum_drift);
+}
+
+/* The drifts are held to what time_evolution() itself drifted by, plus the tolerance */
+static int within(const comparison_t *comparison, const tolerances_t *tolerances)
+{
+    const tolerances_t *error = &comparison->error;
+
+    return error->position <= tolerances->position &&
+           error->momenta <= tolerances->momenta &&
+           error->orientation <= tolerances->orientation &&
+           error->angular_momenta <= tolerances->angular_momenta &&
+           error->energy_drift <= comparison->golden_energy_drift + tolerances->energy_drift &&
+           error->momentum_drift <= comparison->golden_momentum_drift + tolerances->momentum_drift;
+}
+
+/* @return 0 on success, 1 if the file is missing or was recorded from something else */
+static int golden_open(golden_t *golden, const char *filepath, const particle_system_t *initial, const double sample_period)
+{
+    unsigned char header[TRAJECTORY_HEADER_SIZE];
+
+    if (!(golden->file = fopen(filepath, "rb"))) {
+        fprintf(stderr, "Could not open %s, record the golden trajectories first\n", filepath);
+        return 1;
+    }
+
+    if (fread(header, 1, sizeof(header), golden->file) != sizeof(header) ||
+        memcmp(header, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) ||
+        load_little_endian(header + 8, 4) != TRAJECTORY_VERSION ||
+        load_little_endian(header + 12, 4) != TRAJECTORY_HEADER_SIZE ||
+        load_little_endian(header + 32, 4) != GOLDEN_FIELDS) {
+        fprintf(stderr, "%s is not a golden trajectory\n", filepath);
+        return 1;
+    }
+
+    golden->particle_count = load_little_endian(header + 16, 8);
+    golden->sample_period = load_double(header + 24);
+    golden->frame_size = load_little_endian(header + 40, 8);
+
+    /* A changed scenario or unit scale makes every comparison meaningless */
+    if (golden->particle_count != initial->count || golden->sample_period != sample_period ||
+        load_double(header + 48) != UNIT_MASS || load_double(header + 56) != UNIT_CHARGE) {
+        fprintf(stderr, "%s was recorded from another scenario or unit scale, record it again\n", filepath);
+        return 1;
+    }
+
+    /* golden_read_frame() reads the whole frame, a stale or damaged size would run it past the buffer */
+    if (golden->frame_size != GOLDEN_FRAME_HEADER_SIZE + golden->particle_count * 8 * (1 + GOLDEN_DOUBLE_ARRAYS)) {
+        fprintf(stderr, "%s holds frames of the wrong size, record it again\n", filepath);
+        return 1;
+    }
+
+    if (!(golden->frame = malloc(golden->frame_size))) {
+        fprintf(stderr, "%s: out of memory\n", filepath);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void golden_close(golden_t *golden)
+{
+    if (golden->file)
+        fclose(golden->file);
+
+    free(golden->frame);
+    *golden = (golden_t){0};
+}
+
+/* Fills frame with the next golden frame, @return 0 on success, 1 at the end of the file */
+static int golden_read_frame(golden_t *golden, particle_system_t *frame)
+{
+    double *const arrays[] = {
+        frame->mass, frame->charge, frame->radius,
+        frame->pos.i, frame->pos.j, frame->pos.k,
+        frame->momenta.i, frame->momenta.j, frame->momenta.k,
+        frame->orientation.i, frame->orientation.j, frame->orientation.k,
+        frame->angular_momenta.i, frame->angular_momenta.j, frame->angular_momenta.k,
+    };
+    _Static_assert(sizeof(arrays)/sizeof(arrays[0]) == GOLDEN_DOUBLE_ARRAYS, "golden_open() checks the frame size against these");
+    const size_t count = golden->particle_count;
+    const unsigned char *bytes = golden->frame;
+
+    if (fread(golden->frame, 1, golden->frame_size, golden->file) != golden->frame_size)
+        return 1;
+
+    frame->count = count;
+    frame->time = load_double(bytes);
+    frame->step_count = load_little_endian(bytes + 8, 8);
+    frame->forces_current = 0;
+    bytes += GOLDEN_FRAME_HEADER_SIZE;
+
+    for (size_t n = 0; n < count; ++n, bytes += 8)
+        frame->id[n] = load_little_endian(bytes, 8);
+
+    /* GOLDEN_FIELDS holds these in trajectory_field_t order */
+    for (size_t a = 0; a < sizeof(arrays)/sizeof(arrays[0]); ++a)
+        for (size_t n = 0; n < count; ++n, bytes += 8)
+            arrays[a][n] = load_double(bytes);
+
+    return 0;
+}
+
+static uint64_t load_little_endian(const unsigned char *bytes, const size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t n = size; n-- > 0;)
+        value = value << 8 | bytes[n];
+
+    return value;
+}
+
+static double load_double(const unsigned char *bytes)
+{
+    const uint64_t bits = load_little_endian(bytes, 8);
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+/* fmax() that keeps a NaN, so a run that blew up cannot pass */
+static double worst(const double a, const double b)
+{
+    return a >= b || isnan(a) ? a : b;
+}
+
+static int finite_state(const particle_system_t *system)
+{
+    const vector3d_array_t *fields[] = {&system->pos, &system->momenta, &system->orientation, &system->angular_momenta};
+
+    for (size_t f = 0; f < sizeof(fields)/sizeof(fields[0]); ++f)
+        for (size_t n = 0; n < system->count; ++n)
+            if (!isfinite(fields[f]->i[n]) || !isfinite(fields[f]->j[n]) || !isfinite(fields[f]->k[n]))
+                return 0;
+
+    return 1;
+}
+
+/**
+ * Largest distance of a particle's vector from its golden value over
+ * the largest golden magnitude, absolute when the golden field is zero.
+ */
+static double field_error(const vector3d_array_t *field, const vector3d_array_t *golden, const size_t count)
+{
+    double error = 0;
+    double scale = 0;
+
+    for (size_t n = 0; n < count; ++n) {
+
+        const double di = field->i[n] - golden->i[n];
+        const double dj = field->j[n] - golden->j[n];
+        const double dk = field->k[n] - golden->k[n];
+
+        error = worst(error, sqrt(di*di + dj*dj + dk*dk));
+        scale = fmax(scale, sqrt(golden->i[n]*golden->i[n] + golden->j[n]*golden->j[n] + golden->k[n]*golden->k[n]));
+    }
+
+    return scale > 0 ? error / scale : error;
+}
+
+static vector3d_t total_momentum(const particle_system_t *system)
+{
+    vector3d_t P = {0};
+
+    for (size_t n = 0; n < system->count; ++n) {
+        P.i += system->momenta.i[n];
+        P.j += system->momenta.j[n];
+        P.k += system->momenta.k[n];
+    }
+
+    return P;
+}
+
+/* Summed magnitudes, so a system at rest overall still has a scale to measure drift against */
+static double momentum_scale(const particle_system_t *system)
+{
+    double scale = 0;
+
+    for (size_t n = 0; n < system->count; ++n)
+        scale += sqrt(system->momenta.i[n] * system->momenta.i[n] +
+                      system->momenta.j[n] * system->momenta.j[n] +
+                      system->momenta.k[n] * system->momenta.k[n]);
+
+    return scale;
+}
+
+static double momentum_drift(const particle_system_t *system, const vector3d_t initial, const double scale)
+{
+    const vector3d_t P = total_momentum(system);
+    const double di = P.i - initial.i;
+    const double dj = P.j - initial.j;
+    const double dk = P.k - initial.k;
+    const double drift = sqrt(di*di + dj*dj + dk*dk);
+
+    return scale > 0 ? drift / scale : drift;
+}
+
+/* @return 0 on success, 1 on an unknown option or a bad value */
+static int parse_options(const int argc, char **argv, verify_options_t *options)
+{
+    for (int i = 1; i < argc; ++i) {
+
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;   // left NULL by options that do not take a number
+
+        if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+            return 1;
+
+        if (!strcmp(option, "--record")) {
+            options->mode = VERIFY_RECORD;
+            continue;
+        }
+
+        if (!strcmp(option, "--reproduce")) {
+            options->mode = VERIFY_REPRODUCE;
+            continue;
+        }
+
+        if (!strcmp(option, "--deterministic")) {
+            options->deterministic = 1;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return 1;
+        }
+
+        if (!strcmp(option, "-g") || !strcmp(option, "--golden"))
+            options->golden_directory = value;
+        else if (!strcmp(option, "-f") || !strcmp(option, "--filter"))
+            options->filter = value;
+        else if (!strcmp(option, "-s") || !strcmp(option, "--solver")) {
+            if (parse_solver(value, &options->solver)) return 1;
+        }
+        else if (!strcmp(option, "--theta"))
+            options->opening_angle = strtod(value, &end);
+        else if (!strcmp(option, "--cutoff"))
+            options->cutoff = strtod(value, &end);
+        else if (!strcmp(option, "--skin"))
+            options->skin = strtod(value, &end);
+        else if (!strcmp(option, "-i") || !strcmp(option, "--integrator")) {
+            if (parse_integrator(value, &options->integrator)) return 1;
+        }
+        else if (!strcmp(option, "-j") || !strcmp(option, "--threads"))
+            options->thread_count = (unsigned int)strtoul(value, &end, 10);
+        else if (!strcmp(option, "--position-tol"))
+            options->tolerances.position = strtod(value, &end);
+        else if (!strcmp(option, "--momenta-tol"))
+            options->tolerances.momenta = strtod(value, &end);
+        else if (!strcmp(option, "--orientation-tol"))
+            options->tolerances.orientation = strtod(value, &end);
+        else if (!strcmp(option, "--angular-momenta-tol"))
+            options->tolerances.angular_momenta = strtod(value, &end);
+        else if (!strcmp(option, "--energy-tol"))
+            options->tolerances.energy_drift = strtod(value, &end);
+        else if (!strcmp(option, "--momentum-tol"))
+            options->tolerances.momentum_drift = strtod(value, &end);
+        else if (!strcmp(option, "-c") || !strcmp(option, "--checksums"))
+            options->checksum_filepath = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+
+        if (end && (end == value || *end != '\0')) {
+            fprintf(stderr, "Bad value %s for %s\n", value, option);
+            return 1;
+        }
+
+        ++i;
+    }
+
+    const tolerances_t *limits = &options->tolerances;
+
+    if (limits->position < 0 || limits->momenta < 0 || limits->orientation < 0 || limits->angular_momenta < 0 ||
+        limits->energy_drift < 0 || limits->momentum_drift < 0 || options->cutoff < 0 || options->skin < 0) {
+        fprintf(stderr, "Tolerances, cutoff and skin must be positive\n");
+        return 1;
+    }
+
+    /* The references are in open space */
+    if (options->solver == FORCE_SOLVER_PARTICLE_MESH) {
+        fprintf(stderr, "The particle mesh solver needs a periodic box, the reference scenarios have none\n");
+        return 1;
+    }
+
+    if (options->solver == FORCE_SOLVER_NEIGHBOUR_LIST && !(options->cutoff > 0)) {
+        fprintf(stderr, "The neighbour list solver needs a cutoff\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_solver(const char *name, force_solver_t *solver)
+{
+    if (!strcmp(name, "direct"))
+        *solver = FORCE_SOLVER_DIRECT;
+    else if (!strcmp(name, "barnes_hut"))
+        *solver = FORCE_SOLVER_BARNES_HUT;
+    else if (!strcmp(name, "particle_mesh"))
+        *solver = FORCE_SOLVER_PARTICLE_MESH;
+    else if (!strcmp(name, "neighbour_list"))
+        *solver = FORCE_SOLVER_NEIGHBOUR_LIST;
+    else {
+        fprintf(stderr, "Unknown solver %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_integrator(const char *name, integrator_t *integrator)
+{
+    for (integrator_t scheme = INTEGRATOR_EXPLICIT_EULER; scheme <= INTEGRATOR_BLOCK_TIMESTEP; ++scheme) {
+        if (!strcmp(name, integrator_name(scheme))) {
+            *integrator = scheme;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Unknown integrator %s\n", name);
+    return 1;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [--record | --reproduce] [options]\n", program);
+    printf("\n");
+    printf("Checks time_evolution_soa() against golden trajectories of the reference\n");
+    printf("scenarios, recorded with time_evolution() by --record.  --reproduce instead\n");
+    printf("runs each reference in deterministic mode on one and on --threads threads and\n");
+    printf("checks the state checksums agree after every step.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help                  print this message\n");
+    printf("  -g, --golden <directory>    golden trajectories, default %s\n", DEFAULT_GOLDEN_DIRECTORY);
+    printf("  -f, --filter <text>         only references whose name contains text\n");
+    printf("  -s, --solver <name>         direct, barnes_hut or neighbour_list\n");
+    printf("      --theta <angle>         opening angle of barnes_hut, default %g\n", DEFAULT_OPENING_ANGLE);
+    printf("      --cutoff <length>       interaction range of neighbour_list\n");
+    printf("      --skin <length>         margin the neighbour lists cover beyond it\n");
+    printf("  -i, --integrator <name>     explicit_euler, symplectic_euler, velocity_verlet, rk4, boris or block_timestep\n");
+    printf("  -j, --threads <count>       worker threads, 0 for one per processor\n");
+    printf("      --deterministic         fixed-order sums, see set_deterministic()\n");
+    printf("  -c, --checksums <file>      per-step state checksums of every run, to diff between builds\n");
+    printf("\n");
+    printf("Tolerances, the largest error over every frame relative to the largest golden magnitude:\n");
+    printf("      --position-tol <x>          default %g\n", DEFAULT_POSITION_TOLERANCE);
+    printf("      --momenta-tol <x>           default %g\n", DEFAULT_MOMENTA_TOLERANCE);
+    printf("      --orientation-tol <x>       default %g\n", DEFAULT_ORIENTATION_TOLERANCE);
+    printf("      --angular-momenta-tol <x>   default %g\n", DEFAULT_ANGULAR_MOMENTA_TOLERANCE);
+    printf("and drift of the conserved quantities beyond the golden run's:\n");
+    printf("      --energy-tol <x>            of the initial total energy, default %g\n", DEFAULT_ENERGY_DRIFT_TOLERANCE);
+    printf("      --momentum-tol <x>          of the summed initial momenta, default %g\n", DEFAULT_MOMENTUM_DRIFT_TOLERANCE);
+}